@@ -34,9 +34,26 @@
 #include "stb_image_aug.h"
 #include "image_helper.h"
 #include "image_DXT.h"
+#include "image_KTX2.h"
+#include "image_PNG.h"
+#include "image_threads.h"
+#include "image_pipeline.h"
+#include "image_perf.h"
 
 #include <stdlib.h>
 #include <string.h>
+#include <stdio.h>
+#include <limits.h>
+
+/*	map files straight into memory where we can	*/
+#if !defined(WIN32) && (defined(__unix__) || defined(__APPLE__))
+	#define SOIL_USE_MMAP	1
+	#include <sys/types.h>
+	#include <sys/stat.h>
+	#include <sys/mman.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
 
 /*	error reporting	*/
 char *result_string_pointer = "SOIL initialized";
@@ -78,8 +95,32 @@ int query_DXT_capability( void );
 #define SOIL_RGBA_S3TC_DXT1		0x83F1
 #define SOIL_RGBA_S3TC_DXT3		0x83F2
 #define SOIL_RGBA_S3TC_DXT5		0x83F3
+#define SOIL_BGR					0x80E0
+#define SOIL_BGRA					0x80E1
 typedef void (APIENTRY * P_SOIL_GLCOMPRESSEDTEXIMAGE2DPROC) (GLenum target, GLint level, GLenum internalformat, GLsizei width, GLsizei height, GLint border, GLsizei imageSize, const GLvoid * data);
 P_SOIL_GLCOMPRESSEDTEXIMAGE2DPROC soilGlCompressedTexImage2D = NULL;
+/*	for using BPTC (BC6H) compression	*/
+static int has_BPTC_capability = SOIL_CAPABILITY_UNKNOWN;
+int query_BPTC_capability( void );
+#define SOIL_RGB_BPTC_UNSIGNED_FLOAT	0x8E8F
+/*	for immutable texture storage (allocating the whole MIPmap chain at once)	*/
+static int has_texture_storage_capability = SOIL_CAPABILITY_UNKNOWN;
+int query_texture_storage_capability( void );
+#define SOIL_LUMINANCE8				0x8040
+#define SOIL_LUMINANCE8_ALPHA8		0x8045
+#define SOIL_RGB8					0x8051
+#define SOIL_RGBA8					0x8058
+typedef void (APIENTRY * P_SOIL_GLTEXSTORAGE2DPROC) (GLenum target, GLsizei levels, GLenum internalformat, GLsizei width, GLsizei height);
+P_SOIL_GLTEXSTORAGE2DPROC soilGlTexStorage2D = NULL;
+typedef void (APIENTRY * P_SOIL_GLCOMPRESSEDTEXSUBIMAGE2DPROC) (GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height, GLenum format, GLsizei imageSize, const GLvoid * data);
+P_SOIL_GLCOMPRESSEDTEXSUBIMAGE2DPROC soilGlCompressedTexSubImage2D = NULL;
+/*	for having the driver build the MIPmaps	*/
+static int has_generate_mipmap_capability = SOIL_CAPABILITY_UNKNOWN;
+int query_generate_mipmap_capability( void );
+typedef void (APIENTRY * P_SOIL_GLGENERATEMIPMAPPROC) (GLenum target);
+P_SOIL_GLGENERATEMIPMAPPROC soilGlGenerateMipmap = NULL;
+/*	finds an OpenGL extension function, NULL if it isn't there	*/
+void *SOIL_internal_get_GL_function( const char *function_name );
 unsigned int SOIL_direct_load_DDS(
 		const char *filename,
 		unsigned int reuse_texture_ID,
@@ -91,7 +132,132 @@ unsigned int SOIL_direct_load_DDS_from_memory(
 		unsigned int reuse_texture_ID,
 		int flags,
 		int loading_as_cubemap );
+/*	KTX2 files take the same direct path as DDS files	*/
+unsigned int SOIL_direct_load_KTX2_from_memory(
+		const unsigned char *const buffer,
+		int buffer_length,
+		unsigned int reuse_texture_ID,
+		int flags,
+		int loading_as_cubemap );
+/*	for the on-disk texture cache	*/
+static char *texture_cache_directory = NULL;
+void SOIL_internal_hash_bytes(
+		const unsigned char *const buffer,
+		int buffer_length,
+		unsigned int *hash_lo, unsigned int *hash_hi );
+/*	for the in-memory cache of shared images and textures	*/
+typedef struct SOIL_cache_name
+{
+	struct SOIL_cache_name *next;
+	char filename[1];
+}
+SOIL_cache_name;
+typedef struct SOIL_cache_entry
+{
+	/*	most recently used first	*/
+	struct SOIL_cache_entry *prev, *next;
+	/*	every path this content has been loaded from	*/
+	SOIL_cache_name *names;
+	/*	the key: the source bytes, and how they were loaded
+		(a copy of the bytes is kept so a hash match can be confirmed)	*/
+	unsigned int hash_lo, hash_hi;
+	unsigned char *source;
+	int source_length;
+	int is_texture, force_channels;
+	unsigned int flags;
+	/*	what they were loaded into	*/
+	unsigned char *image;
+	int width, height, channels;
+	unsigned int texture_ID;
+	size_t size;
+	int references;
+}
+SOIL_cache_entry;
+static SOIL_cache_entry *memory_cache_head = NULL;
+static SOIL_cache_entry *memory_cache_tail = NULL;
+static size_t memory_cache_size = 0;
+static size_t memory_cache_budget = 0;
+SOIL_cache_entry* SOIL_internal_cache_find_name(
+		const char *filename,
+		int is_texture, int force_channels, unsigned int flags );
+SOIL_cache_entry* SOIL_internal_cache_find_content(
+		const unsigned char *const source, int source_length,
+		unsigned int hash_lo, unsigned int hash_hi,
+		int is_texture, int force_channels, unsigned int flags );
+SOIL_cache_entry* SOIL_internal_cache_insert(
+		const char *filename,
+		const unsigned char *const source, int source_length,
+		unsigned int hash_lo, unsigned int hash_hi,
+		int is_texture, int force_channels, unsigned int flags );
+void SOIL_internal_cache_add_name(
+		SOIL_cache_entry *entry,
+		const char *filename );
+void SOIL_internal_cache_use(
+		SOIL_cache_entry *entry );
+void SOIL_internal_cache_trim(
+		void );
+size_t SOIL_internal_texture_size(
+		unsigned int tex_id,
+		int *width, int *height, int *channels );
+#define SOIL_TEXTURE_BINDING_RECTANGLE_ARB	0x84F6
+#define SOIL_TEXTURE_COMPRESSED_IMAGE_SIZE	0x86A0
+#define SOIL_TEXTURE_COMPRESSED				0x86A1
+#define SOIL_MAX_CAPTURED_LEVELS	32
+typedef struct
+{
+	int width, height, channels;
+	unsigned int format;
+	int num_levels, failed;
+	unsigned char *level_data[SOIL_MAX_CAPTURED_LEVELS];
+	int level_size[SOIL_MAX_CAPTURED_LEVELS];
+}
+SOIL_level_capture;
+/*	while this is set, every uploaded level of a 2D texture is copied here	*/
+static SOIL_level_capture *level_capture = NULL;
+void SOIL_internal_capture_level(
+		int level, int width, int height, int channels,
+		unsigned int format,
+		const unsigned char *const data, int data_size );
+unsigned int SOIL_internal_load_cached_OGL_texture(
+		const unsigned char *const buffer,
+		int buffer_length,
+		int force_channels,
+		unsigned int reuse_texture_ID,
+		unsigned int flags );
+/*	a whole file in memory, mapped if possible	*/
+typedef struct
+{
+	const unsigned char *data;
+	int length;
+	int is_mapped;
+}
+SOIL_file_view;
+int SOIL_internal_open_file_view(
+		const char *filename,
+		SOIL_file_view *view );
+void SOIL_internal_close_file_view(
+		SOIL_file_view *view );
 /*	other functions	*/
+void
+	SOIL_internal_upload_level
+	(
+		int use_storage,
+		unsigned int opengl_texture_target, int level,
+		unsigned int internal_texture_format,
+		int width, int height,
+		unsigned int original_texture_format,
+		const unsigned char *const data
+	);
+void
+	SOIL_internal_upload_compressed_level
+	(
+		int use_storage,
+		unsigned int opengl_texture_target, int level,
+		unsigned int internal_texture_format,
+		int width, int height,
+		int data_size,
+		const unsigned char *const data
+	);
 unsigned int
 	SOIL_internal_create_OGL_texture
 	(
@@ -103,6 +269,14 @@ unsigned int
 		unsigned int opengl_texture_target,
 		unsigned int texture_check_size_enum
 	);
+unsigned int
+	SOIL_internal_create_OGL_BC6H_texture
+	(
+		float *hdr_data,
+		int width, int height,
+		unsigned int reuse_texture_ID,
+		unsigned int flags
+	);
 
 /*	and the code magic begins here [8^)	*/
 unsigned int
@@ -132,6 +306,22 @@ unsigned int
 			return tex_id;
 		}
 	}
+	/*	is the texture cache turned on?	*/
+	if( (NULL != texture_cache_directory) &&
+		!(flags & SOIL_FLAG_TEXTURE_RECTANGLE) )
+	{
+		/*	the cache is keyed on the file contents, so read it all in	*/
+		SOIL_file_view view;
+		if( !SOIL_internal_open_file_view( filename, &view ) )
+		{
+			return 0;
+		}
+		tex_id = SOIL_internal_load_cached_OGL_texture(
+				view.data, view.length, force_channels,
+				reuse_texture_ID, flags );
+		SOIL_internal_close_file_view( &view );
+		return tex_id;
+	}
 	/*	try to load the image	*/
 	img = SOIL_load_image( filename, &width, &height, &channels, force_channels );
 	/*	channels holds the original number of channels, which may have been forced	*/
@@ -157,6 +347,45 @@ unsigned int
 	return tex_id;
 }
 
+unsigned int
+	SOIL_load_OGL_texture_scaled
+	(
+		const char *filename,
+		int force_channels,
+		unsigned int reuse_texture_ID,
+		unsigned int flags,
+		int scale_shift
+	)
+{
+	/*	variables	*/
+	unsigned char* img;
+	int width, height, channels;
+	unsigned int tex_id;
+	/*	no direct DDS uploads or cache here, those are full size only	*/
+	img = SOIL_load_image_scaled( filename, &width, &height, &channels,
+			force_channels, scale_shift );
+	/*	channels holds the original number of channels, which may have been forced	*/
+	if( (force_channels >= 1) && (force_channels <= 4) )
+	{
+		channels = force_channels;
+	}
+	if( NULL == img )
+	{
+		/*	image loading failed	*/
+		return 0;
+	}
+	/*	OK, make it a texture!	*/
+	tex_id = SOIL_internal_create_OGL_texture(
+			img, width, height, channels,
+			reuse_texture_ID, flags,
+			GL_TEXTURE_2D, GL_TEXTURE_2D,
+			GL_MAX_TEXTURE_SIZE );
+	/*	and nuke the image data	*/
+	SOIL_free_image_data( img );
+	/*	and return the handle, such as it is	*/
+	return tex_id;
+}
+
 unsigned int
 	SOIL_load_OGL_HDR_texture
 	(
@@ -175,11 +404,28 @@ unsigned int
 	/* error check */
 	if( (fake_HDR_format != SOIL_HDR_RGBE) &&
 		(fake_HDR_format != SOIL_HDR_RGBdivA) &&
-		(fake_HDR_format != SOIL_HDR_RGBdivA2) )
+		(fake_HDR_format != SOIL_HDR_RGBdivA2) &&
+		(fake_HDR_format != SOIL_HDR_BC6H) )
 	{
 		result_string_pointer = "Invalid fake HDR format specified";
 		return 0;
 	}
+	/*	real HDR goes through the float path instead	*/
+	if( fake_HDR_format == SOIL_HDR_BC6H )
+	{
+		float *hdr_img = stbi_hdr_load( filename, &width, &height, &channels, 3 );
+		if( NULL == hdr_img )
+		{
+			/*	image loading failed	*/
+			result_string_pointer = stbi_failure_reason();
+			return 0;
+		}
+		tex_id = SOIL_internal_create_OGL_BC6H_texture(
+				hdr_img, width, height,
+				reuse_texture_ID, flags );
+		image_free( hdr_img );
+		return tex_id;
+	}
 	/*	try to load the image (only the HDR type) */
 	img = stbi_hdr_load_rgbe( filename, &width, &height, &channels, 4 );
 	/*	channels holds the original number of channels, which may have been forced	*/
@@ -239,6 +485,14 @@ unsigned int
 			return tex_id;
 		}
 	}
+	/*	is the texture cache turned on?	*/
+	if( (NULL != texture_cache_directory) &&
+		!(flags & SOIL_FLAG_TEXTURE_RECTANGLE) )
+	{
+		return SOIL_internal_load_cached_OGL_texture(
+				buffer, buffer_length, force_channels,
+				reuse_texture_ID, flags );
+	}
 	/*	try to load the image	*/
 	img = SOIL_load_image_from_memory(
 					buffer, buffer_length,
@@ -889,7 +1143,7 @@ unsigned int
 		dh = width;
 	}
 	sz = dw+dh;
-	sub_img = (unsigned char *)malloc( sz*sz*channels );
+	sub_img = (unsigned char *)image_malloc( sz*sz*channels );
 	/*	do the splitting and uploading	*/
 	tex_id = reuse_texture_ID;
 	for( i = 0; i < 6; ++i )
@@ -995,6 +1249,9 @@ unsigned int
 	unsigned int internal_texture_format = 0, original_texture_format = 0;
 	int DXT_mode = SOIL_CAPABILITY_UNKNOWN;
 	int max_supported_size;
+	int use_storage = 0;
+	int use_GPU_mipmaps = 0;
+	unsigned int pipeline_steps = 0;
 	/*	If the user wants to use the texture rectangle I kill a few flags	*/
 	if( flags & SOIL_FLAG_TEXTURE_RECTANGLE )
 	{
@@ -1025,58 +1282,6 @@ unsigned int
 			return 0;
 		}
 	}
-	/*	create a copy the image data	*/
-	img = (unsigned char*)malloc( width*height*channels );
-	memcpy( img, data, width*height*channels );
-	/*	does the user want me to invert the image?	*/
-	if( flags & SOIL_FLAG_INVERT_Y )
-	{
-		int i, j;
-		for( j = 0; j*2 < height; ++j )
-		{
-			int index1 = j * width * channels;
-			int index2 = (height - 1 - j) * width * channels;
-			for( i = width * channels; i > 0; --i )
-			{
-				unsigned char temp = img[index1];
-				img[index1] = img[index2];
-				img[index2] = temp;
-				++index1;
-				++index2;
-			}
-		}
-	}
-	/*	does the user want me to scale the colors into the NTSC safe RGB range?	*/
-	if( flags & SOIL_FLAG_NTSC_SAFE_RGB )
-	{
-		scale_image_RGB_to_NTSC_safe( img, width, height, channels );
-	}
-	/*	does the user want me to convert from straight to pre-multiplied alpha?
-		(and do we even _have_ alpha?)	*/
-	if( flags & SOIL_FLAG_MULTIPLY_ALPHA )
-	{
-		int i;
-		switch( channels )
-		{
-		case 2:
-			for( i = 0; i < 2*width*height; i += 2 )
-			{
-				img[i] = (img[i] * img[i+1] + 128) >> 8;
-			}
-			break;
-		case 4:
-			for( i = 0; i < 4*width*height; i += 4 )
-			{
-				img[i+0] = (img[i+0] * img[i+3] + 128) >> 8;
-				img[i+1] = (img[i+1] * img[i+3] + 128) >> 8;
-				img[i+2] = (img[i+2] * img[i+3] + 128) >> 8;
-			}
-			break;
-		default:
-			/*	no other number of channels contains alpha data	*/
-			break;
-		}
-	}
 	/*	if the user can't support NPOT textures, make sure we force the POT option	*/
 	if( (query_NPOT_capability() == SOIL_CAPABILITY_NONE) &&
 		!(flags & SOIL_FLAG_TEXTURE_RECTANGLE) )
@@ -1087,6 +1292,34 @@ unsigned int
 	/*	how large of a texture can this OpenGL implementation handle?	*/
 	/*	texture_check_size_enum will be GL_MAX_TEXTURE_SIZE or SOIL_MAX_CUBE_MAP_TEXTURE_SIZE	*/
 	glGetIntegerv( texture_check_size_enum, &max_supported_size );
+	/*	which of the per-pixel steps does the user want?	*/
+	if( flags & SOIL_FLAG_NTSC_SAFE_RGB )
+	{
+		pipeline_steps |= PIPELINE_NTSC_SAFE_RGB;
+	}
+	if( flags & SOIL_FLAG_MULTIPLY_ALPHA )
+	{
+		pipeline_steps |= PIPELINE_MULTIPLY_ALPHA;
+	}
+	/*	YCoCg comes after any resizing, so it can only join in
+		if the image is going to stay the size it is	*/
+	if( (flags & SOIL_FLAG_CoCg_Y) &&
+		(width <= max_supported_size) && (height <= max_supported_size) &&
+		(!((flags & SOIL_FLAG_POWER_OF_TWO) || (flags & SOIL_FLAG_MIPMAPS)) ||
+		(((width & (width - 1)) == 0) && ((height & (height - 1)) == 0))) )
+	{
+		pipeline_steps |= PIPELINE_RGB_TO_YCoCg;
+	}
+	/*	copy the image data, inverting it and running all those steps
+		on each row as it goes	*/
+	img = (unsigned char*)image_malloc( width*height*channels );
+	if( NULL == img )
+	{
+		result_string_pointer = "Unable to allocate the texture image";
+		return 0;
+	}
+	run_image_pipeline( data, width, height, channels, img,
+			(flags & SOIL_FLAG_INVERT_Y) != 0, pipeline_steps );
 	/*	do I need to make it a power of 2?	*/
 	if(
 		(flags & SOIL_FLAG_POWER_OF_TWO) ||	/*	user asked for it	*/
@@ -1108,7 +1341,7 @@ unsigned int
 		if( (new_width != width) || (new_height != height) )
 		{
 			/*	yep, resize	*/
-			unsigned char *resampled = (unsigned char*)malloc( channels*new_width*new_height );
+			unsigned char *resampled = (unsigned char*)image_malloc( channels*new_width*new_height );
 			up_scale_image(
 					img, width, height, channels,
 					resampled, new_width, new_height );
@@ -1143,7 +1376,7 @@ unsigned int
 		}
 		new_width = width / reduce_block_x;
 		new_height = height / reduce_block_y;
-		resampled = (unsigned char*)malloc( channels*new_width*new_height );
+		resampled = (unsigned char*)image_malloc( channels*new_width*new_height );
 		/*	perform the actual reduction	*/
 		mipmap_image(	img, width, height, channels,
 						resampled, reduce_block_x, reduce_block_y );
@@ -1153,11 +1386,12 @@ unsigned int
 		width = new_width;
 		height = new_height;
 	}
-	/*	does the user want us to use YCoCg color space?	*/
-	if( flags & SOIL_FLAG_CoCg_Y )
+	/*	does the user want us to use YCoCg color space (and is it still to do)?	*/
+	if( (flags & SOIL_FLAG_CoCg_Y) && !(pipeline_steps & PIPELINE_RGB_TO_YCoCg) )
 	{
 		/*	this will only work with RGB and RGBA images */
-		convert_RGB_to_YCoCg( img, width, height, channels );
+		run_image_pipeline( img, width, height, channels, img,
+				0, PIPELINE_RGB_TO_YCoCg );
 		/*
 		save_image_as_DDS( "CoCg_Y.dds", width, height, channels, img );
 		*/
@@ -1211,6 +1445,58 @@ unsigned int
 		/*  bind an OpenGL texture ID	*/
 		glBindTexture( opengl_texture_type, tex_id );
 		check_for_GL_errors( "glBindTexture" );
+		/*	can the driver build the MIPmaps instead?  Not for DXT (my
+			compressor has to see every level), not while the texture
+			cache is watching the levels go up (it saves the whole chain),
+			and not for cubemap faces, which come through one at a time	*/
+		if( (flags & SOIL_FLAG_MIPMAPS) &&
+			(flags & SOIL_FLAG_GPU_MIPMAPS) &&
+			(DXT_mode != SOIL_CAPABILITY_PRESENT) &&
+			(NULL == level_capture) &&
+			(opengl_texture_type == opengl_texture_target) &&
+			(query_generate_mipmap_capability() == SOIL_CAPABILITY_PRESENT) )
+		{
+			use_GPU_mipmaps = 1;
+		}
+		/*	does the user want the whole chain allocated up front?  (only
+			for new textures: an immutable one can't be redefined, and the
+			faces of a cubemap come through here one at a time)	*/
+		if( (flags & SOIL_FLAG_IMMUTABLE_STORAGE) &&
+			(reuse_texture_ID == 0) &&
+			(opengl_texture_type == opengl_texture_target) &&
+			(query_texture_storage_capability() == SOIL_CAPABILITY_PRESENT) )
+		{
+			int levels = 1;
+			unsigned int storage_format = internal_texture_format;
+			if( flags & SOIL_FLAG_MIPMAPS )
+			{
+				while( ((1<<levels) <= width) || ((1<<levels) <= height) )
+				{
+					++levels;
+				}
+			}
+			/*	storage needs a sized format	*/
+			switch( internal_texture_format )
+			{
+			case GL_LUMINANCE:
+				storage_format = SOIL_LUMINANCE8;
+				break;
+			case GL_LUMINANCE_ALPHA:
+				storage_format = SOIL_LUMINANCE8_ALPHA8;
+				break;
+			case GL_RGB:
+				storage_format = SOIL_RGB8;
+				break;
+			case GL_RGBA:
+				storage_format = SOIL_RGBA8;
+				break;
+			}
+			soilGlTexStorage2D( opengl_texture_target, levels,
+					storage_format, width, height );
+			/*	if the driver won't take it, the texture is still
+				mutable, so just upload the old way	*/
+			use_storage = (glGetError() == GL_NO_ERROR);
+		}
 		/*  upload the main image	*/
 		if( DXT_mode == SOIL_CAPABILITY_PRESENT )
 		{
@@ -1228,40 +1514,51 @@ unsigned int
 			}
 			if( DDS_data )
 			{
-				soilGlCompressedTexImage2D(
+				SOIL_internal_upload_compressed_level( use_storage,
 					opengl_texture_target, 0,
-					internal_texture_format, width, height, 0,
+					internal_texture_format, width, height,
 					DDS_size, DDS_data );
-				check_for_GL_errors( "glCompressedTexImage2D" );
+				SOIL_internal_capture_level( 0, width, height, channels,
+					internal_texture_format, DDS_data, DDS_size );
 				SOIL_free_image_data( DDS_data );
 				/*	printf( "Internal DXT compressor\n" );	*/
 			} else
 			{
 				/*	my compression failed, try the OpenGL driver's version	*/
-				glTexImage2D(
+				SOIL_internal_upload_level( use_storage,
 					opengl_texture_target, 0,
-					internal_texture_format, width, height, 0,
-					original_texture_format, GL_UNSIGNED_BYTE, img );
-				check_for_GL_errors( "glTexImage2D" );
+					internal_texture_format, width, height,
+					original_texture_format, img );
+				SOIL_internal_capture_level( 0, width, height, channels,
+					original_texture_format, img, width*height*channels );
 				/*	printf( "OpenGL DXT compressor\n" );	*/
 			}
 		} else
 		{
 			/*	user want OpenGL to do all the work!	*/
-			glTexImage2D(
+			SOIL_internal_upload_level( use_storage,
 				opengl_texture_target, 0,
-				internal_texture_format, width, height, 0,
-				original_texture_format, GL_UNSIGNED_BYTE, img );
-			check_for_GL_errors( "glTexImage2D" );
+				internal_texture_format, width, height,
+				original_texture_format, img );
+			SOIL_internal_capture_level( 0, width, height, channels,
+				original_texture_format, img, width*height*channels );
 			/*printf( "OpenGL DXT compressor\n" );	*/
 		}
 		/*	are any MIPmaps desired?	*/
-		if( flags & SOIL_FLAG_MIPMAPS )
+		if( use_GPU_mipmaps )
+		{
+			/*	the driver builds them all from level 0	*/
+			soilGlGenerateMipmap( opengl_texture_type );
+			check_for_GL_errors( "glGenerateMipmap" );
+			glTexParameteri( opengl_texture_type, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+			glTexParameteri( opengl_texture_type, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
+			check_for_GL_errors( "GL_TEXTURE_MIN/MAG_FILTER" );
+		} else if( flags & SOIL_FLAG_MIPMAPS )
 		{
 			int MIPlevel = 1;
 			int MIPwidth = (width+1) / 2;
 			int MIPheight = (height+1) / 2;
-			unsigned char *resampled = (unsigned char*)malloc( channels*MIPwidth*MIPheight );
+			unsigned char *resampled = (unsigned char*)image_malloc( channels*MIPwidth*MIPheight );
 			while( ((1<<MIPlevel) <= width) || ((1<<MIPlevel) <= height) )
 			{
 				/*	do this MIPmap level	*/
@@ -1288,29 +1585,32 @@ unsigned int
 					}
 					if( DDS_data )
 					{
-						soilGlCompressedTexImage2D(
+						SOIL_internal_upload_compressed_level( use_storage,
 							opengl_texture_target, MIPlevel,
-							internal_texture_format, MIPwidth, MIPheight, 0,
+							internal_texture_format, MIPwidth, MIPheight,
 							DDS_size, DDS_data );
-						check_for_GL_errors( "glCompressedTexImage2D" );
+						SOIL_internal_capture_level( MIPlevel, MIPwidth, MIPheight, channels,
+							internal_texture_format, DDS_data, DDS_size );
 						SOIL_free_image_data( DDS_data );
 					} else
 					{
 						/*	my compression failed, try the OpenGL driver's version	*/
-						glTexImage2D(
+						SOIL_internal_upload_level( use_storage,
 							opengl_texture_target, MIPlevel,
-							internal_texture_format, MIPwidth, MIPheight, 0,
-							original_texture_format, GL_UNSIGNED_BYTE, resampled );
-						check_for_GL_errors( "glTexImage2D" );
+							internal_texture_format, MIPwidth, MIPheight,
+							original_texture_format, resampled );
+						SOIL_internal_capture_level( MIPlevel, MIPwidth, MIPheight, channels,
+							original_texture_format, resampled, MIPwidth*MIPheight*channels );
 					}
 				} else
 				{
 					/*	user want OpenGL to do all the work!	*/
-					glTexImage2D(
+					SOIL_internal_upload_level( use_storage,
 						opengl_texture_target, MIPlevel,
-						internal_texture_format, MIPwidth, MIPheight, 0,
-						original_texture_format, GL_UNSIGNED_BYTE, resampled );
-					check_for_GL_errors( "glTexImage2D" );
+						internal_texture_format, MIPwidth, MIPheight,
+						original_texture_format, resampled );
+					SOIL_internal_capture_level( MIPlevel, MIPwidth, MIPheight, channels,
+						original_texture_format, resampled, MIPwidth*MIPheight*channels );
 				}
 				/*	prep for the next level	*/
 				++MIPlevel;
@@ -1364,6 +1664,206 @@ unsigned int
 	return tex_id;
 }
 
+void
+	SOIL_internal_upload_level
+	(
+		int use_storage,
+		unsigned int opengl_texture_target, int level,
+		unsigned int internal_texture_format,
+		int width, int height,
+		unsigned int original_texture_format,
+		const unsigned char *const data
+	)
+{
+	if( use_storage )
+	{
+		/*	the storage is already there, just fill it in	*/
+		glTexSubImage2D(
+			opengl_texture_target, level,
+			0, 0, width, height,
+			original_texture_format, GL_UNSIGNED_BYTE, data );
+		check_for_GL_errors( "glTexSubImage2D" );
+	} else
+	{
+		glTexImage2D(
+			opengl_texture_target, level,
+			internal_texture_format, width, height, 0,
+			original_texture_format, GL_UNSIGNED_BYTE, data );
+		check_for_GL_errors( "glTexImage2D" );
+	}
+}
+
+void
+	SOIL_internal_upload_compressed_level
+	(
+		int use_storage,
+		unsigned int opengl_texture_target, int level,
+		unsigned int internal_texture_format,
+		int width, int height,
+		int data_size,
+		const unsigned char *const data
+	)
+{
+	if( use_storage )
+	{
+		soilGlCompressedTexSubImage2D(
+			opengl_texture_target, level,
+			0, 0, width, height,
+			internal_texture_format, data_size, data );
+		check_for_GL_errors( "glCompressedTexSubImage2D" );
+	} else
+	{
+		soilGlCompressedTexImage2D(
+			opengl_texture_target, level,
+			internal_texture_format, width, height, 0,
+			data_size, data );
+		check_for_GL_errors( "glCompressedTexImage2D" );
+	}
+}
+
+unsigned int
+	SOIL_internal_create_OGL_BC6H_texture
+	(
+		float *hdr_data,
+		int width, int height,
+		unsigned int reuse_texture_ID,
+		unsigned int flags
+	)
+{
+	/*	variables	*/
+	unsigned int tex_id;
+	int max_supported_size;
+	int DDS_size;
+	unsigned char *DDS_data;
+	/*	can the driver even take BC6H?	*/
+	if( query_BPTC_capability() != SOIL_CAPABILITY_PRESENT )
+	{
+		result_string_pointer = "BPTC (BC6H) compressed textures not supported by the OpenGL driver";
+		return 0;
+	}
+	/*	I don't resample HDR data, so it has to fit as it is	*/
+	glGetIntegerv( GL_MAX_TEXTURE_SIZE, &max_supported_size );
+	if( (width > max_supported_size) || (height > max_supported_size) )
+	{
+		result_string_pointer = "HDR image is too large for a BC6H texture";
+		return 0;
+	}
+	if( (query_NPOT_capability() == SOIL_CAPABILITY_NONE) &&
+		(((width & (width - 1)) != 0) || ((height & (height - 1)) != 0)) )
+	{
+		result_string_pointer = "BC6H textures must be power-of-two sized without NPOT support";
+		return 0;
+	}
+	/*	does the user want me to invert the image?	*/
+	if( flags & SOIL_FLAG_INVERT_Y )
+	{
+		int i, j;
+		for( j = 0; j*2 < height; ++j )
+		{
+			int index1 = j * width * 3;
+			int index2 = (height - 1 - j) * width * 3;
+			for( i = width * 3; i > 0; --i )
+			{
+				float temp = hdr_data[index1];
+				hdr_data[index1] = hdr_data[index2];
+				hdr_data[index2] = temp;
+				++index1;
+				++index2;
+			}
+		}
+	}
+	/*	create the OpenGL texture ID handle	*/
+	tex_id = reuse_texture_ID;
+	if( tex_id == 0 )
+	{
+		glGenTextures( 1, &tex_id );
+	}
+	check_for_GL_errors( "glGenTextures" );
+	if( tex_id )
+	{
+		glBindTexture( GL_TEXTURE_2D, tex_id );
+		check_for_GL_errors( "glBindTexture" );
+		/*  upload the main image	*/
+		DDS_data = convert_image_to_BC6H( hdr_data, width, height, 3, &DDS_size );
+		if( NULL == DDS_data )
+		{
+			glDeleteTextures( 1, &tex_id );
+			result_string_pointer = "BC6H compression failed";
+			return 0;
+		}
+		soilGlCompressedTexImage2D(
+			GL_TEXTURE_2D, 0,
+			SOIL_RGB_BPTC_UNSIGNED_FLOAT, width, height, 0,
+			DDS_size, DDS_data );
+		check_for_GL_errors( "glCompressedTexImage2D" );
+		image_free( DDS_data );
+		/*	are any MIPmaps desired?	*/
+		if( flags & SOIL_FLAG_MIPMAPS )
+		{
+			int MIPlevel = 1;
+			int MIPwidth, MIPheight;
+			float *resampled = (float*)image_malloc( sizeof(float)*3*((width+1)/2)*((height+1)/2) );
+			while( ((1<<MIPlevel) <= width) || ((1<<MIPlevel) <= height) )
+			{
+				MIPwidth = width >> MIPlevel;
+				MIPheight = height >> MIPlevel;
+				if( MIPwidth < 1 )
+				{
+					MIPwidth = 1;
+				}
+				if( MIPheight < 1 )
+				{
+					MIPheight = 1;
+				}
+				/*	do this MIPmap level	*/
+				mipmap_float_image(
+						hdr_data, width, height, 3,
+						resampled,
+						(1 << MIPlevel), (1 << MIPlevel) );
+				DDS_data = convert_image_to_BC6H( resampled, MIPwidth, MIPheight, 3, &DDS_size );
+				if( DDS_data )
+				{
+					soilGlCompressedTexImage2D(
+						GL_TEXTURE_2D, MIPlevel,
+						SOIL_RGB_BPTC_UNSIGNED_FLOAT, MIPwidth, MIPheight, 0,
+						DDS_size, DDS_data );
+					check_for_GL_errors( "glCompressedTexImage2D" );
+					image_free( DDS_data );
+				}
+				++MIPlevel;
+			}
+			image_free( resampled );
+			/*	instruct OpenGL to use the MIPmaps	*/
+			glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+			glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
+		} else
+		{
+			/*	instruct OpenGL _NOT_ to use the MIPmaps	*/
+			glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+			glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+		}
+		check_for_GL_errors( "GL_TEXTURE_MIN/MAG_FILTER" );
+		/*	does the user want clamping, or wrapping?	*/
+		if( flags & SOIL_FLAG_TEXTURE_REPEATS )
+		{
+			glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT );
+			glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT );
+		} else
+		{
+			glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP );
+			glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP );
+		}
+		check_for_GL_errors( "GL_TEXTURE_WRAP_*" );
+		/*	done	*/
+		result_string_pointer = "HDR image loaded as a BC6H OpenGL texture";
+	} else
+	{
+		/*	failed	*/
+		result_string_pointer = "Failed to generate an OpenGL texture name; missing OpenGL context?";
+	}
+	return tex_id;
+}
+
 int
 	SOIL_save_screenshot
 	(
@@ -1395,7 +1895,7 @@ int
 	}
 
     /*  Get the data from OpenGL	*/
-    pixel_data = (unsigned char*)malloc( 3*width*height );
+    pixel_data = (unsigned char*)image_malloc( 3*width*height );
     glReadPixels (x, y, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixel_data);
 
     /*	invert the image	*/
@@ -1429,7 +1929,11 @@ unsigned char*
 		int force_channels
 	)
 {
-	unsigned char *result = stbi_load( filename,
+	static perf_stats stats = PERF_STATS_INIT( "SOIL_load_image", "pixel", 1 );
+	perf_counters counters;
+	unsigned char *result;
+	PERF_BEGIN( counters );
+	result = stbi_load( filename,
 			width, height, channels, force_channels );
 	if( result == NULL )
 	{
@@ -1438,6 +1942,7 @@ unsigned char*
 	{
 		result_string_pointer = "Image loaded";
 	}
+	PERF_END( counters, stats, (result != NULL) ? (double)*width * *height : 0.0 );
 	return result;
 }
 
@@ -1465,15 +1970,240 @@ unsigned char*
 }
 
 int
-	SOIL_save_image
+	SOIL_image_info
 	(
 		const char *filename,
-		int image_type,
-		int width, int height, int channels,
-		const unsigned char *const data
+		int *width, int *height, int *channels
 	)
 {
-	int save_result;
+	if( !stbi_info( filename, width, height, channels ) )
+	{
+		result_string_pointer = stbi_failure_reason();
+		return 0;
+	}
+	result_string_pointer = "Image info read";
+	return 1;
+}
+
+int
+	SOIL_image_info_from_memory
+	(
+		const unsigned char *const buffer,
+		int buffer_length,
+		int *width, int *height, int *channels
+	)
+{
+	if( !stbi_info_from_memory( buffer, buffer_length, width, height, channels ) )
+	{
+		result_string_pointer = stbi_failure_reason();
+		return 0;
+	}
+	result_string_pointer = "Image info read from memory";
+	return 1;
+}
+
+int
+	SOIL_load_image_into
+	(
+		const char *filename,
+		unsigned char *dest,
+		int dest_pitch, int dest_size,
+		int *width, int *height, int *channels,
+		int force_channels
+	)
+{
+	/*	error check	*/
+	if( NULL == dest )
+	{
+		result_string_pointer = "NULL destination";
+		return 0;
+	}
+	if( !stbi_load_into( filename, width, height, channels,
+			force_channels, dest, dest_pitch, dest_size ) )
+	{
+		result_string_pointer = stbi_failure_reason();
+		return 0;
+	}
+	result_string_pointer = "Image loaded";
+	return 1;
+}
+
+int
+	SOIL_load_image_from_memory_into
+	(
+		const unsigned char *const buffer,
+		int buffer_length,
+		unsigned char *dest,
+		int dest_pitch, int dest_size,
+		int *width, int *height, int *channels,
+		int force_channels
+	)
+{
+	/*	error check	*/
+	if( NULL == dest )
+	{
+		result_string_pointer = "NULL destination";
+		return 0;
+	}
+	if( !stbi_load_into_memory( buffer, buffer_length,
+			width, height, channels,
+			force_channels, dest, dest_pitch, dest_size ) )
+	{
+		result_string_pointer = stbi_failure_reason();
+		return 0;
+	}
+	result_string_pointer = "Image loaded from memory";
+	return 1;
+}
+
+/*	what the batch loading threads share	*/
+typedef struct
+{
+	SOIL_batch_item *items;
+	int force_channels;
+	SOIL_batch_callback callback;
+	void *user_data;
+	volatile long loaded;
+}
+SOIL_batch_job;
+
+static void SOIL_internal_load_batch_items( void *job_data, int first, int last )
+{
+	SOIL_batch_job *job = (SOIL_batch_job*)job_data;
+	int i;
+	for( i = first; i < last; ++i )
+	{
+		SOIL_batch_item *item = &job->items[i];
+		/*	stbi keeps its failure reason per thread, so each item
+			gets its own rather than racing on result_string_pointer	*/
+		if( NULL != item->filename )
+		{
+			item->data = stbi_load( item->filename,
+					&item->width, &item->height, &item->channels,
+					job->force_channels );
+		} else
+		{
+			item->data = stbi_load_from_memory(
+					item->buffer, item->buffer_length,
+					&item->width, &item->height, &item->channels,
+					job->force_channels );
+		}
+		if( NULL == item->data )
+		{
+			item->result_string = stbi_failure_reason();
+		} else
+		{
+			item->result_string = "Image loaded";
+			#ifdef WIN32
+				InterlockedIncrement( &job->loaded );
+			#else
+				__sync_fetch_and_add( &job->loaded, 1 );
+			#endif
+		}
+		if( NULL != job->callback )
+		{
+			job->callback( job->user_data, item, i );
+		}
+	}
+}
+
+int
+	SOIL_load_image_batch
+	(
+		SOIL_batch_item *items,
+		int item_count,
+		int force_channels,
+		int max_threads,
+		SOIL_batch_callback callback,
+		void *user_data
+	)
+{
+	SOIL_batch_job job;
+	/*	error check	*/
+	if( (NULL == items) || (item_count < 0) )
+	{
+		result_string_pointer = "Invalid batch";
+		return 0;
+	}
+	/*	nothing loaded, and nothing failed either	*/
+	if( 0 == item_count )
+	{
+		result_string_pointer = "Empty batch, no images to load";
+		return 0;
+	}
+	job.items = items;
+	job.force_channels = force_channels;
+	job.callback = callback;
+	job.user_data = user_data;
+	job.loaded = 0;
+	/*	the images cost wildly different amounts to decode, so let
+		the threads steal from each other rather than split evenly	*/
+	run_stealing_job( SOIL_internal_load_batch_items, &job, item_count, max_threads );
+	if( job.loaded == item_count )
+	{
+		result_string_pointer = "Images loaded";
+	} else
+	{
+		result_string_pointer = "Some images failed to load; see their result_string";
+	}
+	return (int)job.loaded;
+}
+
+unsigned char*
+	SOIL_load_image_scaled
+	(
+		const char *filename,
+		int *width, int *height, int *channels,
+		int force_channels,
+		int scale_shift
+	)
+{
+	unsigned char *result = stbi_load_scaled( filename,
+			width, height, channels, force_channels, scale_shift );
+	if( result == NULL )
+	{
+		result_string_pointer = stbi_failure_reason();
+	} else
+	{
+		result_string_pointer = "Image loaded";
+	}
+	return result;
+}
+
+unsigned char*
+	SOIL_load_image_from_memory_scaled
+	(
+		const unsigned char *const buffer,
+		int buffer_length,
+		int *width, int *height, int *channels,
+		int force_channels,
+		int scale_shift
+	)
+{
+	unsigned char *result = stbi_load_scaled_from_memory(
+				buffer, buffer_length,
+				width, height, channels,
+				force_channels, scale_shift );
+	if( result == NULL )
+	{
+		result_string_pointer = stbi_failure_reason();
+	} else
+	{
+		result_string_pointer = "Image loaded from memory";
+	}
+	return result;
+}
+
+int
+	SOIL_save_image
+	(
+		const char *filename,
+		int image_type,
+		int width, int height, int channels,
+		const unsigned char *const data
+	)
+{
+	int save_result;
 
 	/*	error check	*/
 	if( (width < 1) || (height < 1) ||
@@ -1483,50 +2213,1031 @@ int
 	{
 		return 0;
 	}
-	if( image_type == SOIL_SAVE_TYPE_BMP )
+	if( image_type == SOIL_SAVE_TYPE_BMP )
+	{
+		save_result = stbi_write_bmp( filename,
+				width, height, channels, (void*)data );
+	} else
+	if( image_type == SOIL_SAVE_TYPE_TGA )
+	{
+		save_result = stbi_write_tga( filename,
+				width, height, channels, (void*)data );
+	} else
+	if( image_type == SOIL_SAVE_TYPE_DDS )
+	{
+		save_result = save_image_as_DDS( filename,
+				width, height, channels, (const unsigned char *const)data );
+	} else
+	if( image_type == SOIL_SAVE_TYPE_KTX2 )
+	{
+		save_result = save_image_as_KTX2( filename,
+				width, height, channels, (const unsigned char *const)data );
+	} else
+	if( image_type == SOIL_SAVE_TYPE_QOI )
+	{
+		save_result = stbi_write_qoi( filename,
+				width, height, channels, (void*)data );
+	} else
+	if( image_type == SOIL_SAVE_TYPE_PNG )
+	{
+		save_result = save_image_as_PNG( filename,
+				width, height, channels, (const unsigned char *const)data );
+	} else
+	{
+		save_result = 0;
+	}
+	if( save_result == 0 )
+	{
+		result_string_pointer = "Saving the image failed";
+	} else
+	{
+		result_string_pointer = "Image saved";
+	}
+	return save_result;
+}
+
+unsigned char*
+	SOIL_save_image_to_memory
+	(
+		int image_type,
+		int width, int height, int channels,
+		const unsigned char *const data,
+		int *size
+	)
+{
+	unsigned char *file_data;
+
+	/*	error check	*/
+	if( (width < 1) || (height < 1) ||
+		(channels < 1) || (channels > 4) ||
+		(data == NULL) ||
+		(size == NULL) )
+	{
+		result_string_pointer = "Invalid parameters";
+		return NULL;
+	}
+	*size = 0;
+	if( image_type == SOIL_SAVE_TYPE_BMP )
+	{
+		file_data = stbi_write_bmp_to_mem(
+				width, height, channels, (void*)data, size );
+	} else
+	if( image_type == SOIL_SAVE_TYPE_TGA )
+	{
+		file_data = stbi_write_tga_to_mem(
+				width, height, channels, (void*)data, size );
+	} else
+	if( image_type == SOIL_SAVE_TYPE_DDS )
+	{
+		file_data = convert_image_to_DDS(
+				data, width, height, channels, size );
+	} else
+	if( image_type == SOIL_SAVE_TYPE_QOI )
+	{
+		file_data = stbi_write_qoi_to_mem(
+				width, height, channels, (void*)data, size );
+	} else
+	if( image_type == SOIL_SAVE_TYPE_PNG )
+	{
+		file_data = convert_image_to_PNG(
+				data, width, height, channels, size );
+	} else
+	{
+		file_data = NULL;
+	}
+	if( file_data == NULL )
+	{
+		result_string_pointer = "Saving the image failed";
+	} else
+	{
+		result_string_pointer = "Image saved";
+	}
+	return file_data;
+}
+
+void
+	SOIL_free_image_data
+	(
+		unsigned char *img_data
+	)
+{
+	image_free( (void*)img_data );
+}
+
+void
+	SOIL_set_allocator
+	(
+		void *(*malloc_func)( size_t size, void *user_data ),
+		void *(*realloc_func)( void *p, size_t size, void *user_data ),
+		void (*free_func)( void *p, void *user_data ),
+		void *user_data
+	)
+{
+	/*	SOIL frees what stb_image allocates, so they share it	*/
+	set_image_allocator( malloc_func, realloc_func, free_func, user_data );
+	stbi_set_allocator( malloc_func, realloc_func, free_func, user_data );
+	/*	the old allocator's scratch block goes back to it	*/
+	stbi_release_scratch();
+	result_string_pointer = "Allocator set";
+}
+
+const char*
+	SOIL_last_result
+	(
+		void
+	)
+{
+	return result_string_pointer;
+}
+
+int
+	SOIL_set_texture_cache_directory
+	(
+		const char *directory
+	)
+{
+	/*	forget the old one	*/
+	image_free( texture_cache_directory );
+	texture_cache_directory = NULL;
+	if( NULL == directory )
+	{
+		result_string_pointer = "Texture cache turned off";
+		return 1;
+	}
+	texture_cache_directory = (char*)image_malloc( strlen( directory ) + 1 );
+	if( NULL == texture_cache_directory )
+	{
+		result_string_pointer = "malloc failed";
+		return 0;
+	}
+	strcpy( texture_cache_directory, directory );
+	result_string_pointer = "Texture cache turned on";
+	return 1;
+}
+
+int
+	SOIL_set_memory_cache_budget
+	(
+		size_t budget_bytes
+	)
+{
+	memory_cache_budget = budget_bytes;
+	/*	drop whatever no longer fits	*/
+	SOIL_internal_cache_trim();
+	result_string_pointer = "Memory cache budget set";
+	return 1;
+}
+
+unsigned char*
+	SOIL_load_shared_image
+	(
+		const char *filename,
+		int *width, int *height, int *channels,
+		int force_channels
+	)
+{
+	SOIL_cache_entry *entry;
+	if( (force_channels < 0) || (force_channels > 4) )
+	{
+		force_channels = 0;
+	}
+	/*	loaded from this path before?	*/
+	entry = SOIL_internal_cache_find_name( filename, 0, force_channels, 0 );
+	if( NULL == entry )
+	{
+		/*	no, but the same bytes may have come from somewhere else	*/
+		SOIL_file_view view;
+		unsigned int hash_lo, hash_hi;
+		if( !SOIL_internal_open_file_view( filename, &view ) )
+		{
+			return NULL;
+		}
+		SOIL_internal_hash_bytes( view.data, view.length, &hash_lo, &hash_hi );
+		entry = SOIL_internal_cache_find_content( view.data, view.length,
+				hash_lo, hash_hi, 0, force_channels, 0 );
+		if( NULL != entry )
+		{
+			SOIL_internal_cache_add_name( entry, filename );
+			result_string_pointer = "Image loaded from the memory cache";
+		} else
+		{
+			unsigned char *img;
+			int w, h, c;
+			img = SOIL_load_image_from_memory( view.data, view.length,
+					&w, &h, &c, force_channels );
+			if( NULL == img )
+			{
+				SOIL_internal_close_file_view( &view );
+				return NULL;
+			}
+			entry = SOIL_internal_cache_insert( filename, view.data, view.length,
+					hash_lo, hash_hi, 0, force_channels, 0 );
+			if( NULL == entry )
+			{
+				SOIL_internal_close_file_view( &view );
+				SOIL_free_image_data( img );
+				result_string_pointer = "malloc failed";
+				return NULL;
+			}
+			entry->image = img;
+			entry->width = w;
+			entry->height = h;
+			entry->channels = c;
+			entry->size += (size_t)w * h * (force_channels ? force_channels : c);
+			memory_cache_size += entry->size;
+		}
+		SOIL_internal_close_file_view( &view );
+	} else
+	{
+		result_string_pointer = "Image loaded from the memory cache";
+	}
+	SOIL_internal_cache_use( entry );
+	*width = entry->width;
+	*height = entry->height;
+	*channels = entry->channels;
+	SOIL_internal_cache_trim();
+	return entry->image;
+}
+
+void
+	SOIL_release_shared_image
+	(
+		const unsigned char *img_data
+	)
+{
+	SOIL_cache_entry *entry;
+	for( entry = memory_cache_head; NULL != entry; entry = entry->next )
+	{
+		if( !entry->is_texture && (entry->image == img_data) )
+		{
+			if( entry->references > 0 )
+			{
+				--entry->references;
+			}
+			SOIL_internal_cache_trim();
+			return;
+		}
+	}
+}
+
+unsigned int
+	SOIL_load_shared_OGL_texture
+	(
+		const char *filename,
+		int force_channels,
+		unsigned int flags
+	)
+{
+	SOIL_cache_entry *entry;
+	if( (force_channels < 0) || (force_channels > 4) )
+	{
+		force_channels = 0;
+	}
+	entry = SOIL_internal_cache_find_name( filename, 1, force_channels, flags );
+	if( NULL == entry )
+	{
+		SOIL_file_view view;
+		unsigned int hash_lo, hash_hi;
+		if( !SOIL_internal_open_file_view( filename, &view ) )
+		{
+			return 0;
+		}
+		SOIL_internal_hash_bytes( view.data, view.length, &hash_lo, &hash_hi );
+		entry = SOIL_internal_cache_find_content( view.data, view.length,
+				hash_lo, hash_hi, 1, force_channels, flags );
+		if( NULL != entry )
+		{
+			SOIL_internal_cache_add_name( entry, filename );
+			result_string_pointer = "Texture loaded from the memory cache";
+		} else
+		{
+			unsigned int tex_id;
+			int w, h, c;
+			size_t size;
+			tex_id = SOIL_load_OGL_texture_from_memory( view.data, view.length,
+					force_channels, SOIL_CREATE_NEW_ID, flags );
+			if( 0 == tex_id )
+			{
+				SOIL_internal_close_file_view( &view );
+				return 0;
+			}
+			/*	the driver's copy is what counts (resized, compressed,
+				MIPmapped), and the new texture is still bound	*/
+			size = SOIL_internal_texture_size( tex_id, &w, &h, &c );
+			entry = SOIL_internal_cache_insert( filename, view.data, view.length,
+					hash_lo, hash_hi, 1, force_channels, flags );
+			if( NULL == entry )
+			{
+				SOIL_internal_close_file_view( &view );
+				glDeleteTextures( 1, &tex_id );
+				result_string_pointer = "malloc failed";
+				return 0;
+			}
+			entry->texture_ID = tex_id;
+			entry->width = w;
+			entry->height = h;
+			entry->channels = c;
+			entry->size += size;
+			memory_cache_size += entry->size;
+		}
+		SOIL_internal_close_file_view( &view );
+	} else
+	{
+		result_string_pointer = "Texture loaded from the memory cache";
+	}
+	SOIL_internal_cache_use( entry );
+	SOIL_internal_cache_trim();
+	return entry->texture_ID;
+}
+
+void
+	SOIL_release_shared_OGL_texture
+	(
+		unsigned int texture_ID
+	)
+{
+	SOIL_cache_entry *entry;
+	for( entry = memory_cache_head; NULL != entry; entry = entry->next )
+	{
+		if( entry->is_texture && (entry->texture_ID == texture_ID) )
+		{
+			if( entry->references > 0 )
+			{
+				--entry->references;
+			}
+			SOIL_internal_cache_trim();
+			return;
+		}
+	}
+}
+
+SOIL_cache_entry* SOIL_internal_cache_find_name(
+		const char *filename,
+		int is_texture, int force_channels, unsigned int flags )
+{
+	SOIL_cache_entry *entry;
+	SOIL_cache_name *name;
+	for( entry = memory_cache_head; NULL != entry; entry = entry->next )
+	{
+		if( (entry->is_texture != is_texture) ||
+			(entry->force_channels != force_channels) ||
+			(entry->flags != flags) )
+		{
+			continue;
+		}
+		for( name = entry->names; NULL != name; name = name->next )
+		{
+			if( 0 == strcmp( name->filename, filename ) )
+			{
+				return entry;
+			}
+		}
+	}
+	return NULL;
+}
+
+SOIL_cache_entry* SOIL_internal_cache_find_content(
+		const unsigned char *const source, int source_length,
+		unsigned int hash_lo, unsigned int hash_hi,
+		int is_texture, int force_channels, unsigned int flags )
+{
+	SOIL_cache_entry *entry;
+	for( entry = memory_cache_head; NULL != entry; entry = entry->next )
+	{
+		if( (entry->hash_lo == hash_lo) && (entry->hash_hi == hash_hi) &&
+			(entry->source_length == source_length) &&
+			(entry->is_texture == is_texture) &&
+			(entry->force_channels == force_channels) &&
+			(entry->flags == flags) &&
+			/*	the hash only narrows it down, the bytes decide	*/
+			(0 == memcmp( entry->source, source, source_length )) )
+		{
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+SOIL_cache_entry* SOIL_internal_cache_insert(
+		const char *filename,
+		const unsigned char *const source, int source_length,
+		unsigned int hash_lo, unsigned int hash_hi,
+		int is_texture, int force_channels, unsigned int flags )
+{
+	SOIL_cache_entry *entry = (SOIL_cache_entry*)image_malloc( sizeof( SOIL_cache_entry ) );
+	if( NULL == entry )
+	{
+		return NULL;
+	}
+	memset( entry, 0, sizeof( SOIL_cache_entry ) );
+	entry->source = (unsigned char*)image_malloc( source_length );
+	if( NULL == entry->source )
+	{
+		image_free( entry );
+		return NULL;
+	}
+	memcpy( entry->source, source, source_length );
+	entry->source_length = source_length;
+	/*	the copy counts toward the budget too	*/
+	entry->size = source_length;
+	entry->hash_lo = hash_lo;
+	entry->hash_hi = hash_hi;
+	entry->is_texture = is_texture;
+	entry->force_channels = force_channels;
+	entry->flags = flags;
+	/*	it goes in at the front	*/
+	entry->next = memory_cache_head;
+	if( NULL != memory_cache_head )
+	{
+		memory_cache_head->prev = entry;
+	} else
+	{
+		memory_cache_tail = entry;
+	}
+	memory_cache_head = entry;
+	SOIL_internal_cache_add_name( entry, filename );
+	return entry;
+}
+
+void SOIL_internal_cache_add_name(
+		SOIL_cache_entry *entry,
+		const char *filename )
+{
+	/*	without the name, it can still be found by content	*/
+	SOIL_cache_name *name = (SOIL_cache_name*)image_malloc(
+			sizeof( SOIL_cache_name ) + strlen( filename ) );
+	if( NULL != name )
+	{
+		strcpy( name->filename, filename );
+		name->next = entry->names;
+		entry->names = name;
+	}
+}
+
+void SOIL_internal_cache_use(
+		SOIL_cache_entry *entry )
+{
+	++entry->references;
+	if( entry == memory_cache_head )
+	{
+		return;
+	}
+	/*	unlink it...	*/
+	entry->prev->next = entry->next;
+	if( NULL != entry->next )
+	{
+		entry->next->prev = entry->prev;
+	} else
+	{
+		memory_cache_tail = entry->prev;
+	}
+	/*	...and put it back at the front	*/
+	entry->prev = NULL;
+	entry->next = memory_cache_head;
+	memory_cache_head->prev = entry;
+	memory_cache_head = entry;
+}
+
+void SOIL_internal_cache_trim(
+		void )
+{
+	SOIL_cache_entry *entry = memory_cache_tail;
+	/*	evict the least recently used entries nobody holds
+		until the rest fit (ones still in use never go)	*/
+	while( (NULL != entry) && (memory_cache_size > memory_cache_budget) )
+	{
+		SOIL_cache_entry *prev = entry->prev;
+		if( 0 == entry->references )
+		{
+			while( NULL != entry->names )
+			{
+				SOIL_cache_name *name = entry->names;
+				entry->names = name->next;
+				image_free( name );
+			}
+			if( entry->is_texture )
+			{
+				glDeleteTextures( 1, &entry->texture_ID );
+			} else
+			{
+				SOIL_free_image_data( entry->image );
+			}
+			if( NULL != prev )
+			{
+				prev->next = entry->next;
+			} else
+			{
+				memory_cache_head = entry->next;
+			}
+			if( NULL != entry->next )
+			{
+				entry->next->prev = prev;
+			} else
+			{
+				memory_cache_tail = prev;
+			}
+			memory_cache_size -= entry->size;
+			image_free( entry->source );
+			image_free( entry );
+		}
+		entry = prev;
+	}
+}
+
+size_t SOIL_internal_texture_size(
+		unsigned int tex_id,
+		int *width, int *height, int *channels )
+{
+	GLint binding = 0;
+	GLenum target = GL_TEXTURE_2D;
+	int level;
+	size_t size = 0;
+	*width = *height = 0;
+	*channels = 0;
+	/*	a 2D texture, unless it was made as a rectangle	*/
+	glGetIntegerv( SOIL_TEXTURE_BINDING_RECTANGLE_ARB, &binding );
+	if( (GLint)tex_id == binding )
+	{
+		target = SOIL_TEXTURE_RECTANGLE_ARB;
+	}
+	/*	(without the extension that just set an error, so clear it)	*/
+	glGetError();
+	/*	add up every level the driver holds	*/
+	for( level = 0; level < SOIL_MAX_CAPTURED_LEVELS; ++level )
+	{
+		static const GLenum component_size[5] =
+		{
+			GL_TEXTURE_RED_SIZE, GL_TEXTURE_GREEN_SIZE, GL_TEXTURE_BLUE_SIZE,
+			GL_TEXTURE_ALPHA_SIZE, GL_TEXTURE_LUMINANCE_SIZE
+		};
+		GLint w = 0, h = 0, compressed = 0, bytes = 0;
+		int i, bits = 0;
+		glGetTexLevelParameteriv( target, level, GL_TEXTURE_WIDTH, &w );
+		glGetTexLevelParameteriv( target, level, GL_TEXTURE_HEIGHT, &h );
+		if( (w <= 0) || (h <= 0) )
+		{
+			break;
+		}
+		for( i = 0; i < 5; ++i )
+		{
+			GLint b = 0;
+			glGetTexLevelParameteriv( target, level, component_size[i], &b );
+			bits += b;
+			if( (0 == level) && (b > 0) )
+			{
+				++*channels;
+			}
+		}
+		if( 0 == level )
+		{
+			*width = w;
+			*height = h;
+		}
+		glGetTexLevelParameteriv( target, level, SOIL_TEXTURE_COMPRESSED, &compressed );
+		if( compressed )
+		{
+			glGetTexLevelParameteriv( target, level, SOIL_TEXTURE_COMPRESSED_IMAGE_SIZE, &bytes );
+			size += bytes;
+		} else
+		{
+			size += (size_t)w * h * ((bits + 7) / 8);
+		}
+	}
+	glGetError();
+	return size;
+}
+
+void SOIL_internal_capture_level(
+		int level, int width, int height, int channels,
+		unsigned int format,
+		const unsigned char *const data, int data_size )
+{
+	SOIL_level_capture *cap = level_capture;
+	if( (NULL == cap) || cap->failed )
+	{
+		return;
+	}
+	/*	levels have to come in order, and all in the same format	*/
+	if( (level != cap->num_levels) || (level >= SOIL_MAX_CAPTURED_LEVELS) ||
+		((level > 0) && (format != cap->format)) )
+	{
+		cap->failed = 1;
+		return;
+	}
+	if( level == 0 )
+	{
+		cap->width = width;
+		cap->height = height;
+		cap->channels = channels;
+		cap->format = format;
+	}
+	cap->level_data[level] = (unsigned char*)image_malloc( data_size );
+	if( NULL == cap->level_data[level] )
+	{
+		cap->failed = 1;
+		return;
+	}
+	memcpy( cap->level_data[level], data, data_size );
+	cap->level_size[level] = data_size;
+	++cap->num_levels;
+}
+
+void SOIL_internal_hash_bytes(
+		const unsigned char *const buffer,
+		int buffer_length,
+		unsigned int *hash_lo, unsigned int *hash_hi )
+{
+	/*	FNV-1a, plus a second differently mixed word, to make 64 bits	*/
+	unsigned int lo = 2166136261u, hi = 0x9E3779B9u;
+	int i;
+	for( i = 0; i < buffer_length; ++i )
+	{
+		lo = (lo ^ buffer[i]) * 16777619u;
+		hi = ((hi << 5) + (hi >> 27)) ^ (buffer[i] * 0x01000193u);
+	}
+	*hash_lo = lo;
+	*hash_hi = hi;
+}
+
+unsigned int SOIL_internal_load_cached_OGL_texture(
+		const unsigned char *const buffer,
+		int buffer_length,
+		int force_channels,
+		unsigned int reuse_texture_ID,
+		unsigned int flags )
+{
+	/*	variables	*/
+	unsigned char* img;
+	int width, height, channels;
+	unsigned int tex_id;
+	unsigned int hash_lo, hash_hi;
+	unsigned int caps = 0;
+	int i, max_supported_size, DXT_type = -1;
+	char *cache_filename;
+	SOIL_level_capture capture;
+	/*	hash the source bytes	*/
+	SOIL_internal_hash_bytes( buffer, buffer_length, &hash_lo, &hash_hi );
+	/*	what the driver can do changes what gets built	*/
+	if( query_NPOT_capability() == SOIL_CAPABILITY_PRESENT )
+	{
+		caps |= 1;
+	}
+	if( (flags & SOIL_FLAG_COMPRESS_TO_DXT) &&
+		(query_DXT_capability() == SOIL_CAPABILITY_PRESENT) )
+	{
+		caps |= 2;
+	}
+	glGetIntegerv( GL_MAX_TEXTURE_SIZE, &max_supported_size );
+	cache_filename = (char*)image_malloc( strlen( texture_cache_directory ) + 64 );
+	if( NULL == cache_filename )
+	{
+		result_string_pointer = "malloc failed";
+		return 0;
+	}
+	sprintf( cache_filename, "%s/%08x%08x_%x_%d_%x_%d.dds",
+			texture_cache_directory, hash_hi, hash_lo,
+			flags, force_channels, caps, max_supported_size );
+	/*	a hit?  then skip all the work	*/
+	tex_id = SOIL_direct_load_DDS( cache_filename, reuse_texture_ID, flags, 0 );
+	if( tex_id )
+	{
+		image_free( cache_filename );
+		result_string_pointer = "Image loaded from the texture cache";
+		return tex_id;
+	}
+	/*	nope, do it the long way	*/
+	img = SOIL_load_image_from_memory(
+					buffer, buffer_length,
+					&width, &height, &channels,
+					force_channels );
+	if( (force_channels >= 1) && (force_channels <= 4) )
+	{
+		channels = force_channels;
+	}
+	if( NULL == img )
+	{
+		image_free( cache_filename );
+		result_string_pointer = stbi_failure_reason();
+		return 0;
+	}
+	/*	keep a copy of each level as it goes up	*/
+	memset( &capture, 0, sizeof( SOIL_level_capture ) );
+	level_capture = &capture;
+	tex_id = SOIL_internal_create_OGL_texture(
+			img, width, height, channels,
+			reuse_texture_ID, flags,
+			GL_TEXTURE_2D, GL_TEXTURE_2D,
+			GL_MAX_TEXTURE_SIZE );
+	level_capture = NULL;
+	SOIL_free_image_data( img );
+	/*	can the DDS loader read back what was uploaded?	*/
+	switch( capture.format )
+	{
+	case SOIL_RGB_S3TC_DXT1:
+		DXT_type = 1;
+		break;
+	case SOIL_RGBA_S3TC_DXT5:
+		DXT_type = 5;
+		break;
+	case GL_RGB:
+	case GL_RGBA:
+		/*	if DXT was asked for, raw levels mean my compressor didn't
+			make them (no driver support, or it failed), so a cooked
+			file would not hold the compressed texture asked for	*/
+		if( !(flags & SOIL_FLAG_COMPRESS_TO_DXT) )
+		{
+			DXT_type = 0;
+		}
+		break;
+	}
+	if( tex_id && !capture.failed && (capture.num_levels > 0) && (DXT_type >= 0) )
 	{
-		save_result = stbi_write_bmp( filename,
-				width, height, channels, (void*)data );
-	} else
-	if( image_type == SOIL_SAVE_TYPE_TGA )
+		/*	write it to the side, then move it into place, so a
+			half-written file is never picked up	*/
+		char *temp_filename = (char*)image_malloc( strlen( cache_filename ) + 5 );
+		if( NULL != temp_filename )
+		{
+			sprintf( temp_filename, "%s.tmp", cache_filename );
+			if( save_mipmaps_as_DDS( temp_filename,
+					capture.width, capture.height, capture.channels,
+					DXT_type, capture.num_levels,
+					(const unsigned char *const *)capture.level_data,
+					capture.level_size ) )
+			{
+				remove( cache_filename );
+				rename( temp_filename, cache_filename );
+			} else
+			{
+				remove( temp_filename );
+			}
+			image_free( temp_filename );
+		}
+	}
+	for( i = 0; i < capture.num_levels; ++i )
 	{
-		save_result = stbi_write_tga( filename,
-				width, height, channels, (void*)data );
-	} else
-	if( image_type == SOIL_SAVE_TYPE_DDS )
+		image_free( capture.level_data[i] );
+	}
+	image_free( cache_filename );
+	return tex_id;
+}
+
+int SOIL_internal_open_file_view(
+		const char *filename,
+		SOIL_file_view *view )
+{
+	FILE *f;
+	unsigned char *buffer;
+	long file_length;
+	/*	error checks	*/
+	view->data = NULL;
+	view->length = 0;
+	view->is_mapped = 0;
+	if( NULL == filename )
 	{
-		save_result = save_image_as_DDS( filename,
-				width, height, channels, (const unsigned char *const)data );
-	} else
+		result_string_pointer = "NULL filename";
+		return 0;
+	}
+	#ifdef SOIL_USE_MMAP
 	{
-		save_result = 0;
+		/*	map it: the pages come straight from the page cache,
+			and there is no heap copy of the file at all	*/
+		struct stat file_stats;
+		int fd = open( filename, O_RDONLY );
+		if( fd >= 0 )
+		{
+			if( (0 == fstat( fd, &file_stats )) &&
+				(file_stats.st_size > 0) &&
+				(file_stats.st_size <= INT_MAX) )
+			{
+				void *mapping = mmap( NULL, (size_t)file_stats.st_size,
+						PROT_READ, MAP_PRIVATE, fd, 0 );
+				if( MAP_FAILED != mapping )
+				{
+					/*	it gets read front to back, exactly once	*/
+					madvise( mapping, (size_t)file_stats.st_size, MADV_SEQUENTIAL );
+					madvise( mapping, (size_t)file_stats.st_size, MADV_WILLNEED );
+					view->data = (const unsigned char *)mapping;
+					view->length = (int)file_stats.st_size;
+					view->is_mapped = 1;
+				}
+			}
+			/*	the mapping outlives the descriptor	*/
+			close( fd );
+			if( view->is_mapped )
+			{
+				return 1;
+			}
+		}
 	}
-	if( save_result == 0 )
+	#endif
+	/*	no mapping, so read the whole thing in	*/
+	f = fopen( filename, "rb" );
+	if( NULL == f )
 	{
-		result_string_pointer = "Saving the image failed";
-	} else
+		result_string_pointer = "Can not open the image file";
+		return 0;
+	}
+	fseek( f, 0, SEEK_END );
+	file_length = ftell( f );
+	fseek( f, 0, SEEK_SET );
+	buffer = (unsigned char *) image_malloc( file_length > 0 ? file_length : 1 );
+	if( NULL == buffer )
 	{
-		result_string_pointer = "Image saved";
+		result_string_pointer = "malloc failed";
+		fclose( f );
+		return 0;
 	}
-	return save_result;
+	view->length = (int)fread( (void*)buffer, 1, file_length, f );
+	view->data = buffer;
+	fclose( f );
+	return 1;
 }
 
-void
-	SOIL_free_image_data
-	(
-		unsigned char *img_data
-	)
+void SOIL_internal_close_file_view(
+		SOIL_file_view *view )
 {
-	free( (void*)img_data );
+	#ifdef SOIL_USE_MMAP
+	if( view->is_mapped )
+	{
+		munmap( (void*)view->data, (size_t)view->length );
+	} else
+	#endif
+	{
+		image_free( (void*)view->data );
+	}
+	view->data = NULL;
+	view->length = 0;
+	view->is_mapped = 0;
 }
 
-const char*
-	SOIL_last_result
-	(
-		void
-	)
+unsigned int SOIL_direct_load_KTX2_from_memory(
+		const unsigned char *const buffer,
+		int buffer_length,
+		unsigned int reuse_texture_ID,
+		int flags,
+		int loading_as_cubemap )
 {
-	return result_string_pointer;
+	/*	variables	*/
+	KTX2_image image;
+	unsigned int tex_ID = 0;
+	unsigned int internal_format, pixel_format = 0;
+	unsigned int cf_target, ogl_target_start, ogl_target_end;
+	unsigned int opengl_texture_type;
+	unsigned int level, face;
+	int compressed = 1;
+	GLint old_alignment;
+	/*	validate the header and level index	*/
+	if( !parse_KTX2( buffer, buffer_length, &image ) )
+	{
+		result_string_pointer = "Failed to read a known KTX2 header";
+		return 0;
+	}
+	/*	pick the OpenGL format	*/
+	switch( image.vk_format )
+	{
+	case KTX2_VK_FORMAT_R8_UNORM:
+		internal_format = pixel_format = GL_LUMINANCE;
+		compressed = 0;
+		break;
+	case KTX2_VK_FORMAT_R8G8_UNORM:
+		internal_format = pixel_format = GL_LUMINANCE_ALPHA;
+		compressed = 0;
+		break;
+	case KTX2_VK_FORMAT_R8G8B8_UNORM:
+		internal_format = pixel_format = GL_RGB;
+		compressed = 0;
+		break;
+	case KTX2_VK_FORMAT_R8G8B8A8_UNORM:
+		internal_format = pixel_format = GL_RGBA;
+		compressed = 0;
+		break;
+	case KTX2_VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+		internal_format = SOIL_RGB_S3TC_DXT1;
+		break;
+	case KTX2_VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+		internal_format = SOIL_RGBA_S3TC_DXT1;
+		break;
+	case KTX2_VK_FORMAT_BC2_UNORM_BLOCK:
+		internal_format = SOIL_RGBA_S3TC_DXT3;
+		break;
+	case KTX2_VK_FORMAT_BC3_UNORM_BLOCK:
+		internal_format = SOIL_RGBA_S3TC_DXT5;
+		break;
+	default:
+		internal_format = SOIL_RGB_BPTC_UNSIGNED_FLOAT;
+		break;
+	}
+	/*	can the driver take it as it is?	*/
+	if( (internal_format == SOIL_RGB_BPTC_UNSIGNED_FLOAT) &&
+		(query_BPTC_capability() != SOIL_CAPABILITY_PRESENT) )
+	{
+		result_string_pointer = "Direct upload of BC6H images not supported by the OpenGL driver";
+		return 0;
+	}
+	if( compressed && (internal_format != SOIL_RGB_BPTC_UNSIGNED_FLOAT) &&
+		(query_DXT_capability() != SOIL_CAPABILITY_PRESENT) )
+	{
+		result_string_pointer = "Direct upload of S3TC images not supported by the OpenGL driver";
+		return 0;
+	}
+	if( image.face_count == 6 )
+	{
+		/* does the user want a cubemap?	*/
+		if( !loading_as_cubemap )
+		{
+			result_string_pointer = "KTX2 image was a cubemap";
+			return 0;
+		}
+		if( query_cubemap_capability() != SOIL_CAPABILITY_PRESENT )
+		{
+			result_string_pointer = "Direct upload of cubemap images not supported by the OpenGL driver";
+			return 0;
+		}
+		ogl_target_start = SOIL_TEXTURE_CUBE_MAP_POSITIVE_X;
+		ogl_target_end =   SOIL_TEXTURE_CUBE_MAP_NEGATIVE_Z;
+		opengl_texture_type = SOIL_TEXTURE_CUBE_MAP;
+	} else
+	{
+		/* does the user want a non-cubemap?	*/
+		if( loading_as_cubemap )
+		{
+			result_string_pointer = "KTX2 image was not a cubemap";
+			return 0;
+		}
+		ogl_target_start = GL_TEXTURE_2D;
+		ogl_target_end =   GL_TEXTURE_2D;
+		opengl_texture_type = GL_TEXTURE_2D;
+	}
+	/*	create or use an existing OpenGL texture handle	*/
+	tex_ID = reuse_texture_ID;
+	if( tex_ID == 0 )
+	{
+		glGenTextures( 1, &tex_ID );
+	}
+	glBindTexture( opengl_texture_type, tex_ID );
+	/*	KTX2 rows are tightly packed	*/
+	glGetIntegerv( GL_UNPACK_ALIGNMENT, &old_alignment );
+	glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+	/*	upload every level of every face, straight out of the buffer	*/
+	for( level = 0; level < image.level_count; ++level )
+	{
+		int w = image.width >> level;
+		int h = image.height >> level;
+		if( w < 1 )
+		{
+			w = 1;
+		}
+		if( h < 1 )
+		{
+			h = 1;
+		}
+		for( cf_target = ogl_target_start, face = 0;
+			cf_target <= ogl_target_end;
+			++cf_target, ++face )
+		{
+			const unsigned char *face_data =
+				image.level_data[level] + face * image.face_size[level];
+			if( compressed )
+			{
+				soilGlCompressedTexImage2D(
+					cf_target, level,
+					internal_format, w, h, 0,
+					image.face_size[level], face_data );
+			} else
+			{
+				glTexImage2D(
+					cf_target, level,
+					internal_format, w, h, 0,
+					pixel_format, GL_UNSIGNED_BYTE, face_data );
+			}
+		}
+	}
+	glPixelStorei( GL_UNPACK_ALIGNMENT, old_alignment );
+	/*	did I have MIPmaps?	*/
+	if( image.level_count > 1 )
+	{
+		glTexParameteri( opengl_texture_type, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+		glTexParameteri( opengl_texture_type, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
+	} else
+	{
+		glTexParameteri( opengl_texture_type, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+		glTexParameteri( opengl_texture_type, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+	}
+	/*	does the user want clamping, or wrapping?	*/
+	if( flags & SOIL_FLAG_TEXTURE_REPEATS )
+	{
+		glTexParameteri( opengl_texture_type, GL_TEXTURE_WRAP_S, GL_REPEAT );
+		glTexParameteri( opengl_texture_type, GL_TEXTURE_WRAP_T, GL_REPEAT );
+		glTexParameteri( opengl_texture_type, SOIL_TEXTURE_WRAP_R, GL_REPEAT );
+	} else
+	{
+		unsigned int clamp_mode = GL_CLAMP;
+		glTexParameteri( opengl_texture_type, GL_TEXTURE_WRAP_S, clamp_mode );
+		glTexParameteri( opengl_texture_type, GL_TEXTURE_WRAP_T, clamp_mode );
+		glTexParameteri( opengl_texture_type, SOIL_TEXTURE_WRAP_R, clamp_mode );
+	}
+	result_string_pointer = "KTX2 file loaded";
+	return tex_ID;
 }
 
 unsigned int SOIL_direct_load_DDS_from_memory(
@@ -1538,15 +3249,18 @@ unsigned int SOIL_direct_load_DDS_from_memory(
 {
 	/*	variables	*/
 	DDS_header header;
+	DDS_header_DX10 header_DX10;
 	unsigned int buffer_index = 0;
 	unsigned int tex_ID = 0;
 	/*	file reading variables	*/
 	unsigned int S3TC_type = 0;
-	unsigned char *DDS_data;
+	unsigned int DDS_format = 0;
+	const unsigned char *DDS_data;
 	unsigned int DDS_main_size;
 	unsigned int DDS_full_size;
 	unsigned int width, height;
 	int mipmaps, cubemap, uncompressed, block_size = 16;
+	int has_DX10_header;
 	unsigned int flag;
 	unsigned int cf_target, ogl_target_start, ogl_target_end;
 	unsigned int opengl_texture_type;
@@ -1558,6 +3272,13 @@ unsigned int SOIL_direct_load_DDS_from_memory(
 		result_string_pointer = "NULL buffer";
 		return 0;
 	}
+	/*	is it really a KTX2 file?	*/
+	if( is_KTX2( buffer, buffer_length ) )
+	{
+		return SOIL_direct_load_KTX2_from_memory(
+				buffer, buffer_length,
+				reuse_texture_ID, flags, loading_as_cubemap );
+	}
 	if( buffer_length < sizeof( DDS_header ) )
 	{
 		/*	we can't do it!	*/
@@ -1590,11 +3311,23 @@ unsigned int SOIL_direct_load_DDS_from_memory(
 		!(
 		(header.sPixelFormat.dwFourCC == (('D'<<0)|('X'<<8)|('T'<<16)|('1'<<24))) ||
 		(header.sPixelFormat.dwFourCC == (('D'<<0)|('X'<<8)|('T'<<16)|('3'<<24))) ||
-		(header.sPixelFormat.dwFourCC == (('D'<<0)|('X'<<8)|('T'<<16)|('5'<<24)))
+		(header.sPixelFormat.dwFourCC == (('D'<<0)|('X'<<8)|('T'<<16)|('5'<<24))) ||
+		(header.sPixelFormat.dwFourCC == (('D'<<0)|('X'<<8)|('1'<<16)|('0'<<24)))
 		) )
 	{
 		goto quick_exit;
 	}
+	/*	the DX10 header follows, and it has to be BC6H (all I can write)	*/
+	has_DX10_header = (header.sPixelFormat.dwFlags & DDPF_FOURCC) &&
+		(header.sPixelFormat.dwFourCC == (('D'<<0)|('X'<<8)|('1'<<16)|('0'<<24)));
+	if( has_DX10_header )
+	{
+		if( buffer_length < (int)(sizeof( DDS_header ) + sizeof( DDS_header_DX10 )) ) {goto quick_exit;}
+		memcpy ( (void*)(&header_DX10), (const void *)(&buffer[buffer_index]), sizeof( DDS_header_DX10 ) );
+		buffer_index += sizeof( DDS_header_DX10 );
+		if( header_DX10.dxgiFormat != DXGI_FORMAT_BC6H_UF16 ) {goto quick_exit;}
+		if( header_DX10.resourceDimension != DDS_DIMENSION_TEXTURE2D ) {goto quick_exit;}
+	}
 	/*	OK, validated the header, let's load the image data	*/
 	result_string_pointer = "DDS header loaded and validated";
 	width = header.dwWidth;
@@ -1603,14 +3336,29 @@ unsigned int SOIL_direct_load_DDS_from_memory(
 	cubemap = (header.sCaps.dwCaps2 & DDSCAPS2_CUBEMAP) / DDSCAPS2_CUBEMAP;
 	if( uncompressed )
 	{
+		/*	DDS stores BGR(A), which OpenGL can take as it is	*/
 		S3TC_type = GL_RGB;
+		DDS_format = SOIL_BGR;
 		block_size = 3;
 		if( header.sPixelFormat.dwFlags & DDPF_ALPHAPIXELS )
 		{
 			S3TC_type = GL_RGBA;
+			DDS_format = SOIL_BGRA;
 			block_size = 4;
 		}
 		DDS_main_size = width * height * block_size;
+	} else if( has_DX10_header )
+	{
+		/*	can we even handle direct uploading to OpenGL BPTC compressed images?	*/
+		if( query_BPTC_capability() != SOIL_CAPABILITY_PRESENT )
+		{
+			/*	we can't do it!	*/
+			result_string_pointer = "Direct upload of BC6H images not supported by the OpenGL driver";
+			return 0;
+		}
+		S3TC_type = SOIL_RGB_BPTC_UNSIGNED_FLOAT;
+		block_size = 16;
+		DDS_main_size = ((width+3)>>2)*((height+3)>>2)*block_size;
 	} else
 	{
 		/*	can we even handle direct uploading to OpenGL DXT compressed images?	*/
@@ -1704,8 +3452,8 @@ unsigned int SOIL_direct_load_DDS_from_memory(
 		mipmaps = 0;
 		DDS_full_size = DDS_main_size;
 	}
-	DDS_data = (unsigned char*)malloc( DDS_full_size );
-	/*	got the image data RAM, create or use an existing OpenGL texture handle	*/
+	/*	the levels get uploaded straight out of the buffer, so
+		create or use an existing OpenGL texture handle	*/
 	tex_ID = reuse_texture_ID;
 	if( tex_ID == 0 )
 	{
@@ -1719,23 +3467,15 @@ unsigned int SOIL_direct_load_DDS_from_memory(
 		if( buffer_index + DDS_full_size <= buffer_length )
 		{
 			unsigned int byte_offset = DDS_main_size;
-			memcpy( (void*)DDS_data, (const void*)(&buffer[buffer_index]), DDS_full_size );
+			DDS_data = &buffer[buffer_index];
 			buffer_index += DDS_full_size;
 			/*	upload the main chunk	*/
 			if( uncompressed )
 			{
-				/*	and remember, DXT uncompressed uses BGR(A),
-					so swap to RGB(A) for ALL MIPmap levels	*/
-				for( i = 0; i < DDS_full_size; i += block_size )
-				{
-					unsigned char temp = DDS_data[i];
-					DDS_data[i] = DDS_data[i+2];
-					DDS_data[i+2] = temp;
-				}
 				glTexImage2D(
 					cf_target, 0,
 					S3TC_type, width, height, 0,
-					S3TC_type, GL_UNSIGNED_BYTE, DDS_data );
+					DDS_format, GL_UNSIGNED_BYTE, DDS_data );
 			} else
 			{
 				soilGlCompressedTexImage2D(
@@ -1764,7 +3504,7 @@ unsigned int SOIL_direct_load_DDS_from_memory(
 					glTexImage2D(
 						cf_target, i,
 						S3TC_type, w, h, 0,
-						S3TC_type, GL_UNSIGNED_BYTE, &DDS_data[byte_offset] );
+						DDS_format, GL_UNSIGNED_BYTE, &DDS_data[byte_offset] );
 				} else
 				{
 					mip_size = ((w+3)/4)*((h+3)/4)*block_size;
@@ -1786,7 +3526,6 @@ unsigned int SOIL_direct_load_DDS_from_memory(
 			result_string_pointer = "DDS file was too small for expected image data";
 		}
 	}/* end reading each face */
-	SOIL_free_image_data( DDS_data );
 	if( tex_ID )
 	{
 		/*	did I have MIPmaps?	*/
@@ -1828,9 +3567,7 @@ unsigned int SOIL_direct_load_DDS(
 		int flags,
 		int loading_as_cubemap )
 {
-	FILE *f;
-	unsigned char *buffer;
-	size_t buffer_length, bytes_read;
+	SOIL_file_view view;
 	unsigned int tex_ID = 0;
 	/*	error checks	*/
 	if( NULL == filename )
@@ -1838,35 +3575,18 @@ unsigned int SOIL_direct_load_DDS(
 		result_string_pointer = "NULL filename";
 		return 0;
 	}
-	f = fopen( filename, "rb" );
-	if( NULL == f )
+	if( !SOIL_internal_open_file_view( filename, &view ) )
 	{
 		/*	the file doesn't seem to exist (or be open-able)	*/
 		result_string_pointer = "Can not find DDS file";
 		return 0;
 	}
-	fseek( f, 0, SEEK_END );
-	buffer_length = ftell( f );
-	fseek( f, 0, SEEK_SET );
-	buffer = (unsigned char *) malloc( buffer_length );
-	if( NULL == buffer )
-	{
-		result_string_pointer = "malloc failed";
-		fclose( f );
-		return 0;
-	}
-	bytes_read = fread( (void*)buffer, 1, buffer_length, f );
-	fclose( f );
-	if( bytes_read < buffer_length )
-	{
-		/*	huh?	*/
-		buffer_length = bytes_read;
-	}
-	/*	now try to do the loading	*/
+	/*	now try to do the loading (a mapped file is parsed
+		and uploaded in place)	*/
 	tex_ID = SOIL_direct_load_DDS_from_memory(
-		(const unsigned char *const)buffer, buffer_length,
+		view.data, view.length,
 		reuse_texture_ID, flags, loading_as_cubemap );
-	SOIL_free_image_data( buffer );
+	SOIL_internal_close_file_view( &view );
 	return tex_ID;
 }
 
@@ -1963,44 +3683,9 @@ int query_DXT_capability( void )
 		} else
 		{
 			/*	and find the address of the extension function	*/
-			P_SOIL_GLCOMPRESSEDTEXIMAGE2DPROC ext_addr = NULL;
-			#ifdef WIN32
-				ext_addr = (P_SOIL_GLCOMPRESSEDTEXIMAGE2DPROC)
-						wglGetProcAddress
-						(
-							"glCompressedTexImage2DARB"
-						);
-			#elif defined(__APPLE__) || defined(__APPLE_CC__)
-				/*	I can't test this Apple stuff!	*/
-				CFBundleRef bundle;
-				CFURLRef bundleURL =
-					CFURLCreateWithFileSystemPath(
-						kCFAllocatorDefault,
-						CFSTR("/System/Library/Frameworks/OpenGL.framework"),
-						kCFURLPOSIXPathStyle,
-						true );
-				CFStringRef extensionName =
-					CFStringCreateWithCString(
-						kCFAllocatorDefault,
-						"glCompressedTexImage2DARB",
-						kCFStringEncodingASCII );
-				bundle = CFBundleCreate( kCFAllocatorDefault, bundleURL );
-				assert( bundle != NULL );
-				ext_addr = (P_SOIL_GLCOMPRESSEDTEXIMAGE2DPROC)
-						CFBundleGetFunctionPointerForName
-						(
-							bundle, extensionName
-						);
-				CFRelease( bundleURL );
-				CFRelease( extensionName );
-				CFRelease( bundle );
-			#else
-				ext_addr = (P_SOIL_GLCOMPRESSEDTEXIMAGE2DPROC)
-						glXGetProcAddressARB
-						(
-							(const GLubyte *)"glCompressedTexImage2DARB"
-						);
-			#endif
+			P_SOIL_GLCOMPRESSEDTEXIMAGE2DPROC ext_addr =
+				(P_SOIL_GLCOMPRESSEDTEXIMAGE2DPROC)
+				SOIL_internal_get_GL_function( "glCompressedTexImage2DARB" );
 			/*	Flag it so no checks needed later	*/
 			if( NULL == ext_addr )
 			{
@@ -2022,3 +3707,144 @@ int query_DXT_capability( void )
 	/*	let the user know if we can do DXT or not	*/
 	return has_DXT_capability;
 }
+
+int query_BPTC_capability( void )
+{
+	/*	check for the capability	*/
+	if( has_BPTC_capability == SOIL_CAPABILITY_UNKNOWN )
+	{
+		/*	we haven't yet checked for the capability, do so	*/
+		if( NULL == strstr(
+				(char const*)glGetString( GL_EXTENSIONS ),
+				"GL_ARB_texture_compression_bptc" ) )
+		{
+			/*	not there, flag the failure	*/
+			has_BPTC_capability = SOIL_CAPABILITY_NONE;
+		} else
+		{
+			/*	I need the compressed upload function too (which the
+				DXT check may have already found)	*/
+			if( NULL == soilGlCompressedTexImage2D )
+			{
+				soilGlCompressedTexImage2D = (P_SOIL_GLCOMPRESSEDTEXIMAGE2DPROC)
+					SOIL_internal_get_GL_function( "glCompressedTexImage2DARB" );
+			}
+			if( NULL == soilGlCompressedTexImage2D )
+			{
+				has_BPTC_capability = SOIL_CAPABILITY_NONE;
+			} else
+			{
+				/*	all's well!	*/
+				has_BPTC_capability = SOIL_CAPABILITY_PRESENT;
+			}
+		}
+	}
+	/*	let the user know if we can do BPTC or not	*/
+	return has_BPTC_capability;
+}
+
+int query_texture_storage_capability( void )
+{
+	/*	check for the capability	*/
+	if( has_texture_storage_capability == SOIL_CAPABILITY_UNKNOWN )
+	{
+		/*	we haven't yet checked for the capability, do so	*/
+		if( NULL == strstr(
+				(char const*)glGetString( GL_EXTENSIONS ),
+				"GL_ARB_texture_storage" ) )
+		{
+			/*	not there, flag the failure	*/
+			has_texture_storage_capability = SOIL_CAPABILITY_NONE;
+		} else
+		{
+			/*	find the allocation function, and the one to fill
+				in compressed levels	*/
+			soilGlTexStorage2D = (P_SOIL_GLTEXSTORAGE2DPROC)
+				SOIL_internal_get_GL_function( "glTexStorage2D" );
+			soilGlCompressedTexSubImage2D = (P_SOIL_GLCOMPRESSEDTEXSUBIMAGE2DPROC)
+				SOIL_internal_get_GL_function( "glCompressedTexSubImage2DARB" );
+			if( (NULL == soilGlTexStorage2D) || (NULL == soilGlCompressedTexSubImage2D) )
+			{
+				has_texture_storage_capability = SOIL_CAPABILITY_NONE;
+			} else
+			{
+				/*	all's well!	*/
+				has_texture_storage_capability = SOIL_CAPABILITY_PRESENT;
+			}
+		}
+	}
+	/*	let the user know if we can allocate immutable storage or not	*/
+	return has_texture_storage_capability;
+}
+
+int query_generate_mipmap_capability( void )
+{
+	/*	check for the capability	*/
+	if( has_generate_mipmap_capability == SOIL_CAPABILITY_UNKNOWN )
+	{
+		/*	we haven't yet checked for the capability, do so
+			(glGenerateMipmap came in with the framebuffer objects)	*/
+		if(
+			(NULL == strstr( (char const*)glGetString( GL_EXTENSIONS ),
+				"GL_ARB_framebuffer_object" ) )
+		&&
+			(NULL == strstr( (char const*)glGetString( GL_EXTENSIONS ),
+				"GL_EXT_framebuffer_object" ) )
+			)
+		{
+			/*	not there, flag the failure	*/
+			has_generate_mipmap_capability = SOIL_CAPABILITY_NONE;
+		} else
+		{
+			/*	find the function, under either name	*/
+			soilGlGenerateMipmap = (P_SOIL_GLGENERATEMIPMAPPROC)
+				SOIL_internal_get_GL_function( "glGenerateMipmap" );
+			if( NULL == soilGlGenerateMipmap )
+			{
+				soilGlGenerateMipmap = (P_SOIL_GLGENERATEMIPMAPPROC)
+					SOIL_internal_get_GL_function( "glGenerateMipmapEXT" );
+			}
+			if( NULL == soilGlGenerateMipmap )
+			{
+				has_generate_mipmap_capability = SOIL_CAPABILITY_NONE;
+			} else
+			{
+				/*	all's well!	*/
+				has_generate_mipmap_capability = SOIL_CAPABILITY_PRESENT;
+			}
+		}
+	}
+	/*	let the user know if the driver can build MIPmaps or not	*/
+	return has_generate_mipmap_capability;
+}
+
+void *SOIL_internal_get_GL_function( const char *function_name )
+{
+	void *ext_addr = NULL;
+	#ifdef WIN32
+		ext_addr = (void*)wglGetProcAddress( function_name );
+	#elif defined(__APPLE__) || defined(__APPLE_CC__)
+		/*	I can't test this Apple stuff!	*/
+		CFBundleRef bundle;
+		CFURLRef bundleURL =
+			CFURLCreateWithFileSystemPath(
+				kCFAllocatorDefault,
+				CFSTR("/System/Library/Frameworks/OpenGL.framework"),
+				kCFURLPOSIXPathStyle,
+				true );
+		CFStringRef extensionName =
+			CFStringCreateWithCString(
+				kCFAllocatorDefault,
+				function_name,
+				kCFStringEncodingASCII );
+		bundle = CFBundleCreate( kCFAllocatorDefault, bundleURL );
+		assert( bundle != NULL );
+		ext_addr = CFBundleGetFunctionPointerForName( bundle, extensionName );
+		CFRelease( bundleURL );
+		CFRelease( extensionName );
+		CFRelease( bundle );
+	#else
+		ext_addr = (void*)glXGetProcAddressARB( (const GLubyte *)function_name );
+	#endif
+	return ext_addr;
+}
@@ -20,9 +20,10 @@
 	Image Formats:
 	- BMP		load & save
 	- TGA		load & save
-	- DDS		load & save
-	- PNG		load
+	- DDS		load & save (BC6H save from HDR data)
+	- PNG		load & save
 	- JPG		load
+	- QOI		load & save
 
 	OpenGL Texture Features:
 	- resample to power-of-two sizes
@@ -40,6 +41,8 @@
 #ifndef HEADER_SIMPLE_OPENGL_IMAGE_LIBRARY
 #define HEADER_SIMPLE_OPENGL_IMAGE_LIBRARY
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -87,10 +90,12 @@ enum
 	SOIL_FLAG_MULTIPLY_ALPHA: for using (GL_ONE,GL_ONE_MINUS_SRC_ALPHA) blending
 	SOIL_FLAG_INVERT_Y: flip the image vertically
 	SOIL_FLAG_COMPRESS_TO_DXT: if the card can display them, will convert RGB to DXT1, RGBA to DXT5
-	SOIL_FLAG_DDS_LOAD_DIRECT: will load DDS files directly without _ANY_ additional processing
+	SOIL_FLAG_DDS_LOAD_DIRECT: will load DDS (and KTX2) files directly without _ANY_ additional processing
 	SOIL_FLAG_NTSC_SAFE_RGB: clamps RGB components to the range [16,235]
 	SOIL_FLAG_CoCg_Y: Google YCoCg; RGB=>CoYCg, RGBA=>CoCgAY
 	SOIL_FLAG_TEXTURE_RECTANGE: uses ARB_texture_rectangle ; pixel indexed & no repeat or MIPmaps or cubemaps
+	SOIL_FLAG_IMMUTABLE_STORAGE: with ARB_texture_storage, allocates the whole MIPmap chain up front (new 2D textures only)
+	SOIL_FLAG_GPU_MIPMAPS: with SOIL_FLAG_MIPMAPS, has the driver build the MIPmaps with glGenerateMipmap (2D textures, not DXT)
 **/
 enum
 {
@@ -103,7 +108,9 @@ enum
 	SOIL_FLAG_DDS_LOAD_DIRECT = 64,
 	SOIL_FLAG_NTSC_SAFE_RGB = 128,
 	SOIL_FLAG_CoCg_Y = 256,
-	SOIL_FLAG_TEXTURE_RECTANGLE = 512
+	SOIL_FLAG_TEXTURE_RECTANGLE = 512,
+	SOIL_FLAG_IMMUTABLE_STORAGE = 1024,
+	SOIL_FLAG_GPU_MIPMAPS = 2048
 };
 
 /**
@@ -111,12 +118,18 @@ enum
 	(TGA supports uncompressed RGB / RGBA)
 	(BMP supports uncompressed RGB)
 	(DDS supports DXT1 and DXT5)
+	(KTX2 supports DXT1 and DXT5, with the full MIPmap chain)
+	(QOI supports lossless RGB / RGBA, and is much faster than PNG)
+	(PNG supports lossless grey / grey-alpha / RGB / RGBA, compressed on all cores)
 **/
 enum
 {
 	SOIL_SAVE_TYPE_TGA = 0,
 	SOIL_SAVE_TYPE_BMP = 1,
-	SOIL_SAVE_TYPE_DDS = 2
+	SOIL_SAVE_TYPE_DDS = 2,
+	SOIL_SAVE_TYPE_KTX2 = 3,
+	SOIL_SAVE_TYPE_QOI = 4,
+	SOIL_SAVE_TYPE_PNG = 5
 };
 
 /**
@@ -129,16 +142,19 @@ enum
 
 /**
 	The types of internal fake HDR representations
+	(plus one real one, if the driver supports BPTC)
 
 	SOIL_HDR_RGBE:		RGB * pow( 2.0, A - 128.0 )
 	SOIL_HDR_RGBdivA:	RGB / A
 	SOIL_HDR_RGBdivA2:	RGB / (A*A)
+	SOIL_HDR_BC6H:		RGB half floats, compressed to BC6H (needs ARB_texture_compression_bptc)
 **/
 enum
 {
 	SOIL_HDR_RGBE = 0,
 	SOIL_HDR_RGBdivA = 1,
-	SOIL_HDR_RGBdivA2 = 2
+	SOIL_HDR_RGBdivA2 = 2,
+	SOIL_HDR_BC6H = 3
 };
 
 /**
@@ -158,6 +174,28 @@ unsigned int
 		unsigned int flags
 	);
 
+/**
+	Loads an image from disk into an OpenGL texture at 1/2, 1/4 or 1/8
+	of its size, for previews and distant LODs.  JPEGs are decoded
+	straight to the smaller size, which is much cheaper than decoding
+	them in full; other formats are decoded and then box filtered.
+	\param filename the name of the file to upload as a texture
+	\param force_channels 0-image format, 1-luminous, 2-luminous/alpha, 3-RGB, 4-RGBA
+	\param reuse_texture_ID 0-generate a new texture ID, otherwise reuse the texture ID (overwriting the old texture)
+	\param flags same as SOIL_load_OGL_texture, except SOIL_FLAG_DDS_LOAD_DIRECT
+	\param scale_shift 0-full size, 1-half, 2-quarter, 3-eighth
+	\return 0-failed, otherwise returns the OpenGL texture handle
+**/
+unsigned int
+	SOIL_load_OGL_texture_scaled
+	(
+		const char *filename,
+		int force_channels,
+		unsigned int reuse_texture_ID,
+		unsigned int flags,
+		int scale_shift
+	);
+
 /**
 	Loads 6 images from disk into an OpenGL cubemap texture.
 	\param x_pos_file the name of the file to upload as the +x cube face
@@ -207,7 +245,8 @@ unsigned int
 /**
 	Loads an HDR image from disk into an OpenGL texture.
 	\param filename the name of the file to upload as a texture
-	\param fake_HDR_format SOIL_HDR_RGBE, SOIL_HDR_RGBdivA, SOIL_HDR_RGBdivA2
+	\param fake_HDR_format SOIL_HDR_RGBE, SOIL_HDR_RGBdivA, SOIL_HDR_RGBdivA2, SOIL_HDR_BC6H
+	\param rescale_to_max only used by SOIL_HDR_RGBdivA and SOIL_HDR_RGBdivA2
 	\param reuse_texture_ID 0-generate a new texture ID, otherwise reuse the texture ID (overwriting the old texture)
 	\param flags can be any of SOIL_FLAG_POWER_OF_TWO | SOIL_FLAG_MIPMAPS | SOIL_FLAG_TEXTURE_REPEATS | SOIL_FLAG_MULTIPLY_ALPHA | SOIL_FLAG_INVERT_Y | SOIL_FLAG_COMPRESS_TO_DXT
 	\return 0-failed, otherwise returns the OpenGL texture handle
@@ -390,6 +429,143 @@ unsigned char*
 		int force_channels
 	);
 
+/**
+	Reads the size and channel count of an image on disk without
+	decoding it (for JPEG and PNG; other formats are decoded to find out).
+	\return 0 if failed, otherwise returns 1
+**/
+int
+	SOIL_image_info
+	(
+		const char *filename,
+		int *width, int *height, int *channels
+	);
+
+/**
+	Reads the size and channel count of an image in memory.
+	\return 0 if failed, otherwise returns 1
+**/
+int
+	SOIL_image_info_from_memory
+	(
+		const unsigned char *const buffer,
+		int buffer_length,
+		int *width, int *height, int *channels
+	);
+
+/**
+	Loads an image from disk into memory the caller provides, such as a
+	mapped pixel buffer or a region of an atlas.  Size it with
+	SOIL_image_info first.  JPEG and PNG decode straight into it.
+	\param dest where the top row of the image goes
+	\param dest_pitch bytes from the start of one row to the next
+	\param dest_size bytes available at dest
+	\param force_channels 1-luminous, 2-luminous/alpha, 3-RGB, 4-RGBA (not SOIL_LOAD_AUTO)
+	\return 0 if failed (or the image doesn't fit), otherwise returns 1
+**/
+int
+	SOIL_load_image_into
+	(
+		const char *filename,
+		unsigned char *dest,
+		int dest_pitch, int dest_size,
+		int *width, int *height, int *channels,
+		int force_channels
+	);
+
+/**
+	Loads an image from memory into memory the caller provides.
+	See SOIL_load_image_into.
+	\return 0 if failed (or the image doesn't fit), otherwise returns 1
+**/
+int
+	SOIL_load_image_from_memory_into
+	(
+		const unsigned char *const buffer,
+		int buffer_length,
+		unsigned char *dest,
+		int dest_pitch, int dest_size,
+		int *width, int *height, int *channels,
+		int force_channels
+	);
+
+/**
+	Loads an image from disk at 1/(2^scale_shift) of its size, with
+	scale_shift from 0 (full size) to 3 (1/8).  The sizes round up.
+	See SOIL_load_OGL_texture_scaled for how it is done.
+	\return 0 if failed, otherwise returns the image data
+**/
+unsigned char*
+	SOIL_load_image_scaled
+	(
+		const char *filename,
+		int *width, int *height, int *channels,
+		int force_channels,
+		int scale_shift
+	);
+
+/**
+	Loads an image from memory at 1/(2^scale_shift) of its size.
+	\return 0 if failed, otherwise returns the image data
+**/
+unsigned char*
+	SOIL_load_image_from_memory_scaled
+	(
+		const unsigned char *const buffer,
+		int buffer_length,
+		int *width, int *height, int *channels,
+		int force_channels,
+		int scale_shift
+	);
+
+/**
+	One image of a batch load (see SOIL_load_image_batch).  Set either
+	filename, or buffer and buffer_length; the loader fills in the rest.
+	data is NULL if the image failed to load, and result_string says why.
+	channels holds the original channel count, as in SOIL_load_image.
+**/
+typedef struct
+{
+	const char *filename;
+	const unsigned char *buffer;
+	int buffer_length;
+	unsigned char *data;
+	int width, height, channels;
+	const char *result_string;
+}
+SOIL_batch_item;
+
+/**
+	Called as each image of a batch finishes loading (or fails to),
+	from whichever thread loaded it, so it may run on several threads
+	at once and in any order.
+**/
+typedef void (*SOIL_batch_callback)( void *user_data, SOIL_batch_item *item, int item_index );
+
+/**
+	Loads a list of images from disk and/or memory at once, decoding
+	them on a pool of threads.  The results land in the items, in
+	order; free each data with SOIL_free_image_data.
+	\param items the images to load
+	\param item_count how many items there are
+	\param force_channels 0-image format, 1-luminous, 2-luminous/alpha, 3-RGB, 4-RGBA
+	\param max_threads 0 for one per hardware thread, 1 to load on this thread only
+	\param callback called as each image completes, or NULL
+	\param user_data handed to the callback
+	\return the number of images that loaded; they all did if it equals
+	item_count (so an empty batch returns 0 without having failed)
+**/
+int
+	SOIL_load_image_batch
+	(
+		SOIL_batch_item *items,
+		int item_count,
+		int force_channels,
+		int max_threads,
+		SOIL_batch_callback callback,
+		void *user_data
+	);
+
 /**
 	Saves an image from an array of unsigned chars (RGBA) to disk
 	\return 0 if failed, otherwise returns 1
@@ -404,8 +580,24 @@ int
 	);
 
 /**
-	Frees the image data (note, this is just C's "free()"...this function is
-	present mostly so C++ programmers don't forget to use "free()" and call
+	Saves an image from an array of unsigned chars (RGBA) to a file
+	in memory instead of on disk, in any of the formats but KTX2.
+	\return NULL if failed, otherwise the file (*size bytes), to be
+	freed with SOIL_free_image_data
+**/
+unsigned char*
+	SOIL_save_image_to_memory
+	(
+		int image_type,
+		int width, int height, int channels,
+		const unsigned char *const data,
+		int *size
+	);
+
+/**
+	Frees the image data (note, this is just C's "free()" unless
+	SOIL_set_allocator was called...this function is present mostly
+	so C++ programmers don't forget to use "free()" and call
 	"delete []" instead [8^)
 **/
 void
@@ -414,6 +606,124 @@ void
 		unsigned char *img_data
 	);
 
+/**
+	Routes every allocation SOIL and the image decoders make through
+	your functions: the images SOIL hands back (so SOIL_free_image_data
+	calls free_func), the resampling and DXT buffers, and the blocks the
+	decoders take their scratch memory from.  Set it before loading
+	anything, and don't change it while images from the old one are
+	still around.  Pass NULLs to go back to malloc, realloc and free.
+**/
+void
+	SOIL_set_allocator
+	(
+		void *(*malloc_func)( size_t size, void *user_data ),
+		void *(*realloc_func)( void *p, size_t size, void *user_data ),
+		void (*free_func)( void *p, void *user_data ),
+		void *user_data
+	);
+
+/**
+	Turns on the on-disk texture cache.  Once set, SOIL_load_OGL_texture
+	and SOIL_load_OGL_texture_from_memory look for a DDS file in this
+	directory keyed on a hash of the source image bytes plus the load
+	flags, and upload it directly (no decoding, resampling, MIPmapping
+	or DXT compression).  On a miss the texture is built as usual and
+	its final MIPmap chain is written back to the cache.  Only 2D RGB,
+	RGBA and DXT textures are cached.  With SOIL_FLAG_COMPRESS_TO_DXT,
+	nothing is written unless SOIL's own compressor made every level;
+	levels left for the driver to compress (no DXT support, or the
+	compressor failed) would be cached uncompressed, so they aren't.
+	\param directory an existing, writable directory, or NULL to turn the cache off
+	\return 0 if failed, otherwise returns 1
+**/
+int
+	SOIL_set_texture_cache_directory
+	(
+		const char *directory
+	);
+
+/**
+	Sets how much memory the shared image and texture cache may keep
+	around (see SOIL_load_shared_image and SOIL_load_shared_OGL_texture).
+	Images and textures nobody holds any more are kept, and handed
+	straight back on the next load, until the total goes over this;
+	then the least recently used are freed.  Ones still held count
+	toward the total but are never freed.  The default is 0, which
+	frees each one as soon as its last holder releases it.
+	The cache isn't locked, so this and the shared load and release
+	calls must all come from one thread (the one with the GL context,
+	if textures are shared).
+	\param budget_bytes the most memory to keep (textures count as the driver reports them)
+	\return 0 if failed, otherwise returns 1
+**/
+int
+	SOIL_set_memory_cache_budget
+	(
+		size_t budget_bytes
+	);
+
+/**
+	Loads an image from disk like SOIL_load_image, but shares it: loading
+	the same path again, or any file with byte-identical contents, with
+	the same force_channels hands back the same buffer without decoding.
+	The cache assumes files don't change on disk while it holds them.
+	The buffer is read-only, and must be given back with
+	SOIL_release_shared_image, never SOIL_free_image_data.
+	\param filename the name of the file to upload as a texture
+	\param width the width of the image in pixels
+	\param height the height of the image in pixels
+	\param channels the number of channels: 1-luminous, 2-luminous/alpha, 3-RGB, 4-RGBA
+	\param force_channels 0-image format, 1-luminous, 2-luminous/alpha, 3-RGB, 4-RGBA
+	\return NULL if failed, otherwise returns the shared image data
+**/
+unsigned char*
+	SOIL_load_shared_image
+	(
+		const char *filename,
+		int *width, int *height, int *channels,
+		int force_channels
+	);
+
+/**
+	Drops one hold on an image from SOIL_load_shared_image.
+**/
+void
+	SOIL_release_shared_image
+	(
+		const unsigned char *img_data
+	);
+
+/**
+	Loads an image from disk into a new OpenGL texture like
+	SOIL_load_OGL_texture, but shares it: loading the same path again,
+	or any file with byte-identical contents, with the same
+	force_channels and flags hands back the same texture without any
+	decoding or uploading.  Don't change or delete the texture; give it
+	back with SOIL_release_shared_OGL_texture.  These textures live in
+	the GL context current when they were made.
+	\param filename the name of the file to upload as a texture
+	\param force_channels 0-image format, 1-luminous, 2-luminous/alpha, 3-RGB, 4-RGBA
+	\param flags can be any of SOIL_FLAG_POWER_OF_TWO | SOIL_FLAG_MIPMAPS | SOIL_FLAG_TEXTURE_REPEATS | SOIL_FLAG_MULTIPLY_ALPHA | SOIL_FLAG_INVERT_Y | SOIL_FLAG_COMPRESS_TO_DXT | SOIL_FLAG_DDS_LOAD_DIRECT
+	\return 0-failed, otherwise returns the OpenGL texture handle
+**/
+unsigned int
+	SOIL_load_shared_OGL_texture
+	(
+		const char *filename,
+		int force_channels,
+		unsigned int flags
+	);
+
+/**
+	Drops one hold on a texture from SOIL_load_shared_OGL_texture.
+**/
+void
+	SOIL_release_shared_OGL_texture
+	(
+		unsigned int texture_ID
+	);
+
 /**
 	This function resturn a pointer to a string describing the last thing
 	that happened inside SOIL.  It can be used to determine why an image
@@ -8,6 +8,9 @@
 */
 
 #include "image_DXT.h"
+#include "image_helper.h"
+#include "image_threads.h"
+#include "image_perf.h"
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
@@ -37,47 +40,68 @@ void compress_DDS_color_block(
 void compress_DDS_alpha_block(
 				const unsigned char *const uncompressed,
 				unsigned char compressed[8] );
+/*
+	Takes a 4x4 block of pixels (RGB as unsigned half floats)
+	and compresses it into 16 bytes of BC6H.  Only mode 11 is
+	used: 1 region, 10 bit endpoints, 4 bit indices.
+*/
+void compress_BC6H_block(
+				const int uncompressed[16*3],
+				unsigned char compressed[16] );
+/*	shared state for compressing the BC6H block rows in parallel	*/
+typedef struct
+{
+	const float *uncompressed;
+	int width, height, channels;
+	unsigned char *compressed;
+}
+BC6H_job;
+static void compress_BC6H_block_rows( void *job_data, int first, int last );
 
 /********* Actual Exposed Functions *********/
-int
-	save_image_as_DDS
+unsigned char*
+	convert_image_to_DDS
 	(
-		const char *filename,
+		const unsigned char *const data,
 		int width, int height, int channels,
-		const unsigned char *const data
+		int *out_size
 	)
 {
 	/*	variables	*/
-	FILE *fout;
-	unsigned char *DDS_data;
+	unsigned char *DXT_data, *DDS_data;
 	DDS_header header;
-	int DDS_size;
+	int DXT_size;
 	/*	error check	*/
-	if( (NULL == filename) ||
+	if( (NULL == out_size) ||
 		(width < 1) || (height < 1) ||
 		(channels < 1) || (channels > 4) ||
 		(data == NULL ) )
 	{
-		return 0;
+		return NULL;
 	}
+	*out_size = 0;
 	/*	Convert the image	*/
 	if( (channels & 1) == 1 )
 	{
 		/*	no alpha, just use DXT1	*/
-		DDS_data = convert_image_to_DXT1( data, width, height, channels, &DDS_size );
+		DXT_data = convert_image_to_DXT1( data, width, height, channels, &DXT_size );
 	} else
 	{
 		/*	has alpha, so use DXT5	*/
-		DDS_data = convert_image_to_DXT5( data, width, height, channels, &DDS_size );
+		DXT_data = convert_image_to_DXT5( data, width, height, channels, &DXT_size );
 	}
-	/*	save it	*/
+	if( NULL == DXT_data )
+	{
+		return NULL;
+	}
+	/*	the header	*/
 	memset( &header, 0, sizeof( DDS_header ) );
 	header.dwMagic = ('D' << 0) | ('D' << 8) | ('S' << 16) | (' ' << 24);
 	header.dwSize = 124;
 	header.dwFlags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_LINEARSIZE;
 	header.dwWidth = width;
 	header.dwHeight = height;
-	header.dwPitchOrLinearSize = DDS_size;
+	header.dwPitchOrLinearSize = DXT_size;
 	header.sPixelFormat.dwSize = 32;
 	header.sPixelFormat.dwFlags = DDPF_FOURCC;
 	if( (channels & 1) == 1 )
@@ -88,13 +112,151 @@ int
 		header.sPixelFormat.dwFourCC = ('D' << 0) | ('X' << 8) | ('T' << 16) | ('5' << 24);
 	}
 	header.sCaps.dwCaps1 = DDSCAPS_TEXTURE;
+	/*	and the blocks after it	*/
+	DDS_data = (unsigned char*)image_malloc( sizeof( DDS_header ) + DXT_size );
+	if( NULL != DDS_data )
+	{
+		memcpy( DDS_data, &header, sizeof( DDS_header ) );
+		memcpy( DDS_data + sizeof( DDS_header ), DXT_data, DXT_size );
+		*out_size = sizeof( DDS_header ) + DXT_size;
+	}
+	image_free( DXT_data );
+	return DDS_data;
+}
+
+int
+	save_image_as_DDS
+	(
+		const char *filename,
+		int width, int height, int channels,
+		const unsigned char *const data
+	)
+{
+	/*	variables	*/
+	FILE *fout;
+	unsigned char *DDS_data;
+	int DDS_size, result;
+	/*	error check	*/
+	if( NULL == filename )
+	{
+		return 0;
+	}
+	DDS_data = convert_image_to_DDS( data, width, height, channels, &DDS_size );
+	if( NULL == DDS_data )
+	{
+		return 0;
+	}
+	/*	write it out, in one go	*/
+	fout = fopen( filename, "wb");
+	result = (NULL != fout);
+	if( result )
+	{
+		result = (fwrite( DDS_data, 1, DDS_size, fout ) == (size_t)DDS_size);
+		result = (fclose( fout ) == 0) && result;
+	}
+	/*	done	*/
+	image_free( DDS_data );
+	return result;
+}
+
+int
+	save_mipmaps_as_DDS
+	(
+		const char *filename,
+		int width, int height, int channels,
+		int DXT_type,
+		int num_levels,
+		const unsigned char *const *level_data,
+		const int *level_size
+	)
+{
+	/*	variables	*/
+	FILE *fout;
+	DDS_header header;
+	int i, j;
+	/*	error check	*/
+	if( (NULL == filename) ||
+		(width < 1) || (height < 1) ||
+		(num_levels < 1) ||
+		(level_data == NULL) || (level_size == NULL) )
+	{
+		return 0;
+	}
+	if( (DXT_type != 1) && (DXT_type != 3) && (DXT_type != 5) &&
+		!((DXT_type == 0) && ((channels == 3) || (channels == 4))) )
+	{
+		return 0;
+	}
+	/*	build the header	*/
+	memset( &header, 0, sizeof( DDS_header ) );
+	header.dwMagic = ('D' << 0) | ('D' << 8) | ('S' << 16) | (' ' << 24);
+	header.dwSize = 124;
+	header.dwFlags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT;
+	header.dwWidth = width;
+	header.dwHeight = height;
+	header.sPixelFormat.dwSize = 32;
+	header.sCaps.dwCaps1 = DDSCAPS_TEXTURE;
+	if( DXT_type == 0 )
+	{
+		header.dwFlags |= DDSD_PITCH;
+		header.dwPitchOrLinearSize = width * channels;
+		header.sPixelFormat.dwFlags = DDPF_RGB;
+		header.sPixelFormat.dwRGBBitCount = 8 * channels;
+		header.sPixelFormat.dwRBitMask = 0x00FF0000;
+		header.sPixelFormat.dwGBitMask = 0x0000FF00;
+		header.sPixelFormat.dwBBitMask = 0x000000FF;
+		if( channels == 4 )
+		{
+			header.sPixelFormat.dwFlags |= DDPF_ALPHAPIXELS;
+			header.sPixelFormat.dwAlphaBitMask = 0xFF000000;
+		}
+	} else
+	{
+		header.dwFlags |= DDSD_LINEARSIZE;
+		header.dwPitchOrLinearSize = level_size[0];
+		header.sPixelFormat.dwFlags = DDPF_FOURCC;
+		header.sPixelFormat.dwFourCC = ('D' << 0) | ('X' << 8) | ('T' << 16) | (('0' + DXT_type) << 24);
+	}
+	if( num_levels > 1 )
+	{
+		header.dwFlags |= DDSD_MIPMAPCOUNT;
+		header.dwMipMapCount = num_levels;
+		header.sCaps.dwCaps1 |= DDSCAPS_COMPLEX | DDSCAPS_MIPMAP;
+	}
 	/*	write it out	*/
 	fout = fopen( filename, "wb");
+	if( NULL == fout )
+	{
+		return 0;
+	}
 	fwrite( &header, sizeof( DDS_header ), 1, fout );
-	fwrite( DDS_data, 1, DDS_size, fout );
+	for( i = 0; i < num_levels; ++i )
+	{
+		if( DXT_type == 0 )
+		{
+			/*	RGB(A) => BGR(A), one level at a time	*/
+			unsigned char *swapped = (unsigned char*)image_malloc( level_size[i] );
+			if( NULL == swapped )
+			{
+				fclose( fout );
+				return 0;
+			}
+			memcpy( swapped, level_data[i], level_size[i] );
+			for( j = 0; j + 2 < level_size[i]; j += channels )
+			{
+				unsigned char temp = swapped[j];
+				swapped[j] = swapped[j+2];
+				swapped[j+2] = temp;
+			}
+			fwrite( swapped, 1, level_size[i], fout );
+			image_free( swapped );
+		} else
+		{
+			fwrite( level_data[i], 1, level_size[i], fout );
+		}
+	}
 	fclose( fout );
 	/*	done	*/
-	free( DDS_data );
 	return 1;
 }
 
@@ -103,6 +265,8 @@ unsigned char* convert_image_to_DXT1(
 		int width, int height, int channels,
 		int *out_size )
 {
+	static perf_stats stats = PERF_STATS_INIT( "convert_image_to_DXT1", "pixel", 1 );
+	perf_counters counters;
 	unsigned char *compressed;
 	int i, j, x, y;
 	unsigned char ublock[16*3];
@@ -125,7 +289,8 @@ unsigned char* convert_image_to_DXT1(
 	/*	get the RAM for the compressed image
 		(8 bytes per 4x4 pixel block)	*/
 	*out_size = ((width+3) >> 2) * ((height+3) >> 2) * 8;
-	compressed = (unsigned char*)malloc( *out_size );
+	compressed = (unsigned char*)image_malloc( *out_size );
+	PERF_BEGIN( counters );
 	/*	go through each block	*/
 	for( j = 0; j < height; j += 4 )
 	{
@@ -176,6 +341,7 @@ unsigned char* convert_image_to_DXT1(
 			}
 		}
 	}
+	PERF_END( counters, stats, (double)width * height );
 	return compressed;
 }
 
@@ -184,6 +350,8 @@ unsigned char* convert_image_to_DXT5(
 		int width, int height, int channels,
 		int *out_size )
 {
+	static perf_stats stats = PERF_STATS_INIT( "convert_image_to_DXT5", "pixel", 1 );
+	perf_counters counters;
 	unsigned char *compressed;
 	int i, j, x, y;
 	unsigned char ublock[16*4];
@@ -208,7 +376,8 @@ unsigned char* convert_image_to_DXT5(
 	/*	get the RAM for the compressed image
 		(16 bytes per 4x4 pixel block)	*/
 	*out_size = ((width+3) >> 2) * ((height+3) >> 2) * 16;
-	compressed = (unsigned char*)malloc( *out_size );
+	compressed = (unsigned char*)image_malloc( *out_size );
+	PERF_BEGIN( counters );
 	/*	go through each block	*/
 	for( j = 0; j < height; j += 4 )
 	{
@@ -271,9 +440,103 @@ unsigned char* convert_image_to_DXT5(
 			}
 		}
 	}
+	PERF_END( counters, stats, (double)width * height );
 	return compressed;
 }
 
+unsigned char* convert_image_to_BC6H(
+		const float *const uncompressed,
+		int width, int height, int channels,
+		int *out_size )
+{
+	BC6H_job job;
+	/*	error check	*/
+	*out_size = 0;
+	if( (width < 1) || (height < 1) ||
+		(NULL == uncompressed) ||
+		(channels < 1) || ( channels > 4) )
+	{
+		return NULL;
+	}
+	/*	get the RAM for the compressed image
+		(16 bytes per 4x4 pixel block)	*/
+	*out_size = ((width+3) >> 2) * ((height+3) >> 2) * 16;
+	job.compressed = (unsigned char*)image_malloc( *out_size );
+	if( NULL == job.compressed )
+	{
+		*out_size = 0;
+		return NULL;
+	}
+	job.uncompressed = uncompressed;
+	job.width = width;
+	job.height = height;
+	job.channels = channels;
+	/*	BC6H is slow enough to be worth spreading over the block rows	*/
+	run_parallel_job( compress_BC6H_block_rows, &job, (height+3) >> 2, 1, 0 );
+	return job.compressed;
+}
+
+int
+	save_HDR_image_as_DDS
+	(
+		const char *filename,
+		int width, int height, int channels,
+		const float *const data
+	)
+{
+	/*	variables	*/
+	FILE *fout;
+	unsigned char *DDS_data;
+	DDS_header header;
+	DDS_header_DX10 header_DX10;
+	int DDS_size;
+	/*	error check	*/
+	if( (NULL == filename) ||
+		(width < 1) || (height < 1) ||
+		(channels < 1) || (channels > 4) ||
+		(data == NULL ) )
+	{
+		return 0;
+	}
+	/*	Convert the image	*/
+	DDS_data = convert_image_to_BC6H( data, width, height, channels, &DDS_size );
+	if( NULL == DDS_data )
+	{
+		return 0;
+	}
+	/*	save it	*/
+	memset( &header, 0, sizeof( DDS_header ) );
+	header.dwMagic = ('D' << 0) | ('D' << 8) | ('S' << 16) | (' ' << 24);
+	header.dwSize = 124;
+	header.dwFlags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_LINEARSIZE;
+	header.dwWidth = width;
+	header.dwHeight = height;
+	header.dwPitchOrLinearSize = DDS_size;
+	header.sPixelFormat.dwSize = 32;
+	header.sPixelFormat.dwFlags = DDPF_FOURCC;
+	header.sPixelFormat.dwFourCC = ('D' << 0) | ('X' << 8) | ('1' << 16) | ('0' << 24);
+	header.sCaps.dwCaps1 = DDSCAPS_TEXTURE;
+	/*	BC6H can only be described by the DX10 extended header	*/
+	memset( &header_DX10, 0, sizeof( DDS_header_DX10 ) );
+	header_DX10.dxgiFormat = DXGI_FORMAT_BC6H_UF16;
+	header_DX10.resourceDimension = DDS_DIMENSION_TEXTURE2D;
+	header_DX10.arraySize = 1;
+	/*	write it out	*/
+	fout = fopen( filename, "wb");
+	if( NULL == fout )
+	{
+		image_free( DDS_data );
+		return 0;
+	}
+	fwrite( &header, sizeof( DDS_header ), 1, fout );
+	fwrite( &header_DX10, sizeof( DDS_header_DX10 ), 1, fout );
+	fwrite( DDS_data, 1, DDS_size, fout );
+	fclose( fout );
+	/*	done	*/
+	image_free( DDS_data );
+	return 1;
+}
+
 /********* Helper Functions *********/
 int convert_bit_range( int c, int from_bits, int to_bits )
 {
@@ -630,3 +893,271 @@ void
 	}
 	/*	done compressing to DXT1	*/
 }
+
+/*	converts to an unsigned half float (as an int), which is what
+	BC6H interpolates in.  Negatives clamp to 0, large values to
+	the largest finite half	*/
+int float_to_unsigned_half( float f )
+{
+	union { float f; unsigned int u; } bits;
+	int exponent, half;
+	if( !(f > 0.0f) )
+	{
+		/*	negative, zero, or NaN	*/
+		return 0;
+	}
+	if( f >= 65504.0f )
+	{
+		return 0x7BFF;
+	}
+	if( f < 6.103515625e-05f )
+	{
+		/*	a denormal half	*/
+		return (int)(f * 16777216.0f + 0.5f);
+	}
+	bits.f = f;
+	exponent = (int)((bits.u >> 23) & 255) - 127 + 15;
+	half = (exponent << 10) | ((bits.u >> 13) & 1023);
+	/*	round to nearest (a carry into the exponent is still correct)	*/
+	half += (bits.u >> 12) & 1;
+	if( half > 0x7BFF )
+	{
+		half = 0x7BFF;
+	}
+	return half;
+}
+
+static void compress_BC6H_block_rows( void *job_data, int first, int last )
+{
+	BC6H_job *job = (BC6H_job*)job_data;
+	int width = job->width, height = job->height, channels = job->channels;
+	int blocks_x = (width+3) >> 2;
+	int chan_step = (channels < 3) ? 0 : 1;
+	int block[16*3];
+	int i, j, x, y;
+	for( j = first*4; j < last*4; j += 4 )
+	{
+		unsigned char *compressed = job->compressed + (j >> 2) * blocks_x * 16;
+		for( i = 0; i < width; i += 4 )
+		{
+			/*	copy this block (repeating the edge pixels)	*/
+			int idx = 0;
+			for( y = 0; y < 4; ++y )
+			{
+				int sy = (j+y < height) ? j+y : height-1;
+				for( x = 0; x < 4; ++x )
+				{
+					int sx = (i+x < width) ? i+x : width-1;
+					const float *p = job->uncompressed + (sy*width + sx)*channels;
+					block[idx++] = float_to_unsigned_half( p[0] );
+					block[idx++] = float_to_unsigned_half( p[chan_step] );
+					block[idx++] = float_to_unsigned_half( p[chan_step+chan_step] );
+				}
+			}
+			compress_BC6H_block( block, compressed );
+			compressed += 16;
+		}
+	}
+}
+
+/*	BC6H unsigned endpoint dequantization (10 bits),
+	then the final scale back into half float range	*/
+int BC6H_unquantize( int q )
+{
+	if( q == 0 )
+	{
+		return 0;
+	}
+	if( q == 1023 )
+	{
+		return 0xFFFF;
+	}
+	return ((q << 16) + 0x8000) >> 10;
+}
+
+int BC6H_quantize( int half )
+{
+	/*	the decoder scales by 31/64, so pick the closer of the 2
+		nearest 10 bit values	*/
+	int q = half / 31;
+	if( q >= 1023 )
+	{
+		return 1023;
+	}
+	if( abs( ((BC6H_unquantize( q+1 ) * 31) >> 6) - half ) <
+		abs( ((BC6H_unquantize( q ) * 31) >> 6) - half ) )
+	{
+		++q;
+	}
+	return q;
+}
+
+void
+	compress_BC6H_block
+	(
+		const int uncompressed[16*3],
+		unsigned char compressed[16]
+	)
+{
+	/*	the 4 bit interpolation weights	*/
+	static const int weights[16] =
+		{ 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+	float mean[3] = { 0.0f, 0.0f, 0.0f };
+	float axis[3], cov, axis_len2, t, t_min, t_max;
+	int lo[3], hi[3], q0[3], q1[3];
+	int palette[16*3];
+	int indices[16];
+	int i, k, c, big;
+	int next_bit;
+	/*	find the bounds and the mean of the block	*/
+	for( c = 0; c < 3; ++c )
+	{
+		lo[c] = hi[c] = uncompressed[c];
+	}
+	for( i = 0; i < 16; ++i )
+	{
+		for( c = 0; c < 3; ++c )
+		{
+			int v = uncompressed[i*3+c];
+			mean[c] += v;
+			if( v < lo[c] )
+			{
+				lo[c] = v;
+			} else if( v > hi[c] )
+			{
+				hi[c] = v;
+			}
+		}
+	}
+	for( c = 0; c < 3; ++c )
+	{
+		mean[c] *= 1.0f / 16.0f;
+		axis[c] = (float)(hi[c] - lo[c]);
+	}
+	/*	orient the bounding box diagonal along the widest channel	*/
+	big = 0;
+	if( axis[1] > axis[big] )
+	{
+		big = 1;
+	}
+	if( axis[2] > axis[big] )
+	{
+		big = 2;
+	}
+	for( c = 0; c < 3; ++c )
+	{
+		if( c == big )
+		{
+			continue;
+		}
+		cov = 0.0f;
+		for( i = 0; i < 16; ++i )
+		{
+			cov += (uncompressed[i*3+big] - mean[big]) * (uncompressed[i*3+c] - mean[c]);
+		}
+		if( cov < 0.0f )
+		{
+			axis[c] = -axis[c];
+		}
+	}
+	/*	project the pixels onto that line to get the endpoints	*/
+	axis_len2 = axis[0]*axis[0] + axis[1]*axis[1] + axis[2]*axis[2];
+	t_min = t_max = 0.0f;
+	if( axis_len2 > 0.0f )
+	{
+		for( i = 0; i < 16; ++i )
+		{
+			t = 0.0f;
+			for( c = 0; c < 3; ++c )
+			{
+				t += (uncompressed[i*3+c] - mean[c]) * axis[c];
+			}
+			if( t < t_min )
+			{
+				t_min = t;
+			} else if( t > t_max )
+			{
+				t_max = t;
+			}
+		}
+		t_min /= axis_len2;
+		t_max /= axis_len2;
+	}
+	for( c = 0; c < 3; ++c )
+	{
+		int e0 = (int)(mean[c] + t_min * axis[c] + 0.5f);
+		int e1 = (int)(mean[c] + t_max * axis[c] + 0.5f);
+		q0[c] = BC6H_quantize( e0 < 0 ? 0 : (e0 > 0x7BFF ? 0x7BFF : e0) );
+		q1[c] = BC6H_quantize( e1 < 0 ? 0 : (e1 > 0x7BFF ? 0x7BFF : e1) );
+	}
+	/*	build the palette exactly the way the decoder will	*/
+	for( k = 0; k < 16; ++k )
+	{
+		for( c = 0; c < 3; ++c )
+		{
+			int v =
+				(BC6H_unquantize( q0[c] ) * (64 - weights[k]) +
+				BC6H_unquantize( q1[c] ) * weights[k] + 32) >> 6;
+			palette[k*3+c] = (v * 31) >> 6;
+		}
+	}
+	/*	and pick the closest entry for every pixel	*/
+	for( i = 0; i < 16; ++i )
+	{
+		unsigned int best_error = 0xFFFFFFFF;
+		indices[i] = 0;
+		for( k = 0; k < 16; ++k )
+		{
+			unsigned int error = 0;
+			for( c = 0; c < 3; ++c )
+			{
+				int d = uncompressed[i*3+c] - palette[k*3+c];
+				error += (unsigned int)(d * d);
+			}
+			if( error < best_error )
+			{
+				best_error = error;
+				indices[i] = k;
+			}
+		}
+	}
+	/*	the anchor (1st) index only gets 3 bits, so its top bit
+		must be 0...swap the endpoints if it isn't	*/
+	if( indices[0] & 8 )
+	{
+		for( c = 0; c < 3; ++c )
+		{
+			int temp = q0[c];
+			q0[c] = q1[c];
+			q1[c] = temp;
+		}
+		for( i = 0; i < 16; ++i )
+		{
+			indices[i] = 15 - indices[i];
+		}
+	}
+	/*	pack it all up, LSB first: mode, endpoints, then indices	*/
+	memset( compressed, 0, 16 );
+	next_bit = 0;
+	#define BC6H_PUT_BITS(value,count) \
+		for( k = 0; k < (count); ++k, ++next_bit ) \
+		{ \
+			compressed[next_bit >> 3] |= (((value) >> k) & 1) << (next_bit & 7); \
+		}
+	BC6H_PUT_BITS( 3, 5 );
+	for( c = 0; c < 3; ++c )
+	{
+		BC6H_PUT_BITS( q0[c], 10 );
+	}
+	for( c = 0; c < 3; ++c )
+	{
+		BC6H_PUT_BITS( q1[c], 10 );
+	}
+	BC6H_PUT_BITS( indices[0], 3 );
+	for( i = 1; i < 16; ++i )
+	{
+		BC6H_PUT_BITS( indices[i], 4 );
+	}
+	#undef BC6H_PUT_BITS
+	/*	done compressing to BC6H	*/
+}
@@ -23,6 +23,20 @@ save_image_as_DDS
     const unsigned char *const data
 );
 
+/**
+	Converts an image to DXT1 (1 or 3 channels) or DXT5 (2 or 4
+	channels), as a whole DDS file in RAM.
+	\return NULL if failed, otherwise the DDS file (*out_size bytes),
+	to be freed with SOIL_free_image_data
+**/
+unsigned char*
+convert_image_to_DDS
+(
+    const unsigned char *const data,
+    int width, int height, int channels,
+    int *out_size
+);
+
 /**
 	take an image and convert it to DXT1 (no alpha)
 **/
@@ -45,6 +59,51 @@ convert_image_to_DXT5
     int *out_size
 );
 
+/**
+	take an HDR image (floating point RGB) and convert it to BC6H
+	(unsigned half float, no alpha).  The blocks are compressed on
+	as many threads as the machine has.
+**/
+unsigned char*
+convert_image_to_BC6H
+(
+    const float *const uncompressed,
+    int width, int height, int channels,
+    int *out_size
+);
+
+/**
+	Converts an HDR image from an array of floats (RGB or RGBA) to
+	BC6H, then saves the converted image to disk as a DX10 DDS file.
+	\return 0 if failed, otherwise returns 1
+**/
+int
+save_HDR_image_as_DDS
+(
+    const char *filename,
+    int width, int height, int channels,
+    const float *const data
+);
+
+/**
+	Saves an already prepared chain of MIPmap levels to disk as a DDS
+	file, without any conversion.  DXT_type is 1, 3 or 5 for DXT data,
+	or 0 for uncompressed RGB / RGBA data (which is swapped to BGR(A)
+	on the way out, as DDS expects).  Level i is (width >> i) by
+	(height >> i), and level_size[i] bytes long.
+	\return 0 if failed, otherwise returns 1
+**/
+int
+save_mipmaps_as_DDS
+(
+    const char *filename,
+    int width, int height, int channels,
+    int DXT_type,
+    int num_levels,
+    const unsigned char *const *level_data,
+    const int *level_size
+);
+
 /**	A bunch of DirectDraw Surface structures and flags **/
 typedef struct
 {
@@ -85,6 +144,17 @@ typedef struct
 }
 DDS_header ;
 
+/*	follows the DDS_header when the FourCC is "DX10"	*/
+typedef struct
+{
+    unsigned int    dxgiFormat;
+    unsigned int    resourceDimension;
+    unsigned int    miscFlag;
+    unsigned int    arraySize;
+    unsigned int    miscFlags2;
+}
+DDS_header_DX10 ;
+
 /*	the following constants were copied directly off the MSDN website	*/
 
 /*	The dwFlags member of the original DDSURFACEDESC2 structure
@@ -120,4 +190,8 @@ DDS_header ;
 #define DDSCAPS2_CUBEMAP_NEGATIVEZ	0x00008000
 #define DDSCAPS2_VOLUME	0x00200000
 
+/*	The few DXGI values needed in a DDS_header_DX10	*/
+#define DXGI_FORMAT_BC6H_UF16	95
+#define DDS_DIMENSION_TEXTURE2D	3
+
 #endif /* HEADER_IMAGE_DXT	*/
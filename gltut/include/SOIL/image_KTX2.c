@@ -0,0 +1,487 @@
+/*
+	simple KTX2 container reading / writing code
+	(no supercompression)
+
+	public domain
+*/
+
+#include "image_KTX2.h"
+#include "image_DXT.h"
+#include "image_helper.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+/*	the 12 byte file identifier: «KTX 20»\r\n\x1A\n	*/
+static const unsigned char KTX2_identifier[12] =
+{
+	0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A
+};
+
+/*	header (48) + index (32), then 24 bytes per level	*/
+#define KTX2_HEADER_SIZE	80
+#define KTX2_LEVEL_INDEX_SIZE	24
+
+/*	Khronos data format descriptor values	*/
+#define KHR_DF_MODEL_RGBSDA	1
+#define KHR_DF_MODEL_BC1A	128
+#define KHR_DF_MODEL_BC2	129
+#define KHR_DF_MODEL_BC3	130
+#define KHR_DF_MODEL_BC6H	131
+#define KHR_DF_PRIMARIES_BT709	1
+#define KHR_DF_TRANSFER_LINEAR	1
+#define KHR_DF_SAMPLE_DATATYPE_FLOAT	0x80
+
+/********* Function Prototypes *********/
+/*
+	Returns the texel block size (in pixels, along each side) and
+	the bytes per block of a format, or 0 if it is not supported.
+*/
+int KTX2_format_info(
+				unsigned int vk_format,
+				int *block_dim, int *block_bytes );
+/*
+	The size in bytes of one face of a level.
+*/
+unsigned int KTX2_face_size(
+				unsigned int vk_format,
+				int width, int height );
+/*
+	Fills in the data format descriptor for a format,
+	returning its total size in bytes.
+*/
+int KTX2_build_DFD(
+				unsigned int vk_format,
+				unsigned char *dfd );
+static unsigned int read_u32( const unsigned char *p );
+static void write_u32( unsigned char *p, unsigned int value );
+
+/********* Actual Exposed Functions *********/
+int
+	is_KTX2
+	(
+		const unsigned char *const buffer,
+		int buffer_length
+	)
+{
+	return (NULL != buffer) && (buffer_length >= 12) &&
+		(0 == memcmp( buffer, KTX2_identifier, 12 ));
+}
+
+int
+	parse_KTX2
+	(
+		const unsigned char *const buffer,
+		int buffer_length,
+		KTX2_image *image
+	)
+{
+	unsigned int pixel_depth, layer_count, supercompression;
+	unsigned int i, w, h;
+	int block_dim, block_bytes;
+	/*	error check	*/
+	if( (NULL == image) ||
+		(buffer_length < KTX2_HEADER_SIZE) ||
+		!is_KTX2( buffer, buffer_length ) )
+	{
+		return 0;
+	}
+	memset( image, 0, sizeof( KTX2_image ) );
+	/*	the header	*/
+	image->vk_format = read_u32( buffer + 12 );
+	image->width = read_u32( buffer + 20 );
+	image->height = read_u32( buffer + 24 );
+	pixel_depth = read_u32( buffer + 28 );
+	layer_count = read_u32( buffer + 32 );
+	image->face_count = read_u32( buffer + 36 );
+	image->level_count = read_u32( buffer + 40 );
+	supercompression = read_u32( buffer + 44 );
+	/*	only plain 2D textures and cubemaps, not compressed again	*/
+	if( !KTX2_format_info( image->vk_format, &block_dim, &block_bytes ) ||
+		(image->width < 1) || (image->height < 1) ||
+		(image->width > 0x10000) || (image->height > 0x10000) ||
+		(pixel_depth > 0) || (layer_count > 1) ||
+		((image->face_count != 1) && (image->face_count != 6)) ||
+		(supercompression != 0) )
+	{
+		return 0;
+	}
+	/*	0 levels means "please generate them", which I don't	*/
+	if( image->level_count == 0 )
+	{
+		image->level_count = 1;
+	}
+	if( (image->level_count > KTX2_MAX_LEVELS) ||
+		(buffer_length < KTX2_HEADER_SIZE + (int)image->level_count * KTX2_LEVEL_INDEX_SIZE) )
+	{
+		return 0;
+	}
+	/*	the level index: 64 bit offsets and lengths	*/
+	for( i = 0; i < image->level_count; ++i )
+	{
+		const unsigned char *entry = buffer + KTX2_HEADER_SIZE + i * KTX2_LEVEL_INDEX_SIZE;
+		unsigned int offset = read_u32( entry + 0 );
+		unsigned int length = read_u32( entry + 8 );
+		if( (read_u32( entry + 4 ) != 0) || (read_u32( entry + 12 ) != 0) )
+		{
+			/*	way too big for me	*/
+			return 0;
+		}
+		w = image->width >> i;
+		h = image->height >> i;
+		if( w < 1 )
+		{
+			w = 1;
+		}
+		if( h < 1 )
+		{
+			h = 1;
+		}
+		image->face_size[i] = KTX2_face_size( image->vk_format, w, h );
+		if( (length != image->face_size[i] * image->face_count) ||
+			(offset > (unsigned int)buffer_length) ||
+			(length > (unsigned int)buffer_length - offset) )
+		{
+			return 0;
+		}
+		image->level_data[i] = buffer + offset;
+	}
+	return 1;
+}
+
+int
+	save_mipmaps_as_KTX2
+	(
+		const char *filename,
+		unsigned int vk_format,
+		int width, int height,
+		int level_count,
+		const unsigned char *const *level_data,
+		const int *level_size
+	)
+{
+	/*	variables	*/
+	FILE *fout;
+	unsigned char *header;
+	unsigned char dfd[128];
+	static const char writer_key[] = "KTXwriter\0SOIL";
+	int block_dim, block_bytes, alignment;
+	int header_size, dfd_size, kvd_size, i;
+	unsigned int offset, written;
+	unsigned int level_offset[KTX2_MAX_LEVELS];
+	/*	error check	*/
+	if( (NULL == filename) ||
+		(width < 1) || (height < 1) ||
+		(level_count < 1) || (level_count > KTX2_MAX_LEVELS) ||
+		(NULL == level_data) || (NULL == level_size) ||
+		!KTX2_format_info( vk_format, &block_dim, &block_bytes ) )
+	{
+		return 0;
+	}
+	for( i = 0; i < level_count; ++i )
+	{
+		int w = width >> i, h = height >> i;
+		if( (NULL == level_data[i]) ||
+			(level_size[i] != (int)KTX2_face_size( vk_format, w > 0 ? w : 1, h > 0 ? h : 1 )) )
+		{
+			return 0;
+		}
+	}
+	/*	levels start on a multiple of both the block size and 4	*/
+	alignment = block_bytes;
+	while( alignment & 3 )
+	{
+		alignment += block_bytes;
+	}
+	/*	lay out the file: header, level index, DFD, key/values	*/
+	header_size = KTX2_HEADER_SIZE + level_count * KTX2_LEVEL_INDEX_SIZE;
+	dfd_size = KTX2_build_DFD( vk_format, dfd );
+	kvd_size = (4 + sizeof( writer_key ) + 3) & ~3;
+	header = (unsigned char*)image_malloc( header_size + dfd_size + kvd_size );
+	if( NULL == header )
+	{
+		return 0;
+	}
+	memset( header, 0, header_size + dfd_size + kvd_size );
+	/*	then the levels, smallest first	*/
+	offset = header_size + dfd_size + kvd_size;
+	for( i = level_count - 1; i >= 0; --i )
+	{
+		offset = (offset + alignment - 1) / alignment * alignment;
+		level_offset[i] = offset;
+		offset += level_size[i];
+	}
+	memcpy( header, KTX2_identifier, 12 );
+	write_u32( header + 12, vk_format );
+	write_u32( header + 16, 1 );
+	write_u32( header + 20, width );
+	write_u32( header + 24, height );
+	write_u32( header + 28, 0 );
+	write_u32( header + 32, 0 );
+	write_u32( header + 36, 1 );
+	write_u32( header + 40, level_count );
+	write_u32( header + 44, 0 );
+	write_u32( header + 48, header_size );
+	write_u32( header + 52, dfd_size );
+	write_u32( header + 56, header_size + dfd_size );
+	write_u32( header + 60, kvd_size );
+	for( i = 0; i < level_count; ++i )
+	{
+		unsigned char *entry = header + KTX2_HEADER_SIZE + i * KTX2_LEVEL_INDEX_SIZE;
+		write_u32( entry + 0, level_offset[i] );
+		write_u32( entry + 8, level_size[i] );
+		write_u32( entry + 16, level_size[i] );
+	}
+	memcpy( header + header_size, dfd, dfd_size );
+	write_u32( header + header_size + dfd_size, sizeof( writer_key ) );
+	memcpy( header + header_size + dfd_size + 4, writer_key, sizeof( writer_key ) );
+	/*	write it out	*/
+	fout = fopen( filename, "wb" );
+	if( NULL == fout )
+	{
+		image_free( header );
+		return 0;
+	}
+	fwrite( header, 1, header_size + dfd_size + kvd_size, fout );
+	written = header_size + dfd_size + kvd_size;
+	for( i = level_count - 1; i >= 0; --i )
+	{
+		static const unsigned char padding[16] = { 0 };
+		fwrite( padding, 1, level_offset[i] - written, fout );
+		fwrite( level_data[i], 1, level_size[i], fout );
+		written = level_offset[i] + level_size[i];
+	}
+	fclose( fout );
+	image_free( header );
+	/*	done	*/
+	return 1;
+}
+
+int
+	save_image_as_KTX2
+	(
+		const char *filename,
+		int width, int height, int channels,
+		const unsigned char *const data
+	)
+{
+	/*	variables	*/
+	unsigned char *level_data[KTX2_MAX_LEVELS];
+	int level_size[KTX2_MAX_LEVELS];
+	unsigned char *resampled;
+	int level_count, i, result = 0;
+	/*	error check	*/
+	if( (NULL == filename) ||
+		(width < 1) || (height < 1) ||
+		(channels < 1) || (channels > 4) ||
+		(data == NULL ) )
+	{
+		return 0;
+	}
+	/*	the full chain, down to 1x1	*/
+	level_count = 1;
+	while( ((1 << level_count) <= width) || ((1 << level_count) <= height) )
+	{
+		++level_count;
+	}
+	resampled = (unsigned char*)image_malloc( channels * ((width+1)/2) * ((height+1)/2) );
+	if( NULL == resampled )
+	{
+		return 0;
+	}
+	memset( level_data, 0, sizeof( level_data ) );
+	for( i = 0; i < level_count; ++i )
+	{
+		int w = width >> i, h = height >> i;
+		const unsigned char *level = data;
+		if( w < 1 )
+		{
+			w = 1;
+		}
+		if( h < 1 )
+		{
+			h = 1;
+		}
+		if( i > 0 )
+		{
+			mipmap_image( data, width, height, channels,
+					resampled, 1 << i, 1 << i );
+			level = resampled;
+		}
+		if( (channels & 1) == 1 )
+		{
+			level_data[i] = convert_image_to_DXT1( level, w, h, channels, &level_size[i] );
+		} else
+		{
+			level_data[i] = convert_image_to_DXT5( level, w, h, channels, &level_size[i] );
+		}
+		if( NULL == level_data[i] )
+		{
+			break;
+		}
+	}
+	image_free( resampled );
+	if( i == level_count )
+	{
+		result = save_mipmaps_as_KTX2( filename,
+				((channels & 1) == 1) ?
+					KTX2_VK_FORMAT_BC1_RGB_UNORM_BLOCK :
+					KTX2_VK_FORMAT_BC3_UNORM_BLOCK,
+				width, height, level_count,
+				(const unsigned char *const *)level_data, level_size );
+	}
+	for( i = 0; i < level_count; ++i )
+	{
+		image_free( level_data[i] );
+	}
+	return result;
+}
+
+/********* Helper Functions *********/
+int KTX2_format_info(
+				unsigned int vk_format,
+				int *block_dim, int *block_bytes )
+{
+	*block_dim = 1;
+	switch( vk_format )
+	{
+	case KTX2_VK_FORMAT_R8_UNORM:
+		*block_bytes = 1;
+		return 1;
+	case KTX2_VK_FORMAT_R8G8_UNORM:
+		*block_bytes = 2;
+		return 1;
+	case KTX2_VK_FORMAT_R8G8B8_UNORM:
+		*block_bytes = 3;
+		return 1;
+	case KTX2_VK_FORMAT_R8G8B8A8_UNORM:
+		*block_bytes = 4;
+		return 1;
+	case KTX2_VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case KTX2_VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+		*block_dim = 4;
+		*block_bytes = 8;
+		return 1;
+	case KTX2_VK_FORMAT_BC2_UNORM_BLOCK:
+	case KTX2_VK_FORMAT_BC3_UNORM_BLOCK:
+	case KTX2_VK_FORMAT_BC6H_UFLOAT_BLOCK:
+		*block_dim = 4;
+		*block_bytes = 16;
+		return 1;
+	}
+	*block_bytes = 0;
+	return 0;
+}
+
+unsigned int KTX2_face_size(
+				unsigned int vk_format,
+				int width, int height )
+{
+	int block_dim, block_bytes;
+	if( !KTX2_format_info( vk_format, &block_dim, &block_bytes ) )
+	{
+		return 0;
+	}
+	return
+		((width + block_dim - 1) / block_dim) *
+		((height + block_dim - 1) / block_dim) *
+		block_bytes;
+}
+
+int KTX2_build_DFD(
+				unsigned int vk_format,
+				unsigned char *dfd )
+{
+	/*	one basic descriptor block: channel id, bit offset
+		and bit length for each sample	*/
+	int model, num_samples = 0, i;
+	int block_dim, block_bytes;
+	int channel[4], bit_offset[4], bit_length[4];
+	unsigned int upper = 0xFFFFFFFF;
+	unsigned char *p;
+	KTX2_format_info( vk_format, &block_dim, &block_bytes );
+	switch( vk_format )
+	{
+	case KTX2_VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case KTX2_VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+		model = KHR_DF_MODEL_BC1A;
+		channel[0] = (vk_format == KTX2_VK_FORMAT_BC1_RGBA_UNORM_BLOCK) ? 1 : 0;
+		bit_offset[0] = 0;
+		bit_length[0] = 64;
+		num_samples = 1;
+		break;
+	case KTX2_VK_FORMAT_BC2_UNORM_BLOCK:
+	case KTX2_VK_FORMAT_BC3_UNORM_BLOCK:
+		/*	alpha in the 1st half, color in the 2nd	*/
+		model = (vk_format == KTX2_VK_FORMAT_BC2_UNORM_BLOCK) ?
+				KHR_DF_MODEL_BC2 : KHR_DF_MODEL_BC3;
+		channel[0] = 15;
+		bit_offset[0] = 0;
+		bit_length[0] = 64;
+		channel[1] = 0;
+		bit_offset[1] = 64;
+		bit_length[1] = 64;
+		num_samples = 2;
+		break;
+	case KTX2_VK_FORMAT_BC6H_UFLOAT_BLOCK:
+		model = KHR_DF_MODEL_BC6H;
+		channel[0] = KHR_DF_SAMPLE_DATATYPE_FLOAT;
+		bit_offset[0] = 0;
+		bit_length[0] = 128;
+		num_samples = 1;
+		/*	1.0f	*/
+		upper = 0x3F800000;
+		break;
+	default:
+		/*	8 bits per channel: R, G, B, then A (id 15)	*/
+		model = KHR_DF_MODEL_RGBSDA;
+		num_samples = block_bytes;
+		for( i = 0; i < num_samples; ++i )
+		{
+			channel[i] = (i == 3) ? 15 : i;
+			bit_offset[i] = 8 * i;
+			bit_length[i] = 8;
+		}
+		upper = 255;
+		break;
+	}
+	memset( dfd, 0, 4 + 24 + 16 * num_samples );
+	/*	total size, then the block header	*/
+	write_u32( dfd + 0, 4 + 24 + 16 * num_samples );
+	write_u32( dfd + 4, 0 );
+	write_u32( dfd + 8, 2 | ((24 + 16 * num_samples) << 16) );
+	dfd[12] = (unsigned char)model;
+	dfd[13] = KHR_DF_PRIMARIES_BT709;
+	dfd[14] = KHR_DF_TRANSFER_LINEAR;
+	dfd[15] = 0;
+	/*	texel block dimensions are stored minus 1	*/
+	dfd[16] = (unsigned char)(block_dim - 1);
+	dfd[17] = (unsigned char)(block_dim - 1);
+	dfd[20] = (unsigned char)block_bytes;
+	for( i = 0; i < num_samples; ++i )
+	{
+		p = dfd + 28 + 16 * i;
+		write_u32( p + 0,
+				bit_offset[i] |
+				((bit_length[i] - 1) << 16) |
+				((unsigned int)channel[i] << 24) );
+		write_u32( p + 8, 0 );
+		write_u32( p + 12, upper );
+	}
+	return 4 + 24 + 16 * num_samples;
+}
+
+static unsigned int read_u32( const unsigned char *p )
+{
+	return
+		((unsigned int)p[0] << 0) | ((unsigned int)p[1] << 8) |
+		((unsigned int)p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static void write_u32( unsigned char *p, unsigned int value )
+{
+	p[0] = (unsigned char)(value >> 0);
+	p[1] = (unsigned char)(value >> 8);
+	p[2] = (unsigned char)(value >> 16);
+	p[3] = (unsigned char)(value >> 24);
+}
@@ -0,0 +1,105 @@
+/*
+	simple KTX2 container reading / writing code
+	(no supercompression)
+
+	public domain
+*/
+
+#ifndef HEADER_IMAGE_KTX2
+#define HEADER_IMAGE_KTX2
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**	the most MIPmap levels a KTX2 file may have here	**/
+#define KTX2_MAX_LEVELS	32
+
+/**	the Vulkan formats SOIL reads and writes	**/
+#define KTX2_VK_FORMAT_R8_UNORM				9
+#define KTX2_VK_FORMAT_R8G8_UNORM			16
+#define KTX2_VK_FORMAT_R8G8B8_UNORM			23
+#define KTX2_VK_FORMAT_R8G8B8A8_UNORM		37
+#define KTX2_VK_FORMAT_BC1_RGB_UNORM_BLOCK	131
+#define KTX2_VK_FORMAT_BC1_RGBA_UNORM_BLOCK	133
+#define KTX2_VK_FORMAT_BC2_UNORM_BLOCK		135
+#define KTX2_VK_FORMAT_BC3_UNORM_BLOCK		137
+#define KTX2_VK_FORMAT_BC6H_UFLOAT_BLOCK	143
+
+/**
+	A parsed KTX2 file.  The level pointers point into the
+	buffer that was parsed, nothing is copied.  Each level
+	holds face_count faces of face_size[i] bytes, back to back.
+**/
+typedef struct
+{
+	unsigned int vk_format;
+	unsigned int width, height;
+	unsigned int face_count, level_count;
+	const unsigned char *level_data[KTX2_MAX_LEVELS];
+	unsigned int face_size[KTX2_MAX_LEVELS];
+}
+KTX2_image;
+
+/**
+	Checks the 12 byte KTX2 file identifier.
+	\return 1 if the buffer starts with it, otherwise returns 0
+**/
+int
+is_KTX2
+(
+    const unsigned char *const buffer,
+    int buffer_length
+);
+
+/**
+	Parses the header and level index of a KTX2 file in RAM and
+	validates that every level lies inside the buffer and is the
+	size its format says it should be.
+	\return 0 if failed (or unsupported), otherwise returns 1
+**/
+int
+parse_KTX2
+(
+    const unsigned char *const buffer,
+    int buffer_length,
+    KTX2_image *image
+);
+
+/**
+	Saves an already prepared chain of MIPmap levels (level 0 is the
+	full size image) to disk as a KTX2 file.  The level data is stored
+	smallest level first, so the low resolution versions can be read
+	(or streamed) before the large ones.
+	\return 0 if failed, otherwise returns 1
+**/
+int
+save_mipmaps_as_KTX2
+(
+    const char *filename,
+    unsigned int vk_format,
+    int width, int height,
+    int level_count,
+    const unsigned char *const *level_data,
+    const int *level_size
+);
+
+/**
+	Builds the full MIPmap chain of an image, converts every level to
+	DXT1 (1 or 3 channels) or DXT5 (2 or 4 channels), then saves it to
+	disk as a KTX2 file.
+	\return 0 if failed, otherwise returns 1
+**/
+int
+save_image_as_KTX2
+(
+    const char *filename,
+    int width, int height, int channels,
+    const unsigned char *const data
+);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HEADER_IMAGE_KTX2	*/
@@ -0,0 +1,1106 @@
+/*
+	PNG writing code, deflating bands of the image in parallel
+
+	public domain
+*/
+
+#include "image_PNG.h"
+#include "image_helper.h"
+#include "image_threads.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+/*
+	The filtered image is cut into bands of about this many bytes
+	(whole rows), and each band is deflated on its own thread, into
+	its own IDAT chunk.  A band's matches may reach back into the
+	32K before it, which the thread filters again for itself, so
+	cutting the stream up costs next to nothing in size.
+*/
+#define PNG_BAND_BYTES		(256 * 1024)
+
+/*	deflate parameters	*/
+#define DEFLATE_WINDOW		32768
+#define DEFLATE_WINDOW_MASK	(DEFLATE_WINDOW - 1)
+#define DEFLATE_HASH_BITS	15
+#define DEFLATE_HASH_SIZE	(1 << DEFLATE_HASH_BITS)
+#define DEFLATE_MIN_MATCH	3
+#define DEFLATE_MAX_MATCH	258
+#define DEFLATE_MAX_CHAIN	32		/*	candidates tried per position	*/
+#define DEFLATE_NICE_MATCH	128		/*	stop looking once a match is this long	*/
+#define DEFLATE_LAZY_MATCH	32		/*	try the next position unless the match is this long	*/
+#define DEFLATE_BLOCK_SYMBOLS	16384	/*	symbols per Huffman block	*/
+#define DEFLATE_LITLEN_CODES	286
+#define DEFLATE_DIST_CODES	30
+#define DEFLATE_MAX_BITS	15
+
+/*	length and distance codes: base values and extra bits	*/
+static const unsigned short length_base[29] =
+{
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const unsigned char length_extra[29] =
+{
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const unsigned short dist_base[30] =
+{
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+	8193, 12289, 16385, 24577
+};
+static const unsigned char dist_extra[30] =
+{
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+/*	the order the code length code lengths are sent in	*/
+static const unsigned char code_length_order[19] =
+{
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+/*	a growing buffer, written a bit at a time (LSB first)	*/
+typedef struct
+{
+	unsigned char *data;
+	int size, capacity;
+	unsigned int bits;
+	int bit_count;
+}
+bit_buffer;
+
+/*	one band's IDAT chunk, and the checksum of its filtered data	*/
+typedef struct
+{
+	unsigned char *chunk;
+	int chunk_size;
+	unsigned int adler;
+	int raw_size;
+}
+PNG_band;
+
+/*	what the threads share	*/
+typedef struct
+{
+	const unsigned char *data;
+	int width, height, channels;
+	int rows_per_band, band_count;
+	PNG_band *bands;
+	unsigned int crc_table[256];
+	volatile int failed;
+}
+PNG_job;
+
+/*	one band's deflate state	*/
+typedef struct
+{
+	const unsigned char *in;
+	int start, end;
+	int next_insert;
+	int head[DEFLATE_HASH_SIZE];
+	int prev[DEFLATE_WINDOW];
+	/*	the current block: literals and lengths, with distances (0 for a literal)	*/
+	unsigned short lit_len[DEFLATE_BLOCK_SYMBOLS];
+	unsigned short dist[DEFLATE_BLOCK_SYMBOLS];
+	int symbol_count;
+	int block_start;
+	bit_buffer out;
+}
+deflate_state;
+
+/********* Function Prototypes *********/
+/*
+	Makes sure there is room for another count bytes.
+*/
+static int reserve_bits( bit_buffer *b, int count );
+static void put_bits( bit_buffer *b, unsigned int value, int count );
+static void align_bits( bit_buffer *b );
+/*
+	Filters one row into out (a filter type byte, then the row),
+	picking whichever of the 5 filters gives the smallest sum of
+	absolute (signed) values.
+*/
+static void filter_row(
+				const unsigned char *row, const unsigned char *prior,
+				int stride, int bpp,
+				unsigned char *out, unsigned char *scratch );
+static void deflate_band( deflate_state *d, int final );
+static void PNG_band_job( void *job_data, int first, int last );
+static unsigned int update_crc( const unsigned int *table, unsigned int crc, const unsigned char *p, int length );
+static unsigned int update_adler( unsigned int adler, const unsigned char *p, int length );
+static unsigned int combine_adler( unsigned int adler1, unsigned int adler2, int length2 );
+static void write_u32_be( unsigned char *p, unsigned int value );
+/*
+	Builds every chunk of the PNG file; the bands are returned
+	(and must be freed) separately, the head (signature, IHDR and
+	zlib header) and tail (Adler-32 and IEND) are fixed size.
+*/
+static int encode_PNG(
+				const unsigned char *const data,
+				int width, int height, int channels,
+				unsigned char head[47], unsigned char tail[28],
+				PNG_band **bands, int *band_count );
+
+/********* Actual Exposed Functions *********/
+unsigned char*
+	convert_image_to_PNG
+	(
+		const unsigned char *const data,
+		int width, int height, int channels,
+		int *out_size
+	)
+{
+	unsigned char head[47], tail[28];
+	PNG_band *bands;
+	int band_count, size, i;
+	unsigned char *png;
+	if( NULL == out_size )
+	{
+		return NULL;
+	}
+	*out_size = 0;
+	if( !encode_PNG( data, width, height, channels, head, tail, &bands, &band_count ) )
+	{
+		return NULL;
+	}
+	size = sizeof( head ) + sizeof( tail );
+	for( i = 0; i < band_count; ++i )
+	{
+		size += bands[i].chunk_size;
+	}
+	png = (unsigned char*)image_malloc( size );
+	if( NULL != png )
+	{
+		unsigned char *p = png;
+		memcpy( p, head, sizeof( head ) );
+		p += sizeof( head );
+		for( i = 0; i < band_count; ++i )
+		{
+			memcpy( p, bands[i].chunk, bands[i].chunk_size );
+			p += bands[i].chunk_size;
+		}
+		memcpy( p, tail, sizeof( tail ) );
+		*out_size = size;
+	}
+	for( i = 0; i < band_count; ++i )
+	{
+		image_free( bands[i].chunk );
+	}
+	image_free( bands );
+	return png;
+}
+
+int
+	save_image_as_PNG
+	(
+		const char *filename,
+		int width, int height, int channels,
+		const unsigned char *const data
+	)
+{
+	unsigned char head[47], tail[28];
+	PNG_band *bands;
+	int band_count, i, ok;
+	FILE *fout;
+	if( NULL == filename )
+	{
+		return 0;
+	}
+	if( !encode_PNG( data, width, height, channels, head, tail, &bands, &band_count ) )
+	{
+		return 0;
+	}
+	/*	the bands go straight from their buffers to the file	*/
+	fout = fopen( filename, "wb" );
+	ok = (NULL != fout);
+	if( ok )
+	{
+		ok = (fwrite( head, 1, sizeof( head ), fout ) == sizeof( head ));
+		for( i = 0; ok && (i < band_count); ++i )
+		{
+			ok = (fwrite( bands[i].chunk, 1, bands[i].chunk_size, fout ) == (size_t)bands[i].chunk_size);
+		}
+		ok = ok && (fwrite( tail, 1, sizeof( tail ), fout ) == sizeof( tail ));
+		ok = (fclose( fout ) == 0) && ok;
+	}
+	for( i = 0; i < band_count; ++i )
+	{
+		image_free( bands[i].chunk );
+	}
+	image_free( bands );
+	return ok;
+}
+
+/********* Helper Functions *********/
+static int encode_PNG(
+				const unsigned char *const data,
+				int width, int height, int channels,
+				unsigned char head[47], unsigned char tail[28],
+				PNG_band **bands, int *band_count )
+{
+	static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	static const unsigned char color_type[5] = { 0, 0, 4, 2, 6 };
+	PNG_job job;
+	unsigned int adler;
+	int stride, i, j;
+	/*	error check	*/
+	if( (NULL == data) ||
+		(width < 1) || (height < 1) ||
+		(channels < 1) || (channels > 4) ||
+		(width > (0x7FFFFFFF - 1) / channels) )
+	{
+		return 0;
+	}
+	stride = width * channels;
+	/*	the CRC-32 table	*/
+	for( i = 0; i < 256; ++i )
+	{
+		unsigned int c = i;
+		for( j = 0; j < 8; ++j )
+		{
+			c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+		}
+		job.crc_table[i] = c;
+	}
+	/*	cut the image into bands	*/
+	job.data = data;
+	job.width = width;
+	job.height = height;
+	job.channels = channels;
+	job.rows_per_band = PNG_BAND_BYTES / (stride + 1);
+	if( job.rows_per_band < 1 )
+	{
+		job.rows_per_band = 1;
+	}
+	job.band_count = (height + job.rows_per_band - 1) / job.rows_per_band;
+	job.failed = 0;
+	job.bands = (PNG_band*)image_malloc( job.band_count * sizeof(PNG_band) );
+	if( NULL == job.bands )
+	{
+		return 0;
+	}
+	memset( job.bands, 0, job.band_count * sizeof(PNG_band) );
+	if( !run_parallel_job( PNG_band_job, &job, job.band_count, 1, 0 ) )
+	{
+		job.failed = 1;
+	}
+	if( job.failed )
+	{
+		for( i = 0; i < job.band_count; ++i )
+		{
+			image_free( job.bands[i].chunk );
+		}
+		image_free( job.bands );
+		return 0;
+	}
+	/*	the signature, IHDR, and an IDAT holding the zlib header	*/
+	memcpy( head, signature, 8 );
+	write_u32_be( head + 8, 13 );
+	memcpy( head + 12, "IHDR", 4 );
+	write_u32_be( head + 16, width );
+	write_u32_be( head + 20, height );
+	head[24] = 8;
+	head[25] = color_type[channels];
+	head[26] = 0;
+	head[27] = 0;
+	head[28] = 0;
+	write_u32_be( head + 29, update_crc( job.crc_table, 0, head + 12, 17 ) );
+	write_u32_be( head + 33, 2 );
+	memcpy( head + 37, "IDAT", 4 );
+	head[41] = 0x78;
+	head[42] = 0x9C;
+	write_u32_be( head + 43, update_crc( job.crc_table, 0, head + 37, 6 ) );
+	/*	the Adler-32 of the whole stream, in an IDAT of its own, then IEND	*/
+	adler = job.bands[0].adler;
+	for( i = 1; i < job.band_count; ++i )
+	{
+		adler = combine_adler( adler, job.bands[i].adler, job.bands[i].raw_size );
+	}
+	write_u32_be( tail, 4 );
+	memcpy( tail + 4, "IDAT", 4 );
+	write_u32_be( tail + 8, adler );
+	write_u32_be( tail + 12, update_crc( job.crc_table, 0, tail + 4, 8 ) );
+	write_u32_be( tail + 16, 0 );
+	memcpy( tail + 20, "IEND", 4 );
+	write_u32_be( tail + 24, update_crc( job.crc_table, 0, tail + 20, 4 ) );
+	*bands = job.bands;
+	*band_count = job.band_count;
+	return 1;
+}
+
+/*	filters a band (and the rows before it that its matches may use), then deflates it	*/
+static void PNG_band_job( void *job_data, int first, int last )
+{
+	PNG_job *job = (PNG_job*)job_data;
+	const int stride = job->width * job->channels;
+	int band;
+	for( band = first; band < last; ++band )
+	{
+		PNG_band *out = &job->bands[band];
+		int first_row = band * job->rows_per_band;
+		int last_row = first_row + job->rows_per_band;
+		int dictionary_rows = (DEFLATE_WINDOW + stride) / (stride + 1);
+		int filtered_size, y;
+		unsigned char *filtered, *scratch, *zero_row;
+		deflate_state *d;
+		if( job->failed )
+		{
+			return;
+		}
+		if( last_row > job->height )
+		{
+			last_row = job->height;
+		}
+		if( dictionary_rows > first_row )
+		{
+			dictionary_rows = first_row;
+		}
+		filtered_size = (last_row - first_row + dictionary_rows) * (stride + 1);
+		filtered = (unsigned char*)image_malloc( filtered_size );
+		scratch = (unsigned char*)image_malloc( 5 * stride );
+		d = (deflate_state*)image_malloc( sizeof(deflate_state) );
+		if( (NULL == filtered) || (NULL == scratch) || (NULL == d) )
+		{
+			image_free( filtered );
+			image_free( scratch );
+			image_free( d );
+			job->failed = 1;
+			return;
+		}
+		/*	the first row of the image is filtered against zeros	*/
+		zero_row = scratch + 4 * stride;
+		memset( zero_row, 0, stride );
+		for( y = first_row - dictionary_rows; y < last_row; ++y )
+		{
+			filter_row( job->data + y * stride,
+					(y > 0) ? (job->data + (y - 1) * stride) : zero_row,
+					stride, job->channels,
+					filtered + (y - first_row + dictionary_rows) * (stride + 1),
+					scratch );
+		}
+		/*	deflate it, into an IDAT chunk	*/
+		d->in = filtered;
+		d->start = dictionary_rows * (stride + 1);
+		d->end = filtered_size;
+		d->out.data = NULL;
+		d->out.size = d->out.capacity = 0;
+		d->out.bits = 0;
+		d->out.bit_count = 0;
+		if( reserve_bits( &d->out, (d->end - d->start) / 2 + 1024 ) )
+		{
+			d->out.size = 8;
+			deflate_band( d, band == job->band_count - 1 );
+		}
+		if( (NULL == d->out.data) || !reserve_bits( &d->out, 4 ) )
+		{
+			job->failed = 1;
+		} else
+		{
+			write_u32_be( d->out.data, d->out.size - 8 );
+			memcpy( d->out.data + 4, "IDAT", 4 );
+			write_u32_be( d->out.data + d->out.size,
+					update_crc( job->crc_table, 0, d->out.data + 4, d->out.size - 4 ) );
+			out->chunk = d->out.data;
+			out->chunk_size = d->out.size + 4;
+			out->adler = update_adler( 1, filtered + d->start, d->end - d->start );
+			out->raw_size = d->end - d->start;
+		}
+		image_free( filtered );
+		image_free( scratch );
+		image_free( d );
+	}
+}
+
+static void filter_row(
+				const unsigned char *row, const unsigned char *prior,
+				int stride, int bpp,
+				unsigned char *out, unsigned char *scratch )
+{
+	unsigned char *sub = scratch;
+	unsigned char *up = scratch + stride;
+	unsigned char *average = scratch + 2 * stride;
+	unsigned char *paeth = scratch + 3 * stride;
+	unsigned int sum[5] = { 0, 0, 0, 0, 0 };
+	const unsigned char *chosen = row;
+	int i, best = 0;
+	for( i = 0; i < stride; ++i )
+	{
+		int a = (i >= bpp) ? row[i - bpp] : 0;
+		int b = prior[i];
+		int c = (i >= bpp) ? prior[i - bpp] : 0;
+		int p = a + b - c;
+		int pa = abs( p - a ), pb = abs( p - b ), pc = abs( p - c );
+		int predicted = ((pa <= pb) && (pa <= pc)) ? a : ((pb <= pc) ? b : c);
+		sub[i] = (unsigned char)(row[i] - a);
+		up[i] = (unsigned char)(row[i] - b);
+		average[i] = (unsigned char)(row[i] - ((a + b) >> 1));
+		paeth[i] = (unsigned char)(row[i] - predicted);
+		sum[0] += abs( (signed char)row[i] );
+		sum[1] += abs( (signed char)sub[i] );
+		sum[2] += abs( (signed char)up[i] );
+		sum[3] += abs( (signed char)average[i] );
+		sum[4] += abs( (signed char)paeth[i] );
+	}
+	for( i = 1; i < 5; ++i )
+	{
+		if( sum[i] < sum[best] )
+		{
+			best = i;
+		}
+	}
+	if( best > 0 )
+	{
+		chosen = scratch + (best - 1) * stride;
+	}
+	out[0] = (unsigned char)best;
+	memcpy( out + 1, chosen, stride );
+}
+
+/********* Deflate *********/
+static int reserve_bits( bit_buffer *b, int count )
+{
+	if( b->size + count > b->capacity )
+	{
+		int capacity = b->capacity * 2;
+		unsigned char *data;
+		if( capacity < b->size + count )
+		{
+			capacity = b->size + count;
+		}
+		data = (unsigned char*)image_realloc( b->data, capacity );
+		if( NULL == data )
+		{
+			image_free( b->data );
+			b->data = NULL;
+			b->size = b->capacity = 0;
+			return 0;
+		}
+		b->data = data;
+		b->capacity = capacity;
+	}
+	return 1;
+}
+
+/*	(count <= 16, and there must be room reserved)	*/
+static void put_bits( bit_buffer *b, unsigned int value, int count )
+{
+	b->bits |= value << b->bit_count;
+	b->bit_count += count;
+	while( b->bit_count >= 8 )
+	{
+		b->data[b->size++] = (unsigned char)b->bits;
+		b->bits >>= 8;
+		b->bit_count -= 8;
+	}
+}
+
+static void align_bits( bit_buffer *b )
+{
+	if( b->bit_count > 0 )
+	{
+		put_bits( b, 0, 8 - b->bit_count );
+	}
+}
+
+static int highest_bit( unsigned int x )
+{
+	int n = 0;
+	while( x >>= 1 )
+	{
+		++n;
+	}
+	return n;
+}
+
+static int length_code( int length )
+{
+	int l = length - 3, b;
+	if( length == DEFLATE_MAX_MATCH )
+	{
+		return 28;
+	}
+	if( l < 8 )
+	{
+		return l;
+	}
+	b = highest_bit( l );
+	return 4 * (b - 1) + ((l >> (b - 2)) & 3);
+}
+
+static int dist_code( int distance )
+{
+	int d = distance - 1, b;
+	if( d < 4 )
+	{
+		return d;
+	}
+	b = highest_bit( d );
+	return 2 * b + ((d >> (b - 1)) & 1);
+}
+
+/*
+	Huffman code lengths, no longer than max_bits, for count symbols:
+	the in-place minimum redundancy algorithm of Moffat and Katajainen
+	on the used symbols sorted by frequency, then any over-long codes
+	are pulled in and the lengths shuffled until they add up again.
+*/
+typedef struct
+{
+	unsigned int key;
+	unsigned short symbol;
+}
+symbol_frequency;
+
+static int compare_frequency( const void *a, const void *b )
+{
+	const symbol_frequency *x = (const symbol_frequency*)a;
+	const symbol_frequency *y = (const symbol_frequency*)b;
+	if( x->key != y->key )
+	{
+		return (x->key < y->key) ? -1 : 1;
+	}
+	return (int)x->symbol - (int)y->symbol;
+}
+
+static void build_code_lengths( const unsigned int *frequency, int count, int max_bits, unsigned char *lengths )
+{
+	symbol_frequency A[DEFLATE_LITLEN_CODES];
+	int length_count[DEFLATE_MAX_BITS + 2];
+	int n = 0, i, root, leaf, next, available, used, depth;
+	unsigned int total;
+	memset( lengths, 0, count );
+	for( i = 0; i < count; ++i )
+	{
+		if( frequency[i] )
+		{
+			A[n].key = frequency[i];
+			A[n].symbol = (unsigned short)i;
+			++n;
+		}
+	}
+	if( n == 0 )
+	{
+		return;
+	}
+	if( n == 1 )
+	{
+		lengths[A[0].symbol] = 1;
+		return;
+	}
+	qsort( A, n, sizeof(symbol_frequency), compare_frequency );
+	/*	first pass: the keys become parent pointers, then depths	*/
+	A[0].key += A[1].key;
+	root = 0;
+	leaf = 2;
+	for( next = 1; next < n - 1; ++next )
+	{
+		if( (leaf >= n) || (A[root].key < A[leaf].key) )
+		{
+			A[next].key = A[root].key;
+			A[root++].key = next;
+		} else
+		{
+			A[next].key = A[leaf++].key;
+		}
+		if( (leaf >= n) || ((root < next) && (A[root].key < A[leaf].key)) )
+		{
+			A[next].key += A[root].key;
+			A[root++].key = next;
+		} else
+		{
+			A[next].key += A[leaf++].key;
+		}
+	}
+	A[n - 2].key = 0;
+	for( next = n - 3; next >= 0; --next )
+	{
+		A[next].key = A[A[next].key].key + 1;
+	}
+	/*	second pass: internal node depths to leaf depths	*/
+	available = 1;
+	used = depth = 0;
+	root = n - 2;
+	next = n - 1;
+	while( available > 0 )
+	{
+		while( (root >= 0) && ((int)A[root].key == depth) )
+		{
+			++used;
+			--root;
+		}
+		while( available > used )
+		{
+			A[next--].key = depth;
+			--available;
+		}
+		available = 2 * used;
+		++depth;
+		used = 0;
+	}
+	/*	limit the lengths to max_bits	*/
+	memset( length_count, 0, sizeof(length_count) );
+	for( i = 0; i < n; ++i )
+	{
+		int l = (int)A[i].key;
+		length_count[(l > max_bits) ? max_bits : l]++;
+	}
+	total = 0;
+	for( i = max_bits; i > 0; --i )
+	{
+		total += (unsigned int)length_count[i] << (max_bits - i);
+	}
+	while( total != (1u << max_bits) )
+	{
+		length_count[max_bits]--;
+		for( i = max_bits - 1; i > 0; --i )
+		{
+			if( length_count[i] )
+			{
+				length_count[i]--;
+				length_count[i + 1] += 2;
+				break;
+			}
+		}
+		--total;
+	}
+	/*	the least frequent symbols get the longest codes	*/
+	next = 0;
+	for( i = max_bits; i > 0; --i )
+	{
+		int k;
+		for( k = length_count[i]; k > 0; --k )
+		{
+			lengths[A[next++].symbol] = (unsigned char)i;
+		}
+	}
+}
+
+/*	canonical codes from lengths, bit reversed for the LSB first stream	*/
+static void build_codes( const unsigned char *lengths, int count, unsigned short *codes )
+{
+	int length_count[DEFLATE_MAX_BITS + 1];
+	int next_code[DEFLATE_MAX_BITS + 1];
+	int i, code = 0;
+	memset( length_count, 0, sizeof(length_count) );
+	for( i = 0; i < count; ++i )
+	{
+		length_count[lengths[i]]++;
+	}
+	length_count[0] = 0;
+	for( i = 1; i <= DEFLATE_MAX_BITS; ++i )
+	{
+		code = (code + length_count[i - 1]) << 1;
+		next_code[i] = code;
+	}
+	for( i = 0; i < count; ++i )
+	{
+		int l = lengths[i];
+		if( l )
+		{
+			int c = next_code[l]++, r = 0, k;
+			for( k = 0; k < l; ++k )
+			{
+				r = (r << 1) | ((c >> k) & 1);
+			}
+			codes[i] = (unsigned short)r;
+		}
+	}
+}
+
+/*	codes the symbols collected so far (block_start to block_end) as one block	*/
+static void emit_block( deflate_state *d, int block_end, int final )
+{
+	unsigned int litlen_frequency[DEFLATE_LITLEN_CODES];
+	unsigned int dist_frequency[DEFLATE_DIST_CODES];
+	unsigned int length_frequency[19];
+	unsigned char lengths[DEFLATE_LITLEN_CODES + DEFLATE_DIST_CODES];
+	unsigned char length_lengths[19];
+	unsigned short litlen_codes[DEFLATE_LITLEN_CODES];
+	unsigned short dist_codes[DEFLATE_DIST_CODES];
+	unsigned short length_codes[19];
+	/*	the run length coded code lengths: symbol, extra bits	*/
+	unsigned char rle[DEFLATE_LITLEN_CODES + DEFLATE_DIST_CODES][2];
+	int litlen_count, dist_count, length_count, rle_count = 0;
+	int i, raw_size = block_end - d->block_start;
+	unsigned int dynamic_bits, stored_bits;
+	bit_buffer *out = &d->out;
+	if( NULL == out->data )
+	{
+		return;
+	}
+	memset( litlen_frequency, 0, sizeof(litlen_frequency) );
+	memset( dist_frequency, 0, sizeof(dist_frequency) );
+	memset( length_frequency, 0, sizeof(length_frequency) );
+	for( i = 0; i < d->symbol_count; ++i )
+	{
+		if( d->dist[i] )
+		{
+			litlen_frequency[257 + length_code( d->lit_len[i] )]++;
+			dist_frequency[dist_code( d->dist[i] )]++;
+		} else
+		{
+			litlen_frequency[d->lit_len[i]]++;
+		}
+	}
+	litlen_frequency[256] = 1;
+	/*	inflaters want at least 2 distance codes (or 1, at a push)	*/
+	for( i = 0, dist_count = 0; i < DEFLATE_DIST_CODES; ++i )
+	{
+		dist_count += (dist_frequency[i] != 0);
+	}
+	if( dist_count < 2 )
+	{
+		dist_frequency[dist_frequency[0] ? 1 : 0] = 1;
+		if( dist_count == 0 )
+		{
+			dist_frequency[1] = 1;
+		}
+	}
+	build_code_lengths( litlen_frequency, DEFLATE_LITLEN_CODES, DEFLATE_MAX_BITS, lengths );
+	build_code_lengths( dist_frequency, DEFLATE_DIST_CODES, DEFLATE_MAX_BITS, lengths + DEFLATE_LITLEN_CODES );
+	for( litlen_count = DEFLATE_LITLEN_CODES; lengths[litlen_count - 1] == 0; --litlen_count );
+	for( dist_count = DEFLATE_DIST_CODES; lengths[DEFLATE_LITLEN_CODES + dist_count - 1] == 0; --dist_count );
+	/*	the two sets of lengths are sent back to back, run length coded	*/
+	memmove( lengths + litlen_count, lengths + DEFLATE_LITLEN_CODES, dist_count );
+	for( i = 0; i < litlen_count + dist_count; )
+	{
+		int l = lengths[i], run = 1;
+		while( (i + run < litlen_count + dist_count) && (lengths[i + run] == l) )
+		{
+			++run;
+		}
+		if( (l == 0) && (run >= 3) )
+		{
+			if( run > 138 )
+			{
+				run = 138;
+			}
+			rle[rle_count][0] = (run <= 10) ? 17 : 18;
+			rle[rle_count++][1] = (unsigned char)(run - ((run <= 10) ? 3 : 11));
+		} else
+		if( run >= 4 )
+		{
+			/*	the length itself, then repeats of it	*/
+			if( run > 7 )
+			{
+				run = 7;
+			}
+			rle[rle_count][0] = (unsigned char)l;
+			rle[rle_count++][1] = 0;
+			rle[rle_count][0] = 16;
+			rle[rle_count++][1] = (unsigned char)(run - 4);
+		} else
+		{
+			run = 1;
+			rle[rle_count][0] = (unsigned char)l;
+			rle[rle_count++][1] = 0;
+		}
+		i += run;
+	}
+	for( i = 0; i < rle_count; ++i )
+	{
+		length_frequency[rle[i][0]]++;
+	}
+	build_code_lengths( length_frequency, 19, 7, length_lengths );
+	for( length_count = 19; length_lengths[code_length_order[length_count - 1]] == 0; --length_count );
+	if( length_count < 4 )
+	{
+		length_count = 4;
+	}
+	build_codes( lengths, litlen_count, litlen_codes );
+	build_codes( lengths + litlen_count, dist_count, dist_codes );
+	build_codes( length_lengths, 19, length_codes );
+	/*	would storing it be smaller?	*/
+	dynamic_bits = 3 + 14 + 3 * length_count;
+	for( i = 0; i < rle_count; ++i )
+	{
+		static const unsigned char rle_extra[3] = { 2, 3, 7 };
+		dynamic_bits += length_lengths[rle[i][0]] + ((rle[i][0] >= 16) ? rle_extra[rle[i][0] - 16] : 0);
+	}
+	for( i = 0; i < litlen_count; ++i )
+	{
+		dynamic_bits += litlen_frequency[i] * lengths[i];
+		if( i > 256 )
+		{
+			dynamic_bits += litlen_frequency[i] * length_extra[i - 257];
+		}
+	}
+	for( i = 0; i < dist_count; ++i )
+	{
+		dynamic_bits += dist_frequency[i] * (lengths[litlen_count + i] + dist_extra[i]);
+	}
+	stored_bits = 8 * (raw_size + 5 * (raw_size / 65535 + 1)) + 8;
+	if( stored_bits <= dynamic_bits )
+	{
+		const unsigned char *p = d->in + d->block_start;
+		if( !reserve_bits( out, raw_size + 5 * (raw_size / 65535 + 1) + 8 ) )
+		{
+			return;
+		}
+		do
+		{
+			int n = (raw_size > 65535) ? 65535 : raw_size;
+			raw_size -= n;
+			put_bits( out, (final && (raw_size == 0)) ? 1 : 0, 3 );
+			align_bits( out );
+			put_bits( out, n, 16 );
+			put_bits( out, n ^ 0xFFFF, 16 );
+			memcpy( out->data + out->size, p, n );
+			out->size += n;
+			p += n;
+		} while( raw_size > 0 );
+	} else
+	{
+		if( !reserve_bits( out, dynamic_bits / 8 + 16 ) )
+		{
+			return;
+		}
+		put_bits( out, final ? 5 : 4, 3 );
+		put_bits( out, litlen_count - 257, 5 );
+		put_bits( out, dist_count - 1, 5 );
+		put_bits( out, length_count - 4, 4 );
+		for( i = 0; i < length_count; ++i )
+		{
+			put_bits( out, length_lengths[code_length_order[i]], 3 );
+		}
+		for( i = 0; i < rle_count; ++i )
+		{
+			int s = rle[i][0];
+			put_bits( out, length_codes[s], length_lengths[s] );
+			if( s >= 16 )
+			{
+				put_bits( out, rle[i][1], (s == 16) ? 2 : ((s == 17) ? 3 : 7) );
+			}
+		}
+		for( i = 0; i < d->symbol_count; ++i )
+		{
+			int v = d->lit_len[i];
+			if( d->dist[i] )
+			{
+				int lc = length_code( v ), dc = dist_code( d->dist[i] );
+				put_bits( out, litlen_codes[257 + lc], lengths[257 + lc] );
+				put_bits( out, v - length_base[lc], length_extra[lc] );
+				put_bits( out, dist_codes[dc], lengths[litlen_count + dc] );
+				put_bits( out, d->dist[i] - dist_base[dc], dist_extra[dc] );
+			} else
+			{
+				put_bits( out, litlen_codes[v], lengths[v] );
+			}
+		}
+		put_bits( out, litlen_codes[256], lengths[256] );
+	}
+}
+
+static void write_block( deflate_state *d, int block_end, int final )
+{
+	emit_block( d, block_end, final );
+	d->symbol_count = 0;
+	d->block_start = block_end;
+}
+
+static unsigned int hash3( const unsigned char *p )
+{
+	unsigned int v = (p[0] << 16) | (p[1] << 8) | p[2];
+	return (v * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+}
+
+/*	puts the positions up to (not including) pos into the hash chains	*/
+static void insert_until( deflate_state *d, int pos )
+{
+	int limit = d->end - DEFLATE_MIN_MATCH + 1;
+	if( pos > limit )
+	{
+		pos = limit;
+	}
+	for( ; d->next_insert < pos; ++d->next_insert )
+	{
+		unsigned int h = hash3( d->in + d->next_insert );
+		d->prev[d->next_insert & DEFLATE_WINDOW_MASK] = d->head[h];
+		d->head[h] = d->next_insert;
+	}
+	if( d->next_insert < pos )
+	{
+		d->next_insert = pos;
+	}
+}
+
+/*	the longest match for pos (0 if under 3), and its distance	*/
+static int find_match( deflate_state *d, int pos, int *distance )
+{
+	const unsigned char *in = d->in;
+	const unsigned char *here = in + pos;
+	int max_length = d->end - pos;
+	int best = DEFLATE_MIN_MATCH - 1;
+	int chain = DEFLATE_MAX_CHAIN;
+	int candidate;
+	if( max_length < DEFLATE_MIN_MATCH )
+	{
+		return 0;
+	}
+	if( max_length > DEFLATE_MAX_MATCH )
+	{
+		max_length = DEFLATE_MAX_MATCH;
+	}
+	candidate = d->head[hash3( here )];
+	while( (candidate >= 0) && (pos - candidate <= DEFLATE_WINDOW) && (chain-- > 0) )
+	{
+		const unsigned char *there = in + candidate;
+		int next;
+		if( (there[best] == here[best]) && (there[0] == here[0]) && (there[1] == here[1]) )
+		{
+			int length = 2;
+			while( (length < max_length) && (there[length] == here[length]) )
+			{
+				++length;
+			}
+			if( length > best )
+			{
+				best = length;
+				*distance = pos - candidate;
+				if( (length >= DEFLATE_NICE_MATCH) || (length == max_length) )
+				{
+					break;
+				}
+			}
+		}
+		/*	(a slot reused by a newer position ends the chain)	*/
+		next = d->prev[candidate & DEFLATE_WINDOW_MASK];
+		if( next >= candidate )
+		{
+			break;
+		}
+		candidate = next;
+	}
+	return (best >= DEFLATE_MIN_MATCH) ? best : 0;
+}
+
+static void add_symbol( deflate_state *d, int lit_len, int distance, int pos )
+{
+	d->lit_len[d->symbol_count] = (unsigned short)lit_len;
+	d->dist[d->symbol_count] = (unsigned short)distance;
+	if( ++d->symbol_count == DEFLATE_BLOCK_SYMBOLS )
+	{
+		write_block( d, pos, 0 );
+	}
+}
+
+/*
+	LZ77 with hash chains and one step of lazy matching, the window
+	primed with the data before start.  A band that isn't the last
+	ends on an empty stored block, which byte aligns it so the next
+	band's output can simply follow it.
+*/
+static void deflate_band( deflate_state *d, int final )
+{
+	int pos = d->start;
+	int i;
+	for( i = 0; i < DEFLATE_HASH_SIZE; ++i )
+	{
+		d->head[i] = -1;
+	}
+	d->next_insert = (d->start > DEFLATE_WINDOW) ? (d->start - DEFLATE_WINDOW) : 0;
+	d->symbol_count = 0;
+	d->block_start = d->start;
+	while( pos < d->end )
+	{
+		int distance = 0, length;
+		insert_until( d, pos );
+		length = find_match( d, pos, &distance );
+		if( (length > 0) && (length < DEFLATE_LAZY_MATCH) )
+		{
+			/*	would starting one later find something longer?	*/
+			int next_distance = 0, next_length;
+			insert_until( d, pos + 1 );
+			next_length = find_match( d, pos + 1, &next_distance );
+			if( next_length > length )
+			{
+				add_symbol( d, d->in[pos], 0, pos + 1 );
+				++pos;
+				length = next_length;
+				distance = next_distance;
+			}
+		}
+		if( length > 0 )
+		{
+			add_symbol( d, length, distance, pos + length );
+			pos += length;
+		} else
+		{
+			add_symbol( d, d->in[pos], 0, pos + 1 );
+			++pos;
+		}
+	}
+	write_block( d, d->end, final );
+	if( (NULL == d->out.data) || !reserve_bits( &d->out, 8 ) )
+	{
+		return;
+	}
+	if( !final )
+	{
+		put_bits( &d->out, 0, 3 );
+		align_bits( &d->out );
+		put_bits( &d->out, 0, 16 );
+		put_bits( &d->out, 0xFFFF, 16 );
+	} else
+	{
+		align_bits( &d->out );
+	}
+}
+
+/********* Checksums *********/
+static unsigned int update_crc( const unsigned int *table, unsigned int crc, const unsigned char *p, int length )
+{
+	crc = ~crc;
+	while( length-- > 0 )
+	{
+		crc = table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+static unsigned int update_adler( unsigned int adler, const unsigned char *p, int length )
+{
+	unsigned int s1 = adler & 0xFFFF, s2 = adler >> 16;
+	while( length > 0 )
+	{
+		/*	5552 bytes is as many as can be summed before the modulo	*/
+		int n = (length < 5552) ? length : 5552;
+		length -= n;
+		while( n-- > 0 )
+		{
+			s1 += *p++;
+			s2 += s1;
+		}
+		s1 %= 65521;
+		s2 %= 65521;
+	}
+	return (s2 << 16) | s1;
+}
+
+/*	the Adler-32 of two runs of data put together, from theirs	*/
+static unsigned int combine_adler( unsigned int adler1, unsigned int adler2, int length2 )
+{
+	const unsigned int base = 65521;
+	unsigned int rem = (unsigned int)length2 % base;
+	unsigned int sum1 = adler1 & 0xFFFF;
+	unsigned int sum2 = (rem * sum1) % base;
+	sum1 += (adler2 & 0xFFFF) + base - 1;
+	sum2 += ((adler1 >> 16) & 0xFFFF) + ((adler2 >> 16) & 0xFFFF) + base - rem;
+	if( sum1 >= base ) { sum1 -= base; }
+	if( sum1 >= base ) { sum1 -= base; }
+	if( sum2 >= (base << 1) ) { sum2 -= (base << 1); }
+	if( sum2 >= base ) { sum2 -= base; }
+	return sum1 | (sum2 << 16);
+}
+
+static void write_u32_be( unsigned char *p, unsigned int value )
+{
+	p[0] = (unsigned char)(value >> 24);
+	p[1] = (unsigned char)(value >> 16);
+	p[2] = (unsigned char)(value >> 8);
+	p[3] = (unsigned char)value;
+}
@@ -0,0 +1,48 @@
+/*
+	PNG writing code, deflating bands of the image in parallel
+
+	public domain
+*/
+
+#ifndef HEADER_IMAGE_PNG
+#define HEADER_IMAGE_PNG
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+	Compresses an 8-bit image (grey, grey-alpha, RGB or RGBA) to a
+	PNG file in RAM.  Each row gets the filter that looks cheapest
+	to code, and bands of rows are deflated on separate threads,
+	each primed with the 32K of data before it, so the result is
+	one ordinary zlib stream.
+	\return NULL if failed, otherwise the PNG (*out_size bytes),
+	to be freed with SOIL_free_image_data
+**/
+unsigned char*
+convert_image_to_PNG
+(
+    const unsigned char *const data,
+    int width, int height, int channels,
+    int *out_size
+);
+
+/**
+	Compresses an image to PNG (see convert_image_to_PNG) and
+	saves it to disk.
+	\return 0 if failed, otherwise returns 1
+**/
+int
+save_image_as_PNG
+(
+    const char *filename,
+    int width, int height, int channels,
+    const unsigned char *const data
+);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HEADER_IMAGE_PNG	*/
@@ -7,10 +7,15 @@
 */
 
 #include "image_helper.h"
+#include "image_resample.h"
+#include "image_perf.h"
 #include <stdlib.h>
 #include <math.h>
 
-/*	Upscaling the image uses simple bilinear interpolation	*/
+/*
+	Upscaling the image is a bilinear resample, done by the separable
+	fixed point resampler (so it is split over the hardware threads)
+*/
 int
 	up_scale_image
 	(
@@ -20,9 +25,6 @@ int
 		int resampled_width, int resampled_height
 	)
 {
-	float dx, dy;
-	int x, y, c;
-
     /* error(s) check	*/
     if ( 	(width < 1) || (height < 1) ||
             (resampled_width < 2) || (resampled_height < 2) ||
@@ -32,53 +34,9 @@ int
         /*	signify badness	*/
         return 0;
     }
-    /*
-		for each given pixel in the new map, find the exact location
-		from the original map which would contribute to this guy
-	*/
-    dx = (width - 1.0f) / (resampled_width - 1.0f);
-    dy = (height - 1.0f) / (resampled_height - 1.0f);
-    for ( y = 0; y < resampled_height; ++y )
-    {
-    	/* find the base y index and fractional offset from that	*/
-    	float sampley = y * dy;
-    	int inty = (int)sampley;
-    	/*	if( inty < 0 ) { inty = 0; } else	*/
-		if( inty > height - 2 ) { inty = height - 2; }
-		sampley -= inty;
-        for ( x = 0; x < resampled_width; ++x )
-        {
-			float samplex = x * dx;
-			int intx = (int)samplex;
-			int base_index;
-			/* find the base x index and fractional offset from that	*/
-			/*	if( intx < 0 ) { intx = 0; } else	*/
-			if( intx > width - 2 ) { intx = width - 2; }
-			samplex -= intx;
-			/*	base index into the original image	*/
-			base_index = (inty * width + intx) * channels;
-            for ( c = 0; c < channels; ++c )
-            {
-            	/*	do the sampling	*/
-				float value = 0.5f;
-				value += orig[base_index]
-							*(1.0f-samplex)*(1.0f-sampley);
-				value += orig[base_index+channels]
-							*(samplex)*(1.0f-sampley);
-				value += orig[base_index+width*channels]
-							*(1.0f-samplex)*(sampley);
-				value += orig[base_index+width*channels+channels]
-							*(samplex)*(sampley);
-				/*	move to the next channel	*/
-				++base_index;
-            	/*	save the new value	*/
-            	resampled[y*resampled_width*channels+x*channels+c] =
-						(unsigned char)(value);
-            }
-        }
-    }
-    /*	done	*/
-    return 1;
+	return resample_image( orig, width, height, channels,
+			resampled, resampled_width, resampled_height,
+			RESAMPLE_FILTER_BILINEAR, 0 );
 }
 
 int
@@ -90,6 +48,8 @@ int
 		int block_size_x, int block_size_y
 	)
 {
+	static perf_stats stats = PERF_STATS_INIT( "mipmap_image", "pixel", 1 );
+	perf_counters counters;
 	int mip_width, mip_height;
 	int i, j, c;
 
@@ -112,6 +72,7 @@ int
 	{
 		mip_height = 1;
 	}
+	PERF_BEGIN( counters );
 	for( j = 0; j < mip_height; ++j )
 	{
 		for( i = 0; i < mip_width; ++i )
@@ -148,6 +109,72 @@ int
 			}
 		}
 	}
+	/*	(per source pixel)	*/
+	PERF_END( counters, stats, (double)width * height );
+	return 1;
+}
+
+/*	the same box filter, for HDR (float) images	*/
+int
+	mipmap_float_image
+	(
+		const float* const orig,
+		int width, int height, int channels,
+		float* resampled,
+		int block_size_x, int block_size_y
+	)
+{
+	int mip_width, mip_height;
+	int i, j, c;
+
+	/*	error check	*/
+	if( (width < 1) || (height < 1) ||
+		(channels < 1) || (orig == NULL) ||
+		(resampled == NULL) ||
+		(block_size_x < 1) || (block_size_y < 1) )
+	{
+		/*	nothing to do	*/
+		return 0;
+	}
+	mip_width = width / block_size_x;
+	mip_height = height / block_size_y;
+	if( mip_width < 1 )
+	{
+		mip_width = 1;
+	}
+	if( mip_height < 1 )
+	{
+		mip_height = 1;
+	}
+	for( j = 0; j < mip_height; ++j )
+	{
+		for( i = 0; i < mip_width; ++i )
+		{
+			for( c = 0; c < channels; ++c )
+			{
+				const int index = (j*block_size_y)*width*channels + (i*block_size_x)*channels + c;
+				float sum_value = 0.0f;
+				int u,v;
+				int u_block = block_size_x;
+				int v_block = block_size_y;
+				/*	don't over-run the boundaries	*/
+				if( block_size_x * (i+1) > width )
+				{
+					u_block = width - i*block_size_x;
+				}
+				if( block_size_y * (j+1) > height )
+				{
+					v_block = height - j*block_size_y;
+				}
+				for( v = 0; v < v_block; ++v )
+				for( u = 0; u < u_block; ++u )
+				{
+					sum_value += orig[index + v*width*channels + u*channels];
+				}
+				resampled[j*mip_width*channels + i*channels + c] = sum_value / (u_block*v_block);
+			}
+		}
+	}
 	return 1;
 }
 
@@ -433,3 +460,53 @@ RGBE_to_RGBdivA2
 	}
 	return 1;
 }
+
+/*	the allocator everything goes through	*/
+static void *(*image_malloc_func)( size_t size, void *user_data ) = NULL;
+static void *(*image_realloc_func)( void *p, size_t size, void *user_data ) = NULL;
+static void (*image_free_func)( void *p, void *user_data ) = NULL;
+static void *image_alloc_user_data = NULL;
+
+void
+	set_image_allocator
+	(
+		void *(*malloc_func)( size_t size, void *user_data ),
+		void *(*realloc_func)( void *p, size_t size, void *user_data ),
+		void (*free_func)( void *p, void *user_data ),
+		void *user_data
+	)
+{
+	image_malloc_func = malloc_func;
+	image_realloc_func = realloc_func;
+	image_free_func = free_func;
+	image_alloc_user_data = user_data;
+}
+
+void *image_malloc( size_t size )
+{
+	if( image_malloc_func )
+	{
+		return image_malloc_func( size, image_alloc_user_data );
+	}
+	return malloc( size );
+}
+
+void *image_realloc( void *p, size_t size )
+{
+	if( image_realloc_func )
+	{
+		return image_realloc_func( p, size, image_alloc_user_data );
+	}
+	return realloc( p, size );
+}
+
+void image_free( void *p )
+{
+	if( image_free_func )
+	{
+		image_free_func( p, image_alloc_user_data );
+	} else
+	{
+		free( p );
+	}
+}
@@ -9,6 +9,8 @@
 #ifndef HEADER_IMAGE_HELPER
 #define HEADER_IMAGE_HELPER
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -43,6 +45,19 @@ int
 		int block_size_x, int block_size_y
 	);
 
+/**
+	This function downscales an HDR (float) image,
+	exactly like mipmap_image does for 8-bit images.
+**/
+int
+	mipmap_float_image
+	(
+		const float* const orig,
+		int width, int height, int channels,
+		float* resampled,
+		int block_size_x, int block_size_y
+	);
+
 /**
 	This function takes the RGB components of the image
 	and scales each channel from [0,255] to [16,235].
@@ -108,6 +123,27 @@ int
 		int rescale_to_max
 	);
 
+/**
+	Sets the functions image_malloc, image_realloc and image_free
+	call on to; NULL functions go back to malloc, realloc and free.
+**/
+void
+	set_image_allocator
+	(
+		void *(*malloc_func)( size_t size, void *user_data ),
+		void *(*realloc_func)( void *p, size_t size, void *user_data ),
+		void (*free_func)( void *p, void *user_data ),
+		void *user_data
+	);
+
+/**
+	Every buffer SOIL allocates or frees goes through these,
+	so they all come from the allocator set above.
+**/
+void *image_malloc( size_t size );
+void *image_realloc( void *p, size_t size );
+void image_free( void *p );
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,282 @@
+/*
+	hardware performance counters for the SOIL image routines
+
+	public domain
+*/
+
+#include "image_perf.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#include <windows.h>
+#else
+	#include <time.h>
+	#include <unistd.h>
+#endif
+#ifdef __linux__
+	#include <sys/ioctl.h>
+	#include <sys/syscall.h>
+	#include <linux/perf_event.h>
+	#include <pthread.h>
+	#define PERF_EVENT_OPEN
+#endif
+
+/*	the events, in the order of perf_counters.start and perf_stats.count	*/
+enum
+{
+	PERF_CYCLES = 0,
+	PERF_INSTRUCTIONS,
+	PERF_CACHE_MISSES,
+	PERF_BRANCH_MISSES,
+	PERF_EVENT_COUNT
+};
+
+static double seconds_now( void )
+{
+#ifdef _WIN32
+	LARGE_INTEGER count, frequency;
+	QueryPerformanceCounter( &count );
+	QueryPerformanceFrequency( &frequency );
+	return (double)count.QuadPart / (double)frequency.QuadPart;
+#else
+	struct timespec t;
+	clock_gettime( CLOCK_MONOTONIC, &t );
+	return t.tv_sec + t.tv_nsec * 1e-9;
+#endif
+}
+
+#ifdef PERF_EVENT_OPEN
+/*	a thread's counters, opened on its first perf_begin and kept open
+	until it exits, so a measurement is only a few ioctls	*/
+typedef struct
+{
+	int fd[PERF_EVENT_COUNT];
+	int depth;	/*	how many sections are running on this thread	*/
+}
+perf_thread_counters;
+
+static pthread_key_t perf_key;
+static pthread_once_t perf_key_once = PTHREAD_ONCE_INIT;
+
+static int open_counter( unsigned long long config )
+{
+	struct perf_event_attr attr;
+	memset( &attr, 0, sizeof( attr ) );
+	attr.size = sizeof( attr );
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	/*	so the worker threads of run_parallel_job count too	*/
+	attr.inherit = 1;
+	return (int)syscall( __NR_perf_event_open, &attr, 0, -1, -1, 0 );
+}
+
+static void close_thread_counters( void *data )
+{
+	perf_thread_counters *tc = (perf_thread_counters*)data;
+	int i;
+	for( i = 0; i < PERF_EVENT_COUNT; ++i )
+	{
+		if( tc->fd[i] >= 0 )
+		{
+			close( tc->fd[i] );
+		}
+	}
+	free( tc );
+}
+
+static void create_perf_key( void )
+{
+	pthread_key_create( &perf_key, close_thread_counters );
+}
+
+static perf_thread_counters* thread_counters( void )
+{
+	static const unsigned long long config[PERF_EVENT_COUNT] =
+	{
+		PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+		PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+	};
+	static int warned = 0;
+	perf_thread_counters *tc;
+	int i;
+	pthread_once( &perf_key_once, create_perf_key );
+	tc = (perf_thread_counters*)pthread_getspecific( perf_key );
+	if( NULL != tc )
+	{
+		return tc;
+	}
+	tc = (perf_thread_counters*)malloc( sizeof( perf_thread_counters ) );
+	if( NULL == tc )
+	{
+		return NULL;
+	}
+	for( i = 0; i < PERF_EVENT_COUNT; ++i )
+	{
+		tc->fd[i] = open_counter( config[i] );
+	}
+	tc->depth = 0;
+	if( (tc->fd[PERF_CYCLES] < 0) && !warned )
+	{
+		warned = 1;
+		fprintf( stderr, "perf: no hardware counters (see "
+				"/proc/sys/kernel/perf_event_paranoid), timing only\n" );
+	}
+	if( 0 != pthread_setspecific( perf_key, tc ) )
+	{
+		close_thread_counters( tc );
+		return NULL;
+	}
+	return tc;
+}
+
+static int read_counter( int fd, double *value )
+{
+	unsigned long long v = 0;
+	if( read( fd, &v, sizeof( v ) ) != (ssize_t)sizeof( v ) )
+	{
+		return 0;
+	}
+	*value = (double)v;
+	return 1;
+}
+#endif
+
+void
+	perf_begin
+	(
+		perf_counters *counters
+	)
+{
+	int i;
+	counters->counting = 0;
+	for( i = 0; i < PERF_EVENT_COUNT; ++i )
+	{
+		counters->start[i] = -1;
+	}
+#ifdef PERF_EVENT_OPEN
+	{
+		perf_thread_counters *tc = thread_counters();
+		if( NULL != tc )
+		{
+			counters->counting = 1;
+			/*	the outermost section starts the counters from zero,
+				one inside it just notes where they had got to	*/
+			if( 0 == tc->depth++ )
+			{
+				for( i = 0; i < PERF_EVENT_COUNT; ++i )
+				{
+					if( tc->fd[i] >= 0 )
+					{
+						ioctl( tc->fd[i], PERF_EVENT_IOC_RESET, 0 );
+						ioctl( tc->fd[i], PERF_EVENT_IOC_ENABLE, 0 );
+					}
+				}
+			}
+			for( i = 0; i < PERF_EVENT_COUNT; ++i )
+			{
+				if( (tc->fd[i] >= 0) && !read_counter( tc->fd[i], &counters->start[i] ) )
+				{
+					counters->start[i] = -1;
+				}
+			}
+		}
+	}
+#endif
+	counters->seconds = seconds_now();
+}
+
+static void report( const char *name, const char *unit, int calls,
+				double units, double seconds, const double count[4], int have_counts )
+{
+	char line[512];
+	int n;
+	if( units < 1 )
+	{
+		units = 1;
+	}
+	n = sprintf( line, "perf: %s", name );
+	if( calls > 1 )
+	{
+		n += sprintf( line + n, " (average of %d)", calls );
+	}
+	n += sprintf( line + n, "  %.0f %ss  %.3f ms", units / calls, unit, seconds * 1000 / calls );
+	if( have_counts )
+	{
+		n += sprintf( line + n, "  %.2f cycles/%s  %.2f IPC  %.4f cache misses/%s  %.4f branch misses/%s",
+				count[PERF_CYCLES] / units, unit,
+				(count[PERF_CYCLES] > 0) ? count[PERF_INSTRUCTIONS] / count[PERF_CYCLES] : 0.0,
+				count[PERF_CACHE_MISSES] / units, unit,
+				count[PERF_BRANCH_MISSES] / units, unit );
+	}
+	fprintf( stderr, "%s\n", line );
+}
+
+void
+	perf_end
+	(
+		perf_counters *counters,
+		perf_stats *stats,
+		double units
+	)
+{
+	double seconds = seconds_now() - counters->seconds;
+	double count[PERF_EVENT_COUNT];
+	int i, have_counts = 0;
+	for( i = 0; i < PERF_EVENT_COUNT; ++i )
+	{
+		count[i] = 0;
+	}
+#ifdef PERF_EVENT_OPEN
+	if( counters->counting )
+	{
+		perf_thread_counters *tc = thread_counters();
+		for( i = 0; i < PERF_EVENT_COUNT; ++i )
+		{
+			double value;
+			if( (counters->start[i] >= 0) && read_counter( tc->fd[i], &value ) )
+			{
+				count[i] = value - counters->start[i];
+				/*	(a CPU without one of the others just reports 0 for it)	*/
+				have_counts |= (i == PERF_CYCLES);
+			}
+		}
+		if( 0 == --tc->depth )
+		{
+			for( i = 0; i < PERF_EVENT_COUNT; ++i )
+			{
+				if( tc->fd[i] >= 0 )
+				{
+					ioctl( tc->fd[i], PERF_EVENT_IOC_DISABLE, 0 );
+				}
+			}
+		}
+	}
+#endif
+	if( stats->report_every <= 1 )
+	{
+		/*	(nothing shared is touched, so any thread may do this)	*/
+		report( stats->name, stats->unit, 1, units, seconds, count, have_counts );
+		return;
+	}
+	stats->calls += 1;
+	stats->units += units;
+	stats->seconds += seconds;
+	for( i = 0; i < PERF_EVENT_COUNT; ++i )
+	{
+		stats->count[i] += count[i];
+	}
+	if( stats->calls >= stats->report_every )
+	{
+		report( stats->name, stats->unit, stats->calls,
+				stats->units, stats->seconds, stats->count, have_counts );
+		stats->calls = 0;
+		stats->units = stats->seconds = 0;
+		memset( stats->count, 0, sizeof( stats->count ) );
+	}
+}
@@ -0,0 +1,82 @@
+/*
+	hardware performance counters for the SOIL image routines
+
+	public domain
+*/
+
+#ifndef HEADER_IMAGE_PERF
+#define HEADER_IMAGE_PERF
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+	Counts cycles, instructions, cache misses and branch misses over a
+	section of code (with Linux's perf_event_open; elsewhere, or if the
+	kernel won't allow it, only the time is measured), and prints them
+	to stderr divided by however many pixels, draws, etc. the section
+	handled.  Threads the section starts are counted along with it.
+	Each thread opens its counters once and keeps them, and sections
+	may nest (the inner one's counts are part of the outer one's).
+
+	The PERF_BEGIN / PERF_END macros do nothing unless SOIL is built
+	with SOIL_PERF_COUNTERS defined, so the instrumented routines pay
+	nothing for it otherwise.
+**/
+typedef struct
+{
+	double start[4];
+	double seconds;
+	int counting;
+}
+perf_counters;
+
+/**
+	Where a section's counts add up.  With report_every at 1 (or 0),
+	every call is printed on its own; otherwise that many calls are
+	added up and printed as one line of averages, so a frame loop
+	doesn't flood the console.  Summing isn't locked, so a section
+	that is summed should only run on one thread at a time.
+**/
+typedef struct
+{
+	const char *name;
+	const char *unit;
+	int report_every;
+	int calls;
+	double units, seconds;
+	double count[4];
+}
+perf_stats;
+
+#define PERF_STATS_INIT( name, unit, report_every )	\
+	{ (name), (unit), (report_every), 0, 0, 0, { 0, 0, 0, 0 } }
+
+void
+	perf_begin
+	(
+		perf_counters *counters
+	);
+
+void
+	perf_end
+	(
+		perf_counters *counters,
+		perf_stats *stats,
+		double units
+	);
+
+#ifdef SOIL_PERF_COUNTERS
+	#define PERF_BEGIN( counters )	perf_begin( &(counters) )
+	#define PERF_END( counters, stats, units )	perf_end( &(counters), &(stats), (units) )
+#else
+	#define PERF_BEGIN( counters )	((void)&(counters))
+	#define PERF_END( counters, stats, units )	((void)&(counters), (void)&(stats))
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HEADER_IMAGE_PERF	*/
@@ -0,0 +1,287 @@
+/*
+	fused per-row pixel processing for the SOIL image routines
+
+	public domain
+*/
+
+#include "image_pipeline.h"
+#include "image_threads.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+	#define PIPELINE_SSE2
+	#include <emmintrin.h>
+#endif
+
+/*	rows handed to a thread at a time	*/
+#define PIPELINE_BAND_ROWS	32
+
+/*
+	scale_image_RGB_to_NTSC_safe builds its table in floating point;
+	this reproduces every entry of it exactly in 16-bit integer math
+	(i * 257 is the byte widened to 16 bits, which SSE2 gets for free)
+*/
+#define NTSC_MUL	56322
+#define NTSC_ADD	3967
+#define NTSC_SAFE( i )	(((((unsigned int)(i) * 257u * NTSC_MUL) >> 16) + NTSC_ADD) >> 8)
+
+/*	one step, run in place on a row	*/
+typedef void (*row_step_function)( unsigned char *row, int width, int channels );
+
+/*	what the threads share	*/
+typedef struct
+{
+	const unsigned char *orig;
+	int width, height, channels;
+	unsigned char *processed;
+	int invert_y;
+	int step_count;
+	row_step_function steps[3];
+}
+pipeline_job;
+
+static unsigned char clamp_to_byte( int x )
+{
+	return (unsigned char)((x < 0) ? 0 : ((x > 255) ? 255 : x));
+}
+
+static void ntsc_safe_row( unsigned char *row, int width, int channels )
+{
+	int i = 0, j;
+	const int count = width * channels;
+	/*	for channels = 2 or 4, ignore the alpha component	*/
+	const int nc = channels - (1 - (channels & 1));
+	#ifdef PIPELINE_SSE2
+	/*	16 bytes is a whole number of pixels, so the alpha bytes
+		sit in the same places in every block	*/
+	const __m128i keep = (channels == 4) ? _mm_set1_epi32( (int)0xFF000000 ) :
+			((channels == 2) ? _mm_set1_epi16( (short)0xFF00 ) : _mm_setzero_si128());
+	const __m128i mul = _mm_set1_epi16( (short)NTSC_MUL );
+	const __m128i add = _mm_set1_epi16( NTSC_ADD );
+	for( ; i + 16 <= count; i += 16 )
+	{
+		__m128i v = _mm_loadu_si128( (const __m128i*)(row + i) );
+		__m128i lo = _mm_mulhi_epu16( _mm_unpacklo_epi8( v, v ), mul );
+		__m128i hi = _mm_mulhi_epu16( _mm_unpackhi_epi8( v, v ), mul );
+		lo = _mm_srli_epi16( _mm_add_epi16( lo, add ), 8 );
+		hi = _mm_srli_epi16( _mm_add_epi16( hi, add ), 8 );
+		lo = _mm_packus_epi16( lo, hi );
+		v = _mm_or_si128( _mm_and_si128( keep, v ), _mm_andnot_si128( keep, lo ) );
+		_mm_storeu_si128( (__m128i*)(row + i), v );
+	}
+	#endif
+	if( nc == channels )
+	{
+		/*	no alpha, every byte gets scaled	*/
+		for( ; i < count; ++i )
+		{
+			row[i] = (unsigned char)NTSC_SAFE( row[i] );
+		}
+		return;
+	}
+	for( ; i < count; i += channels )
+	{
+		for( j = 0; j < nc; ++j )
+		{
+			row[i+j] = (unsigned char)NTSC_SAFE( row[i+j] );
+		}
+	}
+}
+
+static void multiply_alpha_row( unsigned char *row, int width, int channels )
+{
+	int i = 0;
+	const int count = width * channels;
+	#ifdef PIPELINE_SSE2
+	/*	the alpha lanes get multiplied by 256, which leaves them be	*/
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i rounding = _mm_set1_epi16( 128 );
+	const __m128i alpha_lanes = (channels == 4) ?
+			_mm_set_epi16( -1, 0, 0, 0, -1, 0, 0, 0 ) :
+			_mm_set_epi16( -1, 0, -1, 0, -1, 0, -1, 0 );
+	const __m128i alpha_scale = _mm_and_si128( alpha_lanes, _mm_set1_epi16( 256 ) );
+	for( ; i + 16 <= count; i += 16 )
+	{
+		__m128i v = _mm_loadu_si128( (const __m128i*)(row + i) );
+		__m128i half[2];
+		int k;
+		half[0] = _mm_unpacklo_epi8( v, zero );
+		half[1] = _mm_unpackhi_epi8( v, zero );
+		for( k = 0; k < 2; ++k )
+		{
+			__m128i a;
+			if( channels == 4 )
+			{
+				a = _mm_shufflehi_epi16( _mm_shufflelo_epi16( half[k], 0xFF ), 0xFF );
+			} else
+			{
+				a = _mm_shufflehi_epi16( _mm_shufflelo_epi16( half[k], 0xF5 ), 0xF5 );
+			}
+			a = _mm_or_si128( _mm_andnot_si128( alpha_lanes, a ), alpha_scale );
+			half[k] = _mm_srli_epi16( _mm_add_epi16( _mm_mullo_epi16( half[k], a ), rounding ), 8 );
+		}
+		_mm_storeu_si128( (__m128i*)(row + i), _mm_packus_epi16( half[0], half[1] ) );
+	}
+	#endif
+	if( channels == 2 )
+	{
+		for( ; i < count; i += 2 )
+		{
+			row[i] = (row[i] * row[i+1] + 128) >> 8;
+		}
+	} else
+	{
+		for( ; i < count; i += 4 )
+		{
+			row[i+0] = (row[i+0] * row[i+3] + 128) >> 8;
+			row[i+1] = (row[i+1] * row[i+3] + 128) >> 8;
+			row[i+2] = (row[i+2] * row[i+3] + 128) >> 8;
+		}
+	}
+}
+
+static void YCoCg_row( unsigned char *row, int width, int channels )
+{
+	int i = 0;
+	const int count = width * channels;
+	if( channels == 3 )
+	{
+		/*	RGB => CoYCg	*/
+		for( ; i < count; i += 3 )
+		{
+			int r = row[i+0];
+			int g = (row[i+1] + 1) >> 1;
+			int b = row[i+2];
+			int tmp = (2 + r + b) >> 2;
+			row[i+0] = clamp_to_byte( 128 + ((r - b + 1) >> 1) );
+			row[i+1] = clamp_to_byte( g + tmp );
+			row[i+2] = clamp_to_byte( 128 + g - tmp );
+		}
+		return;
+	}
+	/*	RGBA => CoCgAY	*/
+	#ifdef PIPELINE_SSE2
+	{
+		/*	each component is spread over its pixel's 4 lanes, the
+			sums done in 16 bits, and the results picked back out
+			by lane (packus does the clamping)	*/
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i one = _mm_set1_epi16( 1 );
+		const __m128i two = _mm_set1_epi16( 2 );
+		const __m128i half_range = _mm_set1_epi16( 128 );
+		const __m128i lane0 = _mm_set_epi16( 0, 0, 0, -1, 0, 0, 0, -1 );
+		const __m128i lane1 = _mm_slli_si128( lane0, 2 );
+		const __m128i lane2 = _mm_slli_si128( lane0, 4 );
+		const __m128i lane3 = _mm_slli_si128( lane0, 6 );
+		for( ; i + 16 <= count; i += 16 )
+		{
+			__m128i v = _mm_loadu_si128( (const __m128i*)(row + i) );
+			__m128i half[2];
+			int k;
+			half[0] = _mm_unpacklo_epi8( v, zero );
+			half[1] = _mm_unpackhi_epi8( v, zero );
+			for( k = 0; k < 2; ++k )
+			{
+				__m128i r = _mm_shufflehi_epi16( _mm_shufflelo_epi16( half[k], 0x00 ), 0x00 );
+				__m128i g = _mm_shufflehi_epi16( _mm_shufflelo_epi16( half[k], 0x55 ), 0x55 );
+				__m128i b = _mm_shufflehi_epi16( _mm_shufflelo_epi16( half[k], 0xAA ), 0xAA );
+				__m128i a = _mm_shufflehi_epi16( _mm_shufflelo_epi16( half[k], 0xFF ), 0xFF );
+				__m128i tmp = _mm_srli_epi16( _mm_add_epi16( _mm_add_epi16( r, b ), two ), 2 );
+				__m128i co = _mm_add_epi16( half_range,
+						_mm_srai_epi16( _mm_add_epi16( _mm_sub_epi16( r, b ), one ), 1 ) );
+				__m128i cg, y;
+				g = _mm_srli_epi16( _mm_add_epi16( g, one ), 1 );
+				cg = _mm_sub_epi16( _mm_add_epi16( half_range, g ), tmp );
+				y = _mm_add_epi16( g, tmp );
+				half[k] = _mm_or_si128(
+						_mm_or_si128( _mm_and_si128( lane0, co ), _mm_and_si128( lane1, cg ) ),
+						_mm_or_si128( _mm_and_si128( lane2, a ), _mm_and_si128( lane3, y ) ) );
+			}
+			_mm_storeu_si128( (__m128i*)(row + i), _mm_packus_epi16( half[0], half[1] ) );
+		}
+	}
+	#endif
+	for( ; i < count; i += 4 )
+	{
+		int r = row[i+0];
+		int g = (row[i+1] + 1) >> 1;
+		int b = row[i+2];
+		unsigned char a = row[i+3];
+		int tmp = (2 + r + b) >> 2;
+		row[i+0] = clamp_to_byte( 128 + ((r - b + 1) >> 1) );
+		row[i+1] = clamp_to_byte( 128 + g - tmp );
+		row[i+2] = a;
+		row[i+3] = clamp_to_byte( g + tmp );
+	}
+}
+
+static void pipeline_rows( void *job_data, int first, int last )
+{
+	pipeline_job *job = (pipeline_job*)job_data;
+	const int pitch = job->width * job->channels;
+	int y, s;
+	for( y = first; y < last; ++y )
+	{
+		int src_y = job->invert_y ? (job->height - 1 - y) : y;
+		const unsigned char *src = job->orig + src_y * pitch;
+		unsigned char *row = job->processed + y * pitch;
+		if( src != row )
+		{
+			memcpy( row, src, pitch );
+		}
+		for( s = 0; s < job->step_count; ++s )
+		{
+			job->steps[s]( row, job->width, job->channels );
+		}
+	}
+}
+
+int
+	run_image_pipeline
+	(
+		const unsigned char* const orig,
+		int width, int height, int channels,
+		unsigned char* processed,
+		int invert_y,
+		unsigned int steps
+	)
+{
+	pipeline_job job;
+	/*	error check	*/
+	if( (width < 1) || (height < 1) ||
+		(channels < 1) || (channels > 4) ||
+		(NULL == orig) || (NULL == processed) ||
+		(invert_y && (orig == processed)) )
+	{
+		return 0;
+	}
+	job.orig = orig;
+	job.width = width;
+	job.height = height;
+	job.channels = channels;
+	job.processed = processed;
+	job.invert_y = invert_y;
+	/*	chain up the steps that apply to this many channels	*/
+	job.step_count = 0;
+	if( steps & PIPELINE_NTSC_SAFE_RGB )
+	{
+		job.steps[job.step_count++] = ntsc_safe_row;
+	}
+	if( (steps & PIPELINE_MULTIPLY_ALPHA) &&
+		((channels == 2) || (channels == 4)) )
+	{
+		job.steps[job.step_count++] = multiply_alpha_row;
+	}
+	if( (steps & PIPELINE_RGB_TO_YCoCg) && (channels >= 3) )
+	{
+		job.steps[job.step_count++] = YCoCg_row;
+	}
+	if( (orig == processed) && (job.step_count == 0) )
+	{
+		/*	nothing to do	*/
+		return 1;
+	}
+	return run_parallel_job( pipeline_rows, &job, height,
+			PIPELINE_BAND_ROWS, 0 );
+}
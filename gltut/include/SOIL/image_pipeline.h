@@ -0,0 +1,52 @@
+/*
+	fused per-row pixel processing for the SOIL image routines
+
+	public domain
+*/
+
+#ifndef HEADER_IMAGE_PIPELINE
+#define HEADER_IMAGE_PIPELINE
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+	The per-pixel steps run_image_pipeline can apply.  They are
+	always run in this order, whatever order they are OR'd together.
+	A step that makes no sense for the channel count (premultiplying
+	an image without alpha, say) is skipped.
+**/
+enum
+{
+	PIPELINE_NTSC_SAFE_RGB = 1,		/*	scale_image_RGB_to_NTSC_safe	*/
+	PIPELINE_MULTIPLY_ALPHA = 2,	/*	straight to premultiplied alpha	*/
+	PIPELINE_RGB_TO_YCoCg = 4		/*	convert_RGB_to_YCoCg	*/
+};
+
+/**
+	Copies an 8-bit image and applies the requested steps to it, one
+	row at a time: each row is copied (from the bottom up if invert_y
+	is set) and then has every step run on it while it is still in
+	the cache, so the whole job is a single pass over the image.  The
+	rows are split over the hardware threads.  The results match the
+	separate whole-image functions exactly.
+	orig and processed may be the same buffer, but only if invert_y
+	is 0.
+	\return 0 if failed, otherwise returns 1
+**/
+int
+	run_image_pipeline
+	(
+		const unsigned char* const orig,
+		int width, int height, int channels,
+		unsigned char* processed,
+		int invert_y,
+		unsigned int steps
+	);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HEADER_IMAGE_PIPELINE	*/
@@ -0,0 +1,403 @@
+/*
+	separable image resampling, with a choice of filters
+
+	public domain
+*/
+
+#include "image_resample.h"
+#include "image_helper.h"
+#include "image_threads.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+	#define RESAMPLE_SSE2
+	#include <emmintrin.h>
+#endif
+
+/*
+	The weights are 1.14 fixed point, and each output pixel's sum to
+	exactly 1<<14, so flat areas stay flat.  The horizontal pass keeps
+	6 fractional bits in its 16-bit results (room for the overshoot of
+	the Mitchell and Lanczos lobes), and the vertical pass rounds those
+	back to bytes.
+*/
+#define WEIGHT_BITS			14
+#define INTERMEDIATE_BITS	6
+#define H_SHIFT				(WEIGHT_BITS - INTERMEDIATE_BITS)
+#define V_SHIFT				(WEIGHT_BITS + INTERMEDIATE_BITS)
+
+/*	output rows handed to a thread at a time	*/
+#define RESAMPLE_BAND_ROWS	32
+
+#ifndef M_PI
+	#define M_PI 3.14159265358979323846
+#endif
+
+/*	the weights for one axis	*/
+typedef struct
+{
+	int taps;		/*	source pixels per output pixel (some weights may be 0)	*/
+	int *first;		/*	the first of them, for each output pixel	*/
+	short *weights;	/*	taps of them per output pixel	*/
+}
+resample_axis;
+
+/*	what the threads share	*/
+typedef struct
+{
+	const unsigned char *orig;
+	int width, height, channels;
+	unsigned char *resampled;
+	int resampled_width;
+	resample_axis horizontal, vertical;
+	volatile int failed;
+}
+resample_job;
+
+static double filter_support( int filter )
+{
+	switch( filter )
+	{
+	case RESAMPLE_FILTER_BOX:		return 0.5;
+	case RESAMPLE_FILTER_BILINEAR:	return 1.0;
+	case RESAMPLE_FILTER_MITCHELL:	return 2.0;
+	default:						return 3.0;
+	}
+}
+
+static double filter_weight( int filter, double x )
+{
+	x = fabs( x );
+	switch( filter )
+	{
+	case RESAMPLE_FILTER_BOX:
+		return (x < 0.5) ? 1.0 : 0.0;
+	case RESAMPLE_FILTER_BILINEAR:
+		return (x < 1.0) ? 1.0 - x : 0.0;
+	case RESAMPLE_FILTER_MITCHELL:
+		/*	B = C = 1/3	*/
+		if( x < 1.0 )
+		{
+			return (7.0*x*x*x - 12.0*x*x + 16.0/3.0) / 6.0;
+		}
+		if( x < 2.0 )
+		{
+			return (-7.0/3.0*x*x*x + 12.0*x*x - 20.0*x + 32.0/3.0) / 6.0;
+		}
+		return 0.0;
+	default:
+		if( x < 1e-8 )
+		{
+			return 1.0;
+		}
+		if( x < 3.0 )
+		{
+			return 3.0 * sin( M_PI * x ) * sin( M_PI * x / 3.0 ) / (M_PI * M_PI * x * x);
+		}
+		return 0.0;
+	}
+}
+
+/*
+	Works out which source pixels each output pixel takes and how much
+	of each, mapping pixel centres to pixel centres.  When shrinking
+	the filter is stretched to cover every source pixel.  Taps off the
+	edge are folded onto the edge pixel, and every output pixel gets the
+	same number of taps (the window slid to fit inside the image), so
+	the kernels need no special cases.
+*/
+static int build_axis( resample_axis *axis, int src_size, int dst_size, int filter )
+{
+	double scale = (double)dst_size / src_size;
+	double stretch = (scale < 1.0) ? 1.0 / scale : 1.0;
+	double support = filter_support( filter ) * stretch;
+	double *contribution;
+	int i, j, t, taps = 0;
+	axis->first = NULL;
+	axis->weights = NULL;
+	/*	how wide can the window get?	*/
+	for( i = 0; i < dst_size; ++i )
+	{
+		double center = (i + 0.5) / scale - 0.5;
+		int lo = (int)ceil( center - support );
+		int hi = (int)floor( center + support );
+		if( lo < 0 ) { lo = 0; }
+		if( hi > src_size - 1 ) { hi = src_size - 1; }
+		if( hi - lo + 1 > taps ) { taps = hi - lo + 1; }
+	}
+	if( taps < 1 ) { taps = 1; }
+	axis->taps = taps;
+	axis->first = (int*)image_malloc( dst_size * sizeof(int) );
+	axis->weights = (short*)image_malloc( dst_size * taps * sizeof(short) );
+	contribution = (double*)image_malloc( taps * sizeof(double) );
+	if( (NULL == axis->first) || (NULL == axis->weights) || (NULL == contribution) )
+	{
+		image_free( contribution );
+		return 0;
+	}
+	for( i = 0; i < dst_size; ++i )
+	{
+		double center = (i + 0.5) / scale - 0.5;
+		int lo = (int)ceil( center - support );
+		int hi = (int)floor( center + support );
+		int first, total = 0, biggest = 0;
+		double sum = 0.0;
+		short *w = axis->weights + i * taps;
+		first = (lo < 0) ? 0 : lo;
+		if( first > src_size - taps ) { first = src_size - taps; }
+		for( t = 0; t < taps; ++t )
+		{
+			contribution[t] = 0.0;
+		}
+		for( j = lo; j <= hi; ++j )
+		{
+			double v = filter_weight( filter, (j - center) / stretch );
+			int k = j;
+			if( k < 0 ) { k = 0; }
+			if( k > src_size - 1 ) { k = src_size - 1; }
+			contribution[k - first] += v;
+			sum += v;
+		}
+		if( sum == 0.0 )
+		{
+			/*	(can only happen to a box that fell between pixels)	*/
+			int k = (int)floor( center + 0.5 );
+			if( k < 0 ) { k = 0; }
+			if( k > src_size - 1 ) { k = src_size - 1; }
+			contribution[k - first] = sum = 1.0;
+		}
+		/*	normalise, then give the rounding error to the biggest tap	*/
+		for( t = 0; t < taps; ++t )
+		{
+			w[t] = (short)floor( contribution[t] / sum * (1 << WEIGHT_BITS) + 0.5 );
+			total += w[t];
+			if( w[t] > w[biggest] ) { biggest = t; }
+		}
+		w[biggest] += (1 << WEIGHT_BITS) - total;
+		axis->first[i] = first;
+	}
+	image_free( contribution );
+	return 1;
+}
+
+static void free_axis( resample_axis *axis )
+{
+	image_free( axis->first );
+	image_free( axis->weights );
+}
+
+#ifdef RESAMPLE_SSE2
+/*	two weights side by side, for _mm_madd_epi16	*/
+static int weight_pair( short a, short b )
+{
+	return (int)((unsigned int)(unsigned short)a | ((unsigned int)(unsigned short)b << 16));
+}
+
+/*	one RGB or RGBA pixel into the low 4 bytes of a register
+	(built in a register, never reading past an RGB pixel)	*/
+static __m128i load_pixel( const unsigned char *p, int channels )
+{
+	int px;
+	if( channels == 4 )
+	{
+		memcpy( &px, p, 4 );
+	} else
+	{
+		px = p[0] | (p[1] << 8) | (p[2] << 16);
+	}
+	return _mm_cvtsi32_si128( px );
+}
+#endif
+
+/*	filters one source row across, into 16-bit fixed point	*/
+static void resample_row_horizontal( const resample_axis *axis, const unsigned char *src, short *dst, int dst_width, int channels )
+{
+	int x, t, c;
+	const int taps = axis->taps;
+	#ifdef RESAMPLE_SSE2
+	if( channels >= 3 )
+	{
+		/*	all the channels of a pixel in one register: interleave the
+			pixels of each pair of taps so madd sums them per channel.
+			RGB pixels are padded out to 4 bytes on the way in, and
+			write a spare 4th value (into the next pixel, or the
+			band's padding) on the way out	*/
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i round = _mm_set1_epi32( 1 << (H_SHIFT - 1) );
+		for( x = 0; x < dst_width; ++x )
+		{
+			const unsigned char *p = src + axis->first[x] * channels;
+			const short *w = axis->weights + x * taps;
+			__m128i sum = round;
+			for( t = 0; t + 1 < taps; t += 2, p += 2 * channels )
+			{
+				__m128i pixels, weights;
+				pixels = _mm_unpacklo_epi32( load_pixel( p, channels ), load_pixel( p + channels, channels ) );
+				pixels = _mm_unpacklo_epi8( pixels, zero );
+				pixels = _mm_unpacklo_epi16( pixels, _mm_srli_si128( pixels, 8 ) );
+				weights = _mm_set1_epi32( weight_pair( w[t], w[t+1] ) );
+				sum = _mm_add_epi32( sum, _mm_madd_epi16( pixels, weights ) );
+			}
+			if( t < taps )
+			{
+				__m128i pixels = _mm_unpacklo_epi8( load_pixel( p, channels ), zero );
+				pixels = _mm_unpacklo_epi16( pixels, zero );
+				sum = _mm_add_epi32( sum, _mm_madd_epi16( pixels, _mm_set1_epi32( weight_pair( w[t], 0 ) ) ) );
+			}
+			sum = _mm_srai_epi32( sum, H_SHIFT );
+			_mm_storel_epi64( (__m128i*)(dst + x * channels), _mm_packs_epi32( sum, sum ) );
+		}
+		return;
+	}
+	#endif
+	for( x = 0; x < dst_width; ++x )
+	{
+		const unsigned char *p = src + axis->first[x] * channels;
+		const short *w = axis->weights + x * taps;
+		for( c = 0; c < channels; ++c )
+		{
+			int sum = 1 << (H_SHIFT - 1);
+			for( t = 0; t < taps; ++t )
+			{
+				sum += w[t] * p[t * channels + c];
+			}
+			sum >>= H_SHIFT;
+			if( sum > 32767 ) { sum = 32767; }
+			if( sum < -32768 ) { sum = -32768; }
+			dst[x * channels + c] = (short)sum;
+		}
+	}
+}
+
+/*	filters a set of the 16-bit rows down into one row of bytes	*/
+static void resample_row_vertical( const short *const *rows, const short *w, int taps, unsigned char *dst, int count )
+{
+	int i = 0, t;
+	#ifdef RESAMPLE_SSE2
+	const __m128i round = _mm_set1_epi32( 1 << (V_SHIFT - 1) );
+	for( ; i + 8 <= count; i += 8 )
+	{
+		__m128i lo = round, hi = round;
+		for( t = 0; t < taps; t += 2 )
+		{
+			__m128i a = _mm_loadu_si128( (const __m128i*)(rows[t] + i) );
+			__m128i b = _mm_setzero_si128();
+			__m128i weights;
+			short next = 0;
+			if( t + 1 < taps )
+			{
+				b = _mm_loadu_si128( (const __m128i*)(rows[t+1] + i) );
+				next = w[t+1];
+			}
+			weights = _mm_set1_epi32( weight_pair( w[t], next ) );
+			lo = _mm_add_epi32( lo, _mm_madd_epi16( _mm_unpacklo_epi16( a, b ), weights ) );
+			hi = _mm_add_epi32( hi, _mm_madd_epi16( _mm_unpackhi_epi16( a, b ), weights ) );
+		}
+		lo = _mm_packs_epi32( _mm_srai_epi32( lo, V_SHIFT ), _mm_srai_epi32( hi, V_SHIFT ) );
+		_mm_storel_epi64( (__m128i*)(dst + i), _mm_packus_epi16( lo, lo ) );
+	}
+	#endif
+	for( ; i < count; ++i )
+	{
+		int sum = 1 << (V_SHIFT - 1);
+		for( t = 0; t < taps; ++t )
+		{
+			sum += w[t] * rows[t][i];
+		}
+		sum >>= V_SHIFT;
+		dst[i] = (unsigned char)((sum < 0) ? 0 : ((sum > 255) ? 255 : sum));
+	}
+}
+
+/*
+	Makes output rows [first, last): filters across just the source
+	rows they need into a private band, then down the band.
+*/
+static void resample_band( void *job_data, int first, int last )
+{
+	resample_job *job = (resample_job*)job_data;
+	const int row_values = job->resampled_width * job->channels;
+	const int taps = job->vertical.taps;
+	int src_first = job->vertical.first[first];
+	int src_last = job->vertical.first[last-1] + taps;
+	short *band;
+	const short **rows;
+	int y, t;
+	if( job->failed )
+	{
+		return;
+	}
+	band = (short*)image_malloc( ((src_last - src_first) * row_values + 1) * sizeof(short) );
+	rows = (const short**)image_malloc( taps * sizeof(short*) );
+	if( (NULL == band) || (NULL == rows) )
+	{
+		job->failed = 1;
+		image_free( band );
+		image_free( (void*)rows );
+		return;
+	}
+	for( y = src_first; y < src_last; ++y )
+	{
+		resample_row_horizontal( &job->horizontal,
+				job->orig + y * job->width * job->channels,
+				band + (y - src_first) * row_values,
+				job->resampled_width, job->channels );
+	}
+	for( y = first; y < last; ++y )
+	{
+		for( t = 0; t < taps; ++t )
+		{
+			rows[t] = band + (job->vertical.first[y] + t - src_first) * row_values;
+		}
+		resample_row_vertical( rows, job->vertical.weights + y * taps, taps,
+				job->resampled + y * row_values, row_values );
+	}
+	image_free( band );
+	image_free( (void*)rows );
+}
+
+int
+	resample_image
+	(
+		const unsigned char* const orig,
+		int width, int height, int channels,
+		unsigned char* resampled,
+		int resampled_width, int resampled_height,
+		int filter,
+		int max_threads
+	)
+{
+	resample_job job;
+	/*	error check	*/
+	if( (width < 1) || (height < 1) ||
+		(resampled_width < 1) || (resampled_height < 1) ||
+		(channels < 1) || (channels > 4) ||
+		(filter < RESAMPLE_FILTER_BOX) || (filter > RESAMPLE_FILTER_LANCZOS) ||
+		(NULL == orig) || (NULL == resampled) )
+	{
+		return 0;
+	}
+	job.orig = orig;
+	job.width = width;
+	job.height = height;
+	job.channels = channels;
+	job.resampled = resampled;
+	job.resampled_width = resampled_width;
+	job.failed = 0;
+	job.vertical.first = NULL;
+	job.vertical.weights = NULL;
+	if( !build_axis( &job.horizontal, width, resampled_width, filter ) ||
+		!build_axis( &job.vertical, height, resampled_height, filter ) )
+	{
+		job.failed = 1;
+	} else
+	{
+		run_parallel_job( resample_band, &job, resampled_height,
+				RESAMPLE_BAND_ROWS, max_threads );
+	}
+	free_axis( &job.horizontal );
+	free_axis( &job.vertical );
+	return !job.failed;
+}
@@ -0,0 +1,51 @@
+/*
+	separable image resampling, with a choice of filters
+
+	public domain
+*/
+
+#ifndef HEADER_IMAGE_RESAMPLE
+#define HEADER_IMAGE_RESAMPLE
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+	The filters resample_image can use.  Box averages the source
+	pixels each output pixel covers (nearest neighbour when
+	enlarging), bilinear is a tent, Mitchell is the B=C=1/3 cubic and
+	Lanczos is the 3 lobe windowed sinc, the sharpest of them.
+**/
+enum
+{
+	RESAMPLE_FILTER_BOX = 0,
+	RESAMPLE_FILTER_BILINEAR = 1,
+	RESAMPLE_FILTER_MITCHELL = 2,
+	RESAMPLE_FILTER_LANCZOS = 3
+};
+
+/**
+	Resizes an 8-bit image to any size, up or down, in two separable
+	passes: across the rows, then down the columns.  The weights for
+	each axis are worked out once, in fixed point, and the rows are
+	split over up to max_threads threads (0 means one per hardware
+	thread).
+	\return 0 if failed, otherwise returns 1
+**/
+int
+	resample_image
+	(
+		const unsigned char* const orig,
+		int width, int height, int channels,
+		unsigned char* resampled,
+		int resampled_width, int resampled_height,
+		int filter,
+		int max_threads
+	);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HEADER_IMAGE_RESAMPLE	*/
@@ -0,0 +1,418 @@
+/*
+	simple worker threads for the SOIL image routines
+
+	public domain
+*/
+
+#include "image_threads.h"
+#include "stb_image_aug.h"
+#include <stdlib.h>
+
+#if defined(WIN32) || defined(_WIN32)
+	#define WIN32_LEAN_AND_MEAN
+	#include <windows.h>
+	#define SOIL_THREAD_WIN32	1
+#else
+	#include <pthread.h>
+	#include <sched.h>
+	#include <unistd.h>
+#endif
+
+/*	no sense in spinning up more threads than this	*/
+#define MAX_WORKER_THREADS	64
+
+typedef struct
+{
+	parallel_job_function job;
+	void *job_data;
+	int count, grain_size;
+	volatile long next_item;
+}
+parallel_job;
+
+/*	one thread's share of a work stealing job	*/
+typedef struct
+{
+	volatile long lock;
+	int next, end;	/*	the items [next, end) still to do	*/
+}
+stealing_share;
+
+typedef struct
+{
+	parallel_job_function job;
+	void *job_data;
+	int num_threads;
+	stealing_share shares[MAX_WORKER_THREADS];
+}
+stealing_job;
+
+typedef struct
+{
+	stealing_job *sj;
+	int self;
+}
+stealing_worker;
+
+/********* Function Prototypes *********/
+static long claim_items( volatile long *next_item, long grain_size );
+static void work_on_job( parallel_job *pj );
+static void lock_share( stealing_share *share );
+static void unlock_share( stealing_share *share );
+static void work_stealing( stealing_job *sj, int self );
+
+/********* Actual Exposed Functions *********/
+int
+	query_thread_count
+	(
+		void
+	)
+{
+	static int thread_count = 0;
+	if( thread_count < 1 )
+	{
+		int n = 1;
+		#ifdef SOIL_THREAD_WIN32
+			SYSTEM_INFO info;
+			GetSystemInfo( &info );
+			n = (int)info.dwNumberOfProcessors;
+		#elif defined(_SC_NPROCESSORS_ONLN)
+			n = (int)sysconf( _SC_NPROCESSORS_ONLN );
+		#endif
+		if( n < 1 )
+		{
+			n = 1;
+		}
+		thread_count = n;
+	}
+	return thread_count;
+}
+
+#ifdef SOIL_THREAD_WIN32
+static DWORD WINAPI worker_thread( LPVOID arg )
+{
+	work_on_job( (parallel_job*)arg );
+	return 0;
+}
+#else
+static void* worker_thread( void *arg )
+{
+	work_on_job( (parallel_job*)arg );
+	return NULL;
+}
+#endif
+
+#ifdef SOIL_THREAD_WIN32
+static DWORD WINAPI stealing_thread( LPVOID arg )
+{
+	stealing_worker *w = (stealing_worker*)arg;
+	work_stealing( w->sj, w->self );
+	/*	the thread is about to exit, so the scratch memory its
+		decodes kept for each other goes (the caller keeps its own)	*/
+	stbi_release_scratch();
+	return 0;
+}
+#else
+static void* stealing_thread( void *arg )
+{
+	stealing_worker *w = (stealing_worker*)arg;
+	work_stealing( w->sj, w->self );
+	/*	the thread is about to exit, so the scratch memory its
+		decodes kept for each other goes (the caller keeps its own)	*/
+	stbi_release_scratch();
+	return NULL;
+}
+#endif
+
+int
+	run_parallel_job
+	(
+		parallel_job_function job,
+		void *job_data,
+		int count, int grain_size,
+		int max_threads
+	)
+{
+	parallel_job pj;
+	int i, num_threads, started = 0;
+	#ifdef SOIL_THREAD_WIN32
+		HANDLE threads[MAX_WORKER_THREADS];
+	#else
+		pthread_t threads[MAX_WORKER_THREADS];
+	#endif
+	/*	error check	*/
+	if( (NULL == job) || (count < 0) )
+	{
+		return 0;
+	}
+	if( grain_size < 1 )
+	{
+		grain_size = 1;
+	}
+	/*	how many threads are worth it?	*/
+	num_threads = max_threads;
+	if( num_threads < 1 )
+	{
+		num_threads = query_thread_count();
+	}
+	if( num_threads > (count + grain_size - 1) / grain_size )
+	{
+		num_threads = (count + grain_size - 1) / grain_size;
+	}
+	if( num_threads > MAX_WORKER_THREADS )
+	{
+		num_threads = MAX_WORKER_THREADS;
+	}
+	/*	not worth a thread?  just do it here	*/
+	if( num_threads < 2 )
+	{
+		if( count > 0 )
+		{
+			job( job_data, 0, count );
+		}
+		return 1;
+	}
+	pj.job = job;
+	pj.job_data = job_data;
+	pj.count = count;
+	pj.grain_size = grain_size;
+	pj.next_item = 0;
+	/*	start the helpers (if one fails to start, the rest of
+		us simply pick up its share of the work)	*/
+	for( i = 1; i < num_threads; ++i )
+	{
+		#ifdef SOIL_THREAD_WIN32
+			threads[started] = CreateThread( NULL, 0, worker_thread, &pj, 0, NULL );
+			if( NULL == threads[started] )
+			{
+				break;
+			}
+		#else
+			if( 0 != pthread_create( &threads[started], NULL, worker_thread, &pj ) )
+			{
+				break;
+			}
+		#endif
+		++started;
+	}
+	/*	and pitch in	*/
+	work_on_job( &pj );
+	/*	wait for everyone to finish	*/
+	for( i = 0; i < started; ++i )
+	{
+		#ifdef SOIL_THREAD_WIN32
+			WaitForSingleObject( threads[i], INFINITE );
+			CloseHandle( threads[i] );
+		#else
+			pthread_join( threads[i], NULL );
+		#endif
+	}
+	return 1;
+}
+
+int
+	run_stealing_job
+	(
+		parallel_job_function job,
+		void *job_data,
+		int count,
+		int max_threads
+	)
+{
+	stealing_job sj;
+	stealing_worker workers[MAX_WORKER_THREADS];
+	int i, num_threads, started = 0;
+	#ifdef SOIL_THREAD_WIN32
+		HANDLE threads[MAX_WORKER_THREADS];
+	#else
+		pthread_t threads[MAX_WORKER_THREADS];
+	#endif
+	/*	error check	*/
+	if( (NULL == job) || (count < 0) )
+	{
+		return 0;
+	}
+	/*	how many threads are worth it?	*/
+	num_threads = max_threads;
+	if( num_threads < 1 )
+	{
+		num_threads = query_thread_count();
+	}
+	if( num_threads > count )
+	{
+		num_threads = count;
+	}
+	if( num_threads > MAX_WORKER_THREADS )
+	{
+		num_threads = MAX_WORKER_THREADS;
+	}
+	/*	not worth a thread?  just do it here	*/
+	if( num_threads < 2 )
+	{
+		for( i = 0; i < count; ++i )
+		{
+			job( job_data, i, i + 1 );
+		}
+		return 1;
+	}
+	/*	deal the items out in even runs	*/
+	sj.job = job;
+	sj.job_data = job_data;
+	sj.num_threads = num_threads;
+	for( i = 0; i < num_threads; ++i )
+	{
+		sj.shares[i].lock = 0;
+		sj.shares[i].next = (int)((long long)count * i / num_threads);
+		sj.shares[i].end = (int)((long long)count * (i + 1) / num_threads);
+		workers[i].sj = &sj;
+		workers[i].self = i;
+	}
+	/*	start the helpers (a share whose thread fails to start
+		just gets stolen by the others)	*/
+	for( i = 1; i < num_threads; ++i )
+	{
+		#ifdef SOIL_THREAD_WIN32
+			threads[started] = CreateThread( NULL, 0, stealing_thread, &workers[i], 0, NULL );
+			if( NULL == threads[started] )
+			{
+				continue;
+			}
+		#else
+			if( 0 != pthread_create( &threads[started], NULL, stealing_thread, &workers[i] ) )
+			{
+				continue;
+			}
+		#endif
+		++started;
+	}
+	/*	and pitch in	*/
+	work_stealing( &sj, 0 );
+	/*	wait for everyone to finish	*/
+	for( i = 0; i < started; ++i )
+	{
+		#ifdef SOIL_THREAD_WIN32
+			WaitForSingleObject( threads[i], INFINITE );
+			CloseHandle( threads[i] );
+		#else
+			pthread_join( threads[i], NULL );
+		#endif
+	}
+	return 1;
+}
+
+/********* Helper Functions *********/
+static long claim_items( volatile long *next_item, long grain_size )
+{
+	/*	atomically grab the next grain, returning its first item	*/
+	#ifdef SOIL_THREAD_WIN32
+		return InterlockedExchangeAdd( next_item, grain_size );
+	#else
+		return __sync_fetch_and_add( next_item, grain_size );
+	#endif
+}
+
+static void work_on_job( parallel_job *pj )
+{
+	for( ;; )
+	{
+		long first = claim_items( &pj->next_item, pj->grain_size );
+		long last = first + pj->grain_size;
+		if( first >= pj->count )
+		{
+			break;
+		}
+		if( last > pj->count )
+		{
+			last = pj->count;
+		}
+		pj->job( pj->job_data, (int)first, (int)last );
+	}
+}
+
+static void lock_share( stealing_share *share )
+{
+	/*	shares are only locked to take an item or to steal, which
+		is nothing next to the work itself, so a spin lock will do	*/
+	#ifdef SOIL_THREAD_WIN32
+		while( InterlockedExchange( &share->lock, 1 ) )
+		{
+			SwitchToThread();
+		}
+	#else
+		while( __sync_lock_test_and_set( &share->lock, 1 ) )
+		{
+			sched_yield();
+		}
+	#endif
+}
+
+static void unlock_share( stealing_share *share )
+{
+	#ifdef SOIL_THREAD_WIN32
+		InterlockedExchange( &share->lock, 0 );
+	#else
+		__sync_lock_release( &share->lock );
+	#endif
+}
+
+static void work_stealing( stealing_job *sj, int self )
+{
+	stealing_share *mine = &sj->shares[self];
+	for( ;; )
+	{
+		int i, item = -1, victim = -1, most = 0;
+		/*	my own items first, in order	*/
+		lock_share( mine );
+		if( mine->next < mine->end )
+		{
+			item = mine->next++;
+		}
+		unlock_share( mine );
+		if( item >= 0 )
+		{
+			sj->job( sj->job_data, item, item + 1 );
+			continue;
+		}
+		/*	out of work, so find whoever has the most left...	*/
+		for( i = 0; i < sj->num_threads; ++i )
+		{
+			int left;
+			if( i == self )
+			{
+				continue;
+			}
+			lock_share( &sj->shares[i] );
+			left = sj->shares[i].end - sj->shares[i].next;
+			unlock_share( &sj->shares[i] );
+			if( left > most )
+			{
+				most = left;
+				victim = i;
+			}
+		}
+		if( victim < 0 )
+		{
+			/*	nothing left anywhere	*/
+			break;
+		}
+		/*	...and take the back half of it (it may have shrunk since)	*/
+		lock_share( &sj->shares[victim] );
+		most = sj->shares[victim].end - sj->shares[victim].next;
+		if( most > 0 )
+		{
+			most = (most + 1) / 2;
+			sj->shares[victim].end -= most;
+			item = sj->shares[victim].end;
+		}
+		unlock_share( &sj->shares[victim] );
+		/*	(never holding two locks at once, so two thieves
+			robbing each other can't deadlock)	*/
+		if( most > 0 )
+		{
+			lock_share( mine );
+			mine->next = item;
+			mine->end = item + most;
+			unlock_share( mine );
+		}
+	}
+}
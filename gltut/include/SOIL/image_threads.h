@@ -0,0 +1,69 @@
+/*
+	simple worker threads for the SOIL image routines
+
+	public domain
+*/
+
+#ifndef HEADER_IMAGE_THREADS
+#define HEADER_IMAGE_THREADS
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+	The work function handed to run_parallel_job.  It is called
+	with the caller's job data and a half-open range of items
+	[first, last) to process.  Ranges never overlap, so the job
+	only needs to be safe against itself on disjoint items.
+**/
+typedef void (*parallel_job_function)( void *job_data, int first, int last );
+
+/**
+	Returns the number of hardware threads (always at least 1).
+**/
+int
+	query_thread_count
+	(
+		void
+	);
+
+/**
+	Processes count items using up to max_threads threads (0 means
+	one per hardware thread).  Items are claimed grain_size at a
+	time, so uneven work balances itself out.  The calling thread
+	works too, and the function returns once every item is done.
+	\return 0 if failed, otherwise returns 1
+**/
+int
+	run_parallel_job
+	(
+		parallel_job_function job,
+		void *job_data,
+		int count, int grain_size,
+		int max_threads
+	);
+
+/**
+	Like run_parallel_job, but for fewer, bigger items of uneven
+	cost (whole images, say).  Each thread starts on its own run of
+	items, one at a time, and when it runs dry it steals the back
+	half of whatever run has the most left, so nobody contends on a
+	shared counter and the expensive items still get spread around.
+	The job is called with one item at a time ([i, i+1)).
+	\return 0 if failed, otherwise returns 1
+**/
+int
+	run_stealing_job
+	(
+		parallel_job_function job,
+		void *job_data,
+		int count,
+		int max_threads
+	);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HEADER_IMAGE_THREADS	*/
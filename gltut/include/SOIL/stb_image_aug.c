@@ -11,7 +11,7 @@
       TGA (not sure what subset, if a subset)
       PSD (composited view only, no extra channels)
       HDR (radiance rgbE format)
-      writes BMP,TGA (define STBI_NO_WRITE to remove code)
+      writes BMP,TGA,QOI (define STBI_NO_WRITE to remove code)
       decoded from memory or through stdio FILE (define STBI_NO_STDIO to remove code)
       supports installable dequantizing-IDCT, YCbCr-to-RGB conversion (define STBI_SIMD)
 
@@ -73,6 +73,10 @@
 #ifndef STBI_NO_STDIO
 #include <stdio.h>
 #endif
+
+#ifndef STBI_NO_THREADS
+#include "image_threads.h"
+#endif
 #include <stdlib.h>
 #include <memory.h>
 #include <assert.h>
@@ -94,9 +98,45 @@ typedef   signed short  int16;
 typedef unsigned int   uint32;
 typedef   signed int    int32;
 typedef unsigned int   uint;
+#ifdef _MSC_VER
+typedef unsigned __int64 uint64;
+#else
+typedef unsigned long long uint64;
+#endif
 
 // should produce compiler error if size is wrong
 typedef unsigned char validate_uint32[sizeof(uint32)==4];
+typedef unsigned char validate_uint64[sizeof(uint64)==8];
+
+// SSE2 kernels: always there on x64, and on x86 when the compiler is
+// allowed to use it (MSVC always is, the CPU is checked at run time)
+#if !defined(STBI_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_MSC_VER) && defined(_M_IX86)))
+#define STBI_SSE2
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// tools/simd_check.c includes this file, and clears this to run the
+// scalar code on the same input
+static int stbi_sse2_enabled = 1;
+
+static int stbi_sse2_available(void)
+{
+   if (!stbi_sse2_enabled) return 0;
+#if defined(_MSC_VER) && defined(_M_IX86) && !defined(__SSE2__)
+   static int available = -1;
+   if (available < 0) {
+      int info[4];
+      __cpuid(info, 1);
+      available = (info[3] >> 26) & 1;
+   }
+   return available;
+#else
+   return 1;
+#endif
+}
+#endif
 
 #if defined(STBI_NO_STDIO) && !defined(STBI_NO_WRITE)
 #define STBI_NO_WRITE
@@ -114,20 +154,278 @@ typedef unsigned char validate_uint32[sizeof(uint32)==4];
 // Generic API that works on all image types
 //
 
-// this is not threadsafe
-static char *failure_reason;
+// Decoder state that isn't in the arguments lives in an stbi_context. The
+// context in use is per thread: whatever stbi_set_thread_context last made
+// current, otherwise the shared default one. The default context's failure
+// reason is kept per thread too, so plain stbi_load calls on different
+// threads don't see each other's errors.
+#if defined(_MSC_VER)
+   #define STBI_THREAD_LOCAL   __declspec(thread)
+#elif defined(__GNUC__)
+   #define STBI_THREAD_LOCAL   __thread
+#else
+   #define STBI_THREAD_LOCAL   // no way to ask for it; single threaded use only
+#endif
+
+static stbi_context default_context = {
+   NULL,             // failure_reason, unused: see default_failure_reason
+   2.2f, 1.0f,       // hdr_to_ldr gamma, scale
+   2.2f, 1.0f,       // ldr_to_hdr gamma, scale
+   1,                // jpeg_max_threads
+   NULL, NULL, NULL, NULL,
+   0,                // scratch_limit
+   #if STBI_SIMD
+   NULL, NULL,
+   #endif
+};
+static STBI_THREAD_LOCAL stbi_context *thread_context;
+static STBI_THREAD_LOCAL char *default_failure_reason;
+
+__forceinline static stbi_context *get_context(void)
+{
+   return thread_context ? thread_context : &default_context;
+}
+
+void stbi_context_init(stbi_context *ctx)
+{
+   memcpy(ctx, &default_context, sizeof(*ctx));
+   // the settings start out as the built-in defaults, not whatever the
+   // default context has been changed to
+   ctx->hdr_to_ldr_gamma = ctx->ldr_to_hdr_gamma = 2.2f;
+   ctx->hdr_to_ldr_scale = ctx->ldr_to_hdr_scale = 1.0f;
+   ctx->jpeg_max_threads = 1;
+   ctx->malloc_func = NULL;
+   ctx->realloc_func = NULL;
+   ctx->free_func = NULL;
+   ctx->alloc_user_data = NULL;
+   ctx->scratch_limit = 0;
+   #if STBI_SIMD
+   ctx->idct = NULL;
+   ctx->YCbCr_to_RGB = NULL;
+   #endif
+}
+
+stbi_context *stbi_set_thread_context(stbi_context *ctx)
+{
+   stbi_context *prev = thread_context;
+   thread_context = ctx;
+   return prev;
+}
 
 char *stbi_failure_reason(void)
 {
-   return failure_reason;
+   return thread_context ? thread_context->failure_reason : default_failure_reason;
 }
 
 static int e(char *str)
 {
-   failure_reason = str;
+   if (thread_context)
+      thread_context->failure_reason = str;
+   else
+      default_failure_reason = str;
    return 0;
 }
 
+// every allocation goes through the context's allocator, so a decode can
+// be kept out of the global heap
+static void *stbi_malloc(size_t size)
+{
+   stbi_context *ctx = get_context();
+   if (ctx->malloc_func) return ctx->malloc_func(size, ctx->alloc_user_data);
+   return malloc(size);
+}
+
+static void *stbi_realloc(void *p, size_t size)
+{
+   stbi_context *ctx = get_context();
+   if (ctx->realloc_func) return ctx->realloc_func(p, size, ctx->alloc_user_data);
+   return realloc(p, size);
+}
+
+static void stbi_free(void *p)
+{
+   stbi_context *ctx = get_context();
+   if (ctx->free_func) ctx->free_func(p, ctx->alloc_user_data);
+   else free(p);
+}
+
+void stbi_set_allocator(void *(*malloc_func)(size_t size, void *user_data),
+                        void *(*realloc_func)(void *p, size_t size, void *user_data),
+                        void  (*free_func)(void *p, void *user_data),
+                        void  *user_data)
+{
+   default_context.malloc_func = malloc_func;
+   default_context.realloc_func = realloc_func;
+   default_context.free_func = free_func;
+   default_context.alloc_user_data = user_data;
+}
+
+// Scratch memory: each allocation is carved off the end of the thread's
+// current block, behind a header holding its size, and only the most
+// recent one can be freed or grown in place; the rest go when the
+// outermost decode ends.  A decode that outgrows the block chains on
+// another; afterwards the chain is swapped for one block of its total
+// size, so the next decode of a similar image fits in one.  Only up to
+// STBI_SCRATCH_KEEP bytes stay with the thread between decodes, so one
+// huge image doesn't pin its scratch memory for the thread's lifetime.
+
+#define SCRATCH_ALIGN   16
+#define SCRATCH_ROUND(n)   (((n) + SCRATCH_ALIGN-1) & ~(size_t) (SCRATCH_ALIGN-1))
+#define SCRATCH_MIN_BLOCK  65536
+#ifndef STBI_SCRATCH_KEEP
+#define STBI_SCRATCH_KEEP  (4 << 20)
+#endif
+
+typedef struct stbi_scratch_block
+{
+   struct stbi_scratch_block *prev;   // earlier in the chain
+   size_t size, used;
+   void  (*free_func)(void *p, void *user_data);   // what it came from
+   void  *alloc_user_data;
+} stbi_scratch_block;
+
+#define SCRATCH_BLOCK_HEADER   SCRATCH_ROUND(sizeof(stbi_scratch_block))
+
+typedef struct
+{
+   stbi_scratch_block *block;
+   int depth;              // decodes under way (they can nest)
+   size_t in_use, peak;    // bytes carved off during this decode
+   size_t last_peak;       // ... and the most the last decode used
+   size_t next_size;       // the block to start the next chain with
+} stbi_scratch;
+
+static STBI_THREAD_LOCAL stbi_scratch scratch;
+
+static uint8 *scratch_base(stbi_scratch_block *b)
+{
+   return (uint8 *) b + SCRATCH_BLOCK_HEADER;
+}
+
+static void scratch_free_chain(void)
+{
+   while (scratch.block) {
+      stbi_scratch_block *b = scratch.block;
+      scratch.block = b->prev;
+      if (b->free_func) b->free_func(b, b->alloc_user_data);
+      else free(b);
+   }
+}
+
+static void scratch_begin(void)
+{
+   if (scratch.depth++ == 0)
+      scratch.in_use = scratch.peak = 0;
+}
+
+static void scratch_end(void)
+{
+   if (--scratch.depth) return;
+   scratch.last_peak = scratch.peak;
+   if (scratch.block && scratch.block->prev) {
+      size_t total = 0;
+      stbi_scratch_block *b;
+      for (b = scratch.block; b; b = b->prev)
+         total += b->size;
+      scratch_free_chain();
+      scratch.next_size = total < STBI_SCRATCH_KEEP ? total : STBI_SCRATCH_KEEP;
+   } else if (scratch.block) {
+      if (scratch.block->size > STBI_SCRATCH_KEEP) {
+         // too big to keep around; a big decode will chain back up to it
+         scratch_free_chain();
+         scratch.next_size = STBI_SCRATCH_KEEP;
+      } else {
+         scratch.block->used = 0;
+      }
+   }
+}
+
+static void *scratch_malloc(size_t size)
+{
+   stbi_context *ctx = get_context();
+   stbi_scratch_block *b = scratch.block;
+   size_t need = SCRATCH_ALIGN + SCRATCH_ROUND(size);
+   uint8 *p;
+   assert(scratch.depth > 0);
+   if (ctx->scratch_limit && scratch.in_use + need > ctx->scratch_limit) return NULL;
+   if (b == NULL || b->used + need > b->size) {
+      size_t block_size = need > scratch.next_size ? need : scratch.next_size;
+      if (block_size < SCRATCH_MIN_BLOCK) block_size = SCRATCH_MIN_BLOCK;
+      b = (stbi_scratch_block *) stbi_malloc(SCRATCH_BLOCK_HEADER + block_size);
+      if (b == NULL) return NULL;
+      b->prev = scratch.block;
+      b->size = block_size;
+      b->used = 0;
+      b->free_func = ctx->free_func;
+      b->alloc_user_data = ctx->alloc_user_data;
+      scratch.block = b;
+      scratch.next_size = block_size * 2;
+   }
+   p = scratch_base(b) + b->used;
+   *(size_t *) p = size;
+   b->used += need;
+   scratch.in_use += need;
+   if (scratch.in_use > scratch.peak) scratch.peak = scratch.in_use;
+   return p + SCRATCH_ALIGN;
+}
+
+// is p the most recent allocation?
+static int scratch_is_last(uint8 *p)
+{
+   stbi_scratch_block *b = scratch.block;
+   size_t size = *(size_t *) (p - SCRATCH_ALIGN);
+   return b && p + SCRATCH_ROUND(size) == scratch_base(b) + b->used;
+}
+
+static void scratch_free(void *p)
+{
+   uint8 *q = (uint8 *) p;
+   if (q && scratch_is_last(q)) {
+      size_t need = SCRATCH_ALIGN + SCRATCH_ROUND(*(size_t *) (q - SCRATCH_ALIGN));
+      scratch.block->used -= need;
+      scratch.in_use -= need;
+   }
+}
+
+static void *scratch_realloc(void *p, size_t size)
+{
+   uint8 *q = (uint8 *) p, *r;
+   size_t old;
+   if (q == NULL) return scratch_malloc(size);
+   old = *(size_t *) (q - SCRATCH_ALIGN);
+   if (size <= old) return q;
+   if (scratch_is_last(q)) {
+      // grow it where it is, if the block has room
+      stbi_scratch_block *b = scratch.block;
+      size_t grow = SCRATCH_ROUND(size) - SCRATCH_ROUND(old);
+      stbi_context *ctx = get_context();
+      if (b->used + grow <= b->size &&
+            !(ctx->scratch_limit && scratch.in_use + grow > ctx->scratch_limit)) {
+         b->used += grow;
+         scratch.in_use += grow;
+         if (scratch.in_use > scratch.peak) scratch.peak = scratch.in_use;
+         *(size_t *) (q - SCRATCH_ALIGN) = size;
+         return q;
+      }
+   }
+   r = (uint8 *) scratch_malloc(size);
+   if (r == NULL) return NULL;
+   memcpy(r, q, old < size ? old : size);
+   return r;
+}
+
+void stbi_release_scratch(void)
+{
+   if (scratch.depth) return;
+   scratch_free_chain();
+   scratch.next_size = 0;
+}
+
+size_t stbi_scratch_peak(void)
+{
+   return scratch.last_peak;
+}
+
 #ifdef STBI_NO_FAILURE_STRINGS
    #define e(x,y)  0
 #elif defined(STBI_FAILURE_USERMSG)
@@ -141,7 +439,14 @@ static int e(char *str)
 
 void stbi_image_free(void *retval_from_stbi_load)
 {
-   free(retval_from_stbi_load);
+   stbi_free(retval_from_stbi_load);
+}
+
+void stbi_image_free_ctx(stbi_context *ctx, void *retval_from_stbi_load)
+{
+   stbi_context *prev = stbi_set_thread_context(ctx);
+   stbi_free(retval_from_stbi_load);
+   stbi_set_thread_context(prev);
 }
 
 #define MAX_LOADERS  32
@@ -171,6 +476,150 @@ static float   *ldr_to_hdr(stbi_uc *data, int x, int y, int comp);
 static stbi_uc *hdr_to_ldr(float   *data, int x, int y, int comp);
 #endif
 
+// Signature dispatch: every loader with a magic number sits in one of 256
+// buckets keyed on its first byte, so finding the decoder for an image is a
+// table lookup plus a memcmp, not a run of header tests that each re-read
+// (and, for files, rewind) the start of the image.  A match goes straight to
+// the loader, which validates the rest of the header itself.  Loaders
+// without a signature are still tested one by one, and TGA (which has no
+// magic number at all) is still tried last.
+
+#define STBI_MAX_SIGNATURE   16
+#define MAX_SIGNATURES       (MAX_LOADERS + 8)
+
+typedef struct
+{
+   stbi_loader *loader;
+   stbi_uc signature[STBI_MAX_SIGNATURE];
+   int signature_len;
+   int next;   // 1 + index of the next signature in the same bucket, 0 at the end
+} stbi_signature;
+
+static stbi_signature signatures[MAX_SIGNATURES];
+static int num_signatures = 0;
+static int signature_bucket[256];   // 1 + index of the first signature, 0 if none
+
+#ifndef STBI_NO_STDIO
+   #define STBI_LOADER(test_mem, load_mem, test_file, load_file) \
+      { test_mem, load_mem, test_file, load_file }
+#else
+   #define STBI_LOADER(test_mem, load_mem, test_file, load_file) \
+      { test_mem, load_mem }
+#endif
+
+#ifndef STBI_NO_HDR
+// the HDR loader has to hand back LDR data here
+static stbi_uc *hdr_ldr_load_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp)
+{
+   float *hdr = stbi_hdr_load_from_memory(buffer, len,x,y,comp,req_comp);
+   if (hdr == NULL) return NULL;
+   return hdr_to_ldr(hdr, *x, *y, req_comp ? req_comp : *comp);
+}
+
+#ifndef STBI_NO_STDIO
+static stbi_uc *hdr_ldr_load_from_file(FILE *f, int *x, int *y, int *comp, int req_comp)
+{
+   float *hdr = stbi_hdr_load_from_file(f, x,y,comp,req_comp);
+   if (hdr == NULL) return NULL;
+   return hdr_to_ldr(hdr, *x, *y, req_comp ? req_comp : *comp);
+}
+#endif
+#endif
+
+static stbi_loader jpeg_loader = STBI_LOADER(stbi_jpeg_test_memory, stbi_jpeg_load_from_memory, stbi_jpeg_test_file, stbi_jpeg_load_from_file);
+static stbi_loader png_loader  = STBI_LOADER(stbi_png_test_memory,  stbi_png_load_from_memory,  stbi_png_test_file,  stbi_png_load_from_file);
+static stbi_loader bmp_loader  = STBI_LOADER(stbi_bmp_test_memory,  stbi_bmp_load_from_memory,  stbi_bmp_test_file,  stbi_bmp_load_from_file);
+static stbi_loader psd_loader  = STBI_LOADER(stbi_psd_test_memory,  stbi_psd_load_from_memory,  stbi_psd_test_file,  stbi_psd_load_from_file);
+static stbi_loader qoi_loader  = STBI_LOADER(stbi_qoi_test_memory,  stbi_qoi_load_from_memory,  stbi_qoi_test_file,  stbi_qoi_load_from_file);
+#ifndef STBI_NO_DDS
+static stbi_loader dds_loader  = STBI_LOADER(stbi_dds_test_memory,  stbi_dds_load_from_memory,  stbi_dds_test_file,  stbi_dds_load_from_file);
+#endif
+#ifndef STBI_NO_HDR
+static stbi_loader hdr_loader  = STBI_LOADER(stbi_hdr_test_memory,  hdr_ldr_load_from_memory,   stbi_hdr_test_file,  hdr_ldr_load_from_file);
+#endif
+
+static int add_signature(stbi_loader *loader, stbi_uc const *signature, int signature_len)
+{
+   stbi_signature *sig;
+   int *link;
+   if (num_signatures >= MAX_SIGNATURES) return 0;
+   // append to the end of its bucket, so earlier loaders win ties
+   link = &signature_bucket[signature[0]];
+   while (*link) {
+      stbi_signature *other = &signatures[*link - 1];
+      if (other->loader == loader && other->signature_len == signature_len &&
+          memcmp(other->signature, signature, signature_len) == 0)
+         return 1;
+      link = &other->next;
+   }
+   sig = &signatures[num_signatures++];
+   sig->loader = loader;
+   memcpy(sig->signature, signature, signature_len);
+   sig->signature_len = signature_len;
+   sig->next = 0;
+   *link = num_signatures;
+   return 1;
+}
+
+// the built-ins go in on first use; a compare-and-swap on the state makes
+// sure that happens once even if two threads start decoding together
+#if defined(_MSC_VER)
+   #include <intrin.h>
+   #define stbi_cas(p, from, to)  (_InterlockedCompareExchange((p), (to), (from)) == (from))
+#elif defined(__GNUC__)
+   #define stbi_cas(p, from, to)  __sync_bool_compare_and_swap((p), (from), (to))
+#else
+   #define stbi_cas(p, from, to)  (*(p) == (from) ? (*(p) = (to), 1) : 0)
+#endif
+
+static volatile long builtin_signature_state = 0;   // 0 = not yet, 1 = going in, 2 = done
+
+static void register_builtin_signatures(void)
+{
+   for (;;) {
+      // (the swap of 2 for 2 is there for its barrier)
+      if (stbi_cas(&builtin_signature_state, 2, 2)) return;
+      if (stbi_cas(&builtin_signature_state, 0, 1)) break;
+      // another thread is adding them; they'll be there in a moment
+   }
+   add_signature(&jpeg_loader, (stbi_uc const *) "\xFF\xD8\xFF", 3);
+   add_signature(&png_loader,  (stbi_uc const *) "\x89PNG\r\n\x1A\n", 8);
+   add_signature(&bmp_loader,  (stbi_uc const *) "BM", 2);
+   add_signature(&psd_loader,  (stbi_uc const *) "8BPS", 4);
+   add_signature(&qoi_loader,  (stbi_uc const *) "qoif", 4);
+   #ifndef STBI_NO_DDS
+   add_signature(&dds_loader,  (stbi_uc const *) "DDS ", 4);
+   #endif
+   #ifndef STBI_NO_HDR
+   add_signature(&hdr_loader,  (stbi_uc const *) "#?RADIANCE\n", 11);
+   #endif
+   stbi_cas(&builtin_signature_state, 1, 2);
+}
+
+int stbi_register_loader_signature(stbi_loader *loader, stbi_uc const *signature, int signature_len)
+{
+   if (signature == NULL || signature_len < 1)
+      return stbi_register_loader(loader);
+   if (signature_len > STBI_MAX_SIGNATURE)
+      return 0;
+   register_builtin_signatures();
+   return add_signature(loader, signature, signature_len);
+}
+
+// the loader whose signature starts this header, or NULL
+static stbi_loader *find_loader(stbi_uc const *header, int len)
+{
+   int i;
+   if (len < 1) return NULL;
+   register_builtin_signatures();
+   for (i = signature_bucket[header[0]]; i; i = signatures[i-1].next) {
+      stbi_signature *sig = &signatures[i-1];
+      if (sig->signature_len <= len && memcmp(sig->signature, header, sig->signature_len) == 0)
+         return sig->loader;
+   }
+   return NULL;
+}
+
 #ifndef STBI_NO_STDIO
 unsigned char *stbi_load(char const *filename, int *x, int *y, int *comp, int req_comp)
 {
@@ -182,27 +631,34 @@ unsigned char *stbi_load(char const *filename, int *x, int *y, int *comp, int re
    return result;
 }
 
+unsigned char *stbi_load_ctx(stbi_context *ctx, char const *filename, int *x, int *y, int *comp, int req_comp)
+{
+   stbi_context *prev = stbi_set_thread_context(ctx);
+   unsigned char *result = stbi_load(filename,x,y,comp,req_comp);
+   stbi_set_thread_context(prev);
+   return result;
+}
+
+unsigned char *stbi_load_from_file_ctx(stbi_context *ctx, FILE *f, int *x, int *y, int *comp, int req_comp)
+{
+   stbi_context *prev = stbi_set_thread_context(ctx);
+   unsigned char *result = stbi_load_from_file(f,x,y,comp,req_comp);
+   stbi_set_thread_context(prev);
+   return result;
+}
+
 unsigned char *stbi_load_from_file(FILE *f, int *x, int *y, int *comp, int req_comp)
 {
-   int i;
-   if (stbi_jpeg_test_file(f))
-      return stbi_jpeg_load_from_file(f,x,y,comp,req_comp);
-   if (stbi_png_test_file(f))
-      return stbi_png_load_from_file(f,x,y,comp,req_comp);
-   if (stbi_bmp_test_file(f))
-      return stbi_bmp_load_from_file(f,x,y,comp,req_comp);
-   if (stbi_psd_test_file(f))
-      return stbi_psd_load_from_file(f,x,y,comp,req_comp);
-   #ifndef STBI_NO_DDS
-   if (stbi_dds_test_file(f))
-      return stbi_dds_load_from_file(f,x,y,comp,req_comp);
-   #endif
-   #ifndef STBI_NO_HDR
-   if (stbi_hdr_test_file(f)) {
-      float *hdr = stbi_hdr_load_from_file(f, x,y,comp,req_comp);
-      return hdr_to_ldr(hdr, *x, *y, req_comp ? req_comp : *comp);
-   }
-   #endif
+   int i, len;
+   stbi_uc header[STBI_MAX_SIGNATURE];
+   stbi_loader *loader;
+   // peek at the first bytes, once
+   long n = ftell(f);
+   len = (int) fread(header, 1, STBI_MAX_SIGNATURE, f);
+   fseek(f, n, SEEK_SET);
+   loader = find_loader(header, len);
+   if (loader)
+      return loader->load_from_file(f,x,y,comp,req_comp);
    for (i=0; i < max_loaders; ++i)
       if (loaders[i]->test_file(f))
          return loaders[i]->load_from_file(f,x,y,comp,req_comp);
@@ -213,27 +669,20 @@ unsigned char *stbi_load_from_file(FILE *f, int *x, int *y, int *comp, int req_c
 }
 #endif
 
+unsigned char *stbi_load_from_memory_ctx(stbi_context *ctx, stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp)
+{
+   stbi_context *prev = stbi_set_thread_context(ctx);
+   unsigned char *result = stbi_load_from_memory(buffer,len,x,y,comp,req_comp);
+   stbi_set_thread_context(prev);
+   return result;
+}
+
 unsigned char *stbi_load_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp)
 {
    int i;
-   if (stbi_jpeg_test_memory(buffer,len))
-      return stbi_jpeg_load_from_memory(buffer,len,x,y,comp,req_comp);
-   if (stbi_png_test_memory(buffer,len))
-      return stbi_png_load_from_memory(buffer,len,x,y,comp,req_comp);
-   if (stbi_bmp_test_memory(buffer,len))
-      return stbi_bmp_load_from_memory(buffer,len,x,y,comp,req_comp);
-   if (stbi_psd_test_memory(buffer,len))
-      return stbi_psd_load_from_memory(buffer,len,x,y,comp,req_comp);
-   #ifndef STBI_NO_DDS
-   if (stbi_dds_test_memory(buffer,len))
-      return stbi_dds_load_from_memory(buffer,len,x,y,comp,req_comp);
-   #endif
-   #ifndef STBI_NO_HDR
-   if (stbi_hdr_test_memory(buffer, len)) {
-      float *hdr = stbi_hdr_load_from_memory(buffer, len,x,y,comp,req_comp);
-      return hdr_to_ldr(hdr, *x, *y, req_comp ? req_comp : *comp);
-   }
-   #endif
+   stbi_loader *loader = find_loader(buffer, len);
+   if (loader)
+      return loader->load_from_memory(buffer,len,x,y,comp,req_comp);
    for (i=0; i < max_loaders; ++i)
       if (loaders[i]->test_memory(buffer,len))
          return loaders[i]->load_from_memory(buffer,len,x,y,comp,req_comp);
@@ -243,6 +692,79 @@ unsigned char *stbi_load_from_memory(stbi_uc const *buffer, int len, int *x, int
    return epuc("unknown image type", "Image not of any known type, or corrupt");
 }
 
+// box filter an image down by 1<<shift each way, for the formats that can't
+// decode straight to a smaller size; the boxes on the right and bottom
+// edges average just the pixels they cover
+static uint8 *reduce_image(uint8 *data, int *x, int *y, int comp, int shift)
+{
+   int i,j,k,u,v;
+   int w = (*x + (1 << shift) - 1) >> shift;
+   int h = (*y + (1 << shift) - 1) >> shift;
+   uint8 *out = (uint8 *) stbi_malloc(w * h * comp);
+   if (out == NULL) { stbi_free(data); return epuc("outofmem", "Out of memory"); }
+   for (j=0; j < h; ++j) {
+      int y0 = j << shift, y1 = y0 + (1 << shift);
+      if (y1 > *y) y1 = *y;
+      for (i=0; i < w; ++i) {
+         int x0 = i << shift, x1 = x0 + (1 << shift);
+         int count;
+         if (x1 > *x) x1 = *x;
+         count = (x1-x0) * (y1-y0);
+         for (k=0; k < comp; ++k) {
+            int sum = 0;
+            for (v=y0; v < y1; ++v)
+               for (u=x0; u < x1; ++u)
+                  sum += data[(v * *x + u) * comp + k];
+            out[(j * w + i) * comp + k] = (uint8) ((sum + count/2) / count);
+         }
+      }
+   }
+   stbi_free(data);
+   *x = w;
+   *y = h;
+   return out;
+}
+
+#ifndef STBI_NO_STDIO
+unsigned char *stbi_load_scaled(char const *filename, int *x, int *y, int *comp, int req_comp, int scale_shift)
+{
+   FILE *f = fopen(filename, "rb");
+   unsigned char *result;
+   if (!f) return epuc("can't fopen", "Unable to open file");
+   result = stbi_load_scaled_from_file(f,x,y,comp,req_comp,scale_shift);
+   fclose(f);
+   return result;
+}
+
+unsigned char *stbi_load_scaled_from_file(FILE *f, int *x, int *y, int *comp, int req_comp, int scale_shift)
+{
+   int n;
+   unsigned char *data;
+   if (scale_shift < 0 || scale_shift > 3) return epuc("bad scale_shift", "Internal error");
+   if (stbi_jpeg_test_file(f))
+      return stbi_jpeg_load_scaled_from_file(f,x,y,comp,req_comp,scale_shift);
+   data = stbi_load_from_file(f,x,y,&n,req_comp);
+   if (comp) *comp = n;
+   if (data && scale_shift)
+      data = reduce_image(data, x, y, req_comp ? req_comp : n, scale_shift);
+   return data;
+}
+#endif
+
+unsigned char *stbi_load_scaled_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, int scale_shift)
+{
+   int n;
+   unsigned char *data;
+   if (scale_shift < 0 || scale_shift > 3) return epuc("bad scale_shift", "Internal error");
+   if (stbi_jpeg_test_memory(buffer,len))
+      return stbi_jpeg_load_scaled_from_memory(buffer,len,x,y,comp,req_comp,scale_shift);
+   data = stbi_load_from_memory(buffer,len,x,y,&n,req_comp);
+   if (comp) *comp = n;
+   if (data && scale_shift)
+      data = reduce_image(data, x, y, req_comp ? req_comp : n, scale_shift);
+   return data;
+}
+
 #ifndef STBI_NO_HDR
 
 #ifndef STBI_NO_STDIO
@@ -320,22 +842,13 @@ extern int      stbi_is_hdr_from_file(FILE *f)
 
 #endif
 
-// @TODO: get image dimensions & components without fully decoding
-#ifndef STBI_NO_STDIO
-extern int      stbi_info            (char const *filename,           int *x, int *y, int *comp);
-extern int      stbi_info_from_file  (FILE *f,                  int *x, int *y, int *comp);
-#endif
-extern int      stbi_info_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp);
-
 #ifndef STBI_NO_HDR
-static float h2l_gamma_i=1.0f/2.2f, h2l_scale_i=1.0f;
-static float l2h_gamma=2.2f, l2h_scale=1.0f;
+// these change the default context
+void   stbi_hdr_to_ldr_gamma(float gamma) { default_context.hdr_to_ldr_gamma = gamma; }
+void   stbi_hdr_to_ldr_scale(float scale) { default_context.hdr_to_ldr_scale = scale; }
 
-void   stbi_hdr_to_ldr_gamma(float gamma) { h2l_gamma_i = 1/gamma; }
-void   stbi_hdr_to_ldr_scale(float scale) { h2l_scale_i = 1/scale; }
-
-void   stbi_ldr_to_hdr_gamma(float gamma) { l2h_gamma = gamma; }
-void   stbi_ldr_to_hdr_scale(float scale) { l2h_scale = scale; }
+void   stbi_ldr_to_hdr_gamma(float gamma) { default_context.ldr_to_hdr_gamma = gamma; }
+void   stbi_ldr_to_hdr_scale(float scale) { default_context.ldr_to_hdr_scale = scale; }
 #endif
 
 
@@ -351,6 +864,12 @@ enum
    SCAN_header,
 };
 
+// FILE reads go through a block buffer, so the decoders see the same
+// pointer-walking fast path whether they're reading from a file or from memory
+#ifndef STBI_BUFFER_SIZE
+#define STBI_BUFFER_SIZE 4096
+#endif
+
 typedef struct
 {
    uint32 img_x, img_y;
@@ -358,6 +877,7 @@ typedef struct
 
    #ifndef STBI_NO_STDIO
    FILE  *img_file;
+   uint8 buffer_start[STBI_BUFFER_SIZE];
    #endif
    uint8 *img_buffer, *img_buffer_end;
 } stbi;
@@ -366,6 +886,23 @@ typedef struct
 static void start_file(stbi *s, FILE *f)
 {
    s->img_file = f;
+   // empty, the first get8 fills it
+   s->img_buffer = s->img_buffer_end = s->buffer_start;
+}
+
+static void refill_buffer(stbi *s)
+{
+   int n = (int) fread(s->buffer_start, 1, STBI_BUFFER_SIZE, s->img_file);
+   s->img_buffer = s->buffer_start;
+   s->img_buffer_end = s->buffer_start + n;
+}
+
+// hand back whatever was read ahead, so the FILE is left just past the image
+static void stop_file(stbi *s)
+{
+   if (s->img_buffer < s->img_buffer_end)
+      fseek(s->img_file, (long) (s->img_buffer - s->img_buffer_end), SEEK_CUR);
+   s->img_buffer = s->img_buffer_end = s->buffer_start;
 }
 #endif
 
@@ -380,24 +917,29 @@ static void start_mem(stbi *s, uint8 const *buffer, int len)
 
 __forceinline static int get8(stbi *s)
 {
+   if (s->img_buffer < s->img_buffer_end)
+      return *s->img_buffer++;
 #ifndef STBI_NO_STDIO
    if (s->img_file) {
-      int c = fgetc(s->img_file);
-      return c == EOF ? 0 : c;
+      refill_buffer(s);
+      if (s->img_buffer < s->img_buffer_end)
+         return *s->img_buffer++;
    }
 #endif
-   if (s->img_buffer < s->img_buffer_end)
-      return *s->img_buffer++;
    return 0;
 }
 
 __forceinline static int at_eof(stbi *s)
 {
+   if (s->img_buffer < s->img_buffer_end)
+      return 0;
 #ifndef STBI_NO_STDIO
-   if (s->img_file)
-      return feof(s->img_file);
+   if (s->img_file) {
+      refill_buffer(s);
+      return s->img_buffer >= s->img_buffer_end;
+   }
 #endif
-   return s->img_buffer >= s->img_buffer_end;
+   return 1;
 }
 
 __forceinline static uint8 get8u(stbi *s)
@@ -408,11 +950,17 @@ __forceinline static uint8 get8u(stbi *s)
 static void skip(stbi *s, int n)
 {
 #ifndef STBI_NO_STDIO
-   if (s->img_file)
-      fseek(s->img_file, n, SEEK_CUR);
-   else
+   if (s->img_file) {
+      int blen = (int) (s->img_buffer_end - s->img_buffer);
+      if (n < 0 || n > blen) {
+         // seek past (or back before) the buffered bytes, and start over
+         fseek(s->img_file, n - blen, SEEK_CUR);
+         s->img_buffer = s->img_buffer_end = s->buffer_start;
+         return;
+      }
+   }
 #endif
-      s->img_buffer += n;
+   s->img_buffer += n;
 }
 
 static int get16(stbi *s)
@@ -439,16 +987,22 @@ static uint32 get32le(stbi *s)
    return z + (get16le(s) << 16);
 }
 
-static void getn(stbi *s, stbi_uc *buffer, int n)
+// returns 0 if there weren't n bytes left
+static int getn(stbi *s, stbi_uc *buffer, int n)
 {
+   int blen = (int) (s->img_buffer_end - s->img_buffer);
 #ifndef STBI_NO_STDIO
-   if (s->img_file) {
-      fread(buffer, 1, n, s->img_file);
-      return;
+   if (s->img_file && n > blen) {
+      // drain the buffer, then read the rest straight into place
+      memcpy(buffer, s->img_buffer, blen);
+      s->img_buffer = s->img_buffer_end = s->buffer_start;
+      return (int) fread(buffer + blen, 1, n - blen, s->img_file) == n - blen;
    }
 #endif
+   if (n > blen) return 0;
    memcpy(buffer, s->img_buffer, n);
    s->img_buffer += n;
+   return 1;
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -467,23 +1021,20 @@ static uint8 compute_y(int r, int g, int b)
    return (uint8) (((r*77) + (g*150) +  (29*b)) >> 8);
 }
 
-static unsigned char *convert_format(unsigned char *data, int img_n, int req_comp, uint x, uint y)
+// convert x*y pixels of img_n components to req_comp components, from
+// rows src_pitch bytes apart to rows dest_pitch bytes apart
+static void convert_rows(unsigned char const *data, int src_pitch, int img_n, unsigned char *good, int dest_pitch, int req_comp, uint x, uint y)
 {
    int i,j;
-   unsigned char *good;
-
-   if (req_comp == img_n) return data;
-   assert(req_comp >= 1 && req_comp <= 4);
-
-   good = (unsigned char *) malloc(req_comp * x * y);
-   if (good == NULL) {
-      free(data);
-      return epuc("outofmem", "Out of memory");
-   }
 
    for (j=0; j < (int) y; ++j) {
-      unsigned char *src  = data + j * x * img_n   ;
-      unsigned char *dest = good + j * x * req_comp;
+      unsigned char const *src = data + j * src_pitch;
+      unsigned char *dest = good + j * dest_pitch;
+
+      if (img_n == req_comp) {
+         memcpy(dest, src, x * img_n);
+         continue;
+      }
 
       #define COMBO(a,b)  ((a)*8+(b))
       #define CASE(a,b)   case COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
@@ -506,8 +1057,24 @@ static unsigned char *convert_format(unsigned char *data, int img_n, int req_com
       }
       #undef CASE
    }
+}
+
+static unsigned char *convert_format(unsigned char *data, int img_n, int req_comp, uint x, uint y)
+{
+   unsigned char *good;
+
+   if (req_comp == img_n) return data;
+   assert(req_comp >= 1 && req_comp <= 4);
+
+   good = (unsigned char *) stbi_malloc(req_comp * x * y);
+   if (good == NULL) {
+      stbi_free(data);
+      return epuc("outofmem", "Out of memory");
+   }
+
+   convert_rows(data, x * img_n, img_n, good, x * req_comp, req_comp, x, y);
 
-   free(data);
+   stbi_free(data);
    return good;
 }
 
@@ -515,8 +1082,10 @@ static unsigned char *convert_format(unsigned char *data, int img_n, int req_com
 static float   *ldr_to_hdr(stbi_uc *data, int x, int y, int comp)
 {
    int i,k,n;
-   float *output = (float *) malloc(x * y * comp * sizeof(float));
-   if (output == NULL) { free(data); return epf("outofmem", "Out of memory"); }
+   stbi_context *ctx = get_context();
+   float l2h_gamma = ctx->ldr_to_hdr_gamma, l2h_scale = ctx->ldr_to_hdr_scale;
+   float *output = (float *) stbi_malloc(x * y * comp * sizeof(float));
+   if (output == NULL) { stbi_free(data); return epf("outofmem", "Out of memory"); }
    // compute number of non-alpha components
    if (comp & 1) n = comp; else n = comp-1;
    for (i=0; i < x*y; ++i) {
@@ -525,7 +1094,7 @@ static float   *ldr_to_hdr(stbi_uc *data, int x, int y, int comp)
       }
       if (k < comp) output[i*comp + k] = data[i*comp+k]/255.0f;
    }
-   free(data);
+   stbi_free(data);
    return output;
 }
 
@@ -533,8 +1102,10 @@ static float   *ldr_to_hdr(stbi_uc *data, int x, int y, int comp)
 static stbi_uc *hdr_to_ldr(float   *data, int x, int y, int comp)
 {
    int i,k,n;
-   stbi_uc *output = (stbi_uc *) malloc(x * y * comp);
-   if (output == NULL) { free(data); return epuc("outofmem", "Out of memory"); }
+   stbi_context *ctx = get_context();
+   float h2l_gamma_i = 1/ctx->hdr_to_ldr_gamma, h2l_scale_i = 1/ctx->hdr_to_ldr_scale;
+   stbi_uc *output = (stbi_uc *) stbi_malloc(x * y * comp);
+   if (output == NULL) { stbi_free(data); return epuc("outofmem", "Out of memory"); }
    // compute number of non-alpha components
    if (comp & 1) n = comp; else n = comp-1;
    for (i=0; i < x*y; ++i) {
@@ -551,7 +1122,7 @@ static stbi_uc *hdr_to_ldr(float   *data, int x, int y, int comp)
          output[i*comp + k] = float2int(z);
       }
    }
-   free(data);
+   stbi_free(data);
    return output;
 }
 #endif
@@ -634,6 +1205,19 @@ typedef struct
 
    int scan_n, order[4];
    int restart_interval, todo;
+
+// decode at 1/(1<<scale_shift) size, scale_shift 0..3
+   int scale_shift;
+
+// per-image kernels, so the SIMD versions can be picked at run time
+   void (*idct_block_kernel)(uint8 *out, int out_stride, short data[64], uint8 *dequantize);
+   #if STBI_SIMD
+   stbi_idct_8x8 idct_installed;
+   stbi_YCbCr_to_RGB_run YCbCr_installed;
+   #endif
+   void (*YCbCr_to_RGB_kernel)(uint8 *out, uint8 *y, uint8 *pcb, uint8 *pcr, int count, int step);
+   uint8 *(*resample_row_h_2_kernel)(uint8 *out, uint8 *in_near, uint8 *in_far, int w, int hs);
+   uint8 *(*resample_row_hv_2_kernel)(uint8 *out, uint8 *in_near, uint8 *in_far, int w, int hs);
 } jpeg;
 
 static int build_huffman(huffman *h, int *count)
@@ -684,9 +1268,11 @@ static void grow_buffer_unsafe(jpeg *j)
       if (b == 0xff) {
          int c = get8(&j->s);
          if (c != 0) {
+            // a marker: the rest of the buffer fills with 0s, so the last
+            // codes before it still see all the bits they ask for
             j->marker = (unsigned char) c;
             j->nomore = 1;
-            return;
+            continue;
          }
       }
       j->code_buffer = (j->code_buffer << 8) | b;
@@ -923,6 +1509,191 @@ static void idct_block(uint8 *out, int out_stride, short data[64], uint8 *dequan
       o[4] = clamp((x3-t0) >> 17);
    }
 }
+
+#ifdef STBI_SSE2
+// SSE2 version of idct_block: the same arithmetic on 8 columns (then 8 rows)
+// at once, in the 16-bit dot-product form, so it matches the integer IDCT
+// above bit for bit on any valid stream
+static void idct_block_sse2(uint8 *out, int out_stride, short data[64], uint8 *dequantize)
+{
+   __m128i row0, row1, row2, row3, row4, row5, row6, row7;
+   __m128i tmp, zero = _mm_setzero_si128();
+
+   // dot product constant: even elems=x, odd elems=y
+   #define dct_const(x,y)  _mm_setr_epi16((x),(y),(x),(y),(x),(y),(x),(y))
+
+   // out(0) = c0[even]*x + c0[odd]*y   (c0, x, y 16-bit, out 32-bit)
+   // out(1) = c1[even]*x + c1[odd]*y
+   #define dct_rot(out0,out1, x,y,c0,c1) \
+      __m128i c0##lo = _mm_unpacklo_epi16((x),(y)); \
+      __m128i c0##hi = _mm_unpackhi_epi16((x),(y)); \
+      __m128i out0##_l = _mm_madd_epi16(c0##lo, c0); \
+      __m128i out0##_h = _mm_madd_epi16(c0##hi, c0); \
+      __m128i out1##_l = _mm_madd_epi16(c0##lo, c1); \
+      __m128i out1##_h = _mm_madd_epi16(c0##hi, c1)
+
+   // out = in << 12  (in 16-bit, out 32-bit)
+   #define dct_widen(out, in) \
+      __m128i out##_l = _mm_srai_epi32(_mm_unpacklo_epi16(zero, (in)), 4); \
+      __m128i out##_h = _mm_srai_epi32(_mm_unpackhi_epi16(zero, (in)), 4)
+
+   // wide add
+   #define dct_wadd(out, a, b) \
+      __m128i out##_l = _mm_add_epi32(a##_l, b##_l); \
+      __m128i out##_h = _mm_add_epi32(a##_h, b##_h)
+
+   // wide sub
+   #define dct_wsub(out, a, b) \
+      __m128i out##_l = _mm_sub_epi32(a##_l, b##_l); \
+      __m128i out##_h = _mm_sub_epi32(a##_h, b##_h)
+
+   // butterfly a/b, add bias, then shift by "s" and pack
+   #define dct_bfly32o(out0, out1, a,b,bias,s) \
+      { \
+         __m128i abiased_l = _mm_add_epi32(a##_l, bias); \
+         __m128i abiased_h = _mm_add_epi32(a##_h, bias); \
+         dct_wadd(sum, abiased, b); \
+         dct_wsub(dif, abiased, b); \
+         out0 = _mm_packs_epi32(_mm_srai_epi32(sum_l, s), _mm_srai_epi32(sum_h, s)); \
+         out1 = _mm_packs_epi32(_mm_srai_epi32(dif_l, s), _mm_srai_epi32(dif_h, s)); \
+      }
+
+   // 8-bit interleave step (for transposes)
+   #define dct_interleave8(a, b) \
+      tmp = a; \
+      a = _mm_unpacklo_epi8(a, b); \
+      b = _mm_unpackhi_epi8(tmp, b)
+
+   // 16-bit interleave step (for transposes)
+   #define dct_interleave16(a, b) \
+      tmp = a; \
+      a = _mm_unpacklo_epi16(a, b); \
+      b = _mm_unpackhi_epi16(tmp, b)
+
+   // one 1D pass, the same steps as IDCT_1D
+   #define dct_pass(bias,shift) \
+      { \
+         /* even part */ \
+         dct_rot(t2e,t3e, row2,row6, rot0_0,rot0_1); \
+         __m128i sum04 = _mm_add_epi16(row0, row4); \
+         __m128i dif04 = _mm_sub_epi16(row0, row4); \
+         dct_widen(t0e, sum04); \
+         dct_widen(t1e, dif04); \
+         dct_wadd(x0, t0e, t3e); \
+         dct_wsub(x3, t0e, t3e); \
+         dct_wadd(x1, t1e, t2e); \
+         dct_wsub(x2, t1e, t2e); \
+         /* odd part */ \
+         dct_rot(y0o,y2o, row7,row3, rot2_0,rot2_1); \
+         dct_rot(y1o,y3o, row5,row1, rot3_0,rot3_1); \
+         __m128i sum17 = _mm_add_epi16(row1, row7); \
+         __m128i sum35 = _mm_add_epi16(row3, row5); \
+         dct_rot(y4o,y5o, sum17,sum35, rot1_0,rot1_1); \
+         dct_wadd(x4, y0o, y4o); \
+         dct_wadd(x5, y1o, y5o); \
+         dct_wadd(x6, y2o, y5o); \
+         dct_wadd(x7, y3o, y4o); \
+         dct_bfly32o(row0,row7, x0,x7,bias,shift); \
+         dct_bfly32o(row1,row6, x1,x6,bias,shift); \
+         dct_bfly32o(row2,row5, x2,x5,bias,shift); \
+         dct_bfly32o(row3,row4, x3,x4,bias,shift); \
+      }
+
+   __m128i rot0_0 = dct_const(f2f(0.5411961f), f2f(0.5411961f) + f2f(-1.847759065f));
+   __m128i rot0_1 = dct_const(f2f(0.5411961f) + f2f( 0.765366865f), f2f(0.5411961f));
+   __m128i rot1_0 = dct_const(f2f(1.175875602f) + f2f(-0.899976223f), f2f(1.175875602f));
+   __m128i rot1_1 = dct_const(f2f(1.175875602f), f2f(1.175875602f) + f2f(-2.562915447f));
+   __m128i rot2_0 = dct_const(f2f(-1.961570560f) + f2f( 0.298631336f), f2f(-1.961570560f));
+   __m128i rot2_1 = dct_const(f2f(-1.961570560f), f2f(-1.961570560f) + f2f( 3.072711026f));
+   __m128i rot3_0 = dct_const(f2f(-0.390180644f) + f2f( 2.053119869f), f2f(-0.390180644f));
+   __m128i rot3_1 = dct_const(f2f(-0.390180644f), f2f(-0.390180644f) + f2f( 1.501321110f));
+
+   // rounding biases in column/row passes, see idct_block for explanation;
+   // the row pass also folds in clamp()'s +128
+   __m128i bias_0 = _mm_set1_epi32(512);
+   __m128i bias_1 = _mm_set1_epi32(65536 + (128<<17));
+
+   // load and dequantize
+   #define dct_load(r, i) \
+      r = _mm_mullo_epi16(_mm_loadu_si128((__m128i const *) (data + (i)*8)), \
+                          _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i const *) (dequantize + (i)*8)), zero))
+   dct_load(row0, 0);
+   dct_load(row1, 1);
+   dct_load(row2, 2);
+   dct_load(row3, 3);
+   dct_load(row4, 4);
+   dct_load(row5, 5);
+   dct_load(row6, 6);
+   dct_load(row7, 7);
+
+   // column pass
+   dct_pass(bias_0, 10);
+
+   {
+      // 16bit 8x8 transpose pass 1
+      dct_interleave16(row0, row4);
+      dct_interleave16(row1, row5);
+      dct_interleave16(row2, row6);
+      dct_interleave16(row3, row7);
+
+      // transpose pass 2
+      dct_interleave16(row0, row2);
+      dct_interleave16(row1, row3);
+      dct_interleave16(row4, row6);
+      dct_interleave16(row5, row7);
+
+      // transpose pass 3
+      dct_interleave16(row0, row1);
+      dct_interleave16(row2, row3);
+      dct_interleave16(row4, row5);
+      dct_interleave16(row6, row7);
+   }
+
+   // row pass
+   dct_pass(bias_1, 17);
+
+   {
+      // pack
+      __m128i p0 = _mm_packus_epi16(row0, row1); // a0a1a2a3...a7b0b1b2b3...b7
+      __m128i p1 = _mm_packus_epi16(row2, row3);
+      __m128i p2 = _mm_packus_epi16(row4, row5);
+      __m128i p3 = _mm_packus_epi16(row6, row7);
+
+      // 8bit 8x8 transpose pass 1
+      dct_interleave8(p0, p2); // a0e0a1e1...
+      dct_interleave8(p1, p3); // c0g0c1g1...
+
+      // transpose pass 2
+      dct_interleave8(p0, p1); // a0c0e0g0...
+      dct_interleave8(p2, p3); // b0d0f0h0...
+
+      // transpose pass 3
+      dct_interleave8(p0, p2); // a0b0c0d0...
+      dct_interleave8(p1, p3); // a4b4c4d4...
+
+      // store
+      _mm_storel_epi64((__m128i *) out, p0); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p0, 0x4e)); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, p2); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p2, 0x4e)); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, p1); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p1, 0x4e)); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, p3); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p3, 0x4e));
+   }
+
+   #undef dct_const
+   #undef dct_rot
+   #undef dct_widen
+   #undef dct_wadd
+   #undef dct_wsub
+   #undef dct_bfly32o
+   #undef dct_interleave8
+   #undef dct_interleave16
+   #undef dct_pass
+   #undef dct_load
+}
+#endif
 #else
 static void idct_block(uint8 *out, int out_stride, short data[64], unsigned short *dequantize)
 {
@@ -976,14 +1747,78 @@ static void idct_block(uint8 *out, int out_stride, short data[64], unsigned shor
       o[4] = clamp((x3-t0) >> 17);
    }
 }
-static stbi_idct_8x8 stbi_idct_installed = idct_block;
-
+// installs into the default context
 extern void stbi_install_idct(stbi_idct_8x8 func)
 {
-   stbi_idct_installed = func;
+   default_context.idct = func;
 }
 #endif
 
+// reduced size IDCTs for scaled decoding: the low frequency corner of the
+// block goes through a 4, 2 or 1 point IDCT, which samples the block at
+// 1/2, 1/4 or 1/8 resolution.  The 1/2 scale of each 8 point pass is folded
+// into the constants, so the final shift is just the fixed point one
+
+static void idct_block_4x4(uint8 *out, int out_stride, short data[64], uint8 *dequantize)
+{
+   int i,val[16],*v=val;
+   int e0,e1,o0,o1;
+   uint8 *o,*dq = dequantize;
+   short *d = data;
+
+   // columns, keeping 2 extra bits of precision like idct_block
+   for (i=0; i < 4; ++i,++d,++dq,++v) {
+      int t0 = d[ 0]*dq[ 0], t1 = d[ 8]*dq[ 8];
+      int t2 = d[16]*dq[16], t3 = d[24]*dq[24];
+      e0 = (t0+t2)*f2f(0.353553391f) + 512;   // cos(pi/4)/2
+      e1 = (t0-t2)*f2f(0.353553391f) + 512;
+      o0 = t1*f2f(0.461939766f) + t3*f2f(0.191341716f);   // cos(pi/8)/2, cos(3pi/8)/2
+      o1 = t1*f2f(0.191341716f) - t3*f2f(0.461939766f);
+      v[ 0] = (e0+o0) >> 10;
+      v[12] = (e0-o0) >> 10;
+      v[ 4] = (e1+o1) >> 10;
+      v[ 8] = (e1-o1) >> 10;
+   }
+
+   // rows; take out the 1<<12 of the constants and the 1<<2 from above
+   for (i=0, v=val, o=out; i < 4; ++i,v+=4,o+=out_stride) {
+      e0 = (v[0]+v[2])*f2f(0.353553391f) + 8192;
+      e1 = (v[0]-v[2])*f2f(0.353553391f) + 8192;
+      o0 = v[1]*f2f(0.461939766f) + v[3]*f2f(0.191341716f);
+      o1 = v[1]*f2f(0.191341716f) - v[3]*f2f(0.461939766f);
+      o[0] = clamp((e0+o0) >> 14);
+      o[3] = clamp((e0-o0) >> 14);
+      o[1] = clamp((e1+o1) >> 14);
+      o[2] = clamp((e1-o1) >> 14);
+   }
+}
+
+#define d_dq(k)   (data[k]*dequantize[k])
+static void idct_block_2x2(uint8 *out, int out_stride, short data[64], uint8 *dequantize)
+{
+   int v0,v1,v2,v3;
+   // columns
+   v0 = ((d_dq(0) + d_dq(8))*f2f(0.353553391f) + 512) >> 10;
+   v2 = ((d_dq(0) - d_dq(8))*f2f(0.353553391f) + 512) >> 10;
+   v1 = ((d_dq(1) + d_dq(9))*f2f(0.353553391f) + 512) >> 10;
+   v3 = ((d_dq(1) - d_dq(9))*f2f(0.353553391f) + 512) >> 10;
+   // rows
+   out[0] = clamp(((v0+v1)*f2f(0.353553391f) + 8192) >> 14);
+   out[1] = clamp(((v0-v1)*f2f(0.353553391f) + 8192) >> 14);
+   out += out_stride;
+   out[0] = clamp(((v2+v3)*f2f(0.353553391f) + 8192) >> 14);
+   out[1] = clamp(((v2-v3)*f2f(0.353553391f) + 8192) >> 14);
+}
+#undef d_dq
+
+static void idct_block_1x1(uint8 *out, int out_stride, short data[64], uint8 *dequantize)
+{
+   // just the DC term, which is 8 times the block average; the output
+   // is a single pixel, so there is no second row to step to
+   (void) out_stride;
+   out[0] = clamp((data[0]*dequantize[0] + 4) >> 3);
+}
+
 #define MARKER_none  0xff
 // if there's a pending marker from the entropy stream, return that
 // otherwise, fetch from the stream and get a marker. if there's no
@@ -1017,72 +1852,181 @@ static void reset(jpeg *j)
    // since we don't even allow 1<<30 pixels
 }
 
+// IDCT a decoded block into its place in the component plane; bx, by
+// count blocks, which are 8>>scale_shift pixels square
+__forceinline static void put_block(jpeg *z, int n, int bx, int by, short data[64])
+{
+   int bs = 8 >> z->scale_shift;
+   uint8 *out = z->img_comp[n].data + z->img_comp[n].w2*by*bs + bx*bs;
+   #if STBI_SIMD
+   if (z->scale_shift == 0) {
+      z->idct_installed(out, z->img_comp[n].w2, data, z->dequant2[z->img_comp[n].tq]);
+      return;
+   }
+   #endif
+   z->idct_block_kernel(out, z->img_comp[n].w2, data, z->dequant[z->img_comp[n].tq]);
+}
+
+// decode one MCU of the current scan into place: a single block for a
+// non-interleaved scan, otherwise every block of every scan component
+__forceinline static int decode_mcu(jpeg *z, int i, int j)
+{
+   int k,x,y;
+   #if STBI_SIMD
+   __declspec(align(16))
+   #endif
+   short data[64];
+   if (z->scan_n == 1) {
+      int n = z->order[0];
+      if (!decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+z->img_comp[n].ha, n)) return 0;
+      put_block(z, n, i, j, data);
+      return 1;
+   }
+   for (k=0; k < z->scan_n; ++k) {
+      int n = z->order[k];
+      // scan out an mcu's worth of this component; that's just determined
+      // by the basic H and V specified for the component
+      for (y=0; y < z->img_comp[n].v; ++y) {
+         for (x=0; x < z->img_comp[n].h; ++x) {
+            if (!decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+z->img_comp[n].ha, n)) return 0;
+            put_block(z, n, i*z->img_comp[n].h + x, j*z->img_comp[n].v + y, data);
+         }
+      }
+   }
+   return 1;
+}
+
+#ifndef STBI_NO_THREADS
+// Every restart interval starts byte aligned with fresh DC predictions, so
+// when the whole scan is in memory the intervals can be found up front by
+// their RST markers and decoded on several threads at once.  Each interval
+// writes only its own MCUs, so the threads never touch the same pixels.
+void stbi_jpeg_set_max_threads(int max_threads)
+{
+   default_context.jpeg_max_threads = max_threads;
+}
+
+typedef struct
+{
+   jpeg *z;
+   stbi_context *ctx;             // the caller's, for the workers too
+   uint8 **seg_start, **seg_end;  // entropy coded bytes of each interval
+   int mcus, mcu_w;               // MCUs in the scan, and in each row of it
+   volatile int failed;
+} jpeg_segment_job;
+
+static void decode_jpeg_segments(void *job_data, int first, int last)
+{
+   jpeg_segment_job *job = (jpeg_segment_job *) job_data;
+   jpeg d = *job->z;   // a private bit reader for this thread
+   int k,m;
+   stbi_context *prev = stbi_set_thread_context(job->ctx);
+   #ifndef STBI_NO_STDIO
+   d.s.img_file = NULL;
+   #endif
+   for (k=first; k < last && !job->failed; ++k) {
+      int end = (k+1) * d.restart_interval;
+      if (end > job->mcus) end = job->mcus;
+      // past the end of the interval get8 returns 0s, just as the serial
+      // decoder pads once it has seen the RST marker
+      d.s.img_buffer = job->seg_start[k];
+      d.s.img_buffer_end = job->seg_end[k];
+      reset(&d);
+      for (m = k * d.restart_interval; m < end; ++m) {
+         if (!decode_mcu(&d, m % job->mcu_w, m / job->mcu_w)) {
+            job->failed = 1;
+            break;
+         }
+      }
+   }
+   stbi_set_thread_context(prev);
+}
+
+// returns -1 if the scan can't be split up (not all in memory, or the RST
+// markers don't match the restart interval), so the caller decodes it serially
+static int parse_entropy_coded_data_parallel(jpeg *z, int w, int h)
+{
+   jpeg_segment_job job;
+   int segs, k = 0;
+   uint8 *p = z->s.img_buffer, *end = z->s.img_buffer_end;
+
+   #ifndef STBI_NO_STDIO
+   if (z->s.img_file) return -1;
+   #endif
+   job.mcus = w * h;
+   segs = (job.mcus + z->restart_interval - 1) / z->restart_interval;
+   if (segs < 2) return -1;
+   job.seg_start = (uint8 **) scratch_malloc(segs * 2 * sizeof(uint8 *));
+   if (!job.seg_start) return -1;
+   job.seg_end = job.seg_start + segs;
+
+   // find the markers: 0xff 0x00 is a stuffed 0xff byte, RSTn ends an
+   // interval, anything else ends the scan
+   job.seg_start[0] = p;
+   while (p+1 < end) {
+      if (p[0] != 0xff) { ++p; continue; }
+      if (p[1] == 0x00) { p += 2; continue; }
+      job.seg_end[k++] = p;
+      if (!RESTART(p[1]) || k == segs) break;
+      job.seg_start[k] = p += 2;
+   }
+   if (k != segs || RESTART(p[1])) {
+      scratch_free(job.seg_start);
+      return -1;
+   }
+
+   job.z = z;
+   job.ctx = get_context();
+   job.mcu_w = w;
+   job.failed = 0;
+   // roughly a row of MCUs per claim, so short intervals don't thrash
+   run_parallel_job(decode_jpeg_segments, &job, segs,
+                    (w + z->restart_interval - 1) / z->restart_interval, job.ctx->jpeg_max_threads);
+   scratch_free(job.seg_start);
+   if (job.failed) return 0;
+
+   // carry on from the marker that ended the scan
+   z->s.img_buffer = p;
+   z->marker = MARKER_none;
+   return 1;
+}
+#endif
+
 static int parse_entropy_coded_data(jpeg *z)
 {
+   int i,j,w,h;
    reset(z);
    if (z->scan_n == 1) {
-      int i,j;
-      #if STBI_SIMD
-      __declspec(align(16))
-      #endif
-      short data[64];
-      int n = z->order[0];
       // non-interleaved data, we just need to process one block at a time,
       // in trivial scanline order
       // number of blocks to do just depends on how many actual "pixels" this
       // component has, independent of interleaved MCU blocking and such
-      int w = (z->img_comp[n].x+7) >> 3;
-      int h = (z->img_comp[n].y+7) >> 3;
-      for (j=0; j < h; ++j) {
-         for (i=0; i < w; ++i) {
-            if (!decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+z->img_comp[n].ha, n)) return 0;
-            #if STBI_SIMD
-            stbi_idct_installed(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data, z->dequant2[z->img_comp[n].tq]);
-            #else
-            idct_block(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data, z->dequant[z->img_comp[n].tq]);
-            #endif
-            // every data block is an MCU, so countdown the restart interval
-            if (--z->todo <= 0) {
-               if (z->code_bits < 24) grow_buffer_unsafe(z);
-               // if it's NOT a restart, then just bail, so we get corrupt data
-               // rather than no data
-               if (!RESTART(z->marker)) return 1;
-               reset(z);
-            }
-         }
-      }
+      int n = z->order[0];
+      w = (z->img_comp[n].x+7) >> 3;
+      h = (z->img_comp[n].y+7) >> 3;
    } else { // interleaved!
-      int i,j,k,x,y;
-      short data[64];
-      for (j=0; j < z->img_mcu_y; ++j) {
-         for (i=0; i < z->img_mcu_x; ++i) {
-            // scan an interleaved mcu... process scan_n components in order
-            for (k=0; k < z->scan_n; ++k) {
-               int n = z->order[k];
-               // scan out an mcu's worth of this component; that's just determined
-               // by the basic H and V specified for the component
-               for (y=0; y < z->img_comp[n].v; ++y) {
-                  for (x=0; x < z->img_comp[n].h; ++x) {
-                     int x2 = (i*z->img_comp[n].h + x)*8;
-                     int y2 = (j*z->img_comp[n].v + y)*8;
-                     if (!decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+z->img_comp[n].ha, n)) return 0;
-                     #if STBI_SIMD
-                     stbi_idct_installed(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data, z->dequant2[z->img_comp[n].tq]);
-                     #else
-                     idct_block(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data, z->dequant[z->img_comp[n].tq]);
-                     #endif
-                  }
-               }
-            }
-            // after all interleaved components, that's an interleaved MCU,
-            // so now count down the restart interval
-            if (--z->todo <= 0) {
-               if (z->code_bits < 24) grow_buffer_unsafe(z);
-               // if it's NOT a restart, then just bail, so we get corrupt data
-               // rather than no data
-               if (!RESTART(z->marker)) return 1;
-               reset(z);
-            }
+      w = z->img_mcu_x;
+      h = z->img_mcu_y;
+   }
+
+   #ifndef STBI_NO_THREADS
+   if (z->restart_interval && get_context()->jpeg_max_threads != 1) {
+      int r = parse_entropy_coded_data_parallel(z, w, h);
+      if (r >= 0) return r;
+   }
+   #endif
+
+   for (j=0; j < h; ++j) {
+      for (i=0; i < w; ++i) {
+         if (!decode_mcu(z, i, j)) return 0;
+         // after each MCU (a single block if non-interleaved), count down
+         // the restart interval
+         if (--z->todo <= 0) {
+            if (z->code_bits < 24) grow_buffer_unsafe(z);
+            // if it's NOT a restart, then just bail, so we get corrupt data
+            // rather than no data
+            if (!RESTART(z->marker)) return 1;
+            reset(z);
          }
       }
    }
@@ -1236,13 +2180,14 @@ static int process_frame_header(jpeg *z, int scan)
       // to simplify generation, we'll allocate enough memory to decode
       // the bogus oversized data from using interleaved MCUs and their
       // big blocks (e.g. a 16x16 iMCU on an image of width 33); we won't
-      // discard the extra data until colorspace conversion
-      z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * 8;
-      z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * 8;
-      z->img_comp[i].raw_data = malloc(z->img_comp[i].w2 * z->img_comp[i].h2+15);
+      // discard the extra data until colorspace conversion.  Scaled
+      // decodes write smaller blocks, so the planes shrink with them
+      z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * (8 >> z->scale_shift);
+      z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * (8 >> z->scale_shift);
+      z->img_comp[i].raw_data = scratch_malloc(z->img_comp[i].w2 * z->img_comp[i].h2+15);
       if (z->img_comp[i].raw_data == NULL) {
          for(--i; i >= 0; --i) {
-            free(z->img_comp[i].raw_data);
+            scratch_free(z->img_comp[i].raw_data);
             z->img_comp[i].data = NULL;
          }
          return e("outofmem", "Out of memory");
@@ -1368,6 +2313,95 @@ static uint8 *resample_row_hv_2(uint8 *out, uint8 *in_near, uint8 *in_far, int w
    return out;
 }
 
+#ifdef STBI_SSE2
+// SSE2 versions of resample_row_h_2 and resample_row_hv_2, 8 input pixels
+// at a time; the ends of the row go through the same scalar code as above,
+// so the results are identical
+
+static uint8 *resample_row_h_2_sse2(uint8 *out, uint8 *in_near, uint8 *in_far, int w, int hs)
+{
+   int i;
+   uint8 *input = in_near;
+   __m128i zero = _mm_setzero_si128();
+   __m128i bias = _mm_set1_epi16(2);
+   (void) in_far; (void) hs;
+   if (w == 1) {
+      out[0] = out[1] = input[0];
+      return out;
+   }
+
+   out[0] = input[0];
+   out[1] = div4(input[0]*3 + input[1] + 2);
+   // the interior pixels, as long as all 8 (and the one after) are there
+   for (i=1; i+9 <= w; i += 8) {
+      __m128i prev = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i const *) (input+i-1)), zero);
+      __m128i curr = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i const *) (input+i  )), zero);
+      __m128i next = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i const *) (input+i+1)), zero);
+      // 3*cur+2, shared by both phases
+      __m128i cur3 = _mm_add_epi16(_mm_add_epi16(_mm_slli_epi16(curr, 1), curr), bias);
+      __m128i even = _mm_srli_epi16(_mm_add_epi16(cur3, prev), 2);
+      __m128i odd  = _mm_srli_epi16(_mm_add_epi16(cur3, next), 2);
+      _mm_storeu_si128((__m128i *) (out + i*2),
+         _mm_packus_epi16(_mm_unpacklo_epi16(even, odd), _mm_unpackhi_epi16(even, odd)));
+   }
+   for (; i < w-1; ++i) {
+      int n = 3*input[i]+2;
+      out[i*2+0] = div4(n+input[i-1]);
+      out[i*2+1] = div4(n+input[i+1]);
+   }
+   out[i*2+0] = div4(input[w-2]*3 + input[w-1] + 2);
+   out[i*2+1] = input[w-1];
+   return out;
+}
+
+static uint8 *resample_row_hv_2_sse2(uint8 *out, uint8 *in_near, uint8 *in_far, int w, int hs)
+{
+   // need to generate 2x2 samples for every one in input
+   int i=0,t0,t1;
+   __m128i zero = _mm_setzero_si128();
+   __m128i bias = _mm_set1_epi16(8);
+   (void) hs;
+   if (w == 1) {
+      out[0] = out[1] = div4(3*in_near[0] + in_far[0] + 2);
+      return out;
+   }
+
+   t1 = 3*in_near[0] + in_far[0];
+   // groups of 8; the last pixel of the row is always left for the
+   // scalar loop, since it needs the edge handling
+   for (; i < ((w-1) & ~7); i += 8) {
+      // vertical pass: 3*near + far = 4*near + (far - near)
+      __m128i farw  = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i const *) (in_far + i)), zero);
+      __m128i nearw = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i const *) (in_near + i)), zero);
+      __m128i curr  = _mm_add_epi16(_mm_slli_epi16(nearw, 2), _mm_sub_epi16(farw, nearw));
+      // the row shifted right and left a pixel, with the neighbours filled in
+      __m128i prev  = _mm_insert_epi16(_mm_slli_si128(curr, 2), t1, 0);
+      __m128i next  = _mm_insert_epi16(_mm_srli_si128(curr, 2), 3*in_near[i+8] + in_far[i+8], 7);
+      // horizontal pass: even = 3*cur + prev, odd = 3*cur + next
+      __m128i curb  = _mm_add_epi16(_mm_slli_epi16(curr, 2), bias);
+      __m128i even  = _mm_add_epi16(_mm_sub_epi16(prev, curr), curb);
+      __m128i odd   = _mm_add_epi16(_mm_sub_epi16(next, curr), curb);
+      __m128i de0   = _mm_srli_epi16(_mm_unpacklo_epi16(even, odd), 4);
+      __m128i de1   = _mm_srli_epi16(_mm_unpackhi_epi16(even, odd), 4);
+      _mm_storeu_si128((__m128i *) (out + i*2), _mm_packus_epi16(de0, de1));
+      // "previous" value for the next group
+      t1 = 3*in_near[i+7] + in_far[i+7];
+   }
+
+   t0 = t1;
+   t1 = 3*in_near[i] + in_far[i];
+   out[i*2] = div16(3*t1 + t0 + 8);
+   for (++i; i < w; ++i) {
+      t0 = t1;
+      t1 = 3*in_near[i]+in_far[i];
+      out[i*2-1] = div16(3*t0 + t1 + 8);
+      out[i*2  ] = div16(3*t1 + t0 + 8);
+   }
+   out[w*2-1] = div4(t1+2);
+   return out;
+}
+#endif
+
 static uint8 *resample_row_generic(uint8 *out, uint8 *in_near, uint8 *in_far, int w, int hs)
 {
    // resample with nearest-neighbor
@@ -1407,12 +2441,89 @@ static void YCbCr_to_RGB_row(uint8 *out, uint8 *y, uint8 *pcb, uint8 *pcr, int c
    }
 }
 
+#ifdef STBI_SSE2
+// SSE2 version of YCbCr_to_RGB_row, 8 pixels at a time.  The 16.16
+// constants don't fit in 16 bits, so each is split into a multiple of
+// 65536 (done with shifts) plus a 16-bit remainder (done with madd);
+// the sums come out exactly as the scalar code's
+static void YCbCr_to_RGB_row_sse2(uint8 *out, uint8 *y, uint8 *pcb, uint8 *pcr, int count, int step)
+{
+   int i = 0;
+   __m128i zero = _mm_setzero_si128();
+   __m128i signflip = _mm_set1_epi16(128);
+   __m128i round = _mm_set1_epi32(32768);
+   // r:  cr* 1.40200 =  cr<<16 + cr*(f-65536)
+   // g: -cr* 0.71414 = -cr<<16 + cr*(65536-f),  -cb*0.34414 as is
+   // b:  cb* 1.77200 =  cb<<17 - cb*(131072-f)
+   __m128i cr_r  = _mm_setr_epi16(float2fixed(1.40200f) - 65536, 0, float2fixed(1.40200f) - 65536, 0,
+                                  float2fixed(1.40200f) - 65536, 0, float2fixed(1.40200f) - 65536, 0);
+   __m128i crcb_g = _mm_setr_epi16(65536 - float2fixed(0.71414f), -float2fixed(0.34414f),
+                                  65536 - float2fixed(0.71414f), -float2fixed(0.34414f),
+                                  65536 - float2fixed(0.71414f), -float2fixed(0.34414f),
+                                  65536 - float2fixed(0.71414f), -float2fixed(0.34414f));
+   __m128i cb_b  = _mm_setr_epi16(0, float2fixed(1.77200f) - 131072, 0, float2fixed(1.77200f) - 131072,
+                                  0, float2fixed(1.77200f) - 131072, 0, float2fixed(1.77200f) - 131072);
+   __m128i alpha = _mm_set1_epi8((char) 255);
+
+   for (; i+8 <= count; i += 8) {
+      __m128i yw  = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i const *) (y+i)), zero);
+      __m128i cbw = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((__m128i const *) (pcb+i)), zero), signflip);
+      __m128i crw = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((__m128i const *) (pcr+i)), zero), signflip);
+      __m128i rw, gw, bw, rg, ba, o0, o1;
+      #define YCC_HALF(unpack, r, g, b) \
+         { \
+            __m128i y_fixed = _mm_add_epi32(unpack(zero, yw), round); \
+            __m128i cr16 = unpack(zero, crw); /* cr << 16 */ \
+            __m128i cb16 = unpack(zero, cbw); /* cb << 16 */ \
+            __m128i crcb = unpack(crw, cbw); \
+            r = _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(y_fixed, cr16), _mm_madd_epi16(crcb, cr_r)), 16); \
+            g = _mm_srai_epi32(_mm_add_epi32(_mm_sub_epi32(y_fixed, cr16), _mm_madd_epi16(crcb, crcb_g)), 16); \
+            b = _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(y_fixed, _mm_add_epi32(cb16, cb16)), _mm_madd_epi16(crcb, cb_b)), 16); \
+         }
+      {
+         __m128i r0, g0, b0, r1, g1, b1;
+         YCC_HALF(_mm_unpacklo_epi16, r0, g0, b0)
+         YCC_HALF(_mm_unpackhi_epi16, r1, g1, b1)
+         rw = _mm_packs_epi32(r0, r1);
+         gw = _mm_packs_epi32(g0, g1);
+         bw = _mm_packs_epi32(b0, b1);
+      }
+      #undef YCC_HALF
+      // clamp to bytes and interleave to RGBA
+      rg = _mm_unpacklo_epi8(_mm_packus_epi16(rw, rw), _mm_packus_epi16(gw, gw));
+      ba = _mm_unpacklo_epi8(_mm_packus_epi16(bw, bw), alpha);
+      o0 = _mm_unpacklo_epi16(rg, ba);
+      o1 = _mm_unpackhi_epi16(rg, ba);
+      if (step == 4) {
+         _mm_storeu_si128((__m128i *) out, o0);
+         _mm_storeu_si128((__m128i *) (out + 16), o1);
+         out += 32;
+      } else {
+         // like the scalar code, each pixel writes a 4th byte that the next
+         // one overwrites (the output has a spare byte at the end for it)
+         int k;
+         for (k=0; k < 4; ++k, out += step) {
+            int px = _mm_cvtsi128_si32(o0);
+            memcpy(out, &px, 4);
+            o0 = _mm_srli_si128(o0, 4);
+         }
+         for (k=0; k < 4; ++k, out += step) {
+            int px = _mm_cvtsi128_si32(o1);
+            memcpy(out, &px, 4);
+            o1 = _mm_srli_si128(o1, 4);
+         }
+      }
+   }
+   // and the rest
+   YCbCr_to_RGB_row(out, y+i, pcb+i, pcr+i, count-i, step);
+}
+#endif
+
 #if STBI_SIMD
-static stbi_YCbCr_to_RGB_run stbi_YCbCr_installed = YCbCr_to_RGB_row;
-
+// installs into the default context
 void stbi_install_YCbCr_to_RGB(stbi_YCbCr_to_RGB_run func)
 {
-   stbi_YCbCr_installed = func;
+   default_context.YCbCr_to_RGB = func;
 }
 #endif
 
@@ -1423,11 +2534,11 @@ static void cleanup_jpeg(jpeg *j)
    int i;
    for (i=0; i < j->s.img_n; ++i) {
       if (j->img_comp[i].data) {
-         free(j->img_comp[i].raw_data);
+         scratch_free(j->img_comp[i].raw_data);
          j->img_comp[i].data = NULL;
       }
       if (j->img_comp[i].linebuf) {
-         free(j->img_comp[i].linebuf);
+         scratch_free(j->img_comp[i].linebuf);
          j->img_comp[i].linebuf = NULL;
       }
    }
@@ -1443,16 +2554,61 @@ typedef struct
    int ypos;    // which pre-expansion row we're on
 } stbi_resample;
 
-static uint8 *load_jpeg_image(jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
+// pick the fastest kernels this CPU can run
+static void setup_jpeg(jpeg *j)
+{
+   #if !STBI_SIMD
+   j->idct_block_kernel = idct_block;
+   #else
+   stbi_context *ctx = get_context();
+   j->idct_block_kernel = NULL;   // idct_installed is used instead
+   j->idct_installed = ctx->idct ? ctx->idct : idct_block;
+   j->YCbCr_installed = ctx->YCbCr_to_RGB ? ctx->YCbCr_to_RGB : YCbCr_to_RGB_row;
+   #endif
+   j->YCbCr_to_RGB_kernel = YCbCr_to_RGB_row;
+   j->resample_row_h_2_kernel = resample_row_h_2;
+   j->resample_row_hv_2_kernel = resample_row_hv_2;
+
+   #ifdef STBI_SSE2
+   if (stbi_sse2_available()) {
+      #if !STBI_SIMD
+      j->idct_block_kernel = idct_block_sse2;
+      #endif
+      j->YCbCr_to_RGB_kernel = YCbCr_to_RGB_row_sse2;
+      j->resample_row_h_2_kernel = resample_row_h_2_sse2;
+      j->resample_row_hv_2_kernel = resample_row_hv_2_sse2;
+   }
+   #endif
+
+   // scaled decodes use the reduced IDCTs on any CPU
+   if      (j->scale_shift == 1) j->idct_block_kernel = idct_block_4x4;
+   else if (j->scale_shift == 2) j->idct_block_kernel = idct_block_2x2;
+   else if (j->scale_shift == 3) j->idct_block_kernel = idct_block_1x1;
+}
+
+static uint8 *do_jpeg(jpeg *z, int *out_x, int *out_y, int *comp, int req_comp, uint8 *into, int into_pitch)
 {
    int n, decode_n;
    // validate req_comp
    if (req_comp < 0 || req_comp > 4) return epuc("bad req_comp", "Internal error");
    z->s.img_n = 0;
+   setup_jpeg(z);
 
    // load a jpeg image from whichever source
    if (!decode_jpeg_image(z)) { cleanup_jpeg(z); return NULL; }
 
+   // the planes came out 1<<scale_shift smaller, so from here on the
+   // image is that size
+   if (z->scale_shift) {
+      int k, round = (1 << z->scale_shift) - 1;
+      z->s.img_x = (z->s.img_x + round) >> z->scale_shift;
+      z->s.img_y = (z->s.img_y + round) >> z->scale_shift;
+      for (k=0; k < z->s.img_n; ++k) {
+         z->img_comp[k].x = (z->img_comp[k].x + round) >> z->scale_shift;
+         z->img_comp[k].y = (z->img_comp[k].y + round) >> z->scale_shift;
+      }
+   }
+
    // determine actual number of components to generate
    n = req_comp ? req_comp : z->s.img_n;
 
@@ -1475,7 +2631,7 @@ static uint8 *load_jpeg_image(jpeg *z, int *out_x, int *out_y, int *comp, int re
 
          // allocate line buffer big enough for upsampling off the edges
          // with upsample factor of 4
-         z->img_comp[k].linebuf = (uint8 *) malloc(z->s.img_x + 3);
+         z->img_comp[k].linebuf = (uint8 *) scratch_malloc(z->s.img_x + 3);
          if (!z->img_comp[k].linebuf) { cleanup_jpeg(z); return epuc("outofmem", "Out of memory"); }
 
          r->hs      = z->img_h_max / z->img_comp[k].h;
@@ -1487,18 +2643,23 @@ static uint8 *load_jpeg_image(jpeg *z, int *out_x, int *out_y, int *comp, int re
 
          if      (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
          else if (r->hs == 1 && r->vs == 2) r->resample = resample_row_v_2;
-         else if (r->hs == 2 && r->vs == 1) r->resample = resample_row_h_2;
-         else if (r->hs == 2 && r->vs == 2) r->resample = resample_row_hv_2;
+         else if (r->hs == 2 && r->vs == 1) r->resample = z->resample_row_h_2_kernel;
+         else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
          else                               r->resample = resample_row_generic;
       }
 
       // can't error after this so, this is safe
-      output = (uint8 *) malloc(n * z->s.img_x * z->s.img_y + 1);
-      if (!output) { cleanup_jpeg(z); return epuc("outofmem", "Out of memory"); }
+      if (into) {
+         output = into;
+      } else {
+         output = (uint8 *) stbi_malloc(n * z->s.img_x * z->s.img_y + 1);
+         if (!output) { cleanup_jpeg(z); return epuc("outofmem", "Out of memory"); }
+         into_pitch = n * z->s.img_x;
+      }
 
       // now go ahead and resample
       for (j=0; j < z->s.img_y; ++j) {
-         uint8 *out = output + n * z->s.img_x * j;
+         uint8 *out = output + into_pitch * j;
          for (k=0; k < decode_n; ++k) {
             stbi_resample *r = &res_comp[k];
             int y_bot = r->ystep >= (r->vs >> 1);
@@ -1516,16 +2677,30 @@ static uint8 *load_jpeg_image(jpeg *z, int *out_x, int *out_y, int *comp, int re
          if (n >= 3) {
             uint8 *y = coutput[0];
             if (z->s.img_n == 3) {
+               // for RGB the kernels write a spare 4th byte after each
+               // pixel, which in caller memory would land past the end of
+               // the row, so there the last pixel goes through a scratch word
+               uint body = (into && n == 3) ? z->s.img_x - 1 : z->s.img_x;
                #if STBI_SIMD
-               stbi_YCbCr_installed(out, y, coutput[1], coutput[2], z->s.img_x, n);
+               z->YCbCr_installed(out, y, coutput[1], coutput[2], body, n);
                #else
-               YCbCr_to_RGB_row(out, y, coutput[1], coutput[2], z->s.img_x, n);
+               z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], body, n);
                #endif
-            } else
+               if (body < z->s.img_x) {
+                  uint8 last[4];
+                  YCbCr_to_RGB_row(last, y+body, coutput[1]+body, coutput[2]+body, 1, n);
+                  memcpy(out + 3*body, last, 3);
+               }
+            } else if (n == 4)
+               for (i=0; i < z->s.img_x; ++i) {
+                  out[0] = out[1] = out[2] = y[i];
+                  out[3] = 255;
+                  out += 4;
+               }
+            else
                for (i=0; i < z->s.img_x; ++i) {
                   out[0] = out[1] = out[2] = y[i];
-                  out[3] = 255; // not used if n==3
-                  out += n;
+                  out += 3;
                }
          } else {
             uint8 *y = coutput[0];
@@ -1543,12 +2718,33 @@ static uint8 *load_jpeg_image(jpeg *z, int *out_x, int *out_y, int *comp, int re
    }
 }
 
+// into, if not NULL, is where the pixels go (rows into_pitch bytes apart);
+// the caller has checked it is big enough
+static uint8 *load_jpeg_image(jpeg *z, int *out_x, int *out_y, int *comp, int req_comp, uint8 *into, int into_pitch)
+{
+   uint8 *result;
+   scratch_begin();
+   result = do_jpeg(z, out_x,out_y,comp,req_comp, into,into_pitch);
+   scratch_end();
+   return result;
+}
+
 #ifndef STBI_NO_STDIO
 unsigned char *stbi_jpeg_load_from_file(FILE *f, int *x, int *y, int *comp, int req_comp)
+{
+   return stbi_jpeg_load_scaled_from_file(f,x,y,comp,req_comp,0);
+}
+
+unsigned char *stbi_jpeg_load_scaled_from_file(FILE *f, int *x, int *y, int *comp, int req_comp, int scale_shift)
 {
    jpeg j;
+   unsigned char *result;
+   if (scale_shift < 0 || scale_shift > 3) return epuc("bad scale_shift", "Internal error");
+   j.scale_shift = scale_shift;
    start_file(&j.s, f);
-   return load_jpeg_image(&j, x,y,comp,req_comp);
+   result = load_jpeg_image(&j, x,y,comp,req_comp, NULL,0);
+   stop_file(&j.s);
+   return result;
 }
 
 unsigned char *stbi_jpeg_load(char const *filename, int *x, int *y, int *comp, int req_comp)
@@ -1563,10 +2759,17 @@ unsigned char *stbi_jpeg_load(char const *filename, int *x, int *y, int *comp, i
 #endif
 
 unsigned char *stbi_jpeg_load_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp)
+{
+   return stbi_jpeg_load_scaled_from_memory(buffer,len,x,y,comp,req_comp,0);
+}
+
+unsigned char *stbi_jpeg_load_scaled_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, int scale_shift)
 {
    jpeg j;
+   if (scale_shift < 0 || scale_shift > 3) return epuc("bad scale_shift", "Internal error");
+   j.scale_shift = scale_shift;
    start_mem(&j.s, buffer,len);
-   return load_jpeg_image(&j, x,y,comp,req_comp);
+   return load_jpeg_image(&j, x,y,comp,req_comp, NULL,0);
 }
 
 #ifndef STBI_NO_STDIO
@@ -1575,6 +2778,7 @@ int stbi_jpeg_test_file(FILE *f)
    int n,r;
    jpeg j;
    n = ftell(f);
+   j.scale_shift = 0;
    start_file(&j.s, f);
    r = decode_jpeg_header(&j, SCAN_type);
    fseek(f,n,SEEK_SET);
@@ -1585,16 +2789,51 @@ int stbi_jpeg_test_file(FILE *f)
 int stbi_jpeg_test_memory(stbi_uc const *buffer, int len)
 {
    jpeg j;
+   j.scale_shift = 0;
    start_mem(&j.s, buffer,len);
    return decode_jpeg_header(&j, SCAN_type);
 }
 
-// @TODO:
+// read as far as the frame header, which is all the sizes need
+static int jpeg_info(jpeg *j, int *x, int *y, int *comp)
+{
+   j->scale_shift = 0;
+   if (!decode_jpeg_header(j, SCAN_header)) return 0;
+   if (x) *x = j->s.img_x;
+   if (y) *y = j->s.img_y;
+   if (comp) *comp = j->s.img_n;
+   return 1;
+}
+
 #ifndef STBI_NO_STDIO
-extern int      stbi_jpeg_info            (char const *filename,           int *x, int *y, int *comp);
-extern int      stbi_jpeg_info_from_file  (FILE *f,                  int *x, int *y, int *comp);
+int stbi_jpeg_info(char const *filename, int *x, int *y, int *comp)
+{
+   int r;
+   FILE *f = fopen(filename, "rb");
+   if (!f) return e("can't fopen", "Unable to open file");
+   r = stbi_jpeg_info_from_file(f, x,y,comp);
+   fclose(f);
+   return r;
+}
+
+int stbi_jpeg_info_from_file(FILE *f, int *x, int *y, int *comp)
+{
+   int n,r;
+   jpeg j;
+   n = ftell(f);
+   start_file(&j.s, f);
+   r = jpeg_info(&j, x,y,comp);
+   fseek(f,n,SEEK_SET);
+   return r;
+}
 #endif
-extern int      stbi_jpeg_info_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp);
+
+int stbi_jpeg_info_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp)
+{
+   jpeg j;
+   start_mem(&j.s, buffer,len);
+   return jpeg_info(&j, x,y,comp);
+}
 
 // public domain zlib decode    v0.2  Sean Barrett 2006-11-18
 //    simple implementation
@@ -1602,16 +2841,18 @@ extern int      stbi_jpeg_info_from_memory(stbi_uc const *buffer, int len, int *
 //      - all output is written to a single output buffer (can malloc/realloc)
 //    performance
 //      - fast huffman
+//      - 64-bit bit buffer, refilled a word at a time
+//      - word-at-a-time match copies
 
 // fast-way is faster to check than jpeg huffman, but slow way is slower
-#define ZFAST_BITS  9 // accelerate all cases in default tables
+#define ZFAST_BITS  11 // accelerate all cases in default tables, and most in dynamic ones
 #define ZFAST_MASK  ((1 << ZFAST_BITS) - 1)
 
 // zlib-style huffman encoding
 // (jpegs packs from left, zlib from right, so can't share code)
 typedef struct
 {
-   uint16 fast[1 << ZFAST_BITS];
+   uint16 fast[1 << ZFAST_BITS];  // (code size << 9) | symbol, 0 if the code is longer
    uint16 firstcode[16];
    int maxcode[17];
    uint16 firstsymbol[16];
@@ -1643,7 +2884,7 @@ static int zbuild_huffman(zhuffman *z, uint8 *sizelist, int num)
 
    // DEFLATE spec for generating codes
    memset(sizes, 0, sizeof(sizes));
-   memset(z->fast, 255, sizeof(z->fast));
+   memset(z->fast, 0, sizeof(z->fast));
    for (i=0; i < num; ++i)
       ++sizes[sizelist[i]];
    sizes[0] = 0;
@@ -1670,8 +2911,9 @@ static int zbuild_huffman(zhuffman *z, uint8 *sizelist, int num)
          z->value[c] = (uint16)i;
          if (s <= ZFAST_BITS) {
             int k = bit_reverse(next_code[s],s);
+            uint16 fastv = (uint16) ((s << 9) | i);
             while (k < (1 << ZFAST_BITS)) {
-               z->fast[k] = (uint16) c;
+               z->fast[k] = fastv;
                k += (1 << s);
             }
          }
@@ -1691,12 +2933,13 @@ typedef struct
 {
    uint8 *zbuffer, *zbuffer_end;
    int num_bits;
-   uint32 code_buffer;
+   uint64 code_buffer;
 
    char *zout;
    char *zout_start;
    char *zout_end;
    int   z_expandable;
+   int   z_scratch;      // the output is scratch memory
 
    zhuffman z_length, z_distance;
 } zbuf;
@@ -1707,20 +2950,46 @@ __forceinline static int zget8(zbuf *z)
    return *z->zbuffer++;
 }
 
+__forceinline static uint64 zload64le(uint8 const *p)
+{
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+   uint64 v;
+   memcpy(&v, p, 8);
+   return v;
+#else
+   return (uint64) (p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32) p[3] << 24)) |
+          ((uint64) (p[4] | (p[5] << 8) | (p[6] << 16) | ((uint32) p[7] << 24)) << 32);
+#endif
+}
+
+// tops the bit buffer up to at least 56 bits
 static void fill_bits(zbuf *z)
 {
-   do {
-      assert(z->code_buffer < (1U << z->num_bits));
-      z->code_buffer |= zget8(z) << z->num_bits;
-      z->num_bits += 8;
-   } while (z->num_bits <= 24);
+   assert(z->num_bits == 64 || z->code_buffer < ((uint64) 1 << z->num_bits));
+   if (z->zbuffer_end - z->zbuffer >= 8) {
+      // grab a whole word, and keep the bytes that fit
+      int bytes = (63 - z->num_bits) >> 3;
+      uint64 word = zload64le(z->zbuffer) & (((uint64) 1 << (bytes * 8)) - 1);
+      z->code_buffer |= word << z->num_bits;
+      z->zbuffer += bytes;
+      z->num_bits += bytes * 8;
+   } else {
+      // near the end, pad with zeros (but keep counting, so the
+      // bytes can be handed back exactly by parse_uncompressed_block)
+      do {
+         if (z->zbuffer < z->zbuffer_end)
+            z->code_buffer |= (uint64) *z->zbuffer << z->num_bits;
+         ++z->zbuffer;
+         z->num_bits += 8;
+      } while (z->num_bits <= 56);
+   }
 }
 
 __forceinline static unsigned int zreceive(zbuf *z, int n)
 {
    unsigned int k;
    if (z->num_bits < n) fill_bits(z);
-   k = z->code_buffer & ((1 << n) - 1);
+   k = (unsigned int) (z->code_buffer & ((1 << n) - 1));
    z->code_buffer >>= n;
    z->num_bits -= n;
    return k;
@@ -1731,16 +3000,16 @@ __forceinline static int zhuffman_decode(zbuf *a, zhuffman *z)
    int b,s,k;
    if (a->num_bits < 16) fill_bits(a);
    b = z->fast[a->code_buffer & ZFAST_MASK];
-   if (b < 0xffff) {
-      s = z->size[b];
+   if (b) {
+      s = b >> 9;
       a->code_buffer >>= s;
       a->num_bits -= s;
-      return z->value[b];
+      return b & 511;
    }
 
    // not resolved by fast table, so compute it the slow way
    // use jpeg approach, which requires MSbits at top
-   k = bit_reverse(a->code_buffer, 16);
+   k = bit_reverse((int) (a->code_buffer & 0xffff), 16);
    for (s=ZFAST_BITS+1; ; ++s)
       if (k < z->maxcode[s])
          break;
@@ -1762,7 +3031,10 @@ static int expand(zbuf *z, int n)  // need to make room for n bytes
    limit = (int) (z->zout_end - z->zout_start);
    while (cur + n > limit)
       limit *= 2;
-   q = (char *) realloc(z->zout_start, limit);
+   if (z->z_scratch)
+      q = (char *) scratch_realloc(z->zout_start, limit);
+   else
+      q = (char *) stbi_realloc(z->zout_start, limit);
    if (q == NULL) return e("outofmem", "Out of memory");
    z->zout_start = q;
    z->zout       = q + cur;
@@ -1786,28 +3058,60 @@ static int dist_extra[32] =
 
 static int parse_huffman_block(zbuf *a)
 {
+   char *zout = a->zout;
    for(;;) {
-      int z = zhuffman_decode(a, &a->z_length);
+      int z;
+      // one refill covers a whole length/distance pair (at most 48 bits)
+      if (a->num_bits < 48) fill_bits(a);
+      z = zhuffman_decode(a, &a->z_length);
       if (z < 256) {
          if (z < 0) return e("bad huffman code","Corrupt PNG"); // error in huffman codes
-         if (a->zout >= a->zout_end) if (!expand(a, 1)) return 0;
-         *a->zout++ = (char) z;
+         if (zout >= a->zout_end) {
+            a->zout = zout;
+            if (!expand(a, 1)) return 0;
+            zout = a->zout;
+         }
+         *zout++ = (char) z;
       } else {
-         uint8 *p;
+         char *p;
          int len,dist;
-         if (z == 256) return 1;
+         if (z == 256) {
+            a->zout = zout;
+            return 1;
+         }
          z -= 257;
+         if (z >= 29) return e("bad huffman code","Corrupt PNG");
          len = length_base[z];
          if (length_extra[z]) len += zreceive(a, length_extra[z]);
          z = zhuffman_decode(a, &a->z_distance);
-         if (z < 0) return e("bad huffman code","Corrupt PNG");
+         if (z < 0 || z >= 30) return e("bad huffman code","Corrupt PNG");
          dist = dist_base[z];
          if (dist_extra[z]) dist += zreceive(a, dist_extra[z]);
-         if (a->zout - a->zout_start < dist) return e("bad dist","Corrupt PNG");
-         if (a->zout + len > a->zout_end) if (!expand(a, len)) return 0;
-         p = (uint8 *) (a->zout - dist);
-         while (len--)
-            *a->zout++ = *p++;
+         if (zout - a->zout_start < dist) return e("bad dist","Corrupt PNG");
+         if (zout + len > a->zout_end) {
+            a->zout = zout;
+            if (!expand(a, len)) return 0;
+            zout = a->zout;
+         }
+         p = zout - dist;
+         if (dist == 1) {
+            // a run of one byte
+            memset(zout, *p, len);
+            zout += len;
+         } else if (dist >= 8 && zout + len + 8 <= a->zout_end) {
+            // 8 bytes at a time; the overshoot past the match is
+            // overwritten by whatever comes next
+            char *end = zout + len;
+            do {
+               memcpy(zout, p, 8);
+               zout += 8;
+               p += 8;
+            } while (zout < end);
+            zout = end;
+         } else {
+            while (len--)
+               *zout++ = *p++;
+         }
       }
    }
 }
@@ -1815,7 +3119,7 @@ static int parse_huffman_block(zbuf *a)
 static int compute_huffman_codes(zbuf *a)
 {
    static uint8 length_dezigzag[19] = { 16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15 };
-   static zhuffman z_codelength; // static just to save stack space
+   zhuffman z_codelength;
    uint8 lencodes[286+32+137];//padding for maximum single op
    uint8 codelength_sizes[19];
    int i,n;
@@ -1866,12 +3170,15 @@ static int parse_uncompressed_block(zbuf *a)
       zreceive(a, a->num_bits & 7); // discard
    // drain the bit-packed data into header
    k = 0;
-   while (a->num_bits > 0) {
+   while (a->num_bits > 0 && k < 4) {
       header[k++] = (uint8) (a->code_buffer & 255); // wtf this warns?
       a->code_buffer >>= 8;
       a->num_bits -= 8;
    }
-   assert(a->num_bits == 0);
+   // the wide bit buffer may have read past the header, so hand the rest back
+   a->zbuffer -= a->num_bits >> 3;
+   a->code_buffer = 0;
+   a->num_bits = 0;
    // now fill header the normal way
    while (k < 4)
       header[k++] = (uint8) zget8(a);
@@ -1948,6 +3255,7 @@ static int do_zlib(zbuf *a, char *obuf, int olen, int exp, int parse_header)
    a->zout       = obuf;
    a->zout_end   = obuf + olen;
    a->z_expandable = exp;
+   a->z_scratch  = 0;
 
    return parse_zlib(a, parse_header);
 }
@@ -1955,7 +3263,7 @@ static int do_zlib(zbuf *a, char *obuf, int olen, int exp, int parse_header)
 char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial_size, int *outlen)
 {
    zbuf a;
-   char *p = (char *) malloc(initial_size);
+   char *p = (char *) stbi_malloc(initial_size);
    if (p == NULL) return NULL;
    a.zbuffer = (uint8 *) buffer;
    a.zbuffer_end = (uint8 *) buffer + len;
@@ -1963,7 +3271,28 @@ char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial
       if (outlen) *outlen = (int) (a.zout - a.zout_start);
       return a.zout_start;
    } else {
-      free(a.zout_start);
+      stbi_free(a.zout_start);
+      return NULL;
+   }
+}
+
+// stbi_zlib_decode_malloc_guesssize into scratch memory
+static char *zlib_decode_scratch(const char *buffer, int len, int initial_size, int *outlen)
+{
+   zbuf a;
+   char *p = (char *) scratch_malloc(initial_size);
+   if (p == NULL) return (char *) epuc("outofmem", "Out of memory");
+   a.zbuffer = (uint8 *) buffer;
+   a.zbuffer_end = (uint8 *) buffer + len;
+   a.zout_start = a.zout = p;
+   a.zout_end = p + initial_size;
+   a.z_expandable = 1;
+   a.z_scratch = 1;
+   if (parse_zlib(&a, 1)) {
+      if (outlen) *outlen = (int) (a.zout - a.zout_start);
+      return a.zout_start;
+   } else {
+      scratch_free(a.zout_start);
       return NULL;
    }
 }
@@ -1987,7 +3316,7 @@ int stbi_zlib_decode_buffer(char *obuffer, int olen, char const *ibuffer, int il
 char *stbi_zlib_decode_noheader_malloc(char const *buffer, int len, int *outlen)
 {
    zbuf a;
-   char *p = (char *) malloc(16384);
+   char *p = (char *) stbi_malloc(16384);
    if (p == NULL) return NULL;
    a.zbuffer = (uint8 *) buffer;
    a.zbuffer_end = (uint8 *) buffer+len;
@@ -1995,7 +3324,7 @@ char *stbi_zlib_decode_noheader_malloc(char const *buffer, int len, int *outlen)
       if (outlen) *outlen = (int) (a.zout - a.zout_start);
       return a.zout_start;
    } else {
-      free(a.zout_start);
+      stbi_free(a.zout_start);
       return NULL;
    }
 }
@@ -2051,6 +3380,8 @@ typedef struct
 {
    stbi s;
    uint8 *idata, *expanded, *out;
+   uint8 *into;      // caller memory to unfilter straight into, if it can be
+   int into_pitch;
 } png;
 
 
@@ -2076,19 +3407,150 @@ static int paeth(int a, int b, int c)
 }
 
 // create the png data from post-deflated data
-static int create_png_image(png *a, uint8 *raw, uint32 raw_len, int out_n)
+#ifdef STBI_SSE2
+// SSE2 unfiltering for 3 and 4 channel images, a pixel per register
+// (Sub, Avg and Paeth depend on the pixel to the left, so that's as wide
+// as they go; Up and None do 16 bytes at a time when there's no expand).
+// The RGB->RGBA expand happens on the way out, in the same pass.
+
+__forceinline static __m128i png_load_pixel(uint8 const *p, int n)
+{
+   if (n == 4) {
+      int v;
+      memcpy(&v, p, 4);
+      return _mm_cvtsi32_si128(v);
+   }
+   return _mm_cvtsi32_si128(p[0] | (p[1] << 8) | (p[2] << 16));
+}
+
+__forceinline static void png_store_pixel(uint8 *p, __m128i v, int n)
+{
+   int x = _mm_cvtsi128_si32(v);
+   if (n == 4) {
+      memcpy(p, &x, 4);
+   } else {
+      p[0] = (uint8) x;
+      p[1] = (uint8) (x >> 8);
+      p[2] = (uint8) (x >> 16);
+   }
+}
+
+// the Paeth predictor on 16-bit lanes, the same way libpng does it
+__forceinline static __m128i png_paeth_sse2(__m128i a, __m128i b, __m128i c)
+{
+   __m128i zero = _mm_setzero_si128();
+   __m128i pa = _mm_sub_epi16(b, c);   // |p-a| = |b-c|
+   __m128i pb = _mm_sub_epi16(a, c);   // |p-b| = |a-c|
+   __m128i pc = _mm_add_epi16(pa, pb); // |p-c| = |a+b-2c|
+   __m128i smallest, use_a, use_b;
+   pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+   pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+   pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+   smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+   // ties go to a, then b
+   use_a = _mm_cmpeq_epi16(smallest, pa);
+   use_b = _mm_andnot_si128(use_a, _mm_cmpeq_epi16(smallest, pb));
+   return _mm_or_si128(_mm_and_si128(use_a, a),
+          _mm_or_si128(_mm_and_si128(use_b, b),
+                       _mm_andnot_si128(_mm_or_si128(use_a, use_b), c)));
+}
+
+static void unfilter_row_sse2(int filter, uint8 *cur, uint8 const *raw, uint8 const *prior,
+                              uint32 width, int img_n, int out_n)
+{
+   __m128i zero = _mm_setzero_si128();
+   __m128i alpha = _mm_cvtsi32_si128(img_n != out_n ? (int) 0xff000000 : 0);
+   __m128i a = zero, b, c = zero, x;
+   uint32 i = 0;
+   switch (filter) {
+      case F_none:
+      case F_up:
+         if (img_n == out_n) {
+            uint32 n = width * img_n;
+            if (filter == F_none) {
+               memcpy(cur, raw, n);
+               return;
+            }
+            for (; i+16 <= n; i += 16)
+               _mm_storeu_si128((__m128i *) (cur+i),
+                  _mm_add_epi8(_mm_loadu_si128((__m128i const *) (raw+i)),
+                               _mm_loadu_si128((__m128i const *) (prior+i))));
+            for (; i < n; ++i)
+               cur[i] = raw[i] + prior[i];
+            return;
+         }
+         for (; i < width; ++i, raw += img_n, cur += out_n, prior += out_n) {
+            x = png_load_pixel(raw, img_n);
+            if (filter == F_up) x = _mm_add_epi8(x, png_load_pixel(prior, out_n));
+            png_store_pixel(cur, _mm_or_si128(x, alpha), out_n);
+         }
+         return;
+      case F_sub:
+         for (; i < width; ++i, raw += img_n, cur += out_n) {
+            a = _mm_add_epi8(png_load_pixel(raw, img_n), a);
+            png_store_pixel(cur, _mm_or_si128(a, alpha), out_n);
+         }
+         return;
+      case F_avg:
+         for (; i < width; ++i, raw += img_n, cur += out_n, prior += out_n) {
+            // (a+b)>>1 without overflow: the rounded-up average, less the rounding
+            b = png_load_pixel(prior, out_n);
+            x = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+            a = _mm_add_epi8(png_load_pixel(raw, img_n), x);
+            png_store_pixel(cur, _mm_or_si128(a, alpha), out_n);
+         }
+         return;
+      case F_paeth:
+         // a and c are kept unpacked to 16 bits
+         for (; i < width; ++i, raw += img_n, cur += out_n, prior += out_n) {
+            b = _mm_unpacklo_epi8(png_load_pixel(prior, out_n), zero);
+            x = _mm_packus_epi16(png_paeth_sse2(a, b, c), zero);
+            x = _mm_add_epi8(png_load_pixel(raw, img_n), x);
+            png_store_pixel(cur, _mm_or_si128(x, alpha), out_n);
+            a = _mm_unpacklo_epi8(x, zero);
+            c = b;
+         }
+         return;
+   }
+}
+#endif
+
+// with direct set, the rows go straight into a->into
+static int create_png_image(png *a, uint8 *raw, uint32 raw_len, int out_n, int direct)
 {
    stbi *s = &a->s;
-   uint32 i,j,stride = s->img_x*out_n;
+   uint32 i,j,stride = s->img_x*out_n, pitch = stride;
    int k;
    int img_n = s->img_n; // copy it into a local for later
    assert(out_n == s->img_n || out_n == s->img_n+1);
-   a->out = (uint8 *) malloc(s->img_x * s->img_y * out_n);
-   if (!a->out) return e("outofmem", "Out of memory");
+   if (direct) {
+      a->out = a->into;
+      pitch = a->into_pitch;
+   } else {
+      a->out = (uint8 *) stbi_malloc(s->img_x * s->img_y * out_n);
+      if (!a->out) return e("outofmem", "Out of memory");
+   }
    if (raw_len != (img_n * s->img_x + 1) * s->img_y) return e("not enough pixels","Corrupt PNG");
+   #ifdef STBI_SSE2
+   if ((img_n == 3 || img_n == 4) && stbi_sse2_available()) {
+      // the first row is unfiltered against a row of zeros
+      uint8 *zero_row = (uint8 *) scratch_malloc(stride);
+      if (!zero_row) return e("outofmem", "Out of memory");
+      memset(zero_row, 0, stride);
+      for (j=0; j < s->img_y; ++j) {
+         uint8 *cur = a->out + pitch*j;
+         int filter = *raw++;
+         if (filter > 4) { scratch_free(zero_row); return e("invalid filter","Corrupt PNG"); }
+         unfilter_row_sse2(filter, cur, raw, j ? cur - pitch : zero_row, s->img_x, img_n, out_n);
+         raw += img_n * s->img_x;
+      }
+      scratch_free(zero_row);
+      return 1;
+   }
+   #endif
    for (j=0; j < s->img_y; ++j) {
-      uint8 *cur = a->out + stride*j;
-      uint8 *prior = cur - stride;
+      uint8 *cur = a->out + pitch*j;
+      uint8 *prior = cur - pitch;
       int filter = *raw++;
       if (filter > 4) return e("invalid filter","Corrupt PNG");
       // if first row, use special filter that doesn't sample previous row
@@ -2176,10 +3638,10 @@ static int expand_palette(png *a, uint8 *palette, int len, int pal_img_n)
    uint32 i, pixel_count = a->s.img_x * a->s.img_y;
    uint8 *p, *temp_out, *orig = a->out;
 
-   p = (uint8 *) malloc(pixel_count * pal_img_n);
+   p = (uint8 *) stbi_malloc(pixel_count * pal_img_n);
    if (p == NULL) return e("outofmem", "Out of memory");
 
-   // between here and free(out) below, exitting would leak
+   // between here and stbi_free(out) below, exitting would leak
    temp_out = p;
 
    if (pal_img_n == 3) {
@@ -2200,7 +3662,7 @@ static int expand_palette(png *a, uint8 *palette, int len, int pal_img_n)
          p += 4;
       }
    }
-   free(a->out);
+   stbi_free(a->out);
    a->out = temp_out;
    return 1;
 }
@@ -2289,149 +3751,555 @@ static int parse_png_file(png *z, int scan, int req_comp)
                if (idata_limit == 0) idata_limit = c.length > 4096 ? c.length : 4096;
                while (ioff + c.length > idata_limit)
                   idata_limit *= 2;
-               p = (uint8 *) realloc(z->idata, idata_limit); if (p == NULL) return e("outofmem", "Out of memory");
+               p = (uint8 *) scratch_realloc(z->idata, idata_limit); if (p == NULL) return e("outofmem", "Out of memory");
                z->idata = p;
             }
-            #ifndef STBI_NO_STDIO
-            if (s->img_file)
-            {
-               if (fread(z->idata+ioff,1,c.length,s->img_file) != c.length) return e("outofdata","Corrupt PNG");
-            }
+            if (!getn(s, z->idata+ioff, c.length)) return e("outofdata","Corrupt PNG");
+            ioff += c.length;
+            break;
+         }
+
+         case PNG_TYPE('I','E','N','D'): {
+            uint32 raw_len;
+            if (scan != SCAN_load) return 1;
+            if (z->idata == NULL) return e("no IDAT","Corrupt PNG");
+            // the header tells us exactly how big the filtered image is, so
+            // size the output for it up front rather than growing it
+            raw_len = s->img_y * (s->img_x * s->img_n + 1);
+            z->expanded = (uint8 *) zlib_decode_scratch((char *) z->idata, ioff, raw_len, (int *) &raw_len);
+            if (z->expanded == NULL) return 0; // zlib should set error
+            scratch_free(z->idata); z->idata = NULL;
+            if ((req_comp == s->img_n+1 && req_comp != 3 && !pal_img_n) || has_trans)
+               s->img_out_n = s->img_n+1;
             else
-            #endif
-            {
-               memcpy(z->idata+ioff, s->img_buffer, c.length);
-               s->img_buffer += c.length;
+               s->img_out_n = s->img_n;
+            // with nothing left to do to the pixels afterwards, they
+            // can be unfiltered straight into the caller's memory
+            if (!create_png_image(z, z->expanded, raw_len, s->img_out_n,
+                                  z->into && !pal_img_n && !has_trans && s->img_out_n == req_comp)) return 0;
+            if (has_trans)
+               if (!compute_transparency(z, tc, s->img_out_n)) return 0;
+            if (pal_img_n) {
+               // pal_img_n == 3 or 4
+               s->img_n = pal_img_n; // record the actual colors we had
+               s->img_out_n = pal_img_n;
+               if (req_comp >= 3) s->img_out_n = req_comp;
+               if (!expand_palette(z, palette, pal_len, s->img_out_n))
+                  return 0;
             }
-            ioff += c.length;
+            scratch_free(z->expanded); z->expanded = NULL;
+            return 1;
+         }
+
+         default:
+            // if critical, fail
+            if ((c.type & (1 << 29)) == 0) {
+               // a constant, so decodes on other threads can't overwrite it
+               return e("unknown critical chunk", "PNG not supported: unknown chunk type");
+            }
+            skip(s, c.length);
             break;
+      }
+      // end of chunk, read and skip CRC
+      get32(s);
+   }
+}
+
+// into, if not NULL, is where the pixels go (rows into_pitch bytes apart,
+// req_comp set); the caller has checked it is big enough
+static unsigned char *do_png(png *p, int *x, int *y, int *n, int req_comp, uint8 *into, int into_pitch)
+{
+   unsigned char *result=NULL;
+   p->expanded = NULL;
+   p->idata = NULL;
+   p->out = NULL;
+   p->into = into;
+   p->into_pitch = into_pitch;
+   if (req_comp < 0 || req_comp > 4) return epuc("bad req_comp", "Internal error");
+   scratch_begin();
+   if (parse_png_file(p, SCAN_load, req_comp)) {
+      if (into) {
+         if (p->out != into)
+            convert_rows(p->out, p->s.img_x * p->s.img_out_n, p->s.img_out_n, into, into_pitch, req_comp, p->s.img_x, p->s.img_y);
+         result = into;
+      } else {
+         result = p->out;
+         p->out = NULL;
+         if (req_comp && req_comp != p->s.img_out_n) {
+            result = convert_format(result, p->s.img_out_n, req_comp, p->s.img_x, p->s.img_y);
+            p->s.img_out_n = req_comp;
          }
+      }
+      *x = p->s.img_x;
+      *y = p->s.img_y;
+      if (n) *n = p->s.img_n;
+   }
+   if (p->out != into) stbi_free(p->out);
+   p->out = NULL;
+   scratch_free(p->expanded); p->expanded = NULL;
+   scratch_free(p->idata);    p->idata    = NULL;
+   scratch_end();
+
+   return result;
+}
+
+#ifndef STBI_NO_STDIO
+unsigned char *stbi_png_load_from_file(FILE *f, int *x, int *y, int *comp, int req_comp)
+{
+   png p;
+   unsigned char *result;
+   start_file(&p.s, f);
+   result = do_png(&p, x,y,comp,req_comp, NULL,0);
+   stop_file(&p.s);
+   return result;
+}
+
+unsigned char *stbi_png_load(char const *filename, int *x, int *y, int *comp, int req_comp)
+{
+   unsigned char *data;
+   FILE *f = fopen(filename, "rb");
+   if (!f) return NULL;
+   data = stbi_png_load_from_file(f,x,y,comp,req_comp);
+   fclose(f);
+   return data;
+}
+#endif
+
+unsigned char *stbi_png_load_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp)
+{
+   png p;
+   start_mem(&p.s, buffer,len);
+   return do_png(&p, x,y,comp,req_comp, NULL,0);
+}
+
+#ifndef STBI_NO_STDIO
+int stbi_png_test_file(FILE *f)
+{
+   png p;
+   int n,r;
+   n = ftell(f);
+   start_file(&p.s, f);
+   r = parse_png_file(&p, SCAN_type,STBI_default);
+   fseek(f,n,SEEK_SET);
+   return r;
+}
+#endif
+
+int stbi_png_test_memory(stbi_uc const *buffer, int len)
+{
+   png p;
+   start_mem(&p.s, buffer, len);
+   return parse_png_file(&p, SCAN_type,STBI_default);
+}
+
+// read as far as IHDR (or, for a paletted image, far enough to know
+// whether it has a tRNS)
+static int png_info(png *p, int *x, int *y, int *comp)
+{
+   p->expanded = NULL;
+   p->idata = NULL;
+   p->out = NULL;
+   if (!parse_png_file(p, SCAN_header, 0)) return 0;
+   if (x) *x = p->s.img_x;
+   if (y) *y = p->s.img_y;
+   if (comp) *comp = p->s.img_n;
+   return 1;
+}
+
+#ifndef STBI_NO_STDIO
+int stbi_png_info(char const *filename, int *x, int *y, int *comp)
+{
+   int r;
+   FILE *f = fopen(filename, "rb");
+   if (!f) return e("can't fopen", "Unable to open file");
+   r = stbi_png_info_from_file(f, x,y,comp);
+   fclose(f);
+   return r;
+}
+
+int stbi_png_info_from_file(FILE *f, int *x, int *y, int *comp)
+{
+   png p;
+   int n,r;
+   n = ftell(f);
+   start_file(&p.s, f);
+   r = png_info(&p, x,y,comp);
+   fseek(f,n,SEEK_SET);
+   return r;
+}
+#endif
+
+int stbi_png_info_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp)
+{
+   png p;
+   start_mem(&p.s, buffer, len);
+   return png_info(&p, x,y,comp);
+}
+
+// *************************************************************************************************
+// QOI ("Quite OK Image") loader -- lossless RGB/RGBA, see https://qoiformat.org/qoi-specification.pdf
+//
+// Each pixel is a run of the previous one, a reference into a 64-entry
+// cache of recent colors, a small delta from the previous pixel, or a
+// literal; there's no entropy coding, so decoding is one byte-driven pass.
+
+#define QOI_OP_INDEX  0x00
+#define QOI_OP_DIFF   0x40
+#define QOI_OP_LUMA   0x80
+#define QOI_OP_RUN    0xc0
+#define QOI_OP_RGB    0xfe
+#define QOI_OP_RGBA   0xff
+#define QOI_HASH(p)   (((p)[0]*3 + (p)[1]*5 + (p)[2]*7 + (p)[3]*11) & 63)
+
+static int qoi_test(stbi *s)
+{
+   return get32(s) == 0x716f6966;   // "qoif"
+}
+
+#ifndef STBI_NO_STDIO
+int stbi_qoi_test_file(FILE *f)
+{
+   stbi s;
+   int r,n = ftell(f);
+   start_file(&s, f);
+   r = qoi_test(&s);
+   fseek(f,n,SEEK_SET);
+   return r;
+}
+#endif
 
-         case PNG_TYPE('I','E','N','D'): {
-            uint32 raw_len;
-            if (scan != SCAN_load) return 1;
-            if (z->idata == NULL) return e("no IDAT","Corrupt PNG");
-            z->expanded = (uint8 *) stbi_zlib_decode_malloc((char *) z->idata, ioff, (int *) &raw_len);
-            if (z->expanded == NULL) return 0; // zlib should set error
-            free(z->idata); z->idata = NULL;
-            if ((req_comp == s->img_n+1 && req_comp != 3 && !pal_img_n) || has_trans)
-               s->img_out_n = s->img_n+1;
-            else
-               s->img_out_n = s->img_n;
-            if (!create_png_image(z, z->expanded, raw_len, s->img_out_n)) return 0;
-            if (has_trans)
-               if (!compute_transparency(z, tc, s->img_out_n)) return 0;
-            if (pal_img_n) {
-               // pal_img_n == 3 or 4
-               s->img_n = pal_img_n; // record the actual colors we had
-               s->img_out_n = pal_img_n;
-               if (req_comp >= 3) s->img_out_n = req_comp;
-               if (!expand_palette(z, palette, pal_len, s->img_out_n))
-                  return 0;
-            }
-            free(z->expanded); z->expanded = NULL;
-            return 1;
-         }
+int stbi_qoi_test_memory(stbi_uc const *buffer, int len)
+{
+   stbi s;
+   start_mem(&s, buffer, len);
+   return qoi_test(&s);
+}
 
-         default:
-            // if critical, fail
-            if ((c.type & (1 << 29)) == 0) {
-               #ifndef STBI_NO_FAILURE_STRINGS
-               // not threadsafe
-               static char invalid_chunk[] = "XXXX chunk not known";
-               invalid_chunk[0] = (uint8) (c.type >> 24);
-               invalid_chunk[1] = (uint8) (c.type >> 16);
-               invalid_chunk[2] = (uint8) (c.type >>  8);
-               invalid_chunk[3] = (uint8) (c.type >>  0);
-               #endif
-               return e(invalid_chunk, "PNG not supported: unknown chunk type");
-            }
-            skip(s, c.length);
-            break;
-      }
-      // end of chunk, read and skip CRC
-      get32(s);
-   }
+static int qoi_header(stbi *s)
+{
+   int colorspace;
+   if (!qoi_test(s)) return e("not QOI", "Corrupt QOI");
+   s->img_x = get32(s);
+   s->img_y = get32(s);
+   s->img_n = get8(s);
+   colorspace = get8(s);
+   if (s->img_n != 3 && s->img_n != 4) return e("bad channels", "Corrupt QOI");
+   if (colorspace > 1) return e("bad colorspace", "Corrupt QOI");
+   if (s->img_x == 0 || s->img_y == 0) return e("0-pixel image", "Corrupt QOI");
+   if (s->img_x > 0x7fffffff / 4 / s->img_y) return e("too large", "QOI image too large to decode");
+   return 1;
 }
 
-static unsigned char *do_png(png *p, int *x, int *y, int *n, int req_comp)
+static int qoi_info(stbi *s, int *x, int *y, int *comp)
 {
-   unsigned char *result=NULL;
-   p->expanded = NULL;
-   p->idata = NULL;
-   p->out = NULL;
+   if (!qoi_header(s)) return 0;
+   if (x) *x = s->img_x;
+   if (y) *y = s->img_y;
+   if (comp) *comp = s->img_n;
+   return 1;
+}
+
+// decodes into 'into' (rows into_pitch apart) if it's given, otherwise
+// into a new image; straight to 3 or 4 components either way
+static uint8 *do_qoi(stbi *s, int *x, int *y, int *comp, int req_comp, uint8 *into, int into_pitch)
+{
+   uint8 index[64][4], px[4];
+   uint8 *out, *row;
+   uint32 i,j;
+   int out_n, run = 0;
    if (req_comp < 0 || req_comp > 4) return epuc("bad req_comp", "Internal error");
-   if (parse_png_file(p, SCAN_load, req_comp)) {
-      result = p->out;
-      p->out = NULL;
-      if (req_comp && req_comp != p->s.img_out_n) {
-         result = convert_format(result, p->s.img_out_n, req_comp, p->s.img_x, p->s.img_y);
-         p->s.img_out_n = req_comp;
-         if (result == NULL) return result;
+   if (!qoi_header(s)) return NULL;
+   out_n = (req_comp == 3 || req_comp == 4) ? req_comp : s->img_n;
+   if (into) {
+      out = into;
+   } else {
+      out = (uint8 *) stbi_malloc(s->img_x * s->img_y * out_n);
+      if (out == NULL) return epuc("outofmem", "Out of memory");
+      into_pitch = s->img_x * out_n;
+   }
+   memset(index, 0, sizeof(index));
+   px[0] = px[1] = px[2] = 0;
+   px[3] = 255;
+   for (j=0; j < s->img_y; ++j) {
+      row = out + j * into_pitch;
+      for (i=0; i < s->img_x; ++i, row += out_n) {
+         if (run > 0) {
+            --run;
+         } else {
+            int b1 = get8(s);
+            if (b1 == QOI_OP_RGB) {
+               px[0] = get8u(s);
+               px[1] = get8u(s);
+               px[2] = get8u(s);
+            } else if (b1 == QOI_OP_RGBA) {
+               px[0] = get8u(s);
+               px[1] = get8u(s);
+               px[2] = get8u(s);
+               px[3] = get8u(s);
+            } else switch (b1 & 0xc0) {
+               case QOI_OP_INDEX:
+                  memcpy(px, index[b1], 4);
+                  break;
+               case QOI_OP_DIFF:
+                  px[0] += ((b1 >> 4) & 3) - 2;
+                  px[1] += ((b1 >> 2) & 3) - 2;
+                  px[2] += ( b1       & 3) - 2;
+                  break;
+               case QOI_OP_LUMA: {
+                  int b2 = get8(s);
+                  int vg = (b1 & 0x3f) - 32;
+                  px[0] += vg - 8 + ((b2 >> 4) & 0x0f);
+                  px[1] += vg;
+                  px[2] += vg - 8 + ( b2       & 0x0f);
+                  break;
+               }
+               default:   // QOI_OP_RUN, this pixel and up to 61 more
+                  run = b1 & 0x3f;
+                  break;
+            }
+            memcpy(index[QOI_HASH(px)], px, 4);
+         }
+         row[0] = px[0];
+         row[1] = px[1];
+         row[2] = px[2];
+         if (out_n == 4) row[3] = px[3];
       }
-      *x = p->s.img_x;
-      *y = p->s.img_y;
-      if (n) *n = p->s.img_n;
    }
-   free(p->out);      p->out      = NULL;
-   free(p->expanded); p->expanded = NULL;
-   free(p->idata);    p->idata    = NULL;
-
-   return result;
+   // a cut-short stream reads as zeros, which can't look like the end marker
+   for (i=0; i < 7; ++i)
+      if (get8(s) != 0) break;
+   if (i < 7 || get8(s) != 1) {
+      if (!into) stbi_free(out);
+      return epuc("bad end marker", "Corrupt QOI");
+   }
+   *x = s->img_x;
+   *y = s->img_y;
+   if (comp) *comp = s->img_n;
+   if (req_comp && req_comp != out_n) {
+      // only for 1 or 2 components, which never come here with 'into'
+      out = convert_format(out, out_n, req_comp, s->img_x, s->img_y);
+   }
+   return out;
 }
 
 #ifndef STBI_NO_STDIO
-unsigned char *stbi_png_load_from_file(FILE *f, int *x, int *y, int *comp, int req_comp)
+stbi_uc *stbi_qoi_load             (char const *filename,           int *x, int *y, int *comp, int req_comp)
 {
-   png p;
-   start_file(&p.s, f);
-   return do_png(&p, x,y,comp,req_comp);
+   stbi_uc *data;
+   FILE *f = fopen(filename, "rb");
+   if (!f) return epuc("can't fopen", "Unable to open file");
+   data = stbi_qoi_load_from_file(f, x,y,comp,req_comp);
+   fclose(f);
+   return data;
 }
 
-unsigned char *stbi_png_load(char const *filename, int *x, int *y, int *comp, int req_comp)
+stbi_uc *stbi_qoi_load_from_file   (FILE *f,                  int *x, int *y, int *comp, int req_comp)
 {
-   unsigned char *data;
+   stbi s;
+   stbi_uc *result;
+   start_file(&s, f);
+   result = do_qoi(&s, x,y,comp,req_comp, NULL,0);
+   stop_file(&s);
+   return result;
+}
+
+int stbi_qoi_info(char const *filename, int *x, int *y, int *comp)
+{
+   int r;
    FILE *f = fopen(filename, "rb");
-   if (!f) return NULL;
-   data = stbi_png_load_from_file(f,x,y,comp,req_comp);
+   if (!f) return e("can't fopen", "Unable to open file");
+   r = stbi_qoi_info_from_file(f, x,y,comp);
    fclose(f);
-   return data;
+   return r;
+}
+
+int stbi_qoi_info_from_file(FILE *f, int *x, int *y, int *comp)
+{
+   stbi s;
+   int r,n = ftell(f);
+   start_file(&s, f);
+   r = qoi_info(&s, x,y,comp);
+   fseek(f,n,SEEK_SET);
+   return r;
 }
 #endif
 
-unsigned char *stbi_png_load_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp)
+stbi_uc *stbi_qoi_load_from_memory (stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp)
 {
-   png p;
-   start_mem(&p.s, buffer,len);
-   return do_png(&p, x,y,comp,req_comp);
+   stbi s;
+   start_mem(&s, buffer, len);
+   return do_qoi(&s, x,y,comp,req_comp, NULL,0);
 }
 
-#ifndef STBI_NO_STDIO
-int stbi_png_test_file(FILE *f)
+int stbi_qoi_info_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp)
 {
-   png p;
-   int n,r;
-   n = ftell(f);
-   start_file(&p.s, f);
-   r = parse_png_file(&p, SCAN_type,STBI_default);
-   fseek(f,n,SEEK_SET);
+   stbi s;
+   start_mem(&s, buffer, len);
+   return qoi_info(&s, x,y,comp);
+}
+
+// Decoding into caller memory, and the generic header probe.
+//
+// JPEG, PNG and QOI write their pixels straight into the caller's rows
+// (PNG only when it needs no palette, tRNS or channel conversion pass,
+// which is the usual RGB/RGBA texture, and QOI only for 3 or 4
+// components); the other formats decode to a temporary image and are
+// copied in.  The generic info functions only probe the headers of JPEG,
+// PNG and QOI; the others are decoded to find out.
+
+// make sure an x*y image of req_comp components fits in the caller's buffer
+static int check_into(int x, int y, int req_comp, int pitch, int size)
+{
+   if (req_comp < 1 || req_comp > 4) return e("bad req_comp", "Internal error");
+   if (pitch < x * req_comp) return e("pitch too small", "Destination rows too short for the image");
+   if (size < x * req_comp || (size - x * req_comp) / pitch < y - 1)
+      return e("buffer too small", "Destination too small for the image");
+   return 1;
+}
+
+static int copy_into(stbi_uc *data, int *x, int *y, int req_comp, stbi_uc *dest, int dest_pitch, int dest_size)
+{
+   int r;
+   if (data == NULL) return 0;
+   r = check_into(*x, *y, req_comp, dest_pitch, dest_size);
+   if (r) convert_rows(data, *x * req_comp, req_comp, dest, dest_pitch, req_comp, *x, *y);
+   stbi_image_free(data);
    return r;
 }
-#endif
 
-int stbi_png_test_memory(stbi_uc const *buffer, int len)
+int stbi_info_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp)
 {
-   png p;
-   start_mem(&p.s, buffer, len);
-   return parse_png_file(&p, SCAN_type,STBI_default);
+   int w,h,n;
+   stbi_uc *data;
+   stbi_loader *loader = find_loader(buffer, len);
+   if (loader == &jpeg_loader) return stbi_jpeg_info_from_memory(buffer,len,x,y,comp);
+   if (loader == &png_loader)  return stbi_png_info_from_memory(buffer,len,x,y,comp);
+   if (loader == &qoi_loader)  return stbi_qoi_info_from_memory(buffer,len,x,y,comp);
+   data = stbi_load_from_memory(buffer,len,&w,&h,&n,0);
+   if (data == NULL) return 0;
+   stbi_image_free(data);
+   if (x) *x = w;
+   if (y) *y = h;
+   if (comp) *comp = n;
+   return 1;
+}
+
+int stbi_load_into_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, stbi_uc *dest, int dest_pitch, int dest_size)
+{
+   int w,h;
+   stbi_loader *loader = find_loader(buffer, len);
+   if (loader == &jpeg_loader || loader == &png_loader) {
+      if (!stbi_info_from_memory(buffer,len,&w,&h,NULL)) return 0;
+      if (!check_into(w,h,req_comp,dest_pitch,dest_size)) return 0;
+      if (loader == &jpeg_loader) {
+         jpeg j;
+         j.scale_shift = 0;
+         start_mem(&j.s, buffer,len);
+         return load_jpeg_image(&j, x,y,comp,req_comp, dest,dest_pitch) != NULL;
+      } else {
+         png p;
+         start_mem(&p.s, buffer,len);
+         return do_png(&p, x,y,comp,req_comp, dest,dest_pitch) != NULL;
+      }
+   }
+   if (loader == &qoi_loader && (req_comp == 3 || req_comp == 4)) {
+      stbi s;
+      if (!stbi_qoi_info_from_memory(buffer,len,&w,&h,NULL)) return 0;
+      if (!check_into(w,h,req_comp,dest_pitch,dest_size)) return 0;
+      start_mem(&s, buffer,len);
+      return do_qoi(&s, x,y,comp,req_comp, dest,dest_pitch) != NULL;
+   }
+   if (req_comp < 1 || req_comp > 4) return e("bad req_comp", "Internal error");
+   return copy_into(stbi_load_from_memory(buffer,len,x,y,comp,req_comp), x,y,req_comp, dest,dest_pitch,dest_size);
 }
 
-// TODO: load header from png
 #ifndef STBI_NO_STDIO
-extern int      stbi_png_info             (char const *filename,           int *x, int *y, int *comp);
-extern int      stbi_png_info_from_file   (FILE *f,                  int *x, int *y, int *comp);
+// the loader whose signature starts the file, without moving the file
+static stbi_loader *find_file_loader(FILE *f)
+{
+   stbi_uc header[STBI_MAX_SIGNATURE];
+   long n = ftell(f);
+   int len = (int) fread(header, 1, STBI_MAX_SIGNATURE, f);
+   fseek(f, n, SEEK_SET);
+   return find_loader(header, len);
+}
+
+int stbi_info(char const *filename, int *x, int *y, int *comp)
+{
+   int r;
+   FILE *f = fopen(filename, "rb");
+   if (!f) return e("can't fopen", "Unable to open file");
+   r = stbi_info_from_file(f, x,y,comp);
+   fclose(f);
+   return r;
+}
+
+int stbi_info_from_file(FILE *f, int *x, int *y, int *comp)
+{
+   int w,h,n;
+   stbi_uc *data;
+   long pos;
+   stbi_loader *loader = find_file_loader(f);
+   if (loader == &jpeg_loader) return stbi_jpeg_info_from_file(f,x,y,comp);
+   if (loader == &png_loader)  return stbi_png_info_from_file(f,x,y,comp);
+   if (loader == &qoi_loader)  return stbi_qoi_info_from_file(f,x,y,comp);
+   pos = ftell(f);
+   data = stbi_load_from_file(f,&w,&h,&n,0);
+   fseek(f, pos, SEEK_SET);
+   if (data == NULL) return 0;
+   stbi_image_free(data);
+   if (x) *x = w;
+   if (y) *y = h;
+   if (comp) *comp = n;
+   return 1;
+}
+
+int stbi_load_into(char const *filename, int *x, int *y, int *comp, int req_comp, stbi_uc *dest, int dest_pitch, int dest_size)
+{
+   int r;
+   FILE *f = fopen(filename, "rb");
+   if (!f) return e("can't fopen", "Unable to open file");
+   r = stbi_load_into_file(f, x,y,comp,req_comp, dest,dest_pitch,dest_size);
+   fclose(f);
+   return r;
+}
+
+int stbi_load_into_file(FILE *f, int *x, int *y, int *comp, int req_comp, stbi_uc *dest, int dest_pitch, int dest_size)
+{
+   int w,h;
+   stbi_loader *loader = find_file_loader(f);
+   if (loader == &jpeg_loader || loader == &png_loader) {
+      uint8 *result;
+      if (!stbi_info_from_file(f,&w,&h,NULL)) return 0;
+      if (!check_into(w,h,req_comp,dest_pitch,dest_size)) return 0;
+      if (loader == &jpeg_loader) {
+         jpeg j;
+         j.scale_shift = 0;
+         start_file(&j.s, f);
+         result = load_jpeg_image(&j, x,y,comp,req_comp, dest,dest_pitch);
+         stop_file(&j.s);
+      } else {
+         png p;
+         start_file(&p.s, f);
+         result = do_png(&p, x,y,comp,req_comp, dest,dest_pitch);
+         stop_file(&p.s);
+      }
+      return result != NULL;
+   }
+   if (loader == &qoi_loader && (req_comp == 3 || req_comp == 4)) {
+      stbi s;
+      uint8 *result;
+      if (!stbi_qoi_info_from_file(f,&w,&h,NULL)) return 0;
+      if (!check_into(w,h,req_comp,dest_pitch,dest_size)) return 0;
+      start_file(&s, f);
+      result = do_qoi(&s, x,y,comp,req_comp, dest,dest_pitch);
+      stop_file(&s);
+      return result != NULL;
+   }
+   if (req_comp < 1 || req_comp > 4) return e("bad req_comp", "Internal error");
+   return copy_into(stbi_load_from_file(f,x,y,comp,req_comp), x,y,req_comp, dest,dest_pitch,dest_size);
+}
 #endif
-extern int      stbi_png_info_from_memory (stbi_uc const *buffer, int len, int *x, int *y, int *comp);
 
 // Microsoft/Windows BMP image
 
@@ -2522,7 +4390,7 @@ static stbi_uc *bmp_load(stbi *s, int *x, int *y, int *comp, int req_comp)
    offset = get32le(s);
    hsz = get32le(s);
    if (hsz != 12 && hsz != 40 && hsz != 56 && hsz != 108) return epuc("unknown BMP", "BMP type not supported: unknown");
-   failure_reason = "bad BMP";
+   e("bad BMP", "bad BMP");
    if (hsz == 12) {
       s->img_x = get16le(s);
       s->img_y = get16le(s);
@@ -2595,11 +4463,11 @@ static stbi_uc *bmp_load(stbi *s, int *x, int *y, int *comp, int req_comp)
       target = req_comp;
    else
       target = s->img_n; // if they want monochrome, we'll post-convert
-   out = (stbi_uc *) malloc(target * s->img_x * s->img_y);
+   out = (stbi_uc *) stbi_malloc(target * s->img_x * s->img_y);
    if (!out) return epuc("outofmem", "Out of memory");
    if (bpp < 16) {
       int z=0;
-      if (psize == 0 || psize > 256) { free(out); return epuc("invalid", "Corrupt BMP"); }
+      if (psize == 0 || psize > 256) { stbi_free(out); return epuc("invalid", "Corrupt BMP"); }
       for (i=0; i < psize; ++i) {
          pal[i][2] = get8(s);
          pal[i][1] = get8(s);
@@ -2610,7 +4478,7 @@ static stbi_uc *bmp_load(stbi *s, int *x, int *y, int *comp, int req_comp)
       skip(s, offset - 14 - hsz - psize * (hsz == 12 ? 3 : 4));
       if (bpp == 4) width = (s->img_x + 1) >> 1;
       else if (bpp == 8) width = s->img_x;
-      else { free(out); return epuc("bad bpp", "Corrupt BMP"); }
+      else { stbi_free(out); return epuc("bad bpp", "Corrupt BMP"); }
       pad = (-width)&3;
       for (j=0; j < (int) s->img_y; ++j) {
          for (i=0; i < (int) s->img_x; i += 2) {
@@ -2716,8 +4584,11 @@ stbi_uc *stbi_bmp_load             (char const *filename,           int *x, int
 stbi_uc *stbi_bmp_load_from_file   (FILE *f,                  int *x, int *y, int *comp, int req_comp)
 {
    stbi s;
+   stbi_uc *result;
    start_file(&s, f);
-   return bmp_load(&s, x,y,comp,req_comp);
+   result = bmp_load(&s, x,y,comp,req_comp);
+   stop_file(&s);
+   return result;
 }
 #endif
 
@@ -2834,7 +4705,7 @@ static stbi_uc *tga_load(stbi *s, int *x, int *y, int *comp, int req_comp)
 		//	force a new number of components
 		*comp = tga_bits_per_pixel/8;
 	}
-	tga_data = (unsigned char*)malloc( tga_width * tga_height * req_comp );
+	tga_data = (unsigned char*)stbi_malloc( tga_width * tga_height * req_comp );
 
 	//	skip to the data's starting position (offset usually = 0)
 	skip(s, tga_offset );
@@ -2844,7 +4715,7 @@ static stbi_uc *tga_load(stbi *s, int *x, int *y, int *comp, int req_comp)
 		//	any data to skip? (offset usually = 0)
 		skip(s, tga_palette_start );
 		//	load the palette
-		tga_palette = (unsigned char*)malloc( tga_palette_len * tga_palette_bits / 8 );
+		tga_palette = (unsigned char*)stbi_malloc( tga_palette_len * tga_palette_bits / 8 );
 		getn(s, tga_palette, tga_palette_len * tga_palette_bits / 8 );
 	}
 	//	load the data
@@ -2978,7 +4849,7 @@ static stbi_uc *tga_load(stbi *s, int *x, int *y, int *comp, int req_comp)
 	//	clear my palette, if I had one
 	if( tga_palette != NULL )
 	{
-		free( tga_palette );
+		stbi_free( tga_palette );
 	}
 	//	the things I do to get rid of an error message, and yet keep
 	//	Microsoft's C compilers happy... [8^(
@@ -3002,8 +4873,11 @@ stbi_uc *stbi_tga_load             (char const *filename,           int *x, int
 stbi_uc *stbi_tga_load_from_file   (FILE *f,                  int *x, int *y, int *comp, int req_comp)
 {
    stbi s;
+   stbi_uc *result;
    start_file(&s, f);
-   return tga_load(&s, x,y,comp,req_comp);
+   result = tga_load(&s, x,y,comp,req_comp);
+   stop_file(&s);
+   return result;
 }
 #endif
 
@@ -3106,7 +4980,7 @@ static stbi_uc *psd_load(stbi *s, int *x, int *y, int *comp, int req_comp)
 		return epuc("bad compression", "PSD has an unknown compression format");
 
 	// Create the destination image.
-	out = (stbi_uc *) malloc(4 * w*h);
+	out = (stbi_uc *) stbi_malloc(4 * w*h);
 	if (!out) return epuc("outofmem", "Out of memory");
    pixelCount = w*h;
 
@@ -3216,8 +5090,11 @@ stbi_uc *stbi_psd_load(char const *filename, int *x, int *y, int *comp, int req_
 stbi_uc *stbi_psd_load_from_file(FILE *f, int *x, int *y, int *comp, int req_comp)
 {
    stbi s;
+   stbi_uc *result;
    start_file(&s, f);
-   return psd_load(&s, x,y,comp,req_comp);
+   result = psd_load(&s, x,y,comp,req_comp);
+   stop_file(&s);
+   return result;
 }
 #endif
 
@@ -3358,7 +5235,7 @@ static float *hdr_load(stbi *s, int *x, int *y, int *comp, int req_comp)
 	if (req_comp == 0) req_comp = 3;
 
 	// Read data
-	hdr_data = (float *) malloc(height * width * req_comp * sizeof(float));
+	hdr_data = (float *) stbi_malloc(height * width * req_comp * sizeof(float));
 
 	// Load image data
    // image data is stored as some number of sca
@@ -3387,13 +5264,13 @@ static float *hdr_load(stbi *s, int *x, int *y, int *comp, int req_comp)
             hdr_convert(hdr_data, rgbe, req_comp);
             i = 1;
             j = 0;
-            free(scanline);
+            stbi_free(scanline);
             goto main_decode_loop; // yes, this is fucking insane; blame the fucking insane format
          }
          len <<= 8;
          len |= get8(s);
-         if (len != width) { free(hdr_data); free(scanline); return epf("invalid decoded scanline length", "corrupt HDR"); }
-         if (scanline == NULL) scanline = (stbi_uc *) malloc(width * 4);
+         if (len != width) { stbi_free(hdr_data); stbi_free(scanline); return epf("invalid decoded scanline length", "corrupt HDR"); }
+         if (scanline == NULL) scanline = (stbi_uc *) stbi_malloc(width * 4);
 
 			for (k = 0; k < 4; ++k) {
 				i = 0;
@@ -3415,7 +5292,7 @@ static float *hdr_load(stbi *s, int *x, int *y, int *comp, int req_comp)
          for (i=0; i < width; ++i)
             hdr_convert(hdr_data+(j*width + i)*req_comp, scanline + i*4, req_comp);
 		}
-      free(scanline);
+      stbi_free(scanline);
 	}
 
    return hdr_data;
@@ -3466,7 +5343,7 @@ static stbi_uc *hdr_load_rgbe(stbi *s, int *x, int *y, int *comp, int req_comp)
 	req_comp = 4;
 
 	// Read data
-	rgbe_data = (stbi_uc *) malloc(height * width * req_comp * sizeof(stbi_uc));
+	rgbe_data = (stbi_uc *) stbi_malloc(height * width * req_comp * sizeof(stbi_uc));
 	//	point to the beginning
 	scanline = rgbe_data;
 
@@ -3502,7 +5379,7 @@ static stbi_uc *hdr_load_rgbe(stbi *s, int *x, int *y, int *comp, int req_comp)
          }
          len <<= 8;
          len |= get8(s);
-         if (len != width) { free(rgbe_data); return epuc("invalid decoded scanline length", "corrupt HDR"); }
+         if (len != width) { stbi_free(rgbe_data); return epuc("invalid decoded scanline length", "corrupt HDR"); }
 			for (k = 0; k < 4; ++k) {
 				i = 0;
 				while (i < width) {
@@ -3532,15 +5409,31 @@ static stbi_uc *hdr_load_rgbe(stbi *s, int *x, int *y, int *comp, int req_comp)
 float *stbi_hdr_load_from_file(FILE *f, int *x, int *y, int *comp, int req_comp)
 {
    stbi s;
-   start_file(&s,f);
-   return hdr_load(&s,x,y,comp,req_comp);
+   float *result;
+   start_file(&s, f);
+   result = hdr_load(&s,x,y,comp,req_comp);
+   stop_file(&s);
+   return result;
 }
 
 stbi_uc *stbi_hdr_load_rgbe_file(FILE *f, int *x, int *y, int *comp, int req_comp)
 {
    stbi s;
-   start_file(&s,f);
-   return hdr_load_rgbe(&s,x,y,comp,req_comp);
+   stbi_uc *result;
+   start_file(&s, f);
+   result = hdr_load_rgbe(&s,x,y,comp,req_comp);
+   stop_file(&s);
+   return result;
+}
+
+float *stbi_hdr_load(char const *filename, int *x, int *y, int *comp, int req_comp)
+{
+   FILE *f = fopen(filename, "rb");
+   float *result;
+   if (!f) return epf("can't fopen", "Unable to open file");
+   result = stbi_hdr_load_from_file(f,x,y,comp,req_comp);
+   fclose(f);
+   return result;
 }
 
 stbi_uc *stbi_hdr_load_rgbe        (char const *filename,           int *x, int *y, int *comp, int req_comp)
@@ -3574,16 +5467,96 @@ stbi_uc *stbi_hdr_load_rgbe_memory(stbi_uc *buffer, int len, int *x, int *y, int
 
 #ifndef STBI_NO_WRITE
 
-static void write8(FILE *f, int x) { uint8 z = (uint8) x; fwrite(&z,1,1,f); }
+// everything is written through a stream: either a file with a large buffer
+// in front of it, or a memory buffer that grows to hold the whole image.
+// writers ask for room with out_reserve and fill it in place, so a file
+// costs one fwrite per STBI_WRITE_BUFFER bytes rather than one per byte
+#define STBI_WRITE_BUFFER 65536
+
+typedef struct
+{
+   FILE *f;          // NULL when writing to memory
+   uint8 *buffer;
+   int len, size;
+   int error;
+} stbi_out;
+
+static int out_open_file(stbi_out *o, char const *filename)
+{
+   o->len = o->error = 0;
+   o->size = STBI_WRITE_BUFFER;
+   o->buffer = (uint8 *) stbi_malloc(o->size);
+   if (o->buffer == NULL) return 0;
+   o->f = fopen(filename, "wb");
+   if (o->f == NULL) { stbi_free(o->buffer); return 0; }
+   return 1;
+}
+
+static int out_open_mem(stbi_out *o)
+{
+   o->f = NULL;
+   o->len = o->error = 0;
+   o->size = STBI_WRITE_BUFFER;
+   o->buffer = (uint8 *) stbi_malloc(o->size);
+   return o->buffer != NULL;
+}
+
+// room for n more bytes at buffer+len (n <= STBI_WRITE_BUFFER); the caller
+// adds what it writes to len.  NULL if out of memory
+static uint8 *out_reserve(stbi_out *o, int n)
+{
+   if (o->len + n > o->size) {
+      if (o->f) {
+         if (fwrite(o->buffer, 1, o->len, o->f) != (size_t) o->len) o->error = 1;
+         o->len = 0;
+      } else {
+         int size = o->size * 2;
+         uint8 *p;
+         if (o->error) return NULL;
+         if (size < o->len + n) size = o->len + n;
+         p = (uint8 *) stbi_realloc(o->buffer, size);
+         if (p == NULL) { o->error = 1; return NULL; }
+         o->buffer = p;
+         o->size = size;
+      }
+   }
+   return o->buffer + o->len;
+}
+
+static int out_close_file(stbi_out *o)
+{
+   int ok;
+   if (o->len > 0 && fwrite(o->buffer, 1, o->len, o->f) != (size_t) o->len) o->error = 1;
+   ok = !o->error && !ferror(o->f);
+   ok = (fclose(o->f) == 0) && ok;
+   stbi_free(o->buffer);
+   return ok;
+}
+
+static stbi_uc *out_close_mem(stbi_out *o, int *len)
+{
+   if (o->error) {
+      stbi_free(o->buffer);
+      return NULL;
+   }
+   if (len) *len = o->len;
+   return o->buffer;
+}
+
+static void write8(stbi_out *o, int x)
+{
+   uint8 *p = out_reserve(o, 1);
+   if (p) { *p = (uint8) x; ++o->len; }
+}
 
-static void writefv(FILE *f, char *fmt, va_list v)
+static void writefv(stbi_out *o, char *fmt, va_list v)
 {
    while (*fmt) {
       switch (*fmt++) {
          case ' ': break;
-         case '1': { uint8 x = va_arg(v, int); write8(f,x); break; }
-         case '2': { int16 x = va_arg(v, int); write8(f,x); write8(f,x>>8); break; }
-         case '4': { int32 x = va_arg(v, int); write8(f,x); write8(f,x>>8); write8(f,x>>16); write8(f,x>>24); break; }
+         case '1': { uint8 x = va_arg(v, int); write8(o,x); break; }
+         case '2': { int16 x = va_arg(v, int); write8(o,x); write8(o,x>>8); break; }
+         case '4': { int32 x = va_arg(v, int); write8(o,x); write8(o,x>>8); write8(o,x>>16); write8(o,x>>24); break; }
          default:
             assert(0);
             va_end(v);
@@ -3592,19 +5565,20 @@ static void writefv(FILE *f, char *fmt, va_list v)
    }
 }
 
-static void writef(FILE *f, char *fmt, ...)
+static void writef(stbi_out *o, char *fmt, ...)
 {
    va_list v;
    va_start(v, fmt);
-   writefv(f,fmt,v);
+   writefv(o,fmt,v);
    va_end(v);
 }
 
-static void write_pixels(FILE *f, int rgb_dir, int vdir, int x, int y, int comp, void *data, int write_alpha, int scanline_pad)
+static void write_pixels(stbi_out *o, int rgb_dir, int vdir, int x, int y, int comp, void *data, int write_alpha, int scanline_pad)
 {
    uint8 bg[3] = { 255, 0, 255}, px[3];
-   uint32 zero = 0;
-   int i,j,k, j_end;
+   int bytes = 3 + (write_alpha != 0);
+   int i,j,k, n, j_end;
+   uint8 *p;
 
    if (vdir < 0)
       j_end = -1, j = y-1;
@@ -3612,63 +5586,186 @@ static void write_pixels(FILE *f, int rgb_dir, int vdir, int x, int y, int comp,
       j_end =  y, j = 0;
 
    for (; j != j_end; j += vdir) {
-      for (i=0; i < x; ++i) {
-         uint8 *d = (uint8 *) data + (j*x+i)*comp;
-         if (write_alpha < 0)
-            fwrite(&d[comp-1], 1, 1, f);
-         switch (comp) {
-            case 1:
-            case 2: writef(f, "111", d[0],d[0],d[0]);
-                    break;
-            case 4:
-               if (!write_alpha) {
-                  for (k=0; k < 3; ++k)
-                     px[k] = bg[k] + ((d[k] - bg[k]) * d[3])/255;
-                  writef(f, "111", px[1-rgb_dir],px[1],px[1+rgb_dir]);
+      uint8 *d = (uint8 *) data + j*x*comp;
+      for (i=0; i < x; ) {
+         // a run of pixels at a time, straight into the buffer
+         n = x - i;
+         if (n > STBI_WRITE_BUFFER / 8) n = STBI_WRITE_BUFFER / 8;
+         p = out_reserve(o, n * bytes);
+         if (p == NULL) return;
+         o->len += n * bytes;
+         for (i += n; n > 0; --n, d += comp) {
+            if (write_alpha < 0)
+               *p++ = d[comp-1];
+            switch (comp) {
+               case 1:
+               case 2: p[0] = p[1] = p[2] = d[0];
+                       break;
+               case 4:
+                  if (!write_alpha) {
+                     for (k=0; k < 3; ++k)
+                        px[k] = bg[k] + ((d[k] - bg[k]) * d[3])/255;
+                     p[0] = px[1-rgb_dir]; p[1] = px[1]; p[2] = px[1+rgb_dir];
+                     break;
+                  }
+                  /* FALLTHROUGH */
+               case 3:
+                  p[0] = d[1-rgb_dir]; p[1] = d[1]; p[2] = d[1+rgb_dir];
                   break;
-               }
-               /* FALLTHROUGH */
-            case 3:
-               writef(f, "111", d[1-rgb_dir],d[1],d[1+rgb_dir]);
-               break;
+            }
+            p += 3;
+            if (write_alpha > 0)
+               *p++ = d[comp-1];
          }
-         if (write_alpha > 0)
-            fwrite(&d[comp-1], 1, 1, f);
       }
-      fwrite(&zero,scanline_pad,1,f);
+      p = out_reserve(o, scanline_pad);
+      if (p == NULL) return;
+      memset(p, 0, scanline_pad);
+      o->len += scanline_pad;
    }
 }
 
-static int outfile(char const *filename, int rgb_dir, int vdir, int x, int y, int comp, void *data, int alpha, int pad, char *fmt, ...)
+static void write_image(stbi_out *o, int rgb_dir, int vdir, int x, int y, int comp, void *data, int alpha, int pad, char *fmt, ...)
 {
-   FILE *f = fopen(filename, "wb");
-   if (f) {
-      va_list v;
-      va_start(v, fmt);
-      writefv(f, fmt, v);
-      va_end(v);
-      write_pixels(f,rgb_dir,vdir,x,y,comp,data,alpha,pad);
-      fclose(f);
-   }
-   return f != NULL;
+   va_list v;
+   va_start(v, fmt);
+   writefv(o, fmt, v);
+   va_end(v);
+   write_pixels(o,rgb_dir,vdir,x,y,comp,data,alpha,pad);
 }
 
-int stbi_write_bmp(char const *filename, int x, int y, int comp, void *data)
+static void write_bmp(stbi_out *o, int x, int y, int comp, void *data)
 {
    int pad = (-x*3) & 3;
-   return outfile(filename,-1,-1,x,y,comp,data,0,pad,
+   write_image(o,-1,-1,x,y,comp,data,0,pad,
            "11 4 22 4" "4 44 22 444444",
            'B', 'M', 14+40+(x*3+pad)*y, 0,0, 14+40,  // file header
             40, x,y, 1,24, 0,0,0,0,0,0);             // bitmap header
 }
 
-int stbi_write_tga(char const *filename, int x, int y, int comp, void *data)
+static void write_tga(stbi_out *o, int x, int y, int comp, void *data)
 {
    int has_alpha = !(comp & 1);
-   return outfile(filename, -1,-1, x, y, comp, data, has_alpha, 0,
+   write_image(o, -1,-1, x, y, comp, data, has_alpha, 0,
                   "111 221 2222 11", 0,0,2, 0,0,0, 0,0,x,y, 24+8*has_alpha, 8*has_alpha);
 }
 
+int stbi_write_bmp(char const *filename, int x, int y, int comp, void *data)
+{
+   stbi_out o;
+   if (!out_open_file(&o, filename)) return 0;
+   write_bmp(&o, x, y, comp, data);
+   return out_close_file(&o);
+}
+
+int stbi_write_tga(char const *filename, int x, int y, int comp, void *data)
+{
+   stbi_out o;
+   if (!out_open_file(&o, filename)) return 0;
+   write_tga(&o, x, y, comp, data);
+   return out_close_file(&o);
+}
+
+stbi_uc *stbi_write_bmp_to_mem(int x, int y, int comp, void *data, int *len)
+{
+   stbi_out o;
+   if (!out_open_mem(&o)) return NULL;
+   write_bmp(&o, x, y, comp, data);
+   return out_close_mem(&o, len);
+}
+
+stbi_uc *stbi_write_tga_to_mem(int x, int y, int comp, void *data, int *len)
+{
+   stbi_out o;
+   if (!out_open_mem(&o)) return NULL;
+   write_tga(&o, x, y, comp, data);
+   return out_close_mem(&o, len);
+}
+
+// QOI takes at most 5 bytes a pixel; 1 and 2 component images are written
+// as RGB and RGBA
+static void write_qoi(stbi_out *o, int x, int y, int comp, void *data)
+{
+   uint8 index[64][4], px[4], prev[4];
+   uint8 *buf, *d = (uint8 *) data;
+   int run = 0, i, n;
+   writef(o, "1111", 'q','o','i','f');
+   writef(o, "1111", x >> 24, x >> 16, x >> 8, x);
+   writef(o, "1111", y >> 24, y >> 16, y >> 8, y);
+   writef(o, "11", (comp & 1) ? 3 : 4, 0);   // sRGB with linear alpha
+   memset(index, 0, sizeof(index));
+   prev[0] = prev[1] = prev[2] = 0;
+   prev[3] = 255;
+   n = x * y;
+   for (i=0; i < n; ++i, d += comp) {
+      buf = out_reserve(o, 5);
+      if (buf == NULL) return;
+      if (comp < 3) {
+         px[0] = px[1] = px[2] = d[0];
+         px[3] = (comp == 2) ? d[1] : 255;
+      } else {
+         px[0] = d[0]; px[1] = d[1]; px[2] = d[2];
+         px[3] = (comp == 4) ? d[3] : 255;
+      }
+      if (memcmp(px, prev, 4) == 0) {
+         if (++run == 62 || i == n-1) {
+            *buf++ = (uint8) (QOI_OP_RUN | (run - 1));
+            run = 0;
+         }
+      } else {
+         int h = QOI_HASH(px);
+         if (run > 0) {
+            *buf++ = (uint8) (QOI_OP_RUN | (run - 1));
+            run = 0;
+         }
+         if (memcmp(index[h], px, 4) == 0) {
+            *buf++ = (uint8) (QOI_OP_INDEX | h);
+         } else {
+            memcpy(index[h], px, 4);
+            if (px[3] == prev[3]) {
+               int vr = (signed char) (px[0] - prev[0]);
+               int vg = (signed char) (px[1] - prev[1]);
+               int vb = (signed char) (px[2] - prev[2]);
+               int vg_r = vr - vg, vg_b = vb - vg;
+               if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+                  *buf++ = (uint8) (QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2));
+               } else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 && vg_b > -9 && vg_b < 8) {
+                  *buf++ = (uint8) (QOI_OP_LUMA | (vg + 32));
+                  *buf++ = (uint8) ((vg_r + 8) << 4 | (vg_b + 8));
+               } else {
+                  *buf++ = QOI_OP_RGB;
+                  *buf++ = px[0]; *buf++ = px[1]; *buf++ = px[2];
+               }
+            } else {
+               *buf++ = QOI_OP_RGBA;
+               *buf++ = px[0]; *buf++ = px[1]; *buf++ = px[2]; *buf++ = px[3];
+            }
+         }
+      }
+      o->len = (int) (buf - o->buffer);
+      memcpy(prev, px, 4);
+   }
+   writef(o, "1111 1111", 0,0,0,0, 0,0,0,1);
+}
+
+int stbi_write_qoi(char const *filename, int x, int y, int comp, void *data)
+{
+   stbi_out o;
+   if (x < 1 || y < 1 || comp < 1 || comp > 4 || data == NULL) return 0;
+   if (!out_open_file(&o, filename)) return 0;
+   write_qoi(&o, x, y, comp, data);
+   return out_close_file(&o);
+}
+
+stbi_uc *stbi_write_qoi_to_mem(int x, int y, int comp, void *data, int *len)
+{
+   stbi_out o;
+   if (x < 1 || y < 1 || comp < 1 || comp > 4 || data == NULL) return NULL;
+   if (!out_open_mem(&o)) return NULL;
+   write_qoi(&o, x, y, comp, data);
+   return out_close_mem(&o, len);
+}
+
 // any other image formats that do interleaved rgb data?
 //    PNG: requires adler32,crc32 -- significant amount of code
 //    PSD: no, channels output separately
@@ -11,7 +11,8 @@
       TGA (not sure what subset, if a subset)
       PSD (composited view only, no extra channels)
       HDR (radiance rgbE format)
-      writes BMP,TGA (define STBI_NO_WRITE to remove code)
+      QOI
+      writes BMP,TGA,QOI (define STBI_NO_WRITE to remove code)
       decoded from memory or through stdio FILE (define STBI_NO_STDIO to remove code)
       supports installable dequantizing-IDCT, YCbCr-to-RGB conversion (define STBI_SIMD)
         
@@ -157,6 +158,7 @@
 #ifndef STBI_NO_STDIO
 #include <stdio.h>
 #endif
+#include <stddef.h>  // size_t
 
 #define STBI_VERSION 1
 
@@ -179,11 +181,18 @@ extern "C" {
 // WRITING API
 
 #if !defined(STBI_NO_WRITE) && !defined(STBI_NO_STDIO)
-// write a BMP/TGA file given tightly packed 'comp' channels (no padding, nor bmp-stride-padding)
+// write a BMP/TGA/QOI file given tightly packed 'comp' channels (no padding, nor bmp-stride-padding)
 // (you must include the appropriate extension in the filename).
 // returns TRUE on success, FALSE if couldn't open file, error writing file
 extern int      stbi_write_bmp       (char const *filename,     int x, int y, int comp, void *data);
 extern int      stbi_write_tga       (char const *filename,     int x, int y, int comp, void *data);
+extern int      stbi_write_qoi       (char const *filename,     int x, int y, int comp, void *data);
+
+// the same, into memory: returns the whole file (*len bytes), to be freed
+// with stbi_image_free, or NULL if out of memory
+extern stbi_uc *stbi_write_bmp_to_mem(int x, int y, int comp, void *data, int *len);
+extern stbi_uc *stbi_write_tga_to_mem(int x, int y, int comp, void *data, int *len);
+extern stbi_uc *stbi_write_qoi_to_mem(int x, int y, int comp, void *data, int *len);
 #endif
 
 // PRIMARY API - works on images of any type
@@ -197,6 +206,15 @@ extern int      stbi_info_from_file  (FILE *f,                  int *x, int *y,
 extern stbi_uc *stbi_load_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp);
 // for stbi_load_from_file, file pointer is left pointing immediately after image
 
+// load at 1/2, 1/4 or 1/8 size (scale_shift 1..3, 0 is full size). JPEGs
+// are decoded straight to the smaller size with reduced IDCTs, anything
+// else is decoded in full and box filtered down. Sizes round up.
+#ifndef STBI_NO_STDIO
+extern stbi_uc *stbi_load_scaled            (char const *filename,     int *x, int *y, int *comp, int req_comp, int scale_shift);
+extern stbi_uc *stbi_load_scaled_from_file  (FILE *f,                  int *x, int *y, int *comp, int req_comp, int scale_shift);
+#endif
+extern stbi_uc *stbi_load_scaled_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, int scale_shift);
+
 #ifndef STBI_NO_HDR
 #ifndef STBI_NO_STDIO
 extern float *stbi_loadf            (char const *filename,     int *x, int *y, int *comp, int req_comp);
@@ -212,8 +230,7 @@ extern void   stbi_ldr_to_hdr_scale(float scale);
 
 #endif // STBI_NO_HDR
 
-// get a VERY brief reason for failure
-// NOT THREADSAFE
+// get a VERY brief reason for failure (of the last call on this thread)
 extern char    *stbi_failure_reason  (void); 
 
 // free the loaded image -- this is just free()
@@ -226,6 +243,16 @@ extern int      stbi_is_hdr_from_memory(stbi_uc const *buffer, int len);
 extern int      stbi_info            (char const *filename,     int *x, int *y, int *comp);
 extern int      stbi_is_hdr          (char const *filename);
 extern int      stbi_is_hdr_from_file(FILE *f);
+#endif // STBI_NO_STDIO
+
+// decode into caller memory: dest_pitch bytes between rows, dest_size bytes
+// in all, and req_comp (1..4) components per pixel; probe the size first
+// with stbi_info.  Returns 1 on success, 0 (with a failure reason) if the
+// image can't be decoded or doesn't fit
+extern int      stbi_load_into_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, stbi_uc *dest, int dest_pitch, int dest_size);
+#ifndef STBI_NO_STDIO
+extern int      stbi_load_into       (char const *filename,     int *x, int *y, int *comp, int req_comp, stbi_uc *dest, int dest_pitch, int dest_size);
+extern int      stbi_load_into_file  (FILE *f,                  int *x, int *y, int *comp, int req_comp, stbi_uc *dest, int dest_pitch, int dest_size);
 #endif
 
 // ZLIB client - used by PNG, available for other purposes
@@ -242,12 +269,20 @@ extern int   stbi_zlib_decode_noheader_buffer(char *obuffer, int olen, const cha
 // is it a jpeg?
 extern int      stbi_jpeg_test_memory     (stbi_uc const *buffer, int len);
 extern stbi_uc *stbi_jpeg_load_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp);
+extern stbi_uc *stbi_jpeg_load_scaled_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, int scale_shift);
+
+// decode the restart intervals of in-memory jpegs on up to max_threads
+// threads (0 = one per hardware thread, 1 = off, the default)
+#ifndef STBI_NO_THREADS
+extern void     stbi_jpeg_set_max_threads (int max_threads);
+#endif
 extern int      stbi_jpeg_info_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp);
 
 #ifndef STBI_NO_STDIO
 extern stbi_uc *stbi_jpeg_load            (char const *filename,     int *x, int *y, int *comp, int req_comp);
 extern int      stbi_jpeg_test_file       (FILE *f);
 extern stbi_uc *stbi_jpeg_load_from_file  (FILE *f,                  int *x, int *y, int *comp, int req_comp);
+extern stbi_uc *stbi_jpeg_load_scaled_from_file(FILE *f,             int *x, int *y, int *comp, int req_comp, int scale_shift);
 
 extern int      stbi_jpeg_info            (char const *filename,     int *x, int *y, int *comp);
 extern int      stbi_jpeg_info_from_file  (FILE *f,                  int *x, int *y, int *comp);
@@ -296,6 +331,19 @@ extern int      stbi_psd_test_file        (FILE *f);
 extern stbi_uc *stbi_psd_load_from_file   (FILE *f,                  int *x, int *y, int *comp, int req_comp);
 #endif
 
+// is it a qoi?
+extern int      stbi_qoi_test_memory      (stbi_uc const *buffer, int len);
+
+extern stbi_uc *stbi_qoi_load_from_memory (stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp);
+extern int      stbi_qoi_info_from_memory (stbi_uc const *buffer, int len, int *x, int *y, int *comp);
+#ifndef STBI_NO_STDIO
+extern stbi_uc *stbi_qoi_load             (char const *filename,     int *x, int *y, int *comp, int req_comp);
+extern int      stbi_qoi_info             (char const *filename,     int *x, int *y, int *comp);
+extern int      stbi_qoi_test_file        (FILE *f);
+extern stbi_uc *stbi_qoi_load_from_file   (FILE *f,                  int *x, int *y, int *comp, int req_comp);
+extern int      stbi_qoi_info_from_file   (FILE *f,                  int *x, int *y, int *comp);
+#endif
+
 // is it an hdr?
 extern int      stbi_hdr_test_memory      (stbi_uc const *buffer, int len);
 
@@ -325,6 +373,15 @@ typedef struct
 // NOT THREADSAFE
 extern int stbi_register_loader(stbi_loader *loader);
 
+// register a loader along with the magic number its files start with (up to
+// 16 bytes).  stbi_load picks the loader by looking the first bytes of the
+// image up in a table, without calling test_*; a NULL or empty signature is
+// the same as stbi_register_loader.  The built-in JPEG, PNG, BMP, PSD, QOI,
+// DDS and HDR loaders are matched first.
+// returns 1 if added or already added, 0 if not added (too many loaders)
+// NOT THREADSAFE
+extern int stbi_register_loader_signature(stbi_loader *loader, stbi_uc const *signature, int signature_len);
+
 // define faster low-level operations (typically SIMD support)
 #if STBI_SIMD
 typedef void (*stbi_idct_8x8)(uint8 *out, int out_stride, short data[64], unsigned short *dequantize);
@@ -344,6 +401,75 @@ extern void stbi_install_idct(stbi_idct_8x8 func);
 extern void stbi_install_YCbCr_to_RGB(stbi_YCbCr_to_RGB_run func);
 #endif // STBI_SIMD
 
+// DECODER CONTEXTS
+//
+// Everything a decode uses besides its arguments lives in a context: the
+// failure reason, the conversion settings and the allocator. The API above
+// runs on a shared default context, which stbi_hdr_to_ldr_gamma() and the
+// like change; its failure reason is kept per thread. To decode on several
+// threads with settings of your own, give each thread a context, either
+// through the *_ctx calls or by making it current with
+// stbi_set_thread_context(), which affects every stbi call on that thread.
+// Registering loaders is still NOT THREADSAFE; do it up front.
+typedef struct
+{
+   char *failure_reason;
+   float hdr_to_ldr_gamma, hdr_to_ldr_scale;
+   float ldr_to_hdr_gamma, ldr_to_hdr_scale;
+   int   jpeg_max_threads;   // see stbi_jpeg_set_max_threads
+
+   // allocator for everything the decoders allocate, including the images
+   // they return (free those with the same context current, or with
+   // stbi_image_free_ctx); NULL functions use malloc/realloc/free
+   void *(*malloc_func)(size_t size, void *user_data);
+   void *(*realloc_func)(void *p, size_t size, void *user_data);
+   void  (*free_func)(void *p, void *user_data);
+   void  *alloc_user_data;
+
+   // most bytes of scratch memory one decode may use (0 for no limit);
+   // past it the decode fails as if out of memory. See stbi_scratch_peak
+   size_t scratch_limit;
+
+   #if STBI_SIMD
+   stbi_idct_8x8 idct;                  // NULL for the built-in one
+   stbi_YCbCr_to_RGB_run YCbCr_to_RGB;  // NULL for the built-in one
+   #endif
+} stbi_context;
+
+// fill in the built-in defaults
+extern void          stbi_context_init(stbi_context *ctx);
+
+// set the allocator of the default context (NULL functions for the C heap)
+extern void          stbi_set_allocator(void *(*malloc_func)(size_t size, void *user_data),
+                                        void *(*realloc_func)(void *p, size_t size, void *user_data),
+                                        void  (*free_func)(void *p, void *user_data),
+                                        void  *user_data);
+
+// SCRATCH MEMORY
+//
+// The temporary buffers of JPEG and PNG decodes (component planes, line
+// buffers, the compressed and inflated PNG data) come from a per-thread
+// arena that is emptied in one go when the decode returns. The other
+// decoders (HDR, TGA, BMP, PSD, DDS, QOI) still take their temporaries
+// from the allocator above. Up to STBI_SCRATCH_KEEP bytes (4MB unless
+// defined otherwise when compiling stb_image_aug.c) of the arena are kept
+// for the next decode on the thread; release them before the thread exits
+// or when no more images are coming.
+extern void          stbi_release_scratch(void);
+// the most scratch memory the last JPEG or PNG decode on this thread used
+extern size_t        stbi_scratch_peak(void);
+
+// make ctx the context for this thread's stbi calls (NULL goes back to the
+// default one); returns the one that was current
+extern stbi_context *stbi_set_thread_context(stbi_context *ctx);
+
+extern stbi_uc *stbi_load_from_memory_ctx(stbi_context *ctx, stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp);
+#ifndef STBI_NO_STDIO
+extern stbi_uc *stbi_load_ctx            (stbi_context *ctx, char const *filename,     int *x, int *y, int *comp, int req_comp);
+extern stbi_uc *stbi_load_from_file_ctx  (stbi_context *ctx, FILE *f,                  int *x, int *y, int *comp, int req_comp);
+#endif
+extern void     stbi_image_free_ctx      (stbi_context *ctx, void *retval_from_stbi_load);
+
 #ifdef __cplusplus
 }
 #endif
@@ -5,6 +5,7 @@
 
 #include "GLFW/glfw3.h"
 #include "SOIL/SOIL.h"
+#include "SOIL/image_perf.h"
 #include "glm/glm.hpp"
 #include "glm/gtc/matrix_transform.hpp"
 #include "glm/gtc/type_ptr.hpp"
@@ -307,8 +308,14 @@ int main()
 	GLfloat angle = -45.0f;
 	GLfloat speed = 0.0f;
 
+	//hardware counters per frame (only when built with SOIL_PERF_COUNTERS), printed as averages
+	//every 60 frames and divided by the one draw call each frame makes
+	perf_stats frameStats = PERF_STATS_INIT("frame", "draw", 60);
+	perf_counters frameCounters;
+
 	while (!glfwWindowShouldClose(window))
 	{
+		PERF_BEGIN(frameCounters);
 		HandleUI(&speed);
 		//clear screen to black
 		glClearColor(0, 0, 0, 1);
@@ -378,6 +385,7 @@ int main()
 		glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
 		//render all drawn graphics to screen
 		Render();
+		PERF_END(frameCounters, frameStats, 1);
 	}
 	glDeleteTextures(2, textures);
 
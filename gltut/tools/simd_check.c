@@ -0,0 +1,345 @@
+/*
+	simd_check: compares the SSE2 kernels in stb_image_aug.c with the
+	scalar code they stand in for
+
+	public domain
+
+	The JPEG kernels (IDCT, 2x upsampling and YCbCr to RGB) are each
+	run next to their scalar versions on the same random input.  The
+	PNG unfiltering is checked by decoding generated PNGs, with every
+	filter type on random rows, once with the SSE2 paths and once
+	without.  Any image files named on the command line are decoded
+	both ways too.  Every output byte has to match; the exit code is 1
+	if any didn't.
+
+	usage:
+		simd_check [--seed n] [--rounds n] [files...]
+
+	building (from the gltut directory):
+		gcc -O2 -Iinclude tools/simd_check.c include/SOIL/image_threads.c
+			-lm -lpthread -o simd_check
+	stb_image_aug.c is included here rather than linked, to get at its
+	kernels, so it must not be linked in as well.
+*/
+
+#include "SOIL/stb_image_aug.c"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+#define CHECK_MAX_ROW		256
+
+static unsigned int random_state = 1;
+static int failures = 0;
+
+static unsigned int random_next( void )
+{
+	/*	xorshift32, so runs repeat on every platform	*/
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state;
+}
+
+static int random_range( int low, int high )
+{
+	return low + (int)(random_next() % (unsigned int)(high - low + 1));
+}
+
+static void random_bytes( unsigned char *p, int n )
+{
+	int i;
+	for( i = 0; i < n; ++i )
+	{
+		p[i] = (unsigned char)random_next();
+	}
+}
+
+static void report( const char *kernel, int runs, int differ )
+{
+	printf( "%-22s %8d runs  %6d differ\n", kernel, runs, differ );
+	failures += (differ > 0);
+}
+
+#ifdef STBI_SSE2
+/********* JPEG kernels *********/
+/*	quantized coefficients of a random 8x8 block of pixels, which is
+	what a valid stream holds (an arbitrary set of coefficients can
+	describe pixels far outside 0..255, where the 16-bit SSE2 IDCT is
+	allowed to saturate differently)	*/
+static void make_DCT_block( short data[64], const uint8 dequantize[64] )
+{
+	double pixels[64];
+	int base = random_range( 0, 255 ), spread = random_range( 0, 255 );
+	int u, v, x, y;
+	for( x = 0; x < 64; ++x )
+	{
+		int p = base + random_range( -spread, spread );
+		pixels[x] = ((p < 0) ? 0 : (p > 255) ? 255 : p) - 128;
+	}
+	for( v = 0; v < 8; ++v )
+	{
+		for( u = 0; u < 8; ++u )
+		{
+			double sum = 0;
+			for( y = 0; y < 8; ++y )
+			{
+				for( x = 0; x < 8; ++x )
+				{
+					sum += pixels[y*8 + x] *
+							cos( (2*x + 1) * u * 3.14159265358979 / 16 ) *
+							cos( (2*y + 1) * v * 3.14159265358979 / 16 );
+				}
+			}
+			sum *= ((u == 0) ? 0.70710678 : 1) * ((v == 0) ? 0.70710678 : 1) / 4;
+			data[v*8 + u] = (short)floor( sum / dequantize[v*8 + u] + 0.5 );
+		}
+	}
+}
+
+static void check_idct( int rounds )
+{
+	short data[64], copy[64];
+	uint8 dequantize[64], expected[64], got[64];
+	int r, i, differ = 0;
+	for( r = 0; r < rounds; ++r )
+	{
+		/*	from fine to coarse quantizing	*/
+		int coarse = random_range( 1, 255 );
+		for( i = 0; i < 64; ++i )
+		{
+			dequantize[i] = (uint8)random_range( 1, coarse );
+		}
+		make_DCT_block( data, dequantize );
+		memcpy( copy, data, sizeof( data ) );
+		idct_block( expected, 8, data, dequantize );
+		idct_block_sse2( got, 8, copy, dequantize );
+		differ += (0 != memcmp( expected, got, 64 ));
+	}
+	report( "idct_block", rounds, differ );
+}
+
+static void check_resample( int rounds )
+{
+	uint8 expected[CHECK_MAX_ROW*2], got[CHECK_MAX_ROW*2];
+	int r, differ_h = 0, differ_hv = 0;
+	for( r = 0; r < rounds; ++r )
+	{
+		/*	exactly sized rows, so a memory checker sees any overread	*/
+		int w = random_range( 1, CHECK_MAX_ROW );
+		uint8 *in_near = (uint8*)malloc( w );
+		uint8 *in_far = (uint8*)malloc( w );
+		random_bytes( in_near, w );
+		random_bytes( in_far, w );
+		resample_row_h_2( expected, in_near, in_far, w, 2 );
+		resample_row_h_2_sse2( got, in_near, in_far, w, 2 );
+		differ_h += (0 != memcmp( expected, got, w*2 ));
+		resample_row_hv_2( expected, in_near, in_far, w, 2 );
+		resample_row_hv_2_sse2( got, in_near, in_far, w, 2 );
+		differ_hv += (0 != memcmp( expected, got, w*2 ));
+		free( in_near );
+		free( in_far );
+	}
+	report( "resample_row_h_2", rounds, differ_h );
+	report( "resample_row_hv_2", rounds, differ_hv );
+}
+
+static void check_YCbCr( int rounds )
+{
+	uint8 y[CHECK_MAX_ROW], cb[CHECK_MAX_ROW], cr[CHECK_MAX_ROW];
+	uint8 expected[CHECK_MAX_ROW*4], got[CHECK_MAX_ROW*4];
+	int r, differ = 0;
+	for( r = 0; r < rounds; ++r )
+	{
+		int count = random_range( 1, CHECK_MAX_ROW );
+		int step = random_range( 3, 4 );
+		random_bytes( y, count );
+		random_bytes( cb, count );
+		random_bytes( cr, count );
+		/*	a 3 byte step still writes a 4th byte after the last pixel	*/
+		memset( expected, 0, sizeof( expected ) );
+		memset( got, 0, sizeof( got ) );
+		YCbCr_to_RGB_row( expected, y, cb, cr, count, step );
+		YCbCr_to_RGB_row_sse2( got, y, cb, cr, count, step );
+		differ += (0 != memcmp( expected, got, count*4 ));
+	}
+	report( "YCbCr_to_RGB_row", rounds, differ );
+}
+#endif
+
+/********* whole decodes, with and without SSE2 *********/
+static int decode_both_ways( const unsigned char *buffer, int length, const char *filename, int req_comp )
+{
+	unsigned char *expected, *got;
+	int x0 = 0, y0 = 0, n0 = 0, x1 = 0, y1 = 0, n1 = 0, differ;
+	stbi_sse2_enabled = 0;
+	expected = (NULL != filename) ?
+			stbi_load( filename, &x0, &y0, &n0, req_comp ) :
+			stbi_load_from_memory( buffer, length, &x0, &y0, &n0, req_comp );
+	stbi_sse2_enabled = 1;
+	got = (NULL != filename) ?
+			stbi_load( filename, &x1, &y1, &n1, req_comp ) :
+			stbi_load_from_memory( buffer, length, &x1, &y1, &n1, req_comp );
+	if( (NULL == expected) || (NULL == got) )
+	{
+		/*	a file neither way can read is nothing to compare, but one
+			only one way can read is a difference	*/
+		differ = ((NULL == expected) != (NULL == got));
+	} else
+	{
+		int channels = req_comp ? req_comp : n0;
+		differ = (x0 != x1) || (y0 != y1) || (n0 != n1) ||
+				(0 != memcmp( expected, got, (size_t)x0 * y0 * channels ));
+	}
+	stbi_image_free( expected );
+	stbi_image_free( got );
+	return differ;
+}
+
+static void put_u32_be( unsigned char *p, unsigned int v )
+{
+	p[0] = (unsigned char)(v >> 24);
+	p[1] = (unsigned char)(v >> 16);
+	p[2] = (unsigned char)(v >> 8);
+	p[3] = (unsigned char)v;
+}
+
+static unsigned int crc32_of( const unsigned char *p, int n )
+{
+	unsigned int crc = 0xFFFFFFFFu;
+	int i, k;
+	for( i = 0; i < n; ++i )
+	{
+		crc ^= p[i];
+		for( k = 0; k < 8; ++k )
+		{
+			crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+		}
+	}
+	return ~crc;
+}
+
+/*	writes a chunk at p, \return the bytes written	*/
+static int put_chunk( unsigned char *p, const char *type, const unsigned char *data, int length )
+{
+	put_u32_be( p, length );
+	memcpy( p + 4, type, 4 );
+	memcpy( p + 8, data, length );
+	put_u32_be( p + 8 + length, crc32_of( p + 4, length + 4 ) );
+	return length + 12;
+}
+
+/*	a PNG of random filtered rows, in stored (uncompressed) deflate blocks	*/
+static unsigned char *make_PNG( int width, int height, int channels, int *size )
+{
+	static const unsigned char signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+	static const unsigned char color_type[5] = { 0, 0, 4, 2, 6 };
+	int raw_length = (width * channels + 1) * height;
+	int blocks = raw_length / 65535 + 1;
+	int zlib_length = 2 + raw_length + blocks * 5 + 4;
+	unsigned char *raw = (unsigned char*)malloc( raw_length );
+	unsigned char *zlib = (unsigned char*)malloc( zlib_length );
+	unsigned char *png = (unsigned char*)malloc( zlib_length + 64 );
+	unsigned char header[13];
+	unsigned int s1 = 1, s2 = 0;
+	int i, y, at = 0, z = 2;
+	random_bytes( raw, raw_length );
+	for( y = 0; y < height; ++y )
+	{
+		raw[y * (width * channels + 1)] = (unsigned char)random_range( 0, 4 );
+	}
+	zlib[0] = 0x78;
+	zlib[1] = 0x01;
+	for( i = 0; i < raw_length; i += 65535 )
+	{
+		int n = (raw_length - i < 65535) ? raw_length - i : 65535;
+		zlib[z++] = (i + n == raw_length) ? 1 : 0;
+		zlib[z++] = (unsigned char)n;
+		zlib[z++] = (unsigned char)(n >> 8);
+		zlib[z++] = (unsigned char)~n;
+		zlib[z++] = (unsigned char)(~n >> 8);
+		memcpy( zlib + z, raw + i, n );
+		z += n;
+	}
+	for( i = 0; i < raw_length; ++i )
+	{
+		s1 = (s1 + raw[i]) % 65521;
+		s2 = (s2 + s1) % 65521;
+	}
+	put_u32_be( zlib + z, (s2 << 16) | s1 );
+	z += 4;
+	put_u32_be( header, width );
+	put_u32_be( header + 4, height );
+	header[8] = 8;
+	header[9] = color_type[channels];
+	header[10] = header[11] = header[12] = 0;
+	memcpy( png, signature, 8 );
+	at = 8;
+	at += put_chunk( png + at, "IHDR", header, 13 );
+	at += put_chunk( png + at, "IDAT", zlib, z );
+	at += put_chunk( png + at, "IEND", header, 0 );
+	free( raw );
+	free( zlib );
+	*size = at;
+	return png;
+}
+
+static void check_PNG( int rounds )
+{
+	int r, differ = 0;
+	for( r = 0; r < rounds; ++r )
+	{
+		int size;
+		int channels = random_range( 3, 4 );
+		unsigned char *png = make_PNG( random_range( 1, 80 ), random_range( 1, 8 ), channels, &size );
+		/*	as is, and expanded to RGBA on the way out	*/
+		differ += decode_both_ways( png, size, NULL, 0 );
+		differ += decode_both_ways( png, size, NULL, 4 );
+		free( png );
+	}
+	report( "PNG unfilter", rounds * 2, differ );
+}
+
+int main( int argc, char **argv )
+{
+	int rounds = 20000, files = 0, differ = 0, i;
+	random_state = 12345;
+	for( i = 1; i < argc; ++i )
+	{
+		if( (0 == strcmp( argv[i], "--seed" )) && (i + 1 < argc) )
+		{
+			random_state = (unsigned int)strtoul( argv[++i], NULL, 10 );
+			if( 0 == random_state )
+			{
+				random_state = 1;
+			}
+		} else if( (0 == strcmp( argv[i], "--rounds" )) && (i + 1 < argc) )
+		{
+			rounds = atoi( argv[++i] );
+		} else
+		{
+			differ += decode_both_ways( NULL, 0, argv[i], 0 );
+			++files;
+		}
+	}
+#ifdef STBI_SSE2
+	if( !stbi_sse2_available() )
+	{
+		printf( "simd_check: this CPU has no SSE2, nothing to compare\n" );
+		return 0;
+	}
+	check_idct( rounds );
+	check_resample( rounds );
+	check_YCbCr( rounds );
+	check_PNG( rounds / 10 );
+#else
+	printf( "simd_check: built without SSE2 kernels, nothing to compare\n" );
+#endif
+	if( files > 0 )
+	{
+		report( "files", files, differ );
+	}
+	return (failures > 0) ? 1 : 0;
+}
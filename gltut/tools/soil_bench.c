@@ -0,0 +1,741 @@
+/*
+	soil_bench: decode throughput of the image loaders behind SOIL
+
+	public domain
+
+	Builds a corpus in memory: a generated test picture saved in every
+	format SOIL can write (BMP, TGA, PNG, QOI and DDS, at 1 to 4
+	channels), plus hand built HDR and PSD files, plus any image files
+	or directories of them named on the command line (images/ when none
+	are).  JPEG has no writer here, so it is only measured from files.
+	Every image is decoded repeatedly and the best time kept; per format
+	it reports MB/s of file data, megapixels/s, allocations per decode,
+	the peak heap and scratch memory of a decode (scratch only for JPEG
+	and PNG, the decoders that use it), and, for the whole run, the
+	process's peak resident set, as JSON.
+
+	usage:
+		soil_bench [--out file.json] [--compare baseline.json]
+				[--threshold percent] [files or directories...]
+
+	With --compare, each format's megapixels/s is checked against the
+	baseline (saved from an earlier --out), and the exit code is 1 if
+	any format got slower by more than the threshold (default 5%).
+
+	building (from the gltut directory):
+		gcc -O2 -Iinclude tools/soil_bench.c include/SOIL/stb_image_aug.c
+			include/SOIL/image_helper.c include/SOIL/image_DXT.c
+			include/SOIL/image_PNG.c include/SOIL/image_threads.c
+			include/SOIL/image_resample.c -lm -lpthread -o soil_bench
+	or add the same files to a console project in Visual Studio.
+*/
+
+#include "SOIL/stb_image_aug.h"
+#include "SOIL/image_helper.h"
+#include "SOIL/image_DXT.h"
+#include "SOIL/image_PNG.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#include <windows.h>
+	#include <psapi.h>
+	#pragma comment( lib, "psapi.lib" )
+#else
+	#include <time.h>
+	#include <dirent.h>
+	#include <sys/resource.h>
+#endif
+
+/*	each image is decoded at least this often, and for at least this long	*/
+#define BENCH_MIN_RUNS		3
+#define BENCH_MIN_SECONDS	0.25
+/*	the generated picture	*/
+#define BENCH_WIDTH		1024
+#define BENCH_HEIGHT	768
+#define BENCH_MAX_FORMATS	16
+#define BENCH_MAX_ITEMS		1024
+
+/*	one file of the corpus, in memory	*/
+typedef struct
+{
+	char name[256];
+	char format[8];
+	unsigned char *data;
+	int size;
+}
+bench_item;
+
+/*	what one format added up to	*/
+typedef struct
+{
+	char format[8];
+	int images;
+	double bytes, pixels, seconds;
+	double allocations, decodes;
+	double peak_heap, peak_scratch;
+	double MB_per_s, Mpixels_per_s;
+}
+bench_result;
+
+static bench_item items[BENCH_MAX_ITEMS];
+static int item_count = 0;
+
+/********* Allocation counting *********/
+/*
+	Every decoder allocation goes through these, with the size kept in
+	front of the block so the live total can be followed.
+*/
+#define ALLOC_HEADER	16
+
+static double alloc_count = 0;
+static size_t alloc_live = 0, alloc_peak = 0;
+
+static void *count_malloc( size_t size, void *user_data )
+{
+	unsigned char *p = (unsigned char*)malloc( size + ALLOC_HEADER );
+	(void)user_data;
+	if( NULL == p )
+	{
+		return NULL;
+	}
+	*(size_t*)p = size;
+	alloc_count += 1;
+	alloc_live += size;
+	if( alloc_live > alloc_peak )
+	{
+		alloc_peak = alloc_live;
+	}
+	return p + ALLOC_HEADER;
+}
+
+static void count_free( void *p, void *user_data )
+{
+	(void)user_data;
+	if( NULL != p )
+	{
+		unsigned char *block = (unsigned char*)p - ALLOC_HEADER;
+		alloc_live -= *(size_t*)block;
+		free( block );
+	}
+}
+
+static void *count_realloc( void *p, size_t size, void *user_data )
+{
+	unsigned char *block;
+	size_t old_size;
+	if( NULL == p )
+	{
+		return count_malloc( size, user_data );
+	}
+	block = (unsigned char*)p - ALLOC_HEADER;
+	old_size = *(size_t*)block;
+	block = (unsigned char*)realloc( block, size + ALLOC_HEADER );
+	if( NULL == block )
+	{
+		return NULL;
+	}
+	*(size_t*)block = size;
+	alloc_count += 1;
+	alloc_live += size - old_size;
+	if( alloc_live > alloc_peak )
+	{
+		alloc_peak = alloc_live;
+	}
+	return block + ALLOC_HEADER;
+}
+
+/********* Platform bits *********/
+static double seconds_now( void )
+{
+#ifdef _WIN32
+	LARGE_INTEGER count, frequency;
+	QueryPerformanceCounter( &count );
+	QueryPerformanceFrequency( &frequency );
+	return (double)count.QuadPart / (double)frequency.QuadPart;
+#else
+	struct timespec t;
+	clock_gettime( CLOCK_MONOTONIC, &t );
+	return t.tv_sec + t.tv_nsec * 1e-9;
+#endif
+}
+
+static double peak_rss_kb( void )
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if( !GetProcessMemoryInfo( GetCurrentProcess(), &counters, sizeof( counters ) ) )
+	{
+		return 0;
+	}
+	return counters.PeakWorkingSetSize / 1024.0;
+#else
+	struct rusage usage;
+	if( getrusage( RUSAGE_SELF, &usage ) != 0 )
+	{
+		return 0;
+	}
+	#ifdef __APPLE__
+	return usage.ru_maxrss / 1024.0;
+	#else
+	return (double)usage.ru_maxrss;
+	#endif
+#endif
+}
+
+/********* The corpus *********/
+static void add_item( const char *name, const char *format, unsigned char *data, int size )
+{
+	if( (NULL == data) || (size < 1) )
+	{
+		fprintf( stderr, "soil_bench: could not make %s\n", name );
+		free( data );
+		return;
+	}
+	if( item_count >= BENCH_MAX_ITEMS )
+	{
+		free( data );
+		return;
+	}
+	strncpy( items[item_count].name, name, sizeof( items[item_count].name ) - 1 );
+	items[item_count].name[sizeof( items[item_count].name ) - 1] = 0;
+	strcpy( items[item_count].format, format );
+	items[item_count].data = data;
+	items[item_count].size = size;
+	++item_count;
+}
+
+/*	the format of a file, from its extension (NULL if it isn't an image)	*/
+static const char *file_format( const char *filename )
+{
+	static const char *extensions[][2] =
+	{
+		{ "jpg", "jpeg" }, { "jpeg", "jpeg" }, { "png", "png" },
+		{ "bmp", "bmp" }, { "tga", "tga" }, { "psd", "psd" },
+		{ "hdr", "hdr" }, { "dds", "dds" }, { "qoi", "qoi" }
+	};
+	const char *dot = strrchr( filename, '.' );
+	char extension[8];
+	int i;
+	if( (NULL == dot) || (strlen( dot + 1 ) >= sizeof( extension )) )
+	{
+		return NULL;
+	}
+	for( i = 0; dot[i + 1]; ++i )
+	{
+		extension[i] = (char)tolower( (unsigned char)dot[i + 1] );
+	}
+	extension[i] = 0;
+	for( i = 0; i < (int)(sizeof( extensions ) / sizeof( extensions[0] )); ++i )
+	{
+		if( 0 == strcmp( extension, extensions[i][0] ) )
+		{
+			return extensions[i][1];
+		}
+	}
+	return NULL;
+}
+
+static void add_file( const char *filename )
+{
+	const char *format = file_format( filename );
+	FILE *f;
+	long size;
+	unsigned char *data;
+	if( NULL == format )
+	{
+		return;
+	}
+	f = fopen( filename, "rb" );
+	if( NULL == f )
+	{
+		fprintf( stderr, "soil_bench: could not open %s\n", filename );
+		return;
+	}
+	fseek( f, 0, SEEK_END );
+	size = ftell( f );
+	fseek( f, 0, SEEK_SET );
+	data = (unsigned char*)malloc( size > 0 ? size : 1 );
+	if( (NULL != data) && (fread( data, 1, size, f ) != (size_t)size) )
+	{
+		free( data );
+		data = NULL;
+	}
+	fclose( f );
+	add_item( filename, format, data, (int)size );
+}
+
+/*	a file, or every image file in a directory	*/
+static void add_path( const char *path )
+{
+	char filename[1024];
+#ifdef _WIN32
+	WIN32_FIND_DATAA found;
+	HANDLE search;
+	sprintf( filename, "%.1000s\\*", path );
+	search = FindFirstFileA( filename, &found );
+	if( INVALID_HANDLE_VALUE == search )
+	{
+		add_file( path );
+		return;
+	}
+	do
+	{
+		if( !(found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) )
+		{
+			sprintf( filename, "%.700s\\%.300s", path, found.cFileName );
+			add_file( filename );
+		}
+	} while( FindNextFileA( search, &found ) );
+	FindClose( search );
+#else
+	DIR *dir = opendir( path );
+	struct dirent *entry;
+	if( NULL == dir )
+	{
+		add_file( path );
+		return;
+	}
+	while( NULL != (entry = readdir( dir )) )
+	{
+		if( entry->d_name[0] != '.' )
+		{
+			sprintf( filename, "%.700s/%.300s", path, entry->d_name );
+			add_file( filename );
+		}
+	}
+	closedir( dir );
+#endif
+}
+
+/*
+	Something between a photo and a screenshot: smooth gradients, flat
+	panels with hard edges, and a band of noise, so that neither the
+	filters nor the entropy coders have it too easy.
+*/
+static unsigned char *make_picture( int channels )
+{
+	unsigned char *img = (unsigned char*)malloc( BENCH_WIDTH * BENCH_HEIGHT * channels );
+	unsigned int seed = 12345;
+	int x, y, c;
+	if( NULL == img )
+	{
+		return NULL;
+	}
+	for( y = 0; y < BENCH_HEIGHT; ++y )
+	{
+		for( x = 0; x < BENCH_WIDTH; ++x )
+		{
+			unsigned char *p = img + (y * BENCH_WIDTH + x) * channels;
+			int panel = ((x / 128) + (y / 96)) & 3;
+			for( c = 0; c < channels; ++c )
+			{
+				int v;
+				seed = seed * 1103515245u + 12345u;
+				if( (y > BENCH_HEIGHT / 2) && (y < BENCH_HEIGHT / 2 + 64) )
+				{
+					v = (seed >> 16) & 255;
+				} else
+				if( panel == 0 )
+				{
+					v = 40 + 60 * c;
+				} else
+				{
+					v = (x * (c + 1) + y * (3 - c) + panel * 50) & 255;
+					v = (v + ((seed >> 20) & 7)) & 255;
+				}
+				if( (c == 3) || ((channels == 2) && (c == 1)) )
+				{
+					/*	alpha: mostly opaque, with a soft edged hole	*/
+					int dx = x - BENCH_WIDTH / 2, dy = y - BENCH_HEIGHT / 2;
+					int d = (dx * dx + dy * dy) / 256;
+					v = (d > 255) ? 255 : d;
+				}
+				p[c] = (unsigned char)v;
+			}
+		}
+	}
+	return img;
+}
+
+static void put_u32_be( unsigned char *p, unsigned int v )
+{
+	p[0] = (unsigned char)(v >> 24);
+	p[1] = (unsigned char)(v >> 16);
+	p[2] = (unsigned char)(v >> 8);
+	p[3] = (unsigned char)v;
+}
+
+/*	an uncompressed 8 bit RGB(A) PSD: header, then planar channel data	*/
+static unsigned char *make_PSD( const unsigned char *img, int channels, int *size )
+{
+	int n = BENCH_WIDTH * BENCH_HEIGHT, c, i;
+	unsigned char *psd;
+	*size = 26 + 4 + 4 + 4 + 2 + n * channels;
+	psd = (unsigned char*)calloc( *size, 1 );
+	if( NULL == psd )
+	{
+		return NULL;
+	}
+	memcpy( psd, "8BPS", 4 );
+	psd[5] = 1;
+	psd[13] = (unsigned char)channels;
+	put_u32_be( psd + 14, BENCH_HEIGHT );
+	put_u32_be( psd + 18, BENCH_WIDTH );
+	psd[23] = 8;
+	psd[25] = 3;
+	/*	(no color mode data, resources or layers, compression 0)	*/
+	for( c = 0; c < channels; ++c )
+	{
+		unsigned char *plane = psd + 40 + c * n;
+		for( i = 0; i < n; ++i )
+		{
+			plane[i] = img[i * channels + c];
+		}
+	}
+	return psd;
+}
+
+/*	a Radiance HDR file, each scanline in the RLE form (as literal runs)	*/
+static unsigned char *make_HDR( const unsigned char *img, int *size )
+{
+	char header[128];
+	int header_size, x, y, c;
+	unsigned char *hdr, *p;
+	unsigned char *scanline = (unsigned char*)malloc( BENCH_WIDTH * 4 );
+	sprintf( header, "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y %d +X %d\n", BENCH_HEIGHT, BENCH_WIDTH );
+	header_size = (int)strlen( header );
+	hdr = (unsigned char*)malloc( header_size +
+			BENCH_HEIGHT * (4 + 4 * (BENCH_WIDTH + BENCH_WIDTH / 128 + 1)) );
+	if( (NULL == hdr) || (NULL == scanline) )
+	{
+		free( hdr );
+		free( scanline );
+		return NULL;
+	}
+	memcpy( hdr, header, header_size );
+	p = hdr + header_size;
+	for( y = 0; y < BENCH_HEIGHT; ++y )
+	{
+		/*	RGBE from the picture, with the exponent varying too	*/
+		for( x = 0; x < BENCH_WIDTH; ++x )
+		{
+			const unsigned char *s = img + (y * BENCH_WIDTH + x) * 3;
+			scanline[x * 4 + 0] = (unsigned char)(s[0] | 128);
+			scanline[x * 4 + 1] = (unsigned char)(s[1] | 128);
+			scanline[x * 4 + 2] = (unsigned char)(s[2] | 128);
+			scanline[x * 4 + 3] = (unsigned char)(120 + (s[0] >> 5));
+		}
+		*p++ = 2;
+		*p++ = 2;
+		*p++ = (unsigned char)(BENCH_WIDTH >> 8);
+		*p++ = (unsigned char)(BENCH_WIDTH & 255);
+		for( c = 0; c < 4; ++c )
+		{
+			for( x = 0; x < BENCH_WIDTH; )
+			{
+				int run = BENCH_WIDTH - x;
+				if( run > 128 )
+				{
+					run = 128;
+				}
+				*p++ = (unsigned char)run;
+				while( run-- > 0 )
+				{
+					*p++ = scanline[(x++) * 4 + c];
+				}
+			}
+		}
+	}
+	free( scanline );
+	*size = (int)(p - hdr);
+	return hdr;
+}
+
+static void make_corpus( void )
+{
+	int channels;
+	for( channels = 1; channels <= 4; ++channels )
+	{
+		unsigned char *img = make_picture( channels );
+		unsigned char *data;
+		char name[64];
+		int size = 0;
+		if( NULL == img )
+		{
+			continue;
+		}
+		sprintf( name, "generated.%dch.bmp", channels );
+		data = stbi_write_bmp_to_mem( BENCH_WIDTH, BENCH_HEIGHT, channels, img, &size );
+		add_item( name, "bmp", data, size );
+		sprintf( name, "generated.%dch.tga", channels );
+		data = stbi_write_tga_to_mem( BENCH_WIDTH, BENCH_HEIGHT, channels, img, &size );
+		add_item( name, "tga", data, size );
+		sprintf( name, "generated.%dch.png", channels );
+		data = convert_image_to_PNG( img, BENCH_WIDTH, BENCH_HEIGHT, channels, &size );
+		add_item( name, "png", data, size );
+		sprintf( name, "generated.%dch.qoi", channels );
+		data = stbi_write_qoi_to_mem( BENCH_WIDTH, BENCH_HEIGHT, channels, img, &size );
+		add_item( name, "qoi", data, size );
+		sprintf( name, "generated.%dch.dds", channels );
+		data = convert_image_to_DDS( img, BENCH_WIDTH, BENCH_HEIGHT, channels, &size );
+		add_item( name, "dds", data, size );
+		if( channels >= 3 )
+		{
+			sprintf( name, "generated.%dch.psd", channels );
+			data = make_PSD( img, channels, &size );
+			add_item( name, "psd", data, size );
+		}
+		if( channels == 3 )
+		{
+			data = make_HDR( img, &size );
+			add_item( "generated.hdr", "hdr", data, size );
+		}
+		free( img );
+	}
+}
+
+/********* Measuring *********/
+/*	decodes one image until the timing settles; 0 if it won't decode	*/
+static int bench_item_decode( const bench_item *item, bench_result *result )
+{
+	int runs = 0, width = 0, height = 0, channels = 0;
+	double best = 1e30, started = seconds_now();
+	double allocations;
+	size_t peak_heap = 0, peak_scratch = 0;
+	int is_HDR = (0 == strcmp( item->format, "hdr" ));
+	/*	only these decoders use the scratch arena; for the rest,
+		stbi_scratch_peak still holds the last JPEG or PNG's figure	*/
+	int uses_scratch = (0 == strcmp( item->format, "jpeg" )) ||
+			(0 == strcmp( item->format, "png" ));
+	/*	once to warm up (the scratch arena keeps its block after this)	*/
+	void *img = is_HDR ?
+			(void*)stbi_loadf_from_memory( item->data, item->size, &width, &height, &channels, 0 ) :
+			(void*)stbi_load_from_memory( item->data, item->size, &width, &height, &channels, 0 );
+	if( NULL == img )
+	{
+		fprintf( stderr, "soil_bench: %s: %s\n", item->name, stbi_failure_reason() );
+		return 0;
+	}
+	stbi_image_free( img );
+	allocations = alloc_count;
+	while( (runs < BENCH_MIN_RUNS) || (seconds_now() - started < BENCH_MIN_SECONDS) )
+	{
+		double t;
+		size_t live = alloc_live;
+		alloc_peak = alloc_live;
+		t = seconds_now();
+		img = is_HDR ?
+				(void*)stbi_loadf_from_memory( item->data, item->size, &width, &height, &channels, 0 ) :
+				(void*)stbi_load_from_memory( item->data, item->size, &width, &height, &channels, 0 );
+		t = seconds_now() - t;
+		/*	(the image itself included)	*/
+		if( alloc_peak - live > peak_heap )
+		{
+			peak_heap = alloc_peak - live;
+		}
+		if( uses_scratch && (stbi_scratch_peak() > peak_scratch) )
+		{
+			peak_scratch = stbi_scratch_peak();
+		}
+		stbi_image_free( img );
+		if( t < best )
+		{
+			best = t;
+		}
+		++runs;
+	}
+	result->images += 1;
+	result->bytes += item->size;
+	result->pixels += (double)width * height;
+	result->seconds += best;
+	result->allocations += alloc_count - allocations;
+	result->decodes += runs;
+	if( peak_heap > result->peak_heap )
+	{
+		result->peak_heap = (double)peak_heap;
+	}
+	if( peak_scratch > result->peak_scratch )
+	{
+		result->peak_scratch = (double)peak_scratch;
+	}
+	return 1;
+}
+
+static int run_benchmarks( bench_result *results )
+{
+	static const char *formats[] = { "jpeg", "png", "bmp", "tga", "psd", "hdr", "dds", "qoi" };
+	int result_count = 0, f, i;
+	for( f = 0; f < (int)(sizeof( formats ) / sizeof( formats[0] )); ++f )
+	{
+		bench_result *r = &results[result_count];
+		memset( r, 0, sizeof( bench_result ) );
+		strcpy( r->format, formats[f] );
+		for( i = 0; i < item_count; ++i )
+		{
+			if( 0 == strcmp( items[i].format, formats[f] ) )
+			{
+				bench_item_decode( &items[i], r );
+			}
+		}
+		if( (r->images > 0) && (r->seconds > 0) )
+		{
+			r->MB_per_s = r->bytes / r->seconds / 1e6;
+			r->Mpixels_per_s = r->pixels / r->seconds / 1e6;
+			fprintf( stderr, "%-5s %3d images  %8.1f MB/s  %8.1f Mpixels/s\n",
+					r->format, r->images, r->MB_per_s, r->Mpixels_per_s );
+			++result_count;
+		}
+	}
+	return result_count;
+}
+
+/********* JSON *********/
+/*	one format to a line, which is all compare_results needs to read back	*/
+static void write_results( FILE *out, const bench_result *results, int result_count )
+{
+	int i;
+	/*	the peak resident set is the whole run's, not any one format's	*/
+	fprintf( out, "{\n\t\"width\": %d, \"height\": %d, \"process_peak_rss_kb\": %.0f,\n\t\"formats\": [\n",
+			BENCH_WIDTH, BENCH_HEIGHT, peak_rss_kb() );
+	for( i = 0; i < result_count; ++i )
+	{
+		const bench_result *r = &results[i];
+		fprintf( out, "\t\t{ \"format\": \"%s\", \"images\": %d, \"bytes\": %.0f, \"pixels\": %.0f, "
+				"\"seconds\": %.6f, \"MB_per_s\": %.2f, \"Mpixels_per_s\": %.2f, "
+				"\"allocations_per_decode\": %.2f, \"peak_heap_bytes\": %.0f, "
+				"\"peak_scratch_bytes\": %.0f }%s\n",
+				r->format, r->images, r->bytes, r->pixels,
+				r->seconds, r->MB_per_s, r->Mpixels_per_s,
+				(r->decodes > 0) ? r->allocations / r->decodes : 0.0, r->peak_heap,
+				r->peak_scratch,
+				(i + 1 < result_count) ? "," : "" );
+	}
+	fprintf( out, "\t]\n}\n" );
+}
+
+static double json_number( const char *line, const char *key )
+{
+	char quoted[64];
+	const char *p;
+	sprintf( quoted, "\"%.50s\":", key );
+	p = strstr( line, quoted );
+	return (NULL == p) ? 0 : atof( p + strlen( quoted ) );
+}
+
+/*	\return the number of formats that got slower by more than threshold percent	*/
+static int compare_results( const char *baseline, const bench_result *results, int result_count, double threshold )
+{
+	FILE *f = fopen( baseline, "r" );
+	char line[1024];
+	int regressions = 0, i;
+	if( NULL == f )
+	{
+		fprintf( stderr, "soil_bench: could not open %s\n", baseline );
+		return 1;
+	}
+	fprintf( stderr, "\n%-5s %12s %12s %8s\n", "", "baseline", "now", "change" );
+	while( fgets( line, sizeof( line ), f ) )
+	{
+		const char *p = strstr( line, "\"format\": \"" );
+		char format[8];
+		int n = 0;
+		if( NULL == p )
+		{
+			continue;
+		}
+		p += strlen( "\"format\": \"" );
+		while( (p[n] != '"') && (p[n] != 0) && (n < (int)sizeof( format ) - 1) )
+		{
+			format[n] = p[n];
+			++n;
+		}
+		format[n] = 0;
+		for( i = 0; i < result_count; ++i )
+		{
+			if( 0 == strcmp( results[i].format, format ) )
+			{
+				double before = json_number( line, "Mpixels_per_s" );
+				double change = (before > 0) ? (results[i].Mpixels_per_s / before - 1) * 100 : 0;
+				int slower = (change < -threshold);
+				fprintf( stderr, "%-5s %12.2f %12.2f %+7.1f%%%s\n", format, before,
+						results[i].Mpixels_per_s, change, slower ? "  REGRESSION" : "" );
+				regressions += slower;
+			}
+		}
+	}
+	fclose( f );
+	return regressions;
+}
+
+int main( int argc, char **argv )
+{
+	static bench_result results[BENCH_MAX_FORMATS];
+	const char *out_name = NULL, *baseline = NULL;
+	double threshold = 5;
+	int paths = 0, result_count, status = 0, i;
+	for( i = 1; i < argc; ++i )
+	{
+		if( (0 == strcmp( argv[i], "--out" )) && (i + 1 < argc) )
+		{
+			out_name = argv[++i];
+		} else
+		if( (0 == strcmp( argv[i], "--compare" )) && (i + 1 < argc) )
+		{
+			baseline = argv[++i];
+		} else
+		if( (0 == strcmp( argv[i], "--threshold" )) && (i + 1 < argc) )
+		{
+			threshold = atof( argv[++i] );
+		} else
+		if( argv[i][0] == '-' )
+		{
+			fprintf( stderr, "usage: %s [--out file.json] [--compare baseline.json] "
+					"[--threshold percent] [files or directories...]\n", argv[0] );
+			return 2;
+		} else
+		{
+			add_path( argv[i] );
+			++paths;
+		}
+	}
+	if( 0 == paths )
+	{
+		add_path( "images" );
+	}
+	make_corpus();
+	/*	count the decoders' allocations (the corpus was made without)	*/
+	stbi_set_allocator( count_malloc, count_realloc, count_free, NULL );
+	result_count = run_benchmarks( results );
+	if( NULL != out_name )
+	{
+		FILE *out = fopen( out_name, "w" );
+		if( NULL == out )
+		{
+			fprintf( stderr, "soil_bench: could not write %s\n", out_name );
+			status = 2;
+		} else
+		{
+			write_results( out, results, result_count );
+			fclose( out );
+		}
+	} else
+	{
+		write_results( stdout, results, result_count );
+	}
+	if( (NULL != baseline) && (compare_results( baseline, results, result_count, threshold ) > 0) )
+	{
+		status = 1;
+	}
+	stbi_set_allocator( NULL, NULL, NULL, NULL );
+	stbi_release_scratch();
+	for( i = 0; i < item_count; ++i )
+	{
+		free( items[i].data );
+	}
+	return status;
+}